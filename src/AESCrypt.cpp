@@ -0,0 +1,278 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <string.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__GNUC__)
+#include <wmmintrin.h>
+#define AESCRYPT_AESNI
+#endif
+#endif
+
+#include "AESCrypt.h"
+
+
+namespace AESCrypt
+{
+
+// blocks processed per backend call in CTR/CCM
+const u32 BatchBlocks = 32;
+
+typedef void (*EncryptBlocksFunc)(const AES_ctx* ctx, const u8* in, u8* out, u32 num);
+typedef void (*CBCMACBlocksFunc)(const AES_ctx* ctx, u8* mac, const u8* in, u32 num);
+
+
+void EncryptBlocks_C(const AES_ctx* ctx, const u8* in, u8* out, u32 num)
+{
+    for (u32 i = 0; i < num*16; i += 16)
+    {
+        if (out != in) memcpy(&out[i], &in[i], 16);
+        AES_ECB_encrypt(ctx, &out[i]);
+    }
+}
+
+void CBCMACBlocks_C(const AES_ctx* ctx, u8* mac, const u8* in, u32 num)
+{
+    for (u32 i = 0; i < num*16; i += 16)
+    {
+        for (int j = 0; j < 16; j++) mac[j] ^= in[i+j];
+        AES_ECB_encrypt(ctx, mac);
+    }
+}
+
+
+#ifdef AESCRYPT_AESNI
+
+// round keys are in the standard FIPS-197 layout, which is what AES-NI expects
+
+__attribute__((target("aes,sse2")))
+void EncryptBlocks_AESNI(const AES_ctx* ctx, const u8* in, u8* out, u32 num)
+{
+    __m128i rk[11];
+    for (int r = 0; r < 11; r++)
+        rk[r] = _mm_loadu_si128((const __m128i*)&ctx->RoundKey[r*16]);
+
+    // interleave 4 blocks to hide the latency of AESENC
+    u32 i = 0;
+    for (; i + 4 <= num; i += 4)
+    {
+        __m128i b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&in[(i+0)*16]), rk[0]);
+        __m128i b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&in[(i+1)*16]), rk[0]);
+        __m128i b2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&in[(i+2)*16]), rk[0]);
+        __m128i b3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&in[(i+3)*16]), rk[0]);
+
+        for (int r = 1; r < 10; r++)
+        {
+            b0 = _mm_aesenc_si128(b0, rk[r]);
+            b1 = _mm_aesenc_si128(b1, rk[r]);
+            b2 = _mm_aesenc_si128(b2, rk[r]);
+            b3 = _mm_aesenc_si128(b3, rk[r]);
+        }
+
+        _mm_storeu_si128((__m128i*)&out[(i+0)*16], _mm_aesenclast_si128(b0, rk[10]));
+        _mm_storeu_si128((__m128i*)&out[(i+1)*16], _mm_aesenclast_si128(b1, rk[10]));
+        _mm_storeu_si128((__m128i*)&out[(i+2)*16], _mm_aesenclast_si128(b2, rk[10]));
+        _mm_storeu_si128((__m128i*)&out[(i+3)*16], _mm_aesenclast_si128(b3, rk[10]));
+    }
+
+    for (; i < num; i++)
+    {
+        __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&in[i*16]), rk[0]);
+        for (int r = 1; r < 10; r++)
+            b = _mm_aesenc_si128(b, rk[r]);
+        _mm_storeu_si128((__m128i*)&out[i*16], _mm_aesenclast_si128(b, rk[10]));
+    }
+}
+
+__attribute__((target("aes,sse2")))
+void CBCMACBlocks_AESNI(const AES_ctx* ctx, u8* mac, const u8* in, u32 num)
+{
+    __m128i rk[11];
+    for (int r = 0; r < 11; r++)
+        rk[r] = _mm_loadu_si128((const __m128i*)&ctx->RoundKey[r*16]);
+
+    __m128i m = _mm_loadu_si128((const __m128i*)mac);
+    for (u32 i = 0; i < num; i++)
+    {
+        m = _mm_xor_si128(m, _mm_loadu_si128((const __m128i*)&in[i*16]));
+        m = _mm_xor_si128(m, rk[0]);
+        for (int r = 1; r < 10; r++)
+            m = _mm_aesenc_si128(m, rk[r]);
+        m = _mm_aesenclast_si128(m, rk[10]);
+    }
+    _mm_storeu_si128((__m128i*)mac, m);
+}
+
+bool HasAESNI()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes");
+}
+
+#endif // AESCRYPT_AESNI
+
+
+#ifdef AESCRYPT_ARMV8
+
+// in AESCrypt_ARMv8.cpp, which is the only file built with the crypto extensions enabled
+void EncryptBlocks_ARMv8(const AES_ctx* ctx, const u8* in, u8* out, u32 num);
+void CBCMACBlocks_ARMv8(const AES_ctx* ctx, u8* mac, const u8* in, u32 num);
+bool HasARMv8AES();
+
+#endif // AESCRYPT_ARMV8
+
+
+struct Backend
+{
+    const char* Name;
+    EncryptBlocksFunc EncryptBlocks;
+    CBCMACBlocksFunc CBCMACBlocks;
+};
+
+Backend Backends[3] = {{"C", EncryptBlocks_C, CBCMACBlocks_C}};
+int NumBackends = 1;
+
+EncryptBlocksFunc EncryptBlocks = EncryptBlocks_C;
+CBCMACBlocksFunc CBCMACBlocks = CBCMACBlocks_C;
+const char* BackendName = "C";
+
+
+void Init()
+{
+    NumBackends = 1;
+
+#ifdef AESCRYPT_AESNI
+    if (HasAESNI())
+        Backends[NumBackends++] = {"AES-NI", EncryptBlocks_AESNI, CBCMACBlocks_AESNI};
+#endif
+#ifdef AESCRYPT_ARMV8
+    if (HasARMv8AES())
+        Backends[NumBackends++] = {"ARMv8", EncryptBlocks_ARMv8, CBCMACBlocks_ARMv8};
+#endif
+
+    SetBackend(NumBackends - 1);
+}
+
+int GetNumBackends()
+{
+    return NumBackends;
+}
+
+const char* GetBackendName(int backend)
+{
+    return Backends[backend].Name;
+}
+
+void SetBackend(int backend)
+{
+    EncryptBlocks = Backends[backend].EncryptBlocks;
+    CBCMACBlocks = Backends[backend].CBCMACBlocks;
+    BackendName = Backends[backend].Name;
+}
+
+const char* GetBackendName()
+{
+    return BackendName;
+}
+
+
+void IncrementCounter(u8* iv)
+{
+    for (int i = 15; i >= 0; i--)
+    {
+        if (++iv[i] != 0) break;
+    }
+}
+
+void ReverseBlocks(u8* dst, const u8* src, u32 len)
+{
+    for (u32 i = 0; i < len; i += 16)
+    {
+        for (int j = 0; j < 16; j++)
+            dst[i+j] = src[i+15-j];
+    }
+}
+
+void CTRXcrypt(AES_ctx* ctx, u8* data, u32 len, bool reversed)
+{
+    u8 counters[BatchBlocks*16];
+    u8 keystream[BatchBlocks*16];
+
+    while (len > 0)
+    {
+        u32 num = std::min((len + 15) >> 4, BatchBlocks);
+        for (u32 i = 0; i < num; i++)
+        {
+            memcpy(&counters[i*16], ctx->Iv, 16);
+            IncrementCounter(ctx->Iv);
+        }
+
+        if (reversed)
+        {
+            // XORing a block-swapped buffer is the same as XORing with a block-swapped keystream
+            EncryptBlocks(ctx, counters, counters, num);
+            ReverseBlocks(keystream, counters, num*16);
+        }
+        else
+            EncryptBlocks(ctx, counters, keystream, num);
+
+        u32 chunk = std::min(len, num*16);
+        for (u32 i = 0; i < chunk; i++)
+            data[i] ^= keystream[i];
+
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+void CBCMAC(const AES_ctx* ctx, u8* mac, const u8* data, u32 len, bool reversed)
+{
+    if (!reversed)
+    {
+        CBCMACBlocks(ctx, mac, data, len >> 4);
+        return;
+    }
+
+    u8 tmp[BatchBlocks*16];
+    while (len > 0)
+    {
+        u32 chunk = std::min(len, (u32)sizeof(tmp));
+        ReverseBlocks(tmp, data, chunk);
+        CBCMACBlocks(ctx, mac, tmp, chunk >> 4);
+
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+void CCMEncrypt(AES_ctx* ctx, u8* mac, u8* data, u32 len, bool reversed)
+{
+    // the MAC only depends on the plaintext, so both passes can be done separately
+    CBCMAC(ctx, mac, data, len, reversed);
+    CTRXcrypt(ctx, data, len, reversed);
+}
+
+void CCMDecrypt(AES_ctx* ctx, u8* mac, u8* data, u32 len, bool reversed)
+{
+    CTRXcrypt(ctx, data, len, reversed);
+    CBCMAC(ctx, mac, data, len, reversed);
+}
+
+}
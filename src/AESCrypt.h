@@ -0,0 +1,57 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef AESCRYPT_H
+#define AESCRYPT_H
+
+#include "types.h"
+#include "tiny-AES-c/aes.hpp"
+
+// AES-128 modes used by the DSi (NAND, ES, AES engine)
+//
+// these work on tiny-AES contexts and give the same results as the
+// equivalent tiny-AES calls, but use the AES instructions of the host CPU
+// when they're available (AES-NI, ARMv8 crypto extensions)
+//
+// 'reversed' is for data stored with the byte order of each 16-byte block
+// reversed, as is the case on the DSi
+namespace AESCrypt
+{
+
+// picks the fastest backend supported by the host
+void Init();
+const char* GetBackendName();
+
+// every backend supported by the host, the fastest one last. for checking them against each other
+int GetNumBackends();
+const char* GetBackendName(int backend);
+void SetBackend(int backend);
+
+// CTR mode, ctx->Iv is the counter and is advanced like AES_CTR_xcrypt_buffer() does
+void CTRXcrypt(AES_ctx* ctx, u8* data, u32 len, bool reversed = false);
+
+// CBC-MAC over whole blocks
+void CBCMAC(const AES_ctx* ctx, u8* mac, const u8* data, u32 len, bool reversed = false);
+
+// CCM payload over whole blocks: CBC-MAC of the plaintext, CTR encryption
+void CCMEncrypt(AES_ctx* ctx, u8* mac, u8* data, u32 len, bool reversed = false);
+void CCMDecrypt(AES_ctx* ctx, u8* mac, u8* data, u32 len, bool reversed = false);
+
+}
+
+#endif // AESCRYPT_H
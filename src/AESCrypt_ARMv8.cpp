@@ -0,0 +1,101 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// ARMv8 crypto extensions backend of AESCrypt. the build only adds this file on arm64,
+// with the crypto extensions enabled for it alone, since not every ARMv8 CPU has them.
+// AESCrypt only calls into it once HasARMv8AES() says they're there
+
+#include <arm_neon.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "AESCrypt.h"
+
+
+namespace AESCrypt
+{
+
+// AESE does AddRoundKey before SubBytes/ShiftRows, so the rounds are shifted
+// by one compared to the usual description: the last round key is XORed at the end
+
+void EncryptBlocks_ARMv8(const AES_ctx* ctx, const u8* in, u8* out, u32 num)
+{
+    uint8x16_t rk[11];
+    for (int r = 0; r < 11; r++)
+        rk[r] = vld1q_u8(&ctx->RoundKey[r*16]);
+
+    u32 i = 0;
+    for (; i + 4 <= num; i += 4)
+    {
+        uint8x16_t b0 = vld1q_u8(&in[(i+0)*16]);
+        uint8x16_t b1 = vld1q_u8(&in[(i+1)*16]);
+        uint8x16_t b2 = vld1q_u8(&in[(i+2)*16]);
+        uint8x16_t b3 = vld1q_u8(&in[(i+3)*16]);
+
+        for (int r = 0; r < 9; r++)
+        {
+            b0 = vaesmcq_u8(vaeseq_u8(b0, rk[r]));
+            b1 = vaesmcq_u8(vaeseq_u8(b1, rk[r]));
+            b2 = vaesmcq_u8(vaeseq_u8(b2, rk[r]));
+            b3 = vaesmcq_u8(vaeseq_u8(b3, rk[r]));
+        }
+
+        vst1q_u8(&out[(i+0)*16], veorq_u8(vaeseq_u8(b0, rk[9]), rk[10]));
+        vst1q_u8(&out[(i+1)*16], veorq_u8(vaeseq_u8(b1, rk[9]), rk[10]));
+        vst1q_u8(&out[(i+2)*16], veorq_u8(vaeseq_u8(b2, rk[9]), rk[10]));
+        vst1q_u8(&out[(i+3)*16], veorq_u8(vaeseq_u8(b3, rk[9]), rk[10]));
+    }
+
+    for (; i < num; i++)
+    {
+        uint8x16_t b = vld1q_u8(&in[i*16]);
+        for (int r = 0; r < 9; r++)
+            b = vaesmcq_u8(vaeseq_u8(b, rk[r]));
+        vst1q_u8(&out[i*16], veorq_u8(vaeseq_u8(b, rk[9]), rk[10]));
+    }
+}
+
+void CBCMACBlocks_ARMv8(const AES_ctx* ctx, u8* mac, const u8* in, u32 num)
+{
+    uint8x16_t rk[11];
+    for (int r = 0; r < 11; r++)
+        rk[r] = vld1q_u8(&ctx->RoundKey[r*16]);
+
+    uint8x16_t m = vld1q_u8(mac);
+    for (u32 i = 0; i < num; i++)
+    {
+        m = veorq_u8(m, vld1q_u8(&in[i*16]));
+        for (int r = 0; r < 9; r++)
+            m = vaesmcq_u8(vaeseq_u8(m, rk[r]));
+        m = veorq_u8(vaeseq_u8(m, rk[9]), rk[10]);
+    }
+    vst1q_u8(mac, m);
+}
+
+bool HasARMv8AES()
+{
+#ifdef __APPLE__
+    return true;
+#else
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#endif
+}
+
+}
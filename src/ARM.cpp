@@ -17,11 +17,13 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include <algorithm>
 #include "NDS.h"
 #include "DSi.h"
 #include "ARM.h"
 #include "ARMInterpreter.h"
+#include "ARM_InstrInfo.h"
 #include "AREngine.h"
 #include "ARMJIT.h"
 
@@ -129,6 +131,8 @@ void ARM::Reset()
 
     CodeMem.Mem = NULL;
 
+    memset(IdleLoopCache, 0, sizeof(IdleLoopCache));
+
 #ifdef JIT_ENABLED
     FastBlockLookup = NULL;
     FastBlockLookupStart = 0;
@@ -199,6 +203,9 @@ void ARM::DoSavestate(Savestate* file)
     file->Var32((u32*)&Cycles);
     //file->Var32((u32*)&CyclesToRun);
 
+    if (!file->Saving)
+        memset(IdleLoopCache, 0, sizeof(IdleLoopCache));
+
     // hack to make save states compatible
     u32 halted = Halted;
     file->Var32(&halted);
@@ -274,6 +281,110 @@ void ARM::SetupCodeMem(u32 addr)
     }
 }
 
+static bool IsIdleLoop(bool thumb, u32 num, u32* code, int len)
+{
+    // same rules as the JIT (see ARMJIT.cpp): nothing that writes memory or system state,
+    // and no register may be written after the loop has read the value it came in with,
+    // so that every iteration does exactly the same thing as long as memory doesn't change
+    u16 regsWrittenTo = 0;
+    u16 regsDisallowedToWrite = 0;
+    for (int i = 0; i < len; i++)
+    {
+        ARMInstrInfo::Info info = ARMInstrInfo::Decode(thumb, num, code[i]);
+
+        if (info.SpecialKind == ARMInstrInfo::special_WriteMem)
+            return false;
+        if (!thumb && info.Kind >= ARMInstrInfo::ak_MSR_IMM && info.Kind <= ARMInstrInfo::ak_MRC)
+            return false;
+        if (i < len - 1 && (info.Branches() || info.EndBlock))
+            return false;
+
+        u16 srcRegs = info.SrcRegs & ~(1 << 15);
+        u16 dstRegs = info.DstRegs & ~(1 << 15);
+
+        regsDisallowedToWrite |= srcRegs & ~regsWrittenTo;
+
+        if (dstRegs & regsDisallowedToWrite)
+            return false;
+        regsWrittenTo |= dstRegs;
+    }
+    return true;
+}
+
+void ARM::CheckIdleLoop(u32 branchaddr, u32 target)
+{
+    if (target > branchaddr || (branchaddr >> 24) != (target >> 24))
+        return;
+
+    bool thumb = CPSR & 0x20;
+    int len = ((branchaddr - target) >> (thumb ? 1 : 2)) + 1;
+    if (len > IdleLoopMaxLength)
+        return;
+
+    // the verdict only ever depends on the code that's there (the same address may hold
+    // something else once another overlay has been loaded), never on what ran before.
+    // that keeps timing the same for the same state, as netplay needs. an entry is checked
+    // against the code it was made for, unless it's a loop that isn't idle and every write
+    // to its code is seen: then it holds until the code generation changes
+    u32 key = branchaddr | (thumb ? 1 : 0);
+    IdleLoopEntry* entry = &IdleLoopCache[(branchaddr >> 1) & (IdleLoopCacheSize - 1)];
+    bool known = entry->BranchAddr == key && entry->Target == target;
+
+    if (known && entry->Watched && entry->Generation == NDS::CodeGeneration)
+        return;
+
+    u32 code[IdleLoopMaxLength] = {0};
+    bool readable = true;
+    for (int i = 0; i < len && readable; i++)
+    {
+        u32 addr = target + (i << (thumb ? 1 : 2));
+        readable = PeekCode32(addr & ~3, &code[i]);
+        if (thumb)
+            code[i] = (addr & 2) ? (code[i] >> 16) : (code[i] & 0xFFFF);
+    }
+
+    if (!known || !readable || memcmp(entry->Code, code, len * 4))
+    {
+        entry->BranchAddr = key;
+        entry->Target = target;
+        memcpy(entry->Code, code, len * 4);
+        entry->Idle = readable && IsIdleLoop(thumb, Num, code, len);
+    }
+
+    entry->Watched = false;
+    if (entry->Idle)
+    {
+        IdleLoop = 1;
+    }
+    else if (readable)
+    {
+        // the code has to be in one piece for its writes to be watched
+        u32 size = (branchaddr - target) + (thumb ? 2 : 4);
+        u8* ptr = GetCodePtr(target);
+        if (ptr && GetCodePtr(branchaddr) == ptr + (branchaddr - target))
+        {
+            entry->Watched = NDS::WatchCode(ptr, size);
+            entry->Generation = NDS::CodeGeneration;
+        }
+    }
+}
+
+u8* ARMv4::GetCodePtr(u32 addr)
+{
+    NDS::MemRegion region;
+    bool mapped;
+
+    if (NDS::ConsoleType == 1)
+        mapped = DSi::ARM7GetMemRegion(addr, false, &region);
+    else
+        mapped = NDS::ARM7GetMemRegion(addr, false, &region);
+
+    if (!mapped)
+        return NULL;
+
+    return &region.Mem[addr & region.Mask];
+}
+
 void ARMv5::JumpTo(u32 addr, bool restorecpsr)
 {
     if (restorecpsr)
@@ -625,21 +736,34 @@ void ARMv5::Execute()
                 AddCycles_C();
         }
 
-        // TODO optimize this shit!!!
-        if (Halted)
+        if (StopExecution)
         {
-            if (Halted == 1 && NDS::ARM9Timestamp < NDS::ARM9Target)
+            if (Halted)
             {
-                NDS::ARM9Timestamp = NDS::ARM9Target;
+                if (Halted == 1 && NDS::ARM9Timestamp < NDS::ARM9Target)
+                {
+                    NDS::ARM9Timestamp = NDS::ARM9Target;
+                }
+                break;
             }
-            break;
+            if (IdleLoop)
+            {
+                // nothing will change until the next event, unless an IRQ is due right away
+                IdleLoop = 0;
+                if (!IRQ && NDS::ARM9Timestamp < NDS::ARM9Target)
+                {
+                    Cycles = 0;
+                    NDS::ARM9Timestamp = NDS::ARM9Target;
+                    break;
+                }
+            }
+            /*if (NDS::IF[0] & NDS::IE[0])
+            {
+                if (NDS::IME[0] & 0x1)
+                    TriggerIRQ();
+            }*/
+            if (IRQ) TriggerIRQ();
         }
-        /*if (NDS::IF[0] & NDS::IE[0])
-        {
-            if (NDS::IME[0] & 0x1)
-                TriggerIRQ();
-        }*/
-        if (IRQ) TriggerIRQ();
 
         NDS::ARM9Timestamp += Cycles;
         Cycles = 0;
@@ -770,21 +894,33 @@ void ARMv4::Execute()
                 AddCycles_C();
         }
 
-        // TODO optimize this shit!!!
-        if (Halted)
+        if (StopExecution)
         {
-            if (Halted == 1 && NDS::ARM7Timestamp < NDS::ARM7Target)
+            if (Halted)
+            {
+                if (Halted == 1 && NDS::ARM7Timestamp < NDS::ARM7Target)
+                {
+                    NDS::ARM7Timestamp = NDS::ARM7Target;
+                }
+                break;
+            }
+            if (IdleLoop)
             {
-                NDS::ARM7Timestamp = NDS::ARM7Target;
+                IdleLoop = 0;
+                if (!IRQ && NDS::ARM7Timestamp < NDS::ARM7Target)
+                {
+                    Cycles = 0;
+                    NDS::ARM7Timestamp = NDS::ARM7Target;
+                    break;
+                }
             }
-            break;
+            /*if (NDS::IF[1] & NDS::IE[1])
+            {
+                if (NDS::IME[1] & 0x1)
+                    TriggerIRQ();
+            }*/
+            if (IRQ) TriggerIRQ();
         }
-        /*if (NDS::IF[1] & NDS::IE[1])
-        {
-            if (NDS::IME[1] & 0x1)
-                TriggerIRQ();
-        }*/
-        if (IRQ) TriggerIRQ();
 
         NDS::ARM7Timestamp += Cycles;
         Cycles = 0;
@@ -38,6 +38,10 @@ enum
 const u32 ITCMPhysicalSize = 0x8000;
 const u32 DTCMPhysicalSize = 0x4000;
 
+// idle loop detection in the interpreter
+const int IdleLoopMaxLength = 8;
+const int IdleLoopCacheSize = 64;
+
 class ARM
 {
 public:
@@ -99,6 +103,14 @@ public:
 
     void SetupCodeMem(u32 addr);
 
+    // called by the interpreter on conditional backward branches, sets IdleLoop
+    // if the loop can't do anything but wait for an event or IRQ
+    void CheckIdleLoop(u32 branchaddr, u32 target);
+
+    // reads code without side effects or timing, false if it's not in plain memory
+    virtual bool PeekCode32(u32 addr, u32* val) = 0;
+    // host pointer to code in plain memory, NULL if it's elsewhere
+    virtual u8* GetCodePtr(u32 addr) = 0;
 
     virtual void DataRead8(u32 addr, u32* val) = 0;
     virtual void DataRead16(u32 addr, u32* val) = 0;
@@ -157,6 +169,18 @@ public:
     static u32 ConditionTable[16];
 
 protected:
+    struct IdleLoopEntry
+    {
+        u32 BranchAddr;     // bit 0 set for THUMB
+        u32 Target;
+        u32 Code[IdleLoopMaxLength];
+        bool Idle;
+        bool Watched;       // writes to the code are seen, the verdict holds for this generation
+        u32 Generation;
+    };
+
+    IdleLoopEntry IdleLoopCache[IdleLoopCacheSize];
+
     u8 (*BusRead8)(u32 addr);
     u16 (*BusRead16)(u32 addr);
     u32 (*BusRead32)(u32 addr);
@@ -191,6 +215,8 @@ public:
 
     // all code accesses are forced nonseq 32bit
     u32 CodeRead32(u32 addr, bool branch);
+    bool PeekCode32(u32 addr, u32* val);
+    u8* GetCodePtr(u32 addr);
 
     void DataRead8(u32 addr, u32* val);
     void DataRead16(u32 addr, u32* val);
@@ -330,6 +356,18 @@ public:
         return BusRead32(addr);
     }
 
+    bool PeekCode32(u32 addr, u32* val)
+    {
+        // main RAM and WRAM, where the ARM7 runs anything that loops
+        if ((addr >> 24) != 0x02 && (addr >> 24) != 0x03)
+            return false;
+
+        *val = BusRead32(addr);
+        return true;
+    }
+
+    u8* GetCodePtr(u32 addr);
+
     void DataRead8(u32 addr, u32* val)
     {
         *val = BusRead8(addr);
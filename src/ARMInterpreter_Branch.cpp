@@ -27,6 +27,11 @@ namespace ARMInterpreter
 void A_B(ARM* cpu)
 {
     s32 offset = (s32)(cpu->CurInstr << 8) >> 6;
+
+    // a conditional branch back might be the end of a loop waiting on something
+    if (offset < 0 && (cpu->CurInstr >> 28) < 0xE)
+        cpu->CheckIdleLoop(cpu->R[15] - 8, cpu->R[15] + offset);
+
     cpu->JumpTo(cpu->R[15] + offset);
 }
 
@@ -64,6 +69,9 @@ void T_BCOND(ARM* cpu)
     if (cpu->CheckCondition((cpu->CurInstr >> 8) & 0xF))
     {
         s32 offset = (s32)(cpu->CurInstr << 24) >> 23;
+        if (offset < 0)
+            cpu->CheckIdleLoop(cpu->R[15] - 4, cpu->R[15] + offset);
+
         cpu->JumpTo(cpu->R[15] + offset + 1);
     }
     else
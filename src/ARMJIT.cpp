@@ -1220,6 +1220,33 @@ void ResetBlockCache()
     JITCompiler->Reset();
 }
 
+// like ResetBlockCache, but the blocks become restore candidates instead of
+// being thrown away, so after loading a snapshot of the same session only
+// the code which actually changed has to be compiled again
+void RetireBlockCache()
+{
+    ARMJIT_Memory::Reset();
+
+    for (int i = 0; i < 2; i++)
+    {
+        auto& blocks = i == 0 ? JitBlocks9 : JitBlocks7;
+        for (auto it : blocks)
+        {
+            JitBlock* block = it.second;
+            for (int j = 0; j < block->NumAddresses; j++)
+            {
+                u32 addr = block->AddressRanges()[j];
+                AddressRange* range = &CodeMemRegions[addr >> 27][(addr & 0x7FFFFFF) / 512];
+                range->Blocks.Clear();
+                range->Code = 0;
+            }
+            FastBlockLookupRegions[block->StartAddrLocal >> 27][(block->StartAddrLocal & 0x7FFFFFF) / 2] = (u64)UINT32_MAX << 32;
+            RetireJitBlock(block);
+        }
+        blocks.clear();
+    }
+}
+
 void JitEnableWrite()
 {
     #if defined(__APPLE__) && defined(__aarch64__)
@@ -54,6 +54,7 @@ void CheckAndInvalidate(u32 addr);
 void CompileBlock(ARM* cpu);
 
 void ResetBlockCache();
+void RetireBlockCache();
 
 JitBlockEntry LookUpBlock(u32 num, u64* entries, u32 offset, u32 addr);
 bool SetupExecutableRegion(u32 num, u32 blockAddr, u64*& entry, u32& start, u32& size);
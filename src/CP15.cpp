@@ -73,6 +73,10 @@ void ARMv5::CP15DoSavestate(Savestate* file)
 {
     file->Section("CP15");
 
+    u32 oldpu[6] = {CP15Control, PU_CodeCacheable, PU_DataCacheable, PU_DataCacheWrite, PU_CodeRW, PU_DataRW};
+    u32 oldregions[8];
+    memcpy(oldregions, PU_Region, sizeof(oldregions));
+
     file->Var32(&CP15Control);
 
     file->Var32(&DTCMSetting);
@@ -94,7 +98,12 @@ void ARMv5::CP15DoSavestate(Savestate* file)
     {
         UpdateDTCMSetting();
         UpdateITCMSetting();
-        UpdatePURegions(true);
+
+        // rebuilding the region maps is slow, and a snapshot from a few frames
+        // back almost always has the same protection unit settings
+        u32 newpu[6] = {CP15Control, PU_CodeCacheable, PU_DataCacheable, PU_DataCacheWrite, PU_CodeRW, PU_DataRW};
+        if (!file->Snapshot || memcmp(oldpu, newpu, sizeof(oldpu)) || memcmp(oldregions, PU_Region, sizeof(oldregions)))
+            UpdatePURegions(true);
     }
 }
 
@@ -142,6 +151,9 @@ void ARMv5::UpdateITCMSetting()
     {
         ITCMSize = 0;
     }
+
+    // code addresses may now lead elsewhere
+    NDS::CodeWritten();
 }
 
 
@@ -782,6 +794,28 @@ u32 ARMv5::CodeRead32(u32 addr, bool branch)
     return BusRead32(addr);
 }
 
+bool ARMv5::PeekCode32(u32 addr, u32* val)
+{
+    u8* ptr = GetCodePtr(addr);
+    if (!ptr)
+        return false;
+
+    *val = *(u32*)ptr;
+    return true;
+}
+
+u8* ARMv5::GetCodePtr(u32 addr)
+{
+    if (addr < ITCMSize)
+        return &ITCM[addr & (ITCMPhysicalSize - 1)];
+
+    // CodeMem is set up for the region currently running
+    if (CodeMem.Mem && (addr >> 24) == (R[15] >> 24))
+        return &CodeMem.Mem[addr & CodeMem.Mask];
+
+    return NULL;
+}
+
 
 void ARMv5::DataRead8(u32 addr, u32* val)
 {
@@ -902,6 +936,7 @@ void ARMv5::DataWrite8(u32 addr, u8 val)
     if (addr < ITCMSize)
     {
         DataCycles = 1;
+        NDS::CheckCodeWrite(&ITCM[addr & (ITCMPhysicalSize - 1)]);
         *(u8*)&ITCM[addr & (ITCMPhysicalSize - 1)] = val;
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_ITCM>(addr);
@@ -934,6 +969,7 @@ void ARMv5::DataWrite16(u32 addr, u16 val)
     if (addr < ITCMSize)
     {
         DataCycles = 1;
+        NDS::CheckCodeWrite(&ITCM[addr & (ITCMPhysicalSize - 1)]);
         *(u16*)&ITCM[addr & (ITCMPhysicalSize - 1)] = val;
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_ITCM>(addr);
@@ -966,6 +1002,7 @@ void ARMv5::DataWrite32(u32 addr, u32 val)
     if (addr < ITCMSize)
     {
         DataCycles = 1;
+        NDS::CheckCodeWrite(&ITCM[addr & (ITCMPhysicalSize - 1)]);
         *(u32*)&ITCM[addr & (ITCMPhysicalSize - 1)] = val;
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_ITCM>(addr);
@@ -990,6 +1027,7 @@ void ARMv5::DataWrite32S(u32 addr, u32 val)
     if (addr < ITCMSize)
     {
         DataCycles += 1;
+        NDS::CheckCodeWrite(&ITCM[addr & (ITCMPhysicalSize - 1)]);
         *(u32*)&ITCM[addr & (ITCMPhysicalSize - 1)] = val;
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_ITCM>(addr);
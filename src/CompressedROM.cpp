@@ -0,0 +1,292 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <string.h>
+#include <algorithm>
+#include <zlib.h>
+
+#include "CompressedROM.h"
+
+
+// file layout (little-endian):
+//
+// 00  magic 'MDSC'
+// 04  version (1)
+// 08  uncompressed ROM size
+// 0C  block size (power of two, 4K-1MB)
+// 10  number of blocks
+// 14  codec (0 = deflate)
+// 18  reserved
+// 20  block index: number of blocks + 1 file offsets (u64)
+//
+// blocks follow the index. the size of a block is the difference between
+// its offset and the next one. a block whose size is equal to its
+// uncompressed size is stored as-is.
+
+const u32 CompressedROMMagic = 0x4353444D;
+const u32 CompressedROMVersion = 1;
+const u32 CompressedROMHeaderSize = 0x20;
+
+// really, Windows?
+#ifdef __WIN32__
+    #define melon_fseek _fseeki64
+#else
+    #define melon_fseek fseek
+#endif // __WIN32__
+
+
+CompressedROM::CompressedROM(FILE* file)
+{
+    File = file;
+
+    ROMSize = 0;
+    BlockSize = 0;
+    NumBlocks = 0;
+
+    CacheHits = 0;
+    CacheMisses = 0;
+
+    for (int i = 0; i < CacheSize; i++)
+    {
+        Cache[i].Block = 0xFFFFFFFF;
+        Cache[i].LastUse = 0;
+        Cache[i].Data = nullptr;
+    }
+    CacheTick = 0;
+    LastEntry = 0;
+}
+
+CompressedROM::~CompressedROM()
+{
+    for (int i = 0; i < CacheSize; i++)
+    {
+        if (Cache[i].Data) delete[] Cache[i].Data;
+    }
+
+    if (File) fclose(File);
+}
+
+
+bool CompressedROM::IsCompressedROM(FILE* file)
+{
+    u32 magic = 0;
+
+    melon_fseek(file, 0, SEEK_SET);
+    size_t nread = fread(&magic, 4, 1, file);
+    melon_fseek(file, 0, SEEK_SET);
+
+    return nread == 1 && magic == CompressedROMMagic;
+}
+
+bool CompressedROM::Compress(FILE* in, FILE* out, u32 blocksize, int level)
+{
+    if (blocksize < 0x1000 || blocksize > 0x100000 || (blocksize & (blocksize-1)))
+        return false;
+
+    melon_fseek(in, 0, SEEK_END);
+    long len = ftell(in);
+    if (len <= 0 || len > 0x40000000)
+        return false;
+
+    u32 romsize = (u32)len;
+    u32 numblocks = (romsize + blocksize - 1) / blocksize;
+
+    u32 header[8] = {0};
+    header[0] = CompressedROMMagic;
+    header[1] = CompressedROMVersion;
+    header[2] = romsize;
+    header[3] = blocksize;
+    header[4] = numblocks;
+    header[5] = 0;
+
+    std::vector<u64> index(numblocks + 1);
+    std::vector<u8> block(blocksize);
+    std::vector<u8> comp(compressBound(blocksize));
+
+    // the index is written once all the block sizes are known
+    melon_fseek(out, 0, SEEK_SET);
+    if (fwrite(header, sizeof(header), 1, out) != 1) return false;
+    if (fwrite(index.data(), index.size() * sizeof(u64), 1, out) != 1) return false;
+
+    u64 offset = CompressedROMHeaderSize + index.size() * sizeof(u64);
+
+    melon_fseek(in, 0, SEEK_SET);
+    for (u32 i = 0; i < numblocks; i++)
+    {
+        u32 blocklen = std::min(blocksize, romsize - i*blocksize);
+        if (fread(block.data(), blocklen, 1, in) != 1)
+            return false;
+
+        uLongf complen = comp.size();
+        const u8* data = comp.data();
+        if (compress2(comp.data(), &complen, block.data(), blocklen, level) != Z_OK || complen >= blocklen)
+        {
+            // not worth compressing, store it as-is
+            complen = blocklen;
+            data = block.data();
+        }
+
+        if (fwrite(data, complen, 1, out) != 1)
+            return false;
+
+        index[i] = offset;
+        offset += complen;
+    }
+    index[numblocks] = offset;
+
+    melon_fseek(out, CompressedROMHeaderSize, SEEK_SET);
+    if (fwrite(index.data(), index.size() * sizeof(u64), 1, out) != 1) return false;
+
+    return true;
+}
+
+
+bool CompressedROM::Open()
+{
+    if (!File) return false;
+
+    u32 header[8];
+    melon_fseek(File, 0, SEEK_SET);
+    if (fread(header, sizeof(header), 1, File) != 1)
+        return false;
+
+    if (header[0] != CompressedROMMagic)
+        return false;
+
+    if (header[1] != CompressedROMVersion || header[5] != 0)
+    {
+        printf("CompressedROM: unsupported version %d / codec %d\n", header[1], header[5]);
+        return false;
+    }
+
+    ROMSize = header[2];
+    BlockSize = header[3];
+    NumBlocks = header[4];
+
+    if (BlockSize < 0x1000 || BlockSize > 0x100000 || (BlockSize & (BlockSize-1)) ||
+        NumBlocks != (ROMSize + BlockSize - 1) / BlockSize)
+    {
+        printf("CompressedROM: bad header (size %08X, block size %08X, %d blocks)\n", ROMSize, BlockSize, NumBlocks);
+        return false;
+    }
+
+    Index.resize(NumBlocks + 1);
+    if (fread(Index.data(), Index.size() * sizeof(u64), 1, File) != 1)
+        return false;
+
+    for (u32 i = 0; i < NumBlocks; i++)
+    {
+        if (Index[i+1] < Index[i] || (Index[i+1] - Index[i]) > compressBound(BlockSize))
+        {
+            printf("CompressedROM: bad index entry for block %d\n", i);
+            return false;
+        }
+    }
+
+    CompBuffer.resize(compressBound(BlockSize));
+
+    for (int i = 0; i < CacheSize; i++)
+        Cache[i].Data = new u8[BlockSize];
+
+    return true;
+}
+
+
+bool CompressedROM::ReadBlock(u32 block, u8* data)
+{
+    if (block >= NumBlocks) return false;
+
+    u32 blocklen = std::min(BlockSize, ROMSize - block*BlockSize);
+    u32 complen = (u32)(Index[block+1] - Index[block]);
+
+    melon_fseek(File, Index[block], SEEK_SET);
+
+    if (complen == blocklen)
+        return fread(data, blocklen, 1, File) == 1;
+
+    if (fread(CompBuffer.data(), complen, 1, File) != 1)
+        return false;
+
+    uLongf outlen = blocklen;
+    if (uncompress(data, &outlen, CompBuffer.data(), complen) != Z_OK || outlen != blocklen)
+        return false;
+
+    return true;
+}
+
+u8* CompressedROM::GetBlock(u32 block)
+{
+    // consecutive reads usually hit the same block
+    if (Cache[LastEntry].Block == block)
+    {
+        CacheHits++;
+        Cache[LastEntry].LastUse = ++CacheTick;
+        return Cache[LastEntry].Data;
+    }
+
+    int victim = 0;
+    for (int i = 0; i < CacheSize; i++)
+    {
+        if (Cache[i].Block == block)
+        {
+            CacheHits++;
+            Cache[i].LastUse = ++CacheTick;
+            LastEntry = i;
+            return Cache[i].Data;
+        }
+
+        if (Cache[i].LastUse < Cache[victim].LastUse)
+            victim = i;
+    }
+
+    CacheMisses++;
+
+    CacheEntry& entry = Cache[victim];
+    if (!ReadBlock(block, entry.Data))
+    {
+        printf("CompressedROM: failed to read block %d\n", block);
+        memset(entry.Data, 0, BlockSize);
+    }
+
+    entry.Block = block;
+    entry.LastUse = ++CacheTick;
+    LastEntry = victim;
+    return entry.Data;
+}
+
+void CompressedROM::Read(u32 addr, u32 len, u8* data)
+{
+    while (len > 0)
+    {
+        if (addr >= ROMSize)
+        {
+            memset(data, 0, len);
+            return;
+        }
+
+        u32 offset = addr & (BlockSize-1);
+        u32 chunk = std::min(len, std::min(BlockSize - offset, ROMSize - addr));
+
+        u8* block = GetBlock(addr / BlockSize);
+        memcpy(data, &block[offset], chunk);
+
+        addr += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
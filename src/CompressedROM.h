@@ -0,0 +1,80 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef COMPRESSEDROM_H
+#define COMPRESSEDROM_H
+
+#include <stdio.h>
+#include <vector>
+
+#include "types.h"
+
+// ROM image split in separately compressed blocks, so that any part of
+// the ROM can be read without decompressing the whole file
+// see CompressedROM.cpp for the file layout
+class CompressedROM
+{
+public:
+    // takes ownership of the file
+    CompressedROM(FILE* file);
+    ~CompressedROM();
+
+    static bool IsCompressedROM(FILE* file);
+    static bool Compress(FILE* in, FILE* out, u32 blocksize, int level);
+
+    bool Open();
+
+    u32 GetSize() { return ROMSize; }
+    u32 GetBlockSize() { return BlockSize; }
+    u32 GetNumBlocks() { return NumBlocks; }
+
+    // bypasses the block cache
+    bool ReadBlock(u32 block, u8* data);
+
+    // data past the end of the ROM reads as zero
+    void Read(u32 addr, u32 len, u8* data);
+
+    u32 CacheHits;
+    u32 CacheMisses;
+
+private:
+    static const int CacheSize = 32;
+
+    struct CacheEntry
+    {
+        u32 Block;
+        u32 LastUse;
+        u8* Data;
+    };
+
+    FILE* File;
+
+    u32 ROMSize;
+    u32 BlockSize;
+    u32 NumBlocks;
+    std::vector<u64> Index;
+    std::vector<u8> CompBuffer;
+
+    CacheEntry Cache[CacheSize];
+    u32 CacheTick;
+    int LastEntry;
+
+    u8* GetBlock(u32 block);
+};
+
+#endif // COMPRESSEDROM_H
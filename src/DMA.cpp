@@ -17,6 +17,8 @@
 */
 
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
 #include "NDS.h"
 #include "DSi.h"
 #include "DMA.h"
@@ -543,6 +545,185 @@ u32 DMA::UnitTimings7_32(bool burststart)
     }
 }
 
+// block copy fast path
+//
+// transfers between plain memory regions (main RAM, WRAM, LCDC-mapped VRAM) don't go
+// through the bus handlers. the timings are still computed for each unit, so that bursts
+// and the point where the transfer yields are the same as with the regular path.
+
+bool DMA::CanCopyBlocks()
+{
+#ifdef JIT_ENABLED
+    // writes would need to invalidate JIT blocks
+    if (NDS::EnableJIT) return false;
+#endif
+
+    return SrcAddrInc > 0 && DstAddrInc > 0;
+}
+
+u8* GetLCDCVRAMPtr(u32 addr, u32& len, int& bank)
+{
+    u32 offset = addr & 0xFFFFF;
+    u32 size;
+
+    if      (offset < 0x80000) { bank = offset >> 17; size = 0x20000; }
+    else if (offset < 0x90000) { bank = 4; size = 0x10000; }
+    else if (offset < 0x94000) { bank = 5; size = 0x4000; }
+    else if (offset < 0x98000) { bank = 6; size = 0x4000; }
+    else if (offset < 0xA0000) { bank = 7; size = 0x8000; }
+    else if (offset < 0xA4000) { bank = 8; size = 0x4000; }
+    else return nullptr;
+
+    if (!(GPU::VRAMMap_LCDC & (1<<bank)))
+        return nullptr;
+
+    offset &= (size - 1);
+    len = size - offset;
+    return &GPU::VRAM[bank][offset];
+}
+
+template <int ConsoleType>
+u8* GetLinearPtr9(u32 addr, u32& len, int& vrambank)
+{
+    NDS::MemRegion region;
+    bool linear;
+
+    if (ConsoleType == 1)
+        linear = DSi::ARM9GetMemRegion(addr, true, &region);
+    else
+        linear = NDS::ARM9GetMemRegion(addr, true, &region);
+
+    vrambank = -1;
+    if (linear)
+    {
+        u32 offset = addr & region.Mask;
+        len = region.Mask + 1 - offset;
+        return &region.Mem[offset];
+    }
+
+    if ((addr & 0xFF800000) == 0x06800000)
+        return GetLCDCVRAMPtr(addr, len, vrambank);
+
+    return nullptr;
+}
+
+template <int ConsoleType>
+u8* GetLinearPtr7(u32 addr, u32& len)
+{
+    NDS::MemRegion region;
+    bool linear;
+
+    if (ConsoleType == 1)
+        linear = DSi::ARM7GetMemRegion(addr, true, &region);
+    else
+        linear = NDS::ARM7GetMemRegion(addr, true, &region);
+
+    if (!linear)
+        return nullptr;
+
+    u32 offset = addr & region.Mask;
+    len = region.Mask + 1 - offset;
+    return &region.Mem[offset];
+}
+
+template <typename T>
+void CopyUnits(u8* dst, u8* src, u32 len)
+{
+    // overlapping transfers have to behave as if they were done unit by unit
+    if (dst <= src || dst >= src + len)
+    {
+        memmove(dst, src, len);
+        return;
+    }
+
+    for (u32 i = 0; i < len; i += sizeof(T))
+        *(T*)&dst[i] = *(T*)&src[i];
+}
+
+template <int ConsoleType, typename T>
+u32 DMA::CopyBlock9(bool burststart)
+{
+    const u32 mask = ~(u32)(sizeof(T) - 1);
+
+    u32 srclen, dstlen;
+    int srcbank, dstbank;
+    u8* src = GetLinearPtr9<ConsoleType>(CurSrcAddr & mask, srclen, srcbank);
+    if (!src) return 0;
+    u8* dst = GetLinearPtr9<ConsoleType>(CurDstAddr & mask, dstlen, dstbank);
+    if (!dst) return 0;
+
+    u32 maxunits = std::min(IterCount, std::min(srclen, dstlen) / (u32)sizeof(T));
+
+    u32 units = 0;
+    while (units < maxunits)
+    {
+        if (sizeof(T) == 2)
+            NDS::ARM9Timestamp += (UnitTimings9_16(burststart) << NDS::ARM9ClockShift);
+        else
+            NDS::ARM9Timestamp += (UnitTimings9_32(burststart) << NDS::ARM9ClockShift);
+        burststart = false;
+
+        CurSrcAddr += sizeof(T);
+        CurDstAddr += sizeof(T);
+        units++;
+
+        if (NDS::ARM9Timestamp >= NDS::ARM9Target) break;
+    }
+
+    u32 len = units * sizeof(T);
+    CopyUnits<T>(dst, src, len);
+    NDS::CheckCodeWrite(dst, len);
+
+    if (dstbank >= 0)
+    {
+        u32 offset = dst - GPU::VRAM[dstbank];
+        u32 first = offset / GPU::VRAMDirtyGranularity;
+        u32 last = (offset + len - 1) / GPU::VRAMDirtyGranularity;
+        GPU::VRAMDirty[dstbank].SetRange(first, last - first + 1);
+    }
+
+    IterCount -= units;
+    RemCount -= units;
+    return units;
+}
+
+template <int ConsoleType, typename T>
+u32 DMA::CopyBlock7(bool burststart)
+{
+    const u32 mask = ~(u32)(sizeof(T) - 1);
+
+    u32 srclen, dstlen;
+    u8* src = GetLinearPtr7<ConsoleType>(CurSrcAddr & mask, srclen);
+    if (!src) return 0;
+    u8* dst = GetLinearPtr7<ConsoleType>(CurDstAddr & mask, dstlen);
+    if (!dst) return 0;
+
+    u32 maxunits = std::min(IterCount, std::min(srclen, dstlen) / (u32)sizeof(T));
+
+    u32 units = 0;
+    while (units < maxunits)
+    {
+        if (sizeof(T) == 2)
+            NDS::ARM7Timestamp += UnitTimings7_16(burststart);
+        else
+            NDS::ARM7Timestamp += UnitTimings7_32(burststart);
+        burststart = false;
+
+        CurSrcAddr += sizeof(T);
+        CurDstAddr += sizeof(T);
+        units++;
+
+        if (NDS::ARM7Timestamp >= NDS::ARM7Target) break;
+    }
+
+    CopyUnits<T>(dst, src, units * sizeof(T));
+    NDS::CheckCodeWrite(dst, units * sizeof(T));
+
+    IterCount -= units;
+    RemCount -= units;
+    return units;
+}
+
 template <int ConsoleType>
 void DMA::Run9()
 {
@@ -554,10 +735,23 @@ void DMA::Run9()
     bool burststart = (Running == 2);
     Running = 1;
 
+    bool blockcopy = CanCopyBlocks();
+
     if (!(Cnt & (1<<26)))
     {
         while (IterCount > 0 && !Stall)
         {
+            if (blockcopy)
+            {
+                if (CopyBlock9<ConsoleType, u16>(burststart))
+                {
+                    burststart = false;
+                    if (NDS::ARM9Timestamp >= NDS::ARM9Target) break;
+                    continue;
+                }
+                blockcopy = false;
+            }
+
             NDS::ARM9Timestamp += (UnitTimings9_16(burststart) << NDS::ARM9ClockShift);
             burststart = false;
 
@@ -578,6 +772,17 @@ void DMA::Run9()
     {
         while (IterCount > 0 && !Stall)
         {
+            if (blockcopy)
+            {
+                if (CopyBlock9<ConsoleType, u32>(burststart))
+                {
+                    burststart = false;
+                    if (NDS::ARM9Timestamp >= NDS::ARM9Target) break;
+                    continue;
+                }
+                blockcopy = false;
+            }
+
             NDS::ARM9Timestamp += (UnitTimings9_32(burststart) << NDS::ARM9ClockShift);
             burststart = false;
 
@@ -634,10 +839,23 @@ void DMA::Run7()
     bool burststart = (Running == 2);
     Running = 1;
 
+    bool blockcopy = CanCopyBlocks();
+
     if (!(Cnt & (1<<26)))
     {
         while (IterCount > 0 && !Stall)
         {
+            if (blockcopy)
+            {
+                if (CopyBlock7<ConsoleType, u16>(burststart))
+                {
+                    burststart = false;
+                    if (NDS::ARM7Timestamp >= NDS::ARM7Target) break;
+                    continue;
+                }
+                blockcopy = false;
+            }
+
             NDS::ARM7Timestamp += UnitTimings7_16(burststart);
             burststart = false;
 
@@ -658,6 +876,17 @@ void DMA::Run7()
     {
         while (IterCount > 0 && !Stall)
         {
+            if (blockcopy)
+            {
+                if (CopyBlock7<ConsoleType, u32>(burststart))
+                {
+                    burststart = false;
+                    if (NDS::ARM7Timestamp >= NDS::ARM7Target) break;
+                    continue;
+                }
+                blockcopy = false;
+            }
+
             NDS::ARM7Timestamp += UnitTimings7_32(burststart);
             burststart = false;
 
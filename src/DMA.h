@@ -98,6 +98,13 @@ private:
 
     u32 MRAMBurstCount;
     const u8* MRAMBurstTable;
+
+    bool CanCopyBlocks();
+
+    template <int ConsoleType, typename T>
+    u32 CopyBlock9(bool burststart);
+    template <int ConsoleType, typename T>
+    u32 CopyBlock7(bool burststart);
 };
 
 #endif
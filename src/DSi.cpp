@@ -745,8 +745,6 @@ bool LoadNAND()
         return false;
     }
 
-    FILE* nand = DSi_NAND::GetFile();
-
     // Make sure NWRAM is accessible.
     // The Bits are set to the startup values in Reset() and we might
     // still have them on default (0) or some bits cleared by the previous
@@ -767,8 +765,7 @@ bool LoadNAND()
     memset(NWRAMMask, 0, sizeof(NWRAMMask));
 
     u32 bootparams[8];
-    fseek(nand, 0x220, SEEK_SET);
-    fread(bootparams, 4, 8, nand);
+    DSi_NAND::ReadRaw(0x220, (u8*)bootparams, 4*8);
 
     printf("ARM9: offset=%08X size=%08X RAM=%08X size_aligned=%08X\n",
            bootparams[0], bootparams[1], bootparams[2], bootparams[3]);
@@ -781,8 +778,7 @@ bool LoadNAND()
     MBK[1][8] = 0;
 
     u32 mbk[12];
-    fseek(nand, 0x380, SEEK_SET);
-    fread(mbk, 4, 12, nand);
+    DSi_NAND::ReadRaw(0x380, (u8*)mbk, 4*12);
 
     MapNWRAM_A(0, mbk[0] & 0xFF);
     MapNWRAM_A(1, (mbk[0] >> 8) & 0xFF);
@@ -826,7 +822,7 @@ bool LoadNAND()
     const u8 boot2key[16] = {0xAD, 0x34, 0xEC, 0xF9, 0x62, 0x6E, 0xC2, 0x3A, 0xF6, 0xB4, 0x6C, 0x00, 0x80, 0x80, 0xEE, 0x98};
     u8 boot2iv[16];
     u8 tmp[16];
-    u32 dstaddr;
+    u32 srcaddr, dstaddr;
 
     *(u32*)&tmp[0] = bootparams[3];
     *(u32*)&tmp[4] = -bootparams[3];
@@ -836,12 +832,12 @@ bool LoadNAND()
 
     AES_init_ctx_iv(&ctx, boot2key, boot2iv);
 
-    fseek(nand, bootparams[0], SEEK_SET);
+    srcaddr = bootparams[0];
     dstaddr = bootparams[2];
     for (u32 i = 0; i < bootparams[3]; i += 16)
     {
         u8 data[16];
-        fread(data, 16, 1, nand);
+        DSi_NAND::ReadRaw(srcaddr, data, 16); srcaddr += 16;
 
         for (int j = 0; j < 16; j++) tmp[j] = data[15-j];
         AES_CTR_xcrypt_buffer(&ctx, tmp, 16);
@@ -861,12 +857,12 @@ bool LoadNAND()
 
     AES_init_ctx_iv(&ctx, boot2key, boot2iv);
 
-    fseek(nand, bootparams[4], SEEK_SET);
+    srcaddr = bootparams[4];
     dstaddr = bootparams[6];
     for (u32 i = 0; i < bootparams[7]; i += 16)
     {
         u8 data[16];
-        fread(data, 16, 1, nand);
+        DSi_NAND::ReadRaw(srcaddr, data, 16); srcaddr += 16;
 
         for (int j = 0; j < 16; j++) tmp[j] = data[15-j];
         AES_CTR_xcrypt_buffer(&ctx, tmp, 16);
@@ -1015,6 +1011,7 @@ void MapNWRAM_A(u32 num, u8 val)
 #ifdef JIT_ENABLED
     ARMJIT_Memory::RemapNWRAM(0);
 #endif
+    NDS::CodeWritten();
 
     MBK[0][mbkn] &= ~(0xFF << mbks);
     MBK[0][mbkn] |= (val << mbks);
@@ -1062,6 +1059,7 @@ void MapNWRAM_B(u32 num, u8 val)
 #ifdef JIT_ENABLED
     ARMJIT_Memory::RemapNWRAM(1);
 #endif
+    NDS::CodeWritten();
 
     MBK[0][mbkn] &= ~(0xFF << mbks);
     MBK[0][mbkn] |= (val << mbks);
@@ -1111,6 +1109,7 @@ void MapNWRAM_C(u32 num, u8 val)
 #ifdef JIT_ENABLED
     ARMJIT_Memory::RemapNWRAM(2);
 #endif
+    NDS::CodeWritten();
 
     MBK[0][mbkn] &= ~(0xFF << mbks);
     MBK[0][mbkn] |= (val << mbks);
@@ -1162,6 +1161,7 @@ void MapNWRAMRange(u32 cpu, u32 num, u32 val)
 #ifdef JIT_ENABLED
     ARMJIT_Memory::RemapNWRAM(num);
 #endif
+    NDS::CodeWritten();
 
     MBK[cpu][5+num] = val;
 
@@ -1228,6 +1228,8 @@ void ApplyNewRAMSize(u32 size)
         printf("RAM: 16MB\n");
         break;
     }
+
+    NDS::UpdatePageTables();
 }
 
 
@@ -1513,6 +1515,7 @@ void ARM9Write8(u32 addr, u8 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        NDS::CheckCodeWrite(&NDS::MainRAM[addr & NDS::MainRAMMask]);
         *(u8*)&NDS::MainRAM[addr & NDS::MainRAMMask] = val;
         return;
     }
@@ -1605,6 +1608,7 @@ void ARM9Write16(u32 addr, u16 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        NDS::CheckCodeWrite(&NDS::MainRAM[addr & NDS::MainRAMMask]);
         *(u16*)&NDS::MainRAM[addr & NDS::MainRAMMask] = val;
         return;
     }
@@ -1697,6 +1701,7 @@ void ARM9Write32(u32 addr, u32 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        NDS::CheckCodeWrite(&NDS::MainRAM[addr & NDS::MainRAMMask]);
         *(u32*)&NDS::MainRAM[addr & NDS::MainRAMMask] = val;
         return;
     }
@@ -2005,6 +2010,7 @@ void ARM7Write8(u32 addr, u8 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        NDS::CheckCodeWrite(&NDS::MainRAM[addr & NDS::MainRAMMask]);
         *(u8*)&NDS::MainRAM[addr & NDS::MainRAMMask] = val;
         return;
     }
@@ -2102,6 +2108,7 @@ void ARM7Write16(u32 addr, u16 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        NDS::CheckCodeWrite(&NDS::MainRAM[addr & NDS::MainRAMMask]);
         *(u16*)&NDS::MainRAM[addr & NDS::MainRAMMask] = val;
         return;
     }
@@ -2199,6 +2206,7 @@ void ARM7Write32(u32 addr, u32 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        NDS::CheckCodeWrite(&NDS::MainRAM[addr & NDS::MainRAMMask]);
         *(u32*)&NDS::MainRAM[addr & NDS::MainRAMMask] = val;
         return;
     }
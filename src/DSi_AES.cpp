@@ -20,6 +20,7 @@
 #include <string.h>
 #include "DSi.h"
 #include "DSi_AES.h"
+#include "AESCrypt.h"
 #include "FIFO.h"
 #include "tiny-AES-c/aes.hpp"
 #include "Platform.h"
@@ -95,6 +96,9 @@ bool Init()
     const u8 zero[16] = {0};
     AES_init_ctx_iv(&Ctx, zero, zero);
 
+    AESCrypt::Init();
+    printf("AES backend: %s\n", AESCrypt::GetBackendName());
+
     return true;
 }
 
@@ -196,23 +200,18 @@ void DoSavestate(Savestate* file)
 void ProcessBlock_CCM_Extra()
 {
     u8 data[16];
-    u8 data_rev[16];
 
     *(u32*)&data[0] = InputFIFO.Read();
     *(u32*)&data[4] = InputFIFO.Read();
     *(u32*)&data[8] = InputFIFO.Read();
     *(u32*)&data[12] = InputFIFO.Read();
 
-    Swap16(data_rev, data);
-
-    for (int i = 0; i < 16; i++) CurMAC[i] ^= data_rev[i];
-    AES_ECB_encrypt(&Ctx, CurMAC);
+    AESCrypt::CBCMAC(&Ctx, CurMAC, data, 16, true);
 }
 
 void ProcessBlock_CCM_Decrypt()
 {
     u8 data[16];
-    u8 data_rev[16];
 
     *(u32*)&data[0] = InputFIFO.Read();
     *(u32*)&data[4] = InputFIFO.Read();
@@ -221,13 +220,7 @@ void ProcessBlock_CCM_Decrypt()
 
     //printf("AES-CCM: "); _printhex2(data, 16);
 
-    Swap16(data_rev, data);
-
-    AES_CTR_xcrypt_buffer(&Ctx, data_rev, 16);
-    for (int i = 0; i < 16; i++) CurMAC[i] ^= data_rev[i];
-    AES_ECB_encrypt(&Ctx, CurMAC);
-
-    Swap16(data, data_rev);
+    AESCrypt::CCMDecrypt(&Ctx, CurMAC, data, 16, true);
 
     //printf(" -> "); _printhex2(data, 16);
 
@@ -240,7 +233,6 @@ void ProcessBlock_CCM_Decrypt()
 void ProcessBlock_CCM_Encrypt()
 {
     u8 data[16];
-    u8 data_rev[16];
 
     *(u32*)&data[0] = InputFIFO.Read();
     *(u32*)&data[4] = InputFIFO.Read();
@@ -249,13 +241,7 @@ void ProcessBlock_CCM_Encrypt()
 
     //printf("AES-CCM: "); _printhex2(data, 16);
 
-    Swap16(data_rev, data);
-
-    for (int i = 0; i < 16; i++) CurMAC[i] ^= data_rev[i];
-    AES_CTR_xcrypt_buffer(&Ctx, data_rev, 16);
-    AES_ECB_encrypt(&Ctx, CurMAC);
-
-    Swap16(data, data_rev);
+    AESCrypt::CCMEncrypt(&Ctx, CurMAC, data, 16, true);
 
     //printf(" -> "); _printhex2(data, 16);
 
@@ -268,7 +254,6 @@ void ProcessBlock_CCM_Encrypt()
 void ProcessBlock_CTR()
 {
     u8 data[16];
-    u8 data_rev[16];
 
     *(u32*)&data[0] = InputFIFO.Read();
     *(u32*)&data[4] = InputFIFO.Read();
@@ -277,9 +262,7 @@ void ProcessBlock_CTR()
 
     //printf("AES-CTR: "); _printhex2(data, 16);
 
-    Swap16(data_rev, data);
-    AES_CTR_xcrypt_buffer(&Ctx, data_rev, 16);
-    Swap16(data, data_rev);
+    AESCrypt::CTRXcrypt(&Ctx, data, 16, true);
 
     //printf(" -> "); _printhex(data, 16);
 
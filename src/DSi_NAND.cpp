@@ -17,11 +17,17 @@
 */
 
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <codecvt>
+#include <algorithm>
+#include <vector>
 
 #include "DSi.h"
 #include "DSi_AES.h"
+#include "AESCrypt.h"
 #include "DSi_NAND.h"
+#include "OverlayImage.h"
 #include "Platform.h"
 
 #include "sha1/sha1.hpp"
@@ -34,6 +40,7 @@ namespace DSi_NAND
 {
 
 FILE* CurFile;
+OverlayImage* CurOverlay;
 FATFS CurFS;
 
 u8 eMMC_CID[16];
@@ -49,53 +56,195 @@ UINT FF_ReadNAND(BYTE* buf, LBA_t sector, UINT num);
 UINT FF_WriteNAND(BYTE* buf, LBA_t sector, UINT num);
 
 
+// the overlays of secondary instances sit on a copy of the main NAND that's
+// made once and then left alone, since the main instance keeps writing to its own.
+// the copy is made under a temporary name and only renamed once it's complete,
+// so a base image that exists is always a whole one
+bool CopyOverlayBase(std::string nandpath, FILE* base)
+{
+    FILE* orig = Platform::OpenLocalFile(nandpath, "rb");
+    if (!orig)
+        return false;
+
+    fseek(orig, 0, SEEK_END);
+    u64 len = ftell(orig);
+    fseek(orig, 0, SEEK_SET);
+
+    printf("DSi NAND: making base image for overlays\n");
+
+    std::vector<u8> buf(0x100000);
+    bool ok = true;
+    for (u64 pos = 0; pos < len && ok; pos += buf.size())
+    {
+        u32 chunk = (u32)std::min((u64)buf.size(), len - pos);
+        ok = fread(buf.data(), chunk, 1, orig) == 1 &&
+             fwrite(buf.data(), chunk, 1, base) == 1;
+    }
+
+    fclose(orig);
+
+    ok = ok && fflush(base) == 0;
+    ok = ok && fsync(fileno(base)) == 0;
+    return ok;
+}
+
+s64 GetFileSize(std::string path)
+{
+    FILE* f = Platform::OpenLocalFile(path, "rb");
+    if (!f)
+        return -1;
+
+    fseek(f, 0, SEEK_END);
+    s64 len = ftell(f);
+    fclose(f);
+    return len;
+}
+
+bool CreateOverlayBase(std::string nandpath, std::string basepath)
+{
+    std::string tmppath = basepath + ".tmp";
+
+    s64 lastlen = 0;
+    int idle = 0;
+    for (;;)
+    {
+        if (Platform::LocalFileExists(basepath))
+            return true;
+
+        // exclusive, so that two instances starting at once don't both write it
+        FILE* base = Platform::OpenLocalFile(tmppath, "wbx");
+        if (base)
+        {
+            bool ok = CopyOverlayBase(nandpath, base);
+
+            // if this stalled for long enough, another instance may have taken the
+            // file for a leftover and started over with its own
+            struct stat own, cur;
+            bool owned = fstat(fileno(base), &own) == 0 && stat(tmppath.c_str(), &cur) == 0 &&
+                         own.st_dev == cur.st_dev && own.st_ino == cur.st_ino;
+
+            ok = ok && owned && rename(tmppath.c_str(), basepath.c_str()) == 0;
+            if (fclose(base) != 0) ok = false;
+
+            if (!ok && owned)
+                remove(tmppath.c_str());
+            return ok;
+        }
+
+        // another instance is making it, wait for it to be renamed into place.
+        // if it stops growing, it was left behind by an instance that didn't finish
+        s64 len = GetFileSize(tmppath);
+        if (len < 0)
+        {
+            // it's gone, either renamed into place or it couldn't be created at all
+            return Platform::LocalFileExists(basepath);
+        }
+        else if (len != lastlen)
+        {
+            lastlen = len;
+            idle = 0;
+        }
+        else if (++idle >= 100)
+        {
+            printf("DSi NAND: removing stale base image %s\n", tmppath.c_str());
+            remove(tmppath.c_str());
+            idle = 0;
+            continue;
+        }
+
+        Platform::Sleep(100000);
+    }
+}
+
+bool CreateOverlay(std::string nandpath, std::string instnand)
+{
+    std::string basepath = nandpath + ".base";
+    if (!CreateOverlayBase(nandpath, basepath))
+    {
+        printf("DSi NAND: failed to make base image for overlays\n");
+        return false;
+    }
+
+    FILE* file = Platform::OpenLocalFile(instnand, "w+b");
+    if (!file)
+        return false;
+
+    bool ok = OverlayImage::Create(file, basepath);
+    fclose(file);
+    return ok;
+}
+
+OverlayImage* OpenOverlay(std::string instnand)
+{
+    FILE* file = Platform::OpenLocalFile(instnand, "r+b");
+    if (!file)
+        return nullptr;
+
+    OverlayImage* overlay = new OverlayImage(file);
+    if (!overlay->Open())
+    {
+        delete overlay;
+        return nullptr;
+    }
+
+    return overlay;
+}
+
 bool Init(u8* es_keyY)
 {
     CurFile = nullptr;
+    CurOverlay = nullptr;
 
     std::string nandpath = Platform::GetConfigString(Platform::DSi_NANDPath);
     std::string instnand = nandpath + Platform::InstanceFileSuffix();
 
+    // secondary instances get a copy-on-write overlay instead of a full copy of the NAND
     FILE* nandfile = Platform::OpenLocalFile(instnand, "r+b");
     if ((!nandfile) && (Platform::InstanceID() > 0))
     {
-        FILE* orig = Platform::OpenLocalFile(nandpath, "rb");
-        if (!orig)
+        if (!CreateOverlay(nandpath, instnand))
         {
             printf("Failed to open DSi NAND\n");
             return false;
         }
 
-        fseek(orig, 0, SEEK_END);
-        long len = ftell(orig);
-        fseek(orig, 0, SEEK_SET);
+        nandfile = Platform::OpenLocalFile(instnand, "r+b");
+    }
 
-        nandfile = Platform::OpenLocalFile(instnand, "w+b");
-        if (nandfile)
-        {
-            u8* tmpbuf = new u8[0x10000];
-            for (long i = 0; i < len; i+=0x10000)
-            {
-                long blklen = 0x10000;
-                if ((i+blklen) > len) blklen = len-i;
+    if (!nandfile)
+        return false;
 
-                fread(tmpbuf, blklen, 1, orig);
-                fwrite(tmpbuf, blklen, 1, nandfile);
-            }
-            delete[] tmpbuf;
+    u64 nandlen;
+    if (OverlayImage::IsOverlay(nandfile))
+    {
+        fclose(nandfile);
+        nandfile = nullptr;
+
+        CurOverlay = OpenOverlay(instnand);
+        if ((!CurOverlay) && (Platform::InstanceID() > 0))
+        {
+            // the blocks it doesn't have can't be read from a base image that changed,
+            // so the overlay has to start over
+            printf("DSi NAND: recreating overlay\n");
+            if (CreateOverlay(nandpath, instnand))
+                CurOverlay = OpenOverlay(instnand);
         }
 
-        fclose(orig);
-        fclose(nandfile);
+        if (!CurOverlay)
+        {
+            printf("Failed to open DSi NAND overlay\n");
+            return false;
+        }
 
-        nandfile = Platform::OpenLocalFile(instnand, "r+b");
+        nandlen = CurOverlay->GetSize();
+    }
+    else
+    {
+        fseek(nandfile, 0, SEEK_END);
+        nandlen = ftell(nandfile);
     }
 
-    if (!nandfile)
-        return false;
-
-    fseek(nandfile, 0, SEEK_END);
-    u64 nandlen = ftell(nandfile);
+    CurFile = nandfile;
 
     ff_disk_open(FF_ReadNAND, FF_WriteNAND, (LBA_t)(nandlen>>9));
 
@@ -111,18 +260,18 @@ bool Init(u8* es_keyY)
 
     // read the nocash footer
 
-    fseek(nandfile, -0x40, SEEK_END);
+    u64 footeraddr = nandlen - 0x40;
 
     char nand_footer[16];
     const char* nand_footer_ref = "DSi eMMC CID/CPU";
-    fread(nand_footer, 1, 16, nandfile);
+    ReadRaw(footeraddr, (u8*)nand_footer, 16);
     if (memcmp(nand_footer, nand_footer_ref, 16))
     {
         // There is another copy of the footer at 000FF800h for the case
         // that by external tools the image was cut off
         // See https://problemkaputt.de/gbatek.htm#dsisdmmcimages
-        fseek(nandfile, 0x000FF800, SEEK_SET);
-        fread(nand_footer, 1, 16, nandfile);
+        footeraddr = 0x000FF800;
+        ReadRaw(footeraddr, (u8*)nand_footer, 16);
         if (memcmp(nand_footer, nand_footer_ref, 16))
         {
             printf("ERROR: NAND missing nocash footer\n");
@@ -130,8 +279,8 @@ bool Init(u8* es_keyY)
         }
     }
 
-    fread(eMMC_CID, 1, 16, nandfile);
-    fread(&ConsoleID, 1, 8, nandfile);
+    ReadRaw(footeraddr+16, eMMC_CID, 16);
+    ReadRaw(footeraddr+32, (u8*)&ConsoleID, 8);
 
     // init NAND crypto
 
@@ -169,7 +318,6 @@ bool Init(u8* es_keyY)
     DSi_AES::DeriveNormalKey(keyX, keyY, tmp);
     DSi_AES::Swap16(ESKey, tmp);
 
-    CurFile = nandfile;
     return true;
 }
 
@@ -180,12 +328,30 @@ void DeInit()
 
     if (CurFile) fclose(CurFile);
     CurFile = nullptr;
+
+    if (CurOverlay) delete CurOverlay;
+    CurOverlay = nullptr;
 }
 
 
-FILE* GetFile()
+bool ReadRaw(u64 addr, u8* buf, u32 len)
 {
-    return CurFile;
+    if (CurOverlay)
+        return CurOverlay->Read(addr, buf, len);
+
+    if (!CurFile) return false;
+    fseek(CurFile, addr, SEEK_SET);
+    return fread(buf, len, 1, CurFile) == 1;
+}
+
+bool WriteRaw(u64 addr, u8* buf, u32 len)
+{
+    if (CurOverlay)
+        return CurOverlay->Write(addr, buf, len);
+
+    if (!CurFile) return false;
+    fseek(CurFile, addr, SEEK_SET);
+    return fwrite(buf, len, 1, CurFile) == 1;
 }
 
 
@@ -227,17 +393,9 @@ u32 ReadFATBlock(u64 addr, u32 len, u8* buf)
     AES_ctx ctx;
     SetupFATCrypto(&ctx, ctr);
 
-    fseek(CurFile, addr, SEEK_SET);
-    u32 res = fread(buf, len, 1, CurFile);
-    if (!res) return 0;
+    if (!ReadRaw(addr, buf, len)) return 0;
 
-    for (u32 i = 0; i < len; i += 16)
-    {
-        u8 tmp[16];
-        DSi_AES::Swap16(tmp, &buf[i]);
-        AES_CTR_xcrypt_buffer(&ctx, tmp, 16);
-        DSi_AES::Swap16(&buf[i], tmp);
-    }
+    AESCrypt::CTRXcrypt(&ctx, buf, len, true);
 
     return len;
 }
@@ -249,22 +407,14 @@ u32 WriteFATBlock(u64 addr, u32 len, u8* buf)
     AES_ctx ctx;
     SetupFATCrypto(&ctx, ctr);
 
-    fseek(CurFile, addr, SEEK_SET);
-
     for (u32 s = 0; s < len; s += 0x200)
     {
         u8 tempbuf[0x200];
 
-        for (u32 i = 0; i < 0x200; i += 16)
-        {
-            u8 tmp[16];
-            DSi_AES::Swap16(tmp, &buf[s+i]);
-            AES_CTR_xcrypt_buffer(&ctx, tmp, 16);
-            DSi_AES::Swap16(&tempbuf[i], tmp);
-        }
+        memcpy(tempbuf, &buf[s], 0x200);
+        AESCrypt::CTRXcrypt(&ctx, tempbuf, 0x200, true);
 
-        u32 res = fwrite(tempbuf, 0x200, 1, CurFile);
-        if (!res) return 0;
+        if (!WriteRaw(addr+s, tempbuf, 0x200)) return 0;
     }
 
     return len;
@@ -318,18 +468,7 @@ bool ESEncrypt(u8* data, u32 len)
     AES_ECB_encrypt(&ctx, mac);
 
     u32 coarselen = len & ~0xF;
-    for (u32 i = 0; i < coarselen; i += 16)
-    {
-        u8 tmp[16];
-
-        DSi_AES::Swap16(tmp, &data[i]);
-
-        for (int i = 0; i < 16; i++) mac[i] ^= tmp[i];
-        AES_CTR_xcrypt_buffer(&ctx, tmp, 16);
-        AES_ECB_encrypt(&ctx, mac);
-
-        DSi_AES::Swap16(&data[i], tmp);
-    }
+    AESCrypt::CCMEncrypt(&ctx, mac, data, coarselen, true);
 
     u32 remlen = len - coarselen;
     if (remlen)
@@ -405,18 +544,7 @@ bool ESDecrypt(u8* data, u32 len)
     AES_ECB_encrypt(&ctx, mac);
 
     u32 coarselen = len & ~0xF;
-    for (u32 i = 0; i < coarselen; i += 16)
-    {
-        u8 tmp[16];
-
-        DSi_AES::Swap16(tmp, &data[i]);
-
-        AES_CTR_xcrypt_buffer(&ctx, tmp, 16);
-        for (int i = 0; i < 16; i++) mac[i] ^= tmp[i];
-        AES_ECB_encrypt(&ctx, mac);
-
-        DSi_AES::Swap16(&data[i], tmp);
-    }
+    AESCrypt::CCMDecrypt(&ctx, mac, data, coarselen, true);
 
     u32 remlen = len - coarselen;
     if (remlen)
@@ -37,7 +37,9 @@ enum
 bool Init(u8* es_keyY);
 void DeInit();
 
-FILE* GetFile();
+// raw access to the NAND image, bypassing the FAT crypto
+bool ReadRaw(u64 addr, u8* buf, u32 len);
+bool WriteRaw(u64 addr, u8* buf, u32 len);
 
 void GetIDs(u8* emmc_cid, u64& consoleid);
 
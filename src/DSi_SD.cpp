@@ -764,6 +764,14 @@ void DSi_SDHost::CheckSwapFIFO()
     }
 }
 
+void DSi_SDHost::Flush()
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (Ports[i]) Ports[i]->Flush();
+    }
+}
+
 
 #define MMC_DESC  (Internal?"NAND":"SDcard")
 
@@ -772,6 +780,25 @@ DSi_MMCStorage::DSi_MMCStorage(DSi_SDHost* host, bool internal, std::string file
 {
     Internal = internal;
     File = Platform::OpenLocalFile(filename, "r+b");
+    Overlay = nullptr;
+    if (File && OverlayImage::IsOverlay(File))
+    {
+        Overlay = new OverlayImage(File);
+        File = nullptr;
+        if (Overlay->Open())
+            FileCache.SetImage(Overlay);
+        else
+        {
+            printf("%s: failed to open overlay image\n", MMC_DESC);
+            delete Overlay;
+            Overlay = nullptr;
+        }
+    }
+    else if (File)
+    {
+        fseek(File, 0, SEEK_END);
+        FileCache.SetFile(File, ftell(File));
+    }
 
     SD = nullptr;
 
@@ -783,6 +810,7 @@ DSi_MMCStorage::DSi_MMCStorage(DSi_SDHost* host, bool internal, std::string file
 {
     Internal = internal;
     File = nullptr;
+    Overlay = nullptr;
 
     SD = new FATStorage(filename, size, readonly, sourcedir);
     SD->Open();
@@ -797,10 +825,15 @@ DSi_MMCStorage::~DSi_MMCStorage()
         SD->Close();
         delete SD;
     }
+    FileCache.SetFile(nullptr, 0);
     if (File)
     {
         fclose(File);
     }
+    if (Overlay)
+    {
+        delete Overlay;
+    }
 }
 
 void DSi_MMCStorage::Reset()
@@ -924,7 +957,7 @@ void DSi_MMCStorage::SendCMD(u8 cmd, u32 param)
 
     case 12: // stop operation
         SetState(0x04);
-        if (File) fflush(File);
+        Flush();
         RWCommand = 0;
         Host->SendResponse(CSR, true);
         return;
@@ -1041,6 +1074,13 @@ void DSi_MMCStorage::ContinueTransfer()
     RWAddress += len;
 }
 
+bool DSi_MMCStorage::Flush()
+{
+    bool ok = FileCache.Flush();
+    if (SD && !SD->Flush()) ok = false;
+    return ok;
+}
+
 u32 DSi_MMCStorage::ReadBlock(u64 addr)
 {
     u32 len = BlockSize;
@@ -1051,10 +1091,9 @@ u32 DSi_MMCStorage::ReadBlock(u64 addr)
     {
         SD->ReadSectors((u32)(addr >> 9), 1, data);
     }
-    else if (File)
+    else
     {
-        fseek(File, addr, SEEK_SET);
-        fread(&data[addr & 0x1FF], 1, len, File);
+        FileCache.Read(addr >> 9, 1, data);
     }
 
     return Host->DataRX(&data[addr & 0x1FF], len);
@@ -1072,6 +1111,10 @@ u32 DSi_MMCStorage::WriteBlock(u64 addr)
         {
             SD->ReadSectors((u32)(addr >> 9), 1, data);
         }
+        else
+        {
+            FileCache.Read(addr >> 9, 1, data);
+        }
     }
     if ((len = Host->DataTX(&data[addr & 0x1FF], len)))
     {
@@ -1081,10 +1124,9 @@ u32 DSi_MMCStorage::WriteBlock(u64 addr)
             {
                 SD->WriteSectors((u32)(addr >> 9), 1, data);
             }
-            else if (File)
+            else
             {
-                fseek(File, addr, SEEK_SET);
-                fwrite(&data[addr & 0x1FF], 1, len, File);
+                FileCache.Write(addr >> 9, 1, data);
             }
         }
     }
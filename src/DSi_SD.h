@@ -61,6 +61,8 @@ public:
     void UpdateFIFO32();
     void CheckSwapFIFO();
 
+    void Flush();
+
 private:
     u32 Num;
 
@@ -114,6 +116,9 @@ public:
     virtual void SendCMD(u8 cmd, u32 param) = 0;
     virtual void ContinueTransfer() = 0;
 
+    // writes back whatever the device caches
+    virtual bool Flush() { return true; }
+
     bool IRQ;
     bool ReadOnly;
 
@@ -140,9 +145,13 @@ public:
 
     void ContinueTransfer();
 
+    bool Flush();
+
 private:
     bool Internal;
     FILE* File;
+    OverlayImage* Overlay;
+    SectorCache FileCache;
     FATStorage* SD;
 
     u8 CID[16];
@@ -19,7 +19,13 @@
 #include <string.h>
 #include <dirent.h>
 #include <inttypes.h>
+#include <sys/stat.h>
 #include <vector>
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
 
 #include "FATStorage.h"
 #include "Platform.h"
@@ -37,12 +43,99 @@ namespace fs = std::filesystem;
 #endif // __WIN32__
 
 
+// host directories that are known to match their image since the last sync
+//
+// on Linux, synced directories are watched with inotify for as long as the
+// process runs, so that they don't need to be scanned again on the next load
+// (the storage gets recreated on every reset). elsewhere, nothing is tracked
+// and the directory is scanned and compared to the index.
+
+enum
+{
+    Watch_None,
+    Watch_Unchanged,
+    Watch_Changed,
+};
+
+#ifdef __linux__
+static std::map<std::string, int> DirWatchers;
+#endif
+
+static void StopWatching(std::string dir)
+{
+#ifdef __linux__
+    auto it = DirWatchers.find(dir);
+    if (it == DirWatchers.end()) return;
+
+    close(it->second);
+    DirWatchers.erase(it);
+#endif
+}
+
+static void StartWatching(std::string dir)
+{
+#ifdef __linux__
+    StopWatching(dir);
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) return;
+
+    const u32 mask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                     IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+    // inotify isn't recursive, every subdirectory needs its own watch
+    bool ok = inotify_add_watch(fd, dir.c_str(), mask) >= 0;
+
+    std::error_code err;
+    for (auto it = fs::recursive_directory_iterator(fs::u8path(dir), err);
+         ok && !err && it != fs::recursive_directory_iterator();
+         it.increment(err))
+    {
+        if (it->is_directory(err))
+            ok = inotify_add_watch(fd, it->path().c_str(), mask) >= 0;
+    }
+
+    if (!ok || err)
+    {
+        // most likely out of watches, fall back to scanning
+        close(fd);
+        return;
+    }
+
+    DirWatchers[dir] = fd;
+#endif
+}
+
+static int GetWatchState(std::string dir)
+{
+#ifdef __linux__
+    auto it = DirWatchers.find(dir);
+    if (it == DirWatchers.end()) return Watch_None;
+
+    // any pending event means something was changed
+    alignas(struct inotify_event) char buf[4096];
+    ssize_t len = read(it->second, buf, sizeof(buf));
+    if (len < 0 && errno == EAGAIN)
+        return Watch_Unchanged;
+
+    StopWatching(dir);
+    return Watch_Changed;
+#else
+    return Watch_None;
+#endif
+}
+
+
 FATStorage::FATStorage(std::string filename, u64 size, bool readonly, std::string sourcedir)
 {
     ReadOnly = readonly;
-    Load(filename, size, sourcedir);
-
     File = nullptr;
+    Overlay = nullptr;
+
+    Modified = false;
+    HasSyncStamp = false;
+
+    Load(filename, size, sourcedir);
 }
 
 FATStorage::~FATStorage()
@@ -53,29 +146,63 @@ FATStorage::~FATStorage()
 
 bool FATStorage::Open()
 {
-    File = Platform::OpenLocalFile(FilePath.c_str(), "r+b");
+    return OpenImage("r+b");
+}
+
+void FATStorage::Close()
+{
+    CloseImage();
+}
+
+
+bool FATStorage::OpenImage(const char* mode)
+{
+    File = Platform::OpenLocalFile(FilePath.c_str(), mode);
     if (!File)
     {
         return false;
     }
 
+    if (OverlayImage::IsOverlay(File))
+    {
+        Overlay = new OverlayImage(File);
+        File = nullptr;
+        if (!Overlay->Open())
+        {
+            delete Overlay;
+            Overlay = nullptr;
+            return false;
+        }
+
+        // overlays can't be resized
+        FileSize = Overlay->GetSize();
+        Cache.SetImage(Overlay);
+    }
+    else
+        Cache.SetFile(File, FileSize);
+
     return true;
 }
 
-void FATStorage::Close()
+void FATStorage::CloseImage()
 {
+    Cache.SetFile(nullptr, 0);
+
     if (File) fclose(File);
     File = nullptr;
+
+    if (Overlay) delete Overlay;
+    Overlay = nullptr;
 }
 
 
 bool FATStorage::InjectFile(std::string path, u8* data, u32 len)
 {
-    if (!File) return false;
-    if (FF_File) return false;
+    if (!File && !Overlay) return false;
+    if (FF_Cache) return false;
 
-    FF_File = File;
-    FF_FileSize = FileSize;
+    Modified = true;
+    FF_Cache = &Cache;
     ff_disk_open(FF_ReadStorage, FF_WriteStorage, (LBA_t)(FileSize>>9));
 
     FRESULT res;
@@ -85,7 +212,7 @@ bool FATStorage::InjectFile(std::string path, u8* data, u32 len)
     if (res != FR_OK)
     {
         ff_disk_close();
-        FF_File = nullptr;
+        FF_Cache = nullptr;
         return false;
     }
 
@@ -96,7 +223,7 @@ bool FATStorage::InjectFile(std::string path, u8* data, u32 len)
     {
         f_unmount("0:");
         ff_disk_close();
-        FF_File = nullptr;
+        FF_Cache = nullptr;
         return false;
     }
 
@@ -106,84 +233,39 @@ bool FATStorage::InjectFile(std::string path, u8* data, u32 len)
 
     f_unmount("0:");
     ff_disk_close();
-    FF_File = nullptr;
+    FF_Cache = nullptr;
     return nwrite==len;
 }
 
 
 u32 FATStorage::ReadSectors(u32 start, u32 num, u8* data)
 {
-    return ReadSectorsInternal(File, FileSize, start, num, data);
+    return Cache.Read(start, num, data);
 }
 
 u32 FATStorage::WriteSectors(u32 start, u32 num, u8* data)
 {
     if (ReadOnly) return 0;
-    return WriteSectorsInternal(File, FileSize, start, num, data);
+    Modified = true;
+    return Cache.Write(start, num, data);
 }
 
-
-FILE* FATStorage::FF_File;
-u64 FATStorage::FF_FileSize;
-
-UINT FATStorage::FF_ReadStorage(BYTE* buf, LBA_t sector, UINT num)
+bool FATStorage::Flush()
 {
-    return ReadSectorsInternal(FF_File, FF_FileSize, sector, num, buf);
+    return Cache.Flush();
 }
 
-UINT FATStorage::FF_WriteStorage(BYTE* buf, LBA_t sector, UINT num)
-{
-    return WriteSectorsInternal(FF_File, FF_FileSize, sector, num, buf);
-}
 
+SectorCache* FATStorage::FF_Cache;
 
-u32 FATStorage::ReadSectorsInternal(FILE* file, u64 filelen, u32 start, u32 num, u8* data)
+UINT FATStorage::FF_ReadStorage(BYTE* buf, LBA_t sector, UINT num)
 {
-    if (!file) return 0;
-
-    u64 addr = start * 0x200ULL;
-    u32 len = num * 0x200;
-
-    if ((addr+len) > filelen)
-    {
-        if (addr >= filelen) return 0;
-        len = filelen - addr;
-        num = len >> 9;
-    }
-
-    melon_fseek(file, addr, SEEK_SET);
-
-    u32 res = fread(data, 0x200, num, file);
-    if (res < num)
-    {
-        if (feof(file))
-        {
-            memset(&data[0x200*res], 0, 0x200*(num-res));
-            return num;
-        }
-    }
-
-    return res;
+    return FF_Cache->Read(sector, num, buf);
 }
 
-u32 FATStorage::WriteSectorsInternal(FILE* file, u64 filelen, u32 start, u32 num, u8* data)
+UINT FATStorage::FF_WriteStorage(BYTE* buf, LBA_t sector, UINT num)
 {
-    if (!file) return 0;
-
-    u64 addr = start * 0x200ULL;
-    u32 len = num * 0x200;
-
-    if ((addr+len) > filelen)
-    {
-        if (addr >= filelen) return 0;
-        len = filelen - addr;
-        num = len >> 9;
-    }
-
-    melon_fseek(file, addr, SEEK_SET);
-
-    u32 res = fwrite(data, 0x200, num, file);
-    return res;
+    return FF_Cache->Write(sector, num, buf);
 }
 
 
@@ -191,6 +273,7 @@ void FATStorage::LoadIndex()
 {
     DirIndex.clear();
     FileIndex.clear();
+    HasSyncStamp = false;
 
     FILE* f = Platform::OpenLocalFile(IndexPath.c_str(), "r");
     if (!f) return;
@@ -204,10 +287,17 @@ void FATStorage::LoadIndex()
         if (linebuf[0] == 'S')
         {
             u64 fsize;
-            int ret = sscanf(linebuf, "SIZE %" PRIu64, &fsize);
-            if (ret < 1) continue;
-
-            FileSize = fsize;
+            s64 ftime;
+            if (sscanf(linebuf, "SIZE %" PRIu64, &fsize) == 1)
+            {
+                FileSize = fsize;
+            }
+            else if (sscanf(linebuf, "SYNC %" PRIu64 " %" PRId64, &fsize, &ftime) == 2)
+            {
+                HasSyncStamp = true;
+                SyncImageSize = fsize;
+                SyncImageTime = ftime;
+            }
         }
         else if (linebuf[0] == 'D')
         {
@@ -329,6 +419,9 @@ void FATStorage::SaveIndex()
 
     fprintf(f, "SIZE %" PRIu64 "\r\n", FileSize);
 
+    if (HasSyncStamp)
+        fprintf(f, "SYNC %" PRIu64 " %" PRId64 "\r\n", SyncImageSize, SyncImageTime);
+
     for (const auto& [key, val] : DirIndex)
     {
         fprintf(f, "DIR %u %s\r\n",
@@ -345,6 +438,100 @@ void FATStorage::SaveIndex()
 }
 
 
+bool FATStorage::GetImageStamp(u64& size, s64& time)
+{
+    // the image path can be relative to the emulator directory,
+    // so go through Platform to find it
+    FILE* f = Platform::OpenLocalFile(FilePath.c_str(), "rb");
+    if (!f) return false;
+
+#ifdef __WIN32__
+    struct _stat64 st;
+    int res = _fstat64(_fileno(f), &st);
+#else
+    struct stat st;
+    int res = fstat(fileno(f), &st);
+#endif
+    fclose(f);
+    if (res != 0) return false;
+
+    size = st.st_size;
+#ifdef __linux__
+    time = ((s64)st.st_mtim.tv_sec * 1000000000) + st.st_mtim.tv_nsec;
+#else
+    time = st.st_mtime;
+#endif
+    return true;
+}
+
+void FATStorage::UpdateSyncStamp()
+{
+    HasSyncStamp = GetImageStamp(SyncImageSize, SyncImageTime);
+    SaveIndex();
+}
+
+bool FATStorage::IsImageUnchanged()
+{
+    if (!HasSyncStamp) return false;
+
+    u64 size;
+    s64 time;
+    if (!GetImageStamp(size, time)) return false;
+
+    return (size == SyncImageSize) && (time == SyncImageTime);
+}
+
+bool FATStorage::IsDirectoryUnchanged(std::string sourcedir)
+{
+    // same checks as ImportDirectory(), without touching the image
+    int srclen = sourcedir.length();
+    u32 numdirs = 0, numfiles = 0;
+
+    std::error_code err;
+    for (auto it = fs::recursive_directory_iterator(fs::u8path(sourcedir), err);
+         !err && it != fs::recursive_directory_iterator();
+         it.increment(err))
+    {
+        auto& entry = *it;
+
+        std::string innerpath = entry.path().u8string().substr(srclen);
+        if (innerpath[0] == '/' || innerpath[0] == '\\')
+            innerpath = innerpath.substr(1);
+
+        int ilen = innerpath.length();
+        for (int i = 0; i < ilen; i++)
+        {
+            if (innerpath[i] == '\\')
+                innerpath[i] = '/';
+        }
+
+        if (entry.is_directory())
+        {
+            if (DirIndex.count(innerpath) < 1) return false;
+
+            numdirs++;
+        }
+        else if (entry.is_regular_file())
+        {
+            auto file = FileIndex.find(innerpath);
+            if (file == FileIndex.end()) return false;
+            if (file->second.Size != entry.file_size()) return false;
+
+            auto lastmodified = entry.last_write_time();
+            s64 lastmodified_raw = std::chrono::duration_cast<std::chrono::seconds>(lastmodified.time_since_epoch()).count();
+            if (file->second.LastModified != lastmodified_raw) return false;
+
+            numfiles++;
+        }
+    }
+
+    if (err) return false;
+
+    // anything left in the index was deleted
+    return (numdirs == DirIndex.size()) && (numfiles == FileIndex.size());
+}
+
+
 bool FATStorage::ExportFile(std::string path, fs::path out)
 {
     FF_FIL file;
@@ -831,6 +1018,7 @@ bool FATStorage::ImportDirectory(std::string sourcedir)
     CleanupDirectory(sourcedir, "", 0);
 
     int srclen = sourcedir.length();
+    bool ret = true;
 
     // iterate through the host directory:
     // * directories will be added if they aren't in the index
@@ -865,6 +1053,8 @@ bool FATStorage::ImportDirectory(std::string sourcedir)
                 {
                     DirIndex[ientry.Path] = ientry;
                 }
+                else
+                    ret = false;
             }
         }
         else if (entry.is_regular_file())
@@ -904,6 +1094,8 @@ bool FATStorage::ImportDirectory(std::string sourcedir)
 
                     FileIndex[ientry.Path] = ientry;
                 }
+                else
+                    ret = false;
             }
         }
 
@@ -912,7 +1104,7 @@ bool FATStorage::ImportDirectory(std::string sourcedir)
 
     SaveIndex();
 
-    return true;
+    return ret;
 }
 
 u64 FATStorage::GetDirectorySize(fs::path sourcedir)
@@ -961,11 +1153,16 @@ bool FATStorage::Load(std::string filename, u64 size, std::string sourcedir)
     //   with a minimum 128MB extra, otherwise size is defaulted to 512MB
 
     bool isnew = false;
-    FF_File = Platform::OpenLocalFile(filename.c_str(), "r+b");
-    if (!FF_File)
+    FILE* f = Platform::OpenLocalFile(filename.c_str(), "rb");
+    if (f)
+    {
+        fclose(f);
+        if (!OpenImage("r+b"))
+            return false;
+    }
+    else
     {
-        FF_File = Platform::OpenLocalFile(filename.c_str(), "w+b");
-        if (!FF_File)
+        if (!OpenImage("w+b"))
             return false;
 
         isnew = true;
@@ -982,10 +1179,11 @@ bool FATStorage::Load(std::string filename, u64 size, std::string sourcedir)
     {
         LoadIndex();
 
-        if (FileSize == 0)
+        if (FileSize == 0 && File)
         {
-            melon_fseek(FF_File, 0, SEEK_END);
-            FileSize = melon_ftell(FF_File);
+            melon_fseek(File, 0, SEEK_END);
+            FileSize = melon_ftell(File);
+            Cache.SetFile(File, FileSize);
         }
     }
 
@@ -999,15 +1197,15 @@ bool FATStorage::Load(std::string filename, u64 size, std::string sourcedir)
     }
     else
     {
-        FF_FileSize = FileSize;
-        ff_disk_open(FF_ReadStorage, FF_WriteStorage, (LBA_t)(FF_FileSize>>9));
+        FF_Cache = &Cache;
+        ff_disk_open(FF_ReadStorage, FF_WriteStorage, (LBA_t)(FileSize>>9));
 
         res = f_mount(&fs, "0:", 1);
         if (res != FR_OK)
         {
             needformat = true;
         }
-        else if (size > 0 && size != FileSize)
+        else if (size > 0 && size != FileSize && !Overlay)
         {
             needformat = true;
         }
@@ -1015,7 +1213,7 @@ bool FATStorage::Load(std::string filename, u64 size, std::string sourcedir)
 
     if (needformat)
     {
-        FileSize = size;
+        if (!Overlay) FileSize = size;
         if (FileSize == 0)
         {
             if (hasdir)
@@ -1036,9 +1234,11 @@ bool FATStorage::Load(std::string filename, u64 size, std::string sourcedir)
                 FileSize = 0x20000000ULL; // 512MB
         }
 
-        FF_FileSize = FileSize;
+        if (File) Cache.SetFile(File, FileSize);
+
+        FF_Cache = &Cache;
         ff_disk_close();
-        ff_disk_open(FF_ReadStorage, FF_WriteStorage, (LBA_t)(FF_FileSize>>9));
+        ff_disk_open(FF_ReadStorage, FF_WriteStorage, (LBA_t)(FileSize>>9));
 
         DirIndex.clear();
         FileIndex.clear();
@@ -1066,18 +1266,48 @@ bool FATStorage::Load(std::string filename, u64 size, std::string sourcedir)
             res = f_mount(&fs, "0:", 1);
     }
 
-    if (res == FR_OK)
+    // the import can be skipped when neither the image nor the host directory
+    // were changed since they were last synced
+    bool synced = false;
+    bool imported = false;
+    if (res == FR_OK && hasdir)
     {
-        if (hasdir)
-            ImportDirectory(sourcedir);
+        // start watching before scanning or importing, so that changes made meanwhile aren't missed
+        int watch = GetWatchState(sourcedir);
+        if (watch != Watch_Unchanged)
+            StartWatching(sourcedir);
+
+        if (!needformat && IsImageUnchanged() &&
+            (watch == Watch_Unchanged || (watch == Watch_None && IsDirectoryUnchanged(sourcedir))))
+        {
+            synced = true;
+        }
+        else
+        {
+            synced = ImportDirectory(sourcedir);
+            imported = true;
+        }
     }
 
     f_unmount("0:");
 
     ff_disk_close();
-    fclose(FF_File);
-    FF_File = nullptr;
+    FF_Cache = nullptr;
+    CloseImage();
+
+    if (hasdir)
+    {
+        if (!synced)
+        {
+            StopWatching(sourcedir);
+            HasSyncStamp = false;
+            SaveIndex();
+        }
+        else if (imported)
+            UpdateSyncStamp();
+    }
 
+    Modified = false;
     return true;
 }
 
@@ -1088,13 +1318,22 @@ bool FATStorage::Save()
         return true;
     }
 
-    FF_File = Platform::OpenLocalFile(FilePath.c_str(), "r+b");
-    if (!FF_File)
+    // nothing to export if the emulated side never wrote to the image
+    if (!Modified)
+    {
+        return true;
+    }
+
+    // the export itself changes the host directory, so it can only be considered
+    // unchanged afterwards if it already was before
+    bool watched = GetWatchState(SourceDir) == Watch_Unchanged;
+
+    if (!OpenImage("r+b"))
     {
         return false;
     }
 
-    FF_FileSize = FileSize;
+    FF_Cache = &Cache;
     ff_disk_open(FF_ReadStorage, FF_WriteStorage, (LBA_t)(FileSize>>9));
 
     FRESULT res;
@@ -1104,20 +1343,26 @@ bool FATStorage::Save()
     if (res != FR_OK)
     {
         ff_disk_close();
-        fclose(FF_File);
-        FF_File = nullptr;
+        FF_Cache = nullptr;
+        CloseImage();
         return false;
     }
 
     ExportChanges(SourceDir);
 
-    SaveIndex();
-
     f_unmount("0:");
 
     ff_disk_close();
-    fclose(FF_File);
-    FF_File = nullptr;
+    FF_Cache = nullptr;
+    CloseImage();
+
+    if (watched)
+        StartWatching(SourceDir);
+    else
+        StopWatching(SourceDir);
+
+    UpdateSyncStamp();
+    Modified = false;
 
     return true;
 }
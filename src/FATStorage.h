@@ -25,6 +25,7 @@
 #include <filesystem>
 
 #include "types.h"
+#include "SectorCache.h"
 #include "fatfs/ff.h"
 
 
@@ -41,6 +42,9 @@ public:
 
     u32 ReadSectors(u32 start, u32 num, u8* data);
     u32 WriteSectors(u32 start, u32 num, u8* data);
+    bool Flush();
+
+    const SectorCache& GetCache() { return Cache; }
 
 private:
     std::string FilePath;
@@ -48,20 +52,35 @@ private:
     std::string SourceDir;
     bool ReadOnly;
 
+    // whether the image was written to since it was last synced with SourceDir
+    bool Modified;
+
+    // size and modification time of the image file when it was last synced
+    bool HasSyncStamp;
+    u64 SyncImageSize;
+    s64 SyncImageTime;
+
     FILE* File;
+    OverlayImage* Overlay;
     u64 FileSize;
+    SectorCache Cache;
 
-    static FILE* FF_File;
-    static u64 FF_FileSize;
+    bool OpenImage(const char* mode);
+    void CloseImage();
+
+    // fatfs accesses go through the cache of the storage being worked on
+    static SectorCache* FF_Cache;
     static UINT FF_ReadStorage(BYTE* buf, LBA_t sector, UINT num);
     static UINT FF_WriteStorage(BYTE* buf, LBA_t sector, UINT num);
 
-    static u32 ReadSectorsInternal(FILE* file, u64 filelen, u32 start, u32 num, u8* data);
-    static u32 WriteSectorsInternal(FILE* file, u64 filelen, u32 start, u32 num, u8* data);
-
     void LoadIndex();
     void SaveIndex();
 
+    bool GetImageStamp(u64& size, s64& time);
+    void UpdateSyncStamp();
+    bool IsImageUnchanged();
+    bool IsDirectoryUnchanged(std::string sourcedir);
+
     bool ExportFile(std::string path, std::filesystem::path out);
     void ExportDirectory(std::string path, std::string outbase, int level);
     bool DeleteHostDirectory(std::string path, std::string outbase, int level);
@@ -48,6 +48,7 @@
 FileSavestate::FileSavestate(std::string filename, bool save)
 {
     Error = false;
+    Snapshot = false;
 
     if (save)
     {
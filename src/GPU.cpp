@@ -40,6 +40,9 @@ u16 TotalScanlines;
 
 bool RunFIFO;
 
+bool RenderSkip;
+bool FrameSkipped;
+
 u16 DispStat[2], VMatch[2];
 
 u8 Palette[2*1024];
@@ -249,6 +252,8 @@ void Reset()
     memset(VRAMPtr_BBG, 0, sizeof(VRAMPtr_BBG));
     memset(VRAMPtr_BOBJ, 0, sizeof(VRAMPtr_BOBJ));
 
+    NDS::UpdateVRAMPages();
+
     size_t fbsize;
     if (GPU3D::CurrentRenderer->Accelerated)
         fbsize = (256*3 + 1) * 192;
@@ -279,6 +284,8 @@ void Reset()
 
     OAMDirty = 0x3;
     PaletteDirty = 0xF;
+
+    FrameSkipped = false;
 }
 
 void Stop()
@@ -359,6 +366,8 @@ void DoSavestate(Savestate* file)
             VRAMPtr_BBG[i] = GetUniqueBankPtr(VRAMMap_BBG[i], i << 14);
         for (int i = 0; i < 0x8; i++)
             VRAMPtr_BOBJ[i] = GetUniqueBankPtr(VRAMMap_BOBJ[i], i << 14);
+
+        NDS::UpdateVRAMPages();
     }
 
     GPU2D_A.DoSavestate(file);
@@ -483,6 +492,8 @@ void SetRenderSettings(int renderer, RenderSettings& settings)
         GPU3D::CurrentRenderer->SetRenderSettings(settings);
     }
 #endif
+
+    GPU3D::SetThreadedGeometry(settings.ThreadedGeometry);
 }
 
 
@@ -589,6 +600,8 @@ void MapVRAM_AB(u32 bank, u8 cnt)
             break;
         }
     }
+
+    NDS::UpdateVRAMPages();
 }
 
 void MapVRAM_CD(u32 bank, u8 cnt)
@@ -678,6 +691,8 @@ void MapVRAM_CD(u32 bank, u8 cnt)
             break;
         }
     }
+
+    NDS::UpdateVRAMPages();
 }
 
 void MapVRAM_E(u32 bank, u8 cnt)
@@ -742,6 +757,8 @@ void MapVRAM_E(u32 bank, u8 cnt)
             break;
         }
     }
+
+    NDS::UpdateVRAMPages();
 }
 
 void MapVRAM_FG(u32 bank, u8 cnt)
@@ -842,6 +859,8 @@ void MapVRAM_FG(u32 bank, u8 cnt)
             break;
         }
     }
+
+    NDS::UpdateVRAMPages();
 }
 
 void MapVRAM_H(u32 bank, u8 cnt)
@@ -904,6 +923,8 @@ void MapVRAM_H(u32 bank, u8 cnt)
             break;
         }
     }
+
+    NDS::UpdateVRAMPages();
 }
 
 void MapVRAM_I(u32 bank, u8 cnt)
@@ -974,6 +995,8 @@ void MapVRAM_I(u32 bank, u8 cnt)
             break;
         }
     }
+
+    NDS::UpdateVRAMPages();
 }
 
 
@@ -1020,6 +1043,16 @@ void DisplayFIFO(u32 x)
         GPU2D_A.SampleFIFO(253, 3); // sample the remaining pixels
 }
 
+void SetRenderSkip(bool skip)
+{
+    RenderSkip = skip;
+}
+
+bool CaptureEnabled()
+{
+    return GPU2D_A.CaptureCnt & (1<<31);
+}
+
 void StartFrame()
 {
     // only run the display FIFO if needed:
@@ -1038,26 +1071,42 @@ void StartHBlank(u32 line)
 
     if (VCount < 192)
     {
-        // draw
-        // note: this should start 48 cycles after the scanline start
-        if (line < 192)
+        if (line == 0 && FrameSkipped && CaptureEnabled())
         {
-            GPU2D_Renderer->DrawScanline(line, &GPU2D_A);
-            GPU2D_Renderer->DrawScanline(line, &GPU2D_B);
+            // capture was enabled after the start of the frame, we need to draw it after all
+            FrameSkipped = false;
+            GPU3D::RenderPendingFrame();
         }
 
-        // sprites are pre-rendered one scanline in advance
-        if (line < 191)
+        if (!FrameSkipped)
         {
-            GPU2D_Renderer->DrawSprites(line+1, &GPU2D_A);
-            GPU2D_Renderer->DrawSprites(line+1, &GPU2D_B);
+            // draw
+            // note: this should start 48 cycles after the scanline start
+            if (line < 192)
+            {
+                GPU2D_Renderer->DrawScanline(line, &GPU2D_A);
+                GPU2D_Renderer->DrawScanline(line, &GPU2D_B);
+            }
+
+            // sprites are pre-rendered one scanline in advance
+            if (line < 191)
+            {
+                GPU2D_Renderer->DrawSprites(line+1, &GPU2D_A);
+                GPU2D_Renderer->DrawSprites(line+1, &GPU2D_B);
+            }
         }
 
         NDS::CheckDMAs(0, 0x02);
     }
     else if (VCount == 215)
     {
-        GPU3D::VCount215();
+        // the 3D frame rendered now is displayed during the next frame
+        // if that one is going to be skipped too, rendering is postponed
+        // until it's known whether capture needs it
+        if (RenderSkip && !CaptureEnabled())
+            GPU3D::SkipFrame();
+        else
+            GPU3D::VCount215();
     }
     else if (VCount == 262)
     {
@@ -1132,6 +1181,12 @@ void StartScanline(u32 line)
     {
         if (line == 0)
         {
+            // in render-skip mode, the frame is only drawn if display capture needs it
+            // this also requires its 3D frame to not have been started already
+            FrameSkipped = RenderSkip && GPU3D::RenderFramePending && !CaptureEnabled();
+            if (!FrameSkipped)
+                GPU3D::RenderPendingFrame();
+
             GPU2D_Renderer->VBlankEnd(&GPU2D_A, &GPU2D_B);
             GPU2D_A.VBlankEnd();
             GPU2D_B.VBlankEnd();
@@ -1178,7 +1233,7 @@ void StartScanline(u32 line)
 
 #ifdef OGLRENDERER_ENABLED
             // Need a better way to identify the openGL renderer in particular
-            if (GPU3D::CurrentRenderer->Accelerated)
+            if (GPU3D::CurrentRenderer->Accelerated && !FrameSkipped)
                 CurGLCompositor->RenderFrame();
 #endif
         }
@@ -75,6 +75,8 @@ extern u8* VRAMPtr_BOBJ[0x8];
 extern int FrontBuffer;
 extern u32* Framebuffer[2][2];
 
+extern bool FrameSkipped;
+
 extern GPU2D::Unit GPU2D_A;
 extern GPU2D::Unit GPU2D_B;
 
@@ -157,6 +159,7 @@ extern std::unique_ptr<GLCompositor> CurGLCompositor;
 struct RenderSettings
 {
     bool Soft_Threaded;
+    bool ThreadedGeometry = false; // not every frontend sets this one
 
     int GL_ScaleFactor;
     bool GL_BetterPolygons;
@@ -605,6 +608,12 @@ void WriteOAM(u32 addr, T val)
 
 void SetPowerCnt(u32 val);
 
+// render-skip mode: frames aren't drawn, unless the emulated
+// system depends on the output (display capture)
+// FrameSkipped tells whether the last frame was skipped
+void SetRenderSkip(bool skip);
+bool CaptureEnabled();
+
 void StartFrame();
 void FinishFrame(u32 lines);
 void StartScanline(u32 line);
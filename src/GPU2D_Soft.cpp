@@ -175,6 +175,7 @@ void SoftRenderer::DrawScanline(u32 line, Unit* unit)
     {
         auto bgDirty = GPU::VRAMDirty_ABG.DeriveState(GPU::VRAMMap_ABG);
         GPU::MakeVRAMFlat_ABGCoherent(bgDirty);
+        BGTileCache_A.Invalidate(bgDirty);
         auto bgExtPalDirty = GPU::VRAMDirty_ABGExtPal.DeriveState(GPU::VRAMMap_ABGExtPal);
         GPU::MakeVRAMFlat_ABGExtPalCoherent(bgExtPalDirty);
         auto objExtPalDirty = GPU::VRAMDirty_AOBJExtPal.DeriveState(&GPU::VRAMMap_AOBJExtPal);
@@ -184,6 +185,7 @@ void SoftRenderer::DrawScanline(u32 line, Unit* unit)
     {
         auto bgDirty = GPU::VRAMDirty_BBG.DeriveState(GPU::VRAMMap_BBG);
         GPU::MakeVRAMFlat_BBGCoherent(bgDirty);
+        BGTileCache_B.Invalidate(bgDirty);
         auto bgExtPalDirty = GPU::VRAMDirty_BBGExtPal.DeriveState(GPU::VRAMMap_BBGExtPal);
         GPU::MakeVRAMFlat_BBGExtPalCoherent(bgExtPalDirty);
         auto objExtPalDirty = GPU::VRAMDirty_BOBJExtPal.DeriveState(&GPU::VRAMMap_BOBJExtPal);
@@ -1019,114 +1021,70 @@ void SoftRenderer::DrawBG_Text(u32 line, u32 bgnum)
 
     u16 curtile;
     u16* curpal;
-    u32 pixelsaddr;
+    u64 currow;
     u8 color;
     u32 lastxpos;
 
-    if (bgcnt & 0x0080)
+    // rows are fetched as one byte per pixel and pre-flipped horizontally,
+    // so the inner loop only has to shift out the right byte
+    auto loadRow = [&](u32 xpos)
     {
-        // 256-color
+        curtile = *(u16*)&bgvram[(tilemapaddr + ((xpos & 0xF8) >> 2) + ((xpos & widexmask) << 3)) & bgvrammask];
 
-        // preload shit as needed
-        if ((xoff & 0x7) || mosaic)
+        u32 tiley = (curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7);
+        if (bgcnt & 0x0080)
         {
-            curtile = *(u16*)&bgvram[(tilemapaddr + ((xoff & 0xF8) >> 2) + ((xoff & widexmask) << 3)) & bgvrammask];
-
+            // 256-color
             if (extpal) curpal = CurUnit->GetBGExtPal(extpalslot, curtile>>12);
             else        curpal = pal;
 
-            pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 6)
-                                     + (((curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7)) << 3);
+            currow = *(u64*)&bgvram[(tilesetaddr + ((curtile & 0x03FF) << 6) + (tiley << 3)) & bgvrammask];
         }
-
-        if (mosaic) lastxpos = xoff;
-
-        for (int i = 0; i < 256; i++)
+        else
         {
-            u32 xpos;
-            if (mosaic) xpos = xoff - CurBGXMosaicTable[i];
-            else        xpos = xoff;
-
-            if ((!mosaic && (!(xpos & 0x7))) ||
-                (mosaic && ((xpos >> 3) != (lastxpos >> 3))))
-            {
-                // load a new tile
-                curtile = *(u16*)&bgvram[(tilemapaddr + ((xpos & 0xF8) >> 2) + ((xpos & widexmask) << 3)) & bgvrammask];
+            // 16-color
+            curpal = pal + ((curtile & 0xF000) >> 8);
 
-                if (extpal) curpal = CurUnit->GetBGExtPal(extpalslot, curtile>>12);
-                else        curpal = pal;
+            u32 rowaddr = tilesetaddr + ((curtile & 0x03FF) << 5) + (tiley << 2);
+            if (CurUnit->Num) currow = BGTileCache_B.GetRow4bpp(bgvram, rowaddr);
+            else              currow = BGTileCache_A.GetRow4bpp(bgvram, rowaddr);
+        }
 
-                pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 6)
-                                         + (((curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7)) << 3);
+        if (curtile & 0x0400)
+            currow = __builtin_bswap64(currow);
+    };
 
-                if (mosaic) lastxpos = xpos;
-            }
+    // preload shit as needed
+    if ((xoff & 0x7) || mosaic)
+        loadRow(xoff);
 
-            // draw pixel
-            if (WindowMask[i] & (1<<bgnum))
-            {
-                u32 tilexoff = (curtile & 0x0400) ? (7-(xpos&0x7)) : (xpos&0x7);
-                color = bgvram[(pixelsaddr + tilexoff) & bgvrammask];
+    if (mosaic) lastxpos = xoff;
 
-                if (color)
-                    drawPixel(&BGOBJLine[i], curpal[color], 0x01000000<<bgnum);
-            }
-
-            xoff++;
-        }
-    }
-    else
+    for (int i = 0; i < 256; i++)
     {
-        // 16-color
+        u32 xpos;
+        if (mosaic) xpos = xoff - CurBGXMosaicTable[i];
+        else        xpos = xoff;
 
-        // preload shit as needed
-        if ((xoff & 0x7) || mosaic)
+        if ((!mosaic && (!(xpos & 0x7))) ||
+            (mosaic && ((xpos >> 3) != (lastxpos >> 3))))
         {
-            curtile = *(u16*)&bgvram[((tilemapaddr + ((xoff & 0xF8) >> 2) + ((xoff & widexmask) << 3))) & bgvrammask];
-            curpal = pal + ((curtile & 0xF000) >> 8);
-            pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 5)
-                                     + (((curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7)) << 2);
-        }
+            // load a new tile
+            loadRow(xpos);
 
-        if (mosaic) lastxpos = xoff;
+            if (mosaic) lastxpos = xpos;
+        }
 
-        for (int i = 0; i < 256; i++)
+        // draw pixel
+        if (WindowMask[i] & (1<<bgnum))
         {
-            u32 xpos;
-            if (mosaic) xpos = xoff - CurBGXMosaicTable[i];
-            else        xpos = xoff;
-
-            if ((!mosaic && (!(xpos & 0x7))) ||
-                (mosaic && ((xpos >> 3) != (lastxpos >> 3))))
-            {
-                // load a new tile
-                curtile = *(u16*)&bgvram[(tilemapaddr + ((xpos & 0xF8) >> 2) + ((xpos & widexmask) << 3)) & bgvrammask];
-                curpal = pal + ((curtile & 0xF000) >> 8);
-                pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 5)
-                                         + (((curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7)) << 2);
+            color = currow >> ((xpos & 0x7) << 3);
 
-                if (mosaic) lastxpos = xpos;
-            }
-
-            // draw pixel
-            if (WindowMask[i] & (1<<bgnum))
-            {
-                u32 tilexoff = (curtile & 0x0400) ? (7-(xpos&0x7)) : (xpos&0x7);
-                if (tilexoff & 0x1)
-                {
-                    color = bgvram[(pixelsaddr + (tilexoff >> 1)) & bgvrammask] >> 4;
-                }
-                else
-                {
-                    color = bgvram[(pixelsaddr + (tilexoff >> 1)) & bgvrammask] & 0x0F;
-                }
-
-                if (color)
-                    drawPixel(&BGOBJLine[i], curpal[color], 0x01000000<<bgnum);
-            }
-
-            xoff++;
+            if (color)
+                drawPixel(&BGOBJLine[i], curpal[color], 0x01000000<<bgnum);
         }
+
+        xoff++;
     }
 }
 
@@ -1662,11 +1620,13 @@ void SoftRenderer::DrawSprites(u32 line, Unit* unit)
     {
         auto objDirty = GPU::VRAMDirty_AOBJ.DeriveState(GPU::VRAMMap_AOBJ);
         GPU::MakeVRAMFlat_AOBJCoherent(objDirty);
+        OBJTileCache_A.Invalidate(objDirty);
     }
     else
     {
         auto objDirty = GPU::VRAMDirty_BOBJ.DeriveState(GPU::VRAMMap_BOBJ);
         GPU::MakeVRAMFlat_BOBJCoherent(objDirty);
+        OBJTileCache_B.Invalidate(objDirty);
     }
 
     NumSprites[CurUnit->Num] = 0;
@@ -2190,7 +2150,6 @@ void SoftRenderer::DrawSprite_Normal(u32 num, u32 width, u32 height, s32 xpos, s
             // 16-color
             pixelsaddr <<= 5;
             pixelsaddr += ((ypos & 0x7) << 2);
-            s32 pixelstride;
 
             if (!window)
             {
@@ -2198,37 +2157,28 @@ void SoftRenderer::DrawSprite_Normal(u32 num, u32 width, u32 height, s32 xpos, s
                 pixelattr |= ((attrib[2] & 0xF000) >> 8);
             }
 
-            // TODO: optimize VRAM access!!
-            // TODO: do xflip better? the 'two pixels per byte' thing makes it a bit shitty
-
-            if (attrib[1] & 0x1000) // xflip
-            {
-                pixelsaddr += (((width-1) & wmask) << 2);
-                pixelsaddr += (((width-1) & 0x7) >> 1);
-                pixelsaddr -= ((xoff & wmask) << 2);
-                pixelsaddr -= ((xoff & 0x7) >> 1);
-                pixelstride = -1;
-            }
-            else
-            {
-                pixelsaddr += ((xoff & wmask) << 2);
-                pixelsaddr += ((xoff & 0x7) >> 1);
-                pixelstride = 1;
-            }
+            // tile rows come from the decode cache, one byte per pixel
+            // xflip is handled by flipping the whole row when it is loaded
+            bool xflip = attrib[1] & 0x1000;
+            u64 currow = 0;
+            bool loadrow = true;
 
             for (; xoff < xend;)
             {
-                if (attrib[1] & 0x1000)
-                {
-                    if (xoff & 0x1) { color = objvram[pixelsaddr & objvrammask] & 0x0F; pixelsaddr--; }
-                    else              color = objvram[pixelsaddr & objvrammask] >> 4;
-                }
-                else
+                if (loadrow || !(xoff & 0x7))
                 {
-                    if (xoff & 0x1) { color = objvram[pixelsaddr & objvrammask] >> 4; pixelsaddr++; }
-                    else              color = objvram[pixelsaddr & objvrammask] & 0x0F;
+                    u32 tilex = xflip ? ((width-1-xoff) >> 3) : (xoff >> 3);
+                    u32 rowaddr = pixelsaddr + (tilex << 5);
+
+                    if (CurUnit->Num) currow = OBJTileCache_B.GetRow4bpp(objvram, rowaddr);
+                    else              currow = OBJTileCache_A.GetRow4bpp(objvram, rowaddr);
+
+                    if (xflip) currow = __builtin_bswap64(currow);
+                    loadrow = false;
                 }
 
+                color = (currow >> ((xoff & 0x7) << 3)) & 0xFF;
+
                 if (color)
                 {
                     if (window) objWindow[xpos] = 1;
@@ -2245,7 +2195,6 @@ void SoftRenderer::DrawSprite_Normal(u32 num, u32 width, u32 height, s32 xpos, s
 
                 xoff++;
                 xpos++;
-                if (!(xoff & 0x7)) pixelsaddr += ((attrib[1] & 0x1000) ? -28 : 28);
             }
         }
     }
@@ -19,6 +19,7 @@
 #pragma once
 
 #include "GPU2D.h"
+#include "GPU.h"
 
 namespace GPU2D
 {
@@ -33,6 +34,52 @@ public:
     void DrawSprites(u32 line, Unit* unit) override;
     void VBlankEnd(Unit* unitA, Unit* unitB) override;
 private:
+    // 4bpp tile rows expanded to one byte per pixel, so that drawing
+    // doesn't have to pick nibbles apart for every pixel
+    // rows are decoded on demand, a whole VRAM dirty block at a time,
+    // and stay valid until that block gets marked dirty again
+    template <u32 Size>
+    struct TileRowCache
+    {
+        u64 Rows[Size / 4];
+        NonStupidBitField<Size/GPU::VRAMDirtyGranularity> Valid;
+
+        void Invalidate(NonStupidBitField<Size/GPU::VRAMDirtyGranularity>& dirty)
+        {
+            for (u32 i = 0; i < Valid.DataLength; i++)
+                Valid.Data[i] &= ~dirty.Data[i];
+        }
+
+        u64 GetRow4bpp(u8* vram, u32 addr)
+        {
+            addr &= (Size - 1) & ~0x3;
+
+            u32 block = addr / GPU::VRAMDirtyGranularity;
+            if (!(Valid.Data[block >> 6] & (1ULL << (block & 0x3F))))
+            {
+                u32 start = block * GPU::VRAMDirtyGranularity;
+                for (u32 i = 0; i < GPU::VRAMDirtyGranularity; i += 4)
+                {
+                    u32 val = *(u32*)&vram[start + i];
+                    u64 row = 0;
+                    for (int j = 0; j < 8; j++)
+                        row |= (u64)((val >> (j*4)) & 0xF) << (j*8);
+
+                    Rows[(start + i) >> 2] = row;
+                }
+
+                Valid.Data[block >> 6] |= (1ULL << (block & 0x3F));
+            }
+
+            return Rows[addr >> 2];
+        }
+    };
+
+    TileRowCache<512*1024> BGTileCache_A;
+    TileRowCache<128*1024> BGTileCache_B;
+    TileRowCache<256*1024> OBJTileCache_A;
+    TileRowCache<128*1024> OBJTileCache_B;
+
     alignas(8) u32 BGOBJLine[256*3];
     u32* _3DLine;
 
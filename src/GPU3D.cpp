@@ -19,9 +19,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <algorithm>
+#include <atomic>
 #include "NDS.h"
 #include "GPU.h"
 #include "FIFO.h"
+#include "Platform.h"
 
 
 // 3D engine notes
@@ -95,6 +97,18 @@
 // * additionally, some commands (BEGIN, LIGHT_VECTOR, BOXTEST) stall the polygon pipeline
 
 
+// threaded geometry notes
+//
+// when enabled, the emulation thread only does the cycle accounting and keeps track of
+// the state visible to the emulated system (GXSTAT), while the actual transforms, lighting
+// and polygon setup are handed over to a separate thread
+// * the polygon pipeline timings depend on the culling/clipping results, which aren't
+//   known to the emulation thread. all polygons are assumed to be visible and unclipped.
+// * the geometry thread is synced whenever its results can be observed: box/pos/vec tests,
+//   clip/vector matrix reads, polygon/vertex RAM counters, DISP3DCNT accesses, VBlank
+//   and savestates
+
+
 namespace GPU3D
 {
 
@@ -180,6 +194,10 @@ u32 RenderClearAttr1, RenderClearAttr2;
 
 bool RenderFrameIdentical;
 
+// set when the last frame's rendering was skipped (render-skip mode)
+// the render state is kept so the frame can still be rendered late if needed
+bool RenderFramePending;
+
 u16 RenderXPos;
 
 u32 ZeroDotWLimit;
@@ -276,13 +294,61 @@ std::unique_ptr<GPU3D::Renderer3D> CurrentRenderer = {};
 
 bool AbortFrame;
 
+bool GeometryThreaded;
+
+Platform::Thread* GeometryThread;
+std::atomic_bool GeometryThreadRunning;
+std::atomic_bool GeometryThreadIdle;
+std::atomic_bool GeometrySyncPending;
+Platform::Semaphore* Sema_GeometryStart;
+Platform::Semaphore* Sema_GeometryIdle;
+
+// commands queued for the geometry thread
+const u32 GeometryQueueSize = 0x10000;
+CmdFIFOEntry GeometryQueue[GeometryQueueSize];
+std::atomic_uint32_t GeometryQueueRead, GeometryQueueWrite;
+
+// the state the emulation thread needs for cycle accounting when geometry is threaded
+// it mirrors the actual geometry state, which is owned by the geometry thread
+struct
+{
+    u32 MatrixMode;
+    s32 ProjMatrixStackPointer;
+    s32 PosMatrixStackPointer;
+    s32 TexMatrixStackPointer;
+
+    u32 PolygonMode;
+    u32 PolygonAttr;
+    u32 CurPolygonAttr;
+    u32 VertexNumInPoly;
+    u32 NumConsecutivePolygons;
+
+    u32 ExecParams[32];
+    u32 ExecParamCount;
+} Shadow;
+
+void SyncGeometry();
+void LoadGeometryShadow();
+void StopGeometryThread();
+
 bool Init()
 {
+    Sema_GeometryStart = Platform::Semaphore_Create();
+    Sema_GeometryIdle = Platform::Semaphore_Create();
+
+    GeometryThreaded = false;
+    GeometryThreadRunning = false;
+
     return true;
 }
 
 void DeInit()
 {
+    StopGeometryThread();
+    GeometryThreaded = false;
+
+    Platform::Semaphore_Free(Sema_GeometryStart);
+    Platform::Semaphore_Free(Sema_GeometryIdle);
 }
 
 void ResetRenderingState()
@@ -306,6 +372,8 @@ void ResetRenderingState()
 
 void Reset()
 {
+    if (GeometryThreaded) SyncGeometry();
+
     CmdFIFO.Clear();
     CmdPIPE.Clear();
 
@@ -379,16 +447,21 @@ void Reset()
     FlushAttributes = 0;
 
     ResetRenderingState();
+    RenderFramePending = false;
 
     RenderXPos = 0;
 
     AbortFrame = false;
+
+    if (GeometryThreaded) LoadGeometryShadow();
 }
 
 void DoSavestate(Savestate* file)
 {
     file->Section("GP3D");
 
+    if (GeometryThreaded) SyncGeometry();
+
     CmdFIFO.DoSavestate(file);
     CmdPIPE.DoSavestate(file);
 
@@ -501,89 +574,98 @@ void DoSavestate(Savestate* file)
     file->Var32(&FlushRequest);
     file->Var32(&FlushAttributes);
 
-    for (int i = 0; i < 6144*2; i++)
+    if (file->Snapshot)
     {
-        Vertex* vtx = &VertexRAM[i];
-
-        file->VarArray(vtx->Position, sizeof(s32)*4);
-        file->VarArray(vtx->Color, sizeof(s32)*3);
-        file->VarArray(vtx->TexCoords, sizeof(s16)*2);
+        // the vertex pointers stay valid within the session, so both can be kept as they are
+        file->VarArray(VertexRAM, sizeof(VertexRAM));
+        file->VarArray(PolygonRAM, sizeof(PolygonRAM));
+    }
+    else
+    {
+        for (int i = 0; i < 6144*2; i++)
+        {
+            Vertex* vtx = &VertexRAM[i];
 
-        file->Bool32(&vtx->Clipped);
+            file->VarArray(vtx->Position, sizeof(s32)*4);
+            file->VarArray(vtx->Color, sizeof(s32)*3);
+            file->VarArray(vtx->TexCoords, sizeof(s16)*2);
 
-        file->VarArray(vtx->FinalPosition, sizeof(s32)*2);
-        file->VarArray(vtx->FinalColor, sizeof(s32)*3);
-    }
+            file->Bool32(&vtx->Clipped);
 
-    for(int i = 0; i < 2048*2; i++)
-    {
-        Polygon* poly = &PolygonRAM[i];
+            file->VarArray(vtx->FinalPosition, sizeof(s32)*2);
+            file->VarArray(vtx->FinalColor, sizeof(s32)*3);
+        }
 
-        // this is a bit ugly, but eh
-        // we can't save the pointers as-is, that's a bad idea
-        if (file->Saving)
+        for(int i = 0; i < 2048*2; i++)
         {
-            for (int j = 0; j < 10; j++)
+            Polygon* poly = &PolygonRAM[i];
+
+            // this is a bit ugly, but eh
+            // we can't save the pointers as-is, that's a bad idea
+            if (file->Saving)
             {
-                Vertex* ptr = poly->Vertices[j];
-                u32 id;
-                if (ptr) id = (u32)((ptr - (&VertexRAM[0])) / sizeof(Vertex));
-                else     id = -1;
-                file->Var32(&id);
+                for (int j = 0; j < 10; j++)
+                {
+                    Vertex* ptr = poly->Vertices[j];
+                    u32 id;
+                    if (ptr) id = (u32)((ptr - (&VertexRAM[0])) / sizeof(Vertex));
+                    else     id = -1;
+                    file->Var32(&id);
+                }
             }
-        }
-        else
-        {
-            for (int j = 0; j < 10; j++)
+            else
             {
-                u32 id = -1;
-                file->Var32(&id);
-                if (id == 0xFFFFFFFF) poly->Vertices[j] = NULL;
-                else          poly->Vertices[j] = &VertexRAM[id];
+                for (int j = 0; j < 10; j++)
+                {
+                    u32 id = -1;
+                    file->Var32(&id);
+                    if (id == 0xFFFFFFFF) poly->Vertices[j] = NULL;
+                    else          poly->Vertices[j] = &VertexRAM[id];
+                }
             }
-        }
 
-        file->Var32(&poly->NumVertices);
+            file->Var32(&poly->NumVertices);
 
-        file->VarArray(poly->FinalZ, sizeof(s32)*10);
-        file->VarArray(poly->FinalW, sizeof(s32)*10);
-        file->Bool32(&poly->WBuffer);
+            file->VarArray(poly->FinalZ, sizeof(s32)*10);
+            file->VarArray(poly->FinalW, sizeof(s32)*10);
+            file->Bool32(&poly->WBuffer);
 
-        file->Var32(&poly->Attr);
-        file->Var32(&poly->TexParam);
-        file->Var32(&poly->TexPalette);
+            file->Var32(&poly->Attr);
+            file->Var32(&poly->TexParam);
+            file->Var32(&poly->TexPalette);
 
-        file->Bool32(&poly->FacingView);
-        file->Bool32(&poly->Translucent);
+            file->Bool32(&poly->FacingView);
+            file->Bool32(&poly->Translucent);
 
-        file->Bool32(&poly->IsShadowMask);
-        file->Bool32(&poly->IsShadow);
+            file->Bool32(&poly->IsShadowMask);
+            file->Bool32(&poly->IsShadow);
 
-        if (file->IsAtleastVersion(4, 1))
-            file->Var32((u32*)&poly->Type);
-        else
-            poly->Type = 0;
+            if (file->IsAtleastVersion(4, 1))
+                file->Var32((u32*)&poly->Type);
+            else
+                poly->Type = 0;
 
-        file->Var32(&poly->VTop);
-        file->Var32(&poly->VBottom);
-        file->Var32((u32*)&poly->YTop);
-        file->Var32((u32*)&poly->YBottom);
-        file->Var32((u32*)&poly->XTop);
-        file->Var32((u32*)&poly->XBottom);
+            file->Var32(&poly->VTop);
+            file->Var32(&poly->VBottom);
+            file->Var32((u32*)&poly->YTop);
+            file->Var32((u32*)&poly->YBottom);
+            file->Var32((u32*)&poly->XTop);
+            file->Var32((u32*)&poly->XBottom);
 
-        file->Var32(&poly->SortKey);
+            file->Var32(&poly->SortKey);
 
-        if (!file->Saving)
-        {
-            poly->Degenerate = false;
-
-            for (u32 j = 0; j < poly->NumVertices; j++)
+            if (!file->Saving)
             {
-                if (poly->Vertices[j]->Position[3] == 0)
-                    poly->Degenerate = true;
-            }
+                poly->Degenerate = false;
 
-            if (poly->YBottom > 192) poly->Degenerate = true;
+                for (u32 j = 0; j < poly->NumVertices; j++)
+                {
+                    if (poly->Vertices[j]->Position[3] == 0)
+                        poly->Degenerate = true;
+                }
+
+                if (poly->YBottom > 192) poly->Degenerate = true;
+            }
         }
     }
 
@@ -626,6 +708,9 @@ void DoSavestate(Savestate* file)
     file->VarArray(ShininessTable, 128*sizeof(u8));
 
     file->Bool32(&AbortFrame);
+
+    if (GeometryThreaded && !file->Saving)
+        LoadGeometryShadow();
 }
 
 
@@ -774,8 +859,11 @@ void UpdateClipMatrix()
 
 
 
+template <bool timing = true>
 void AddCycles(s32 num)
 {
+    if (!timing) return;
+
     CycleCount += num;
 
     if (VertexPipeline > 0)
@@ -848,8 +936,11 @@ void NextVertexSlot()
     }
 }
 
+template <bool timing = true>
 void StallPolygonPipeline(s32 delay, s32 nonstalldelay)
 {
+    if (!timing) return;
+
     if (PolygonPipeline > 0)
     {
         CycleCount += PolygonPipeline + delay;
@@ -1016,6 +1107,7 @@ bool ClipCoordsEqual(Vertex* a, Vertex* b)
            a->Position[3] == b->Position[3];
 }
 
+template <bool timing>
 void SubmitPolygon()
 {
     Vertex clippedvertices[10];
@@ -1029,9 +1121,12 @@ void SubmitPolygon()
     // submitting a polygon starts the polygon pipeline
     // noting that for now we are only reserving one vertex slot
     // further slots only get reserved if the polygon makes it through culling/clipping
-    PolygonPipeline = 8;
-    VertexSlotCounter = 1;
-    VertexSlotsFree = 0b11110;
+    if (timing)
+    {
+        PolygonPipeline = 8;
+        VertexSlotCounter = 1;
+        VertexSlotsFree = 0b11110;
+    }
 
     // culling
     // TODO: work out how it works on the real thing
@@ -1256,19 +1351,22 @@ void SubmitPolygon()
 
     // build the actual polygon
 
-    if (nverts == 4)
-    {
-        PolygonPipeline = 35;
-        VertexSlotCounter = 1;
-        if (PolygonMode & 0x2) VertexSlotsFree = 0b11100;
-        else                   VertexSlotsFree = 0b11110;
-    }
-    else
+    if (timing)
     {
-        PolygonPipeline = 26;
-        VertexSlotCounter = 1;
-        if (PolygonMode & 0x2) VertexSlotsFree = 0b1000;
-        else                   VertexSlotsFree = 0b1110;
+        if (nverts == 4)
+        {
+            PolygonPipeline = 35;
+            VertexSlotCounter = 1;
+            if (PolygonMode & 0x2) VertexSlotsFree = 0b11100;
+            else                   VertexSlotsFree = 0b11110;
+        }
+        else
+        {
+            PolygonPipeline = 26;
+            VertexSlotCounter = 1;
+            if (PolygonMode & 0x2) VertexSlotsFree = 0b1000;
+            else                   VertexSlotsFree = 0b1110;
+        }
     }
 
     Polygon* poly = &CurPolygonRAM[NumPolygons++];
@@ -1421,6 +1519,7 @@ void SubmitPolygon()
         LastStripPolygon = NULL;
 }
 
+template <bool timing>
 void SubmitVertex()
 {
     s64 vertex[4] = {(s64)CurVertex[0], (s64)CurVertex[1], (s64)CurVertex[2], 0x1000};
@@ -1460,7 +1559,7 @@ void SubmitVertex()
         if (VertexNumInPoly == 3)
         {
             VertexNumInPoly = 0;
-            SubmitPolygon();
+            SubmitPolygon<timing>();
             NumConsecutivePolygons++;
         }
         break;
@@ -1469,7 +1568,7 @@ void SubmitVertex()
         if (VertexNumInPoly == 4)
         {
             VertexNumInPoly = 0;
-            SubmitPolygon();
+            SubmitPolygon<timing>();
             NumConsecutivePolygons++;
         }
         break;
@@ -1482,7 +1581,7 @@ void SubmitVertex()
             TempVertexBuffer[0] = tmp;
 
             VertexNumInPoly = 2;
-            SubmitPolygon();
+            SubmitPolygon<timing>();
             NumConsecutivePolygons++;
 
             TempVertexBuffer[1] = TempVertexBuffer[2];
@@ -1490,7 +1589,7 @@ void SubmitVertex()
         else if (VertexNumInPoly == 3)
         {
             VertexNumInPoly = 2;
-            SubmitPolygon();
+            SubmitPolygon<timing>();
             NumConsecutivePolygons++;
 
             TempVertexBuffer[0] = TempVertexBuffer[1];
@@ -1506,7 +1605,7 @@ void SubmitVertex()
             TempVertexBuffer[2] = tmp;
 
             VertexNumInPoly = 2;
-            SubmitPolygon();
+            SubmitPolygon<timing>();
             NumConsecutivePolygons++;
 
             TempVertexBuffer[0] = TempVertexBuffer[3];
@@ -1515,10 +1614,14 @@ void SubmitVertex()
         break;
     }
 
-    VertexPipeline = 7;
-    AddCycles(3);
+    if (timing)
+    {
+        VertexPipeline = 7;
+        AddCycles(3);
+    }
 }
 
+template <bool timing>
 void CalculateLighting()
 {
     if ((TexParam >> 30) == 2)
@@ -1588,9 +1691,12 @@ void CalculateLighting()
         c++;
     }
 
-    if (c < 1) c = 1;
-    NormalPipeline = 7;
-    AddCycles(c);
+    if (timing)
+    {
+        if (c < 1) c = 1;
+        NormalPipeline = 7;
+        AddCycles(c);
+    }
 }
 
 
@@ -1796,42 +1902,49 @@ CmdFIFOEntry CmdFIFORead()
     return ret;
 }
 
+template <bool timing = true>
 inline void VertexPipelineSubmitCmd()
 {
     // vertex commands 0x24, 0x25, 0x26, 0x27, 0x28
+    if (!timing) return;
     if (!(VertexSlotsFree & 0x1)) NextVertexSlot();
     else                          AddCycles(1);
     NormalPipeline = 0;
 }
 
+template <bool timing = true>
 inline void VertexPipelineCmdDelayed6()
 {
     // commands 0x20, 0x30, 0x31, 0x72 that can run 6 cycles after a vertex
+    if (!timing) return;
     if (VertexPipeline > 2) AddCycles((VertexPipeline - 2) + 1);
     else                    AddCycles(NormalPipeline + 1);
     NormalPipeline = 0;
 }
 
+template <bool timing = true>
 inline void VertexPipelineCmdDelayed8()
 {
     // commands 0x29, 0x2A, 0x2B, 0x33, 0x34, 0x41, 0x60, 0x71 that can run 8 cycles after a vertex
+    if (!timing) return;
     if (VertexPipeline > 0) AddCycles(VertexPipeline + 1);
     else                    AddCycles(NormalPipeline + 1);
     NormalPipeline = 0;
 }
 
+template <bool timing = true>
 inline void VertexPipelineCmdDelayed4()
 {
     // all other commands can run 4 cycles after a vertex
     // no need to do much here since that is the minimum
+    if (!timing) return;
     AddCycles(NormalPipeline + 1);
     NormalPipeline = 0;
 }
 
-void ExecuteCommand()
+template <bool timing>
+void ProcessCommand(CmdFIFOEntry& entry)
 {
-    CmdFIFOEntry entry = CmdFIFORead();
-
     //printf("FIFO: processing %02X %08X. Levels: FIFO=%d, PIPE=%d\n", entry.Command, entry.Param, CmdFIFO->Level(), CmdPIPE->Level());
 
     // each FIFO entry takes 1 cycle to be processed
@@ -1848,16 +1961,16 @@ void ExecuteCommand()
         switch (entry.Command)
         {
         case 0x10: // matrix mode
-            VertexPipelineCmdDelayed4();
+            VertexPipelineCmdDelayed4<timing>();
             MatrixMode = entry.Param & 0x3;
             break;
 
         case 0x11: // push matrix
-            VertexPipelineCmdDelayed4();
-            NumPushPopCommands--;
+            VertexPipelineCmdDelayed4<timing>();
+            if (timing) NumPushPopCommands--;
             if (MatrixMode == 0)
             {
-                if (ProjMatrixStackPointer > 0) GXStat |= (1<<15);
+                if (timing && ProjMatrixStackPointer > 0) GXStat |= (1<<15);
 
                 memcpy(ProjMatrixStack, ProjMatrix, 16*4);
                 ProjMatrixStackPointer++;
@@ -1865,7 +1978,7 @@ void ExecuteCommand()
             }
             else if (MatrixMode == 3)
             {
-                if (TexMatrixStackPointer > 0) GXStat |= (1<<15);
+                if (timing && TexMatrixStackPointer > 0) GXStat |= (1<<15);
 
                 memcpy(TexMatrixStack, TexMatrix, 16*4);
                 TexMatrixStackPointer++;
@@ -1873,37 +1986,37 @@ void ExecuteCommand()
             }
             else
             {
-                if (PosMatrixStackPointer > 30) GXStat |= (1<<15);
+                if (timing && PosMatrixStackPointer > 30) GXStat |= (1<<15);
 
                 memcpy(PosMatrixStack[PosMatrixStackPointer & 0x1F], PosMatrix, 16*4);
                 memcpy(VecMatrixStack[PosMatrixStackPointer & 0x1F], VecMatrix, 16*4);
                 PosMatrixStackPointer++;
                 PosMatrixStackPointer &= 0x3F;
             }
-            AddCycles(16);
+            AddCycles<timing>(16);
             break;
 
         case 0x12: // pop matrix
-            VertexPipelineCmdDelayed4();
-            NumPushPopCommands--;
+            VertexPipelineCmdDelayed4<timing>();
+            if (timing) NumPushPopCommands--;
             if (MatrixMode == 0)
             {
-                if (ProjMatrixStackPointer == 0) GXStat |= (1<<15);
+                if (timing && ProjMatrixStackPointer == 0) GXStat |= (1<<15);
 
                 ProjMatrixStackPointer--;
                 ProjMatrixStackPointer &= 0x1;
                 memcpy(ProjMatrix, ProjMatrixStack, 16*4);
                 ClipMatrixDirty = true;
-                AddCycles(35);
+                AddCycles<timing>(35);
             }
             else if (MatrixMode == 3)
             {
-                if (TexMatrixStackPointer == 0) GXStat |= (1<<15);
+                if (timing && TexMatrixStackPointer == 0) GXStat |= (1<<15);
 
                 TexMatrixStackPointer--;
                 TexMatrixStackPointer &= 0x1;
                 memcpy(TexMatrix, TexMatrixStack, 16*4);
-                AddCycles(17);
+                AddCycles<timing>(17);
             }
             else
             {
@@ -1911,17 +2024,17 @@ void ExecuteCommand()
                 PosMatrixStackPointer -= offset;
                 PosMatrixStackPointer &= 0x3F;
 
-                if (PosMatrixStackPointer > 30) GXStat |= (1<<15);
+                if (timing && PosMatrixStackPointer > 30) GXStat |= (1<<15);
 
                 memcpy(PosMatrix, PosMatrixStack[PosMatrixStackPointer & 0x1F], 16*4);
                 memcpy(VecMatrix, VecMatrixStack[PosMatrixStackPointer & 0x1F], 16*4);
                 ClipMatrixDirty = true;
-                AddCycles(35);
+                AddCycles<timing>(35);
             }
             break;
 
         case 0x13: // store matrix
-            VertexPipelineCmdDelayed4();
+            VertexPipelineCmdDelayed4<timing>();
             if (MatrixMode == 0)
             {
                 memcpy(ProjMatrixStack, ProjMatrix, 16*4);
@@ -1933,46 +2046,46 @@ void ExecuteCommand()
             else
             {
                 u32 addr = entry.Param & 0x1F;
-                if (addr > 30) GXStat |= (1<<15);
+                if (timing && addr > 30) GXStat |= (1<<15);
 
                 memcpy(PosMatrixStack[addr], PosMatrix, 16*4);
                 memcpy(VecMatrixStack[addr], VecMatrix, 16*4);
             }
-            AddCycles(16);
+            AddCycles<timing>(16);
             break;
 
         case 0x14: // restore matrix
-            VertexPipelineCmdDelayed4();
+            VertexPipelineCmdDelayed4<timing>();
             if (MatrixMode == 0)
             {
                 memcpy(ProjMatrix, ProjMatrixStack, 16*4);
                 ClipMatrixDirty = true;
-                AddCycles(35);
+                AddCycles<timing>(35);
             }
             else if (MatrixMode == 3)
             {
                 memcpy(TexMatrix, TexMatrixStack, 16*4);
-                AddCycles(17);
+                AddCycles<timing>(17);
             }
             else
             {
                 u32 addr = entry.Param & 0x1F;
-                if (addr > 30) GXStat |= (1<<15);
+                if (timing && addr > 30) GXStat |= (1<<15);
 
                 memcpy(PosMatrix, PosMatrixStack[addr], 16*4);
                 memcpy(VecMatrix, VecMatrixStack[addr], 16*4);
                 ClipMatrixDirty = true;
-                AddCycles(35);
+                AddCycles<timing>(35);
             }
             break;
 
         case 0x15: // identity
-            VertexPipelineCmdDelayed4();
+            VertexPipelineCmdDelayed4<timing>();
             if (MatrixMode == 0)
             {
                 MatrixLoadIdentity(ProjMatrix);
                 ClipMatrixDirty = true;
-                AddCycles(18);
+                AddCycles<timing>(18);
             }
             else if (MatrixMode == 3)
                 MatrixLoadIdentity(TexMatrix);
@@ -1982,12 +2095,12 @@ void ExecuteCommand()
                 if (MatrixMode == 2)
                     MatrixLoadIdentity(VecMatrix);
                 ClipMatrixDirty = true;
-                AddCycles(18);
+                AddCycles<timing>(18);
             }
             break;
 
         case 0x20: // vertex color
-            VertexPipelineCmdDelayed6();
+            VertexPipelineCmdDelayed6<timing>();
             {
                 u32 c = entry.Param;
                 u32 r = c & 0x1F;
@@ -2000,15 +2113,15 @@ void ExecuteCommand()
             break;
 
         case 0x21: // normal
-            VertexPipelineCmdDelayed4();
+            VertexPipelineCmdDelayed4<timing>();
             Normal[0] = (s16)((entry.Param & 0x000003FF) << 6) >> 6;
             Normal[1] = (s16)((entry.Param & 0x000FFC00) >> 4) >> 6;
             Normal[2] = (s16)((entry.Param & 0x3FF00000) >> 14) >> 6;
-            CalculateLighting();
+            CalculateLighting<timing>();
             break;
 
         case 0x22: // texcoord
-            VertexPipelineCmdDelayed4();
+            VertexPipelineCmdDelayed4<timing>();
             RawTexCoords[0] = entry.Param & 0xFFFF;
             RawTexCoords[1] = entry.Param >> 16;
             if ((TexParam >> 30) == 1)
@@ -2024,59 +2137,59 @@ void ExecuteCommand()
             break;
 
         case 0x24: // 10-bit vertex
-            VertexPipelineSubmitCmd();
+            VertexPipelineSubmitCmd<timing>();
             CurVertex[0] = (entry.Param & 0x000003FF) << 6;
             CurVertex[1] = (entry.Param & 0x000FFC00) >> 4;
             CurVertex[2] = (entry.Param & 0x3FF00000) >> 14;
-            SubmitVertex();
+            SubmitVertex<timing>();
             break;
 
         case 0x25: // vertex XY
-            VertexPipelineSubmitCmd();
+            VertexPipelineSubmitCmd<timing>();
             CurVertex[0] = entry.Param & 0xFFFF;
             CurVertex[1] = entry.Param >> 16;
-            SubmitVertex();
+            SubmitVertex<timing>();
             break;
 
         case 0x26: // vertex XZ
-            VertexPipelineSubmitCmd();
+            VertexPipelineSubmitCmd<timing>();
             CurVertex[0] = entry.Param & 0xFFFF;
             CurVertex[2] = entry.Param >> 16;
-            SubmitVertex();
+            SubmitVertex<timing>();
             break;
 
         case 0x27: // vertex YZ
-            VertexPipelineSubmitCmd();
+            VertexPipelineSubmitCmd<timing>();
             CurVertex[1] = entry.Param & 0xFFFF;
             CurVertex[2] = entry.Param >> 16;
-            SubmitVertex();
+            SubmitVertex<timing>();
             break;
 
         case 0x28: // 10-bit delta vertex
-            VertexPipelineSubmitCmd();
+            VertexPipelineSubmitCmd<timing>();
             CurVertex[0] += (s16)((entry.Param & 0x000003FF) << 6) >> 6;
             CurVertex[1] += (s16)((entry.Param & 0x000FFC00) >> 4) >> 6;
             CurVertex[2] += (s16)((entry.Param & 0x3FF00000) >> 14) >> 6;
-            SubmitVertex();
+            SubmitVertex<timing>();
             break;
 
         case 0x29: // polygon attributes
-            VertexPipelineCmdDelayed8();
+            VertexPipelineCmdDelayed8<timing>();
             PolygonAttr = entry.Param;
             break;
 
         case 0x2A: // texture param
-            VertexPipelineCmdDelayed8();
+            VertexPipelineCmdDelayed8<timing>();
             TexParam = entry.Param;
             break;
 
         case 0x2B: // texture palette
-            VertexPipelineCmdDelayed8();
+            VertexPipelineCmdDelayed8<timing>();
             TexPalette = entry.Param & 0x1FFF;
             break;
 
         case 0x30: // diffuse/ambient material
-            VertexPipelineCmdDelayed6();
+            VertexPipelineCmdDelayed6<timing>();
             MatDiffuse[0] = entry.Param & 0x1F;
             MatDiffuse[1] = (entry.Param >> 5) & 0x1F;
             MatDiffuse[2] = (entry.Param >> 10) & 0x1F;
@@ -2089,11 +2202,11 @@ void ExecuteCommand()
                 VertexColor[1] = MatDiffuse[1];
                 VertexColor[2] = MatDiffuse[2];
             }
-            AddCycles(3);
+            AddCycles<timing>(3);
             break;
 
         case 0x31: // specular/emission material
-            VertexPipelineCmdDelayed6();
+            VertexPipelineCmdDelayed6<timing>();
             MatSpecular[0] = entry.Param & 0x1F;
             MatSpecular[1] = (entry.Param >> 5) & 0x1F;
             MatSpecular[2] = (entry.Param >> 10) & 0x1F;
@@ -2101,11 +2214,11 @@ void ExecuteCommand()
             MatEmission[1] = (entry.Param >> 21) & 0x1F;
             MatEmission[2] = (entry.Param >> 26) & 0x1F;
             UseShininessTable = (entry.Param & 0x8000) != 0;
-            AddCycles(3);
+            AddCycles<timing>(3);
             break;
 
         case 0x32: // light direction
-            StallPolygonPipeline(8 + 1,  2); // 0x32 can run 6 cycles after a vertex
+            StallPolygonPipeline<timing>(8 + 1,  2); // 0x32 can run 6 cycles after a vertex
             {
                 u32 l = entry.Param >> 30;
                 s16 dir[3];
@@ -2116,22 +2229,22 @@ void ExecuteCommand()
                 LightDirection[l][1] = (dir[0]*VecMatrix[1] + dir[1]*VecMatrix[5] + dir[2]*VecMatrix[9]) >> 12;
                 LightDirection[l][2] = (dir[0]*VecMatrix[2] + dir[1]*VecMatrix[6] + dir[2]*VecMatrix[10]) >> 12;
             }
-            AddCycles(5);
+            AddCycles<timing>(5);
             break;
 
         case 0x33: // light color
-            VertexPipelineCmdDelayed8();
+            VertexPipelineCmdDelayed8<timing>();
             {
                 u32 l = entry.Param >> 30;
                 LightColor[l][0] = entry.Param & 0x1F;
                 LightColor[l][1] = (entry.Param >> 5) & 0x1F;
                 LightColor[l][2] = (entry.Param >> 10) & 0x1F;
             }
-            AddCycles(1);
+            AddCycles<timing>(1);
             break;
 
         case 0x40: // begin polygons
-            StallPolygonPipeline(1, 0);
+            StallPolygonPipeline<timing>(1, 0);
             // TODO: check if there was a polygon being defined but incomplete
             // such cases seem to freeze the GPU
             PolygonMode = entry.Param & 0x3;
@@ -2143,7 +2256,7 @@ void ExecuteCommand()
             break;
 
         case 0x41: // end polygons
-            VertexPipelineCmdDelayed8();
+            VertexPipelineCmdDelayed8<timing>();
             // TODO: research this?
             // it doesn't seem to have any effect whatsoever, but
             // its timing characteristics are different from those of other
@@ -2151,21 +2264,24 @@ void ExecuteCommand()
             break;
 
         case 0x50: // flush
-            VertexPipelineCmdDelayed4();
-            FlushRequest = 1;
+            VertexPipelineCmdDelayed4<timing>();
             FlushAttributes = entry.Param & 0x3;
-            CycleCount = 325;
-            // probably safe to just reset all pipelines
-            // but needs checked
-            VertexPipeline = 0;
-            NormalPipeline = 0;
-            PolygonPipeline = 0;
-            VertexSlotCounter = 0;
-            VertexSlotsFree = 1;
+            if (timing)
+            {
+                FlushRequest = 1;
+                CycleCount = 325;
+                // probably safe to just reset all pipelines
+                // but needs checked
+                VertexPipeline = 0;
+                NormalPipeline = 0;
+                PolygonPipeline = 0;
+                VertexSlotCounter = 0;
+                VertexSlotsFree = 1;
+            }
             break;
 
         case 0x60: // viewport x1,y1,x2,y2
-            VertexPipelineCmdDelayed8();
+            VertexPipelineCmdDelayed8<timing>();
             // note: viewport Y coordinates are upside-down
             Viewport[0] = entry.Param & 0xFF;                             // x0
             Viewport[1] = (191 - ((entry.Param >> 8) & 0xFF)) & 0xFF;     // y0
@@ -2176,13 +2292,16 @@ void ExecuteCommand()
             break;
 
         case 0x72: // vec test
-            VertexPipelineCmdDelayed6();
-            NumTestCommands--;
-            VecTest(entry.Param);
+            VertexPipelineCmdDelayed6<timing>();
+            if (timing)
+            {
+                NumTestCommands--;
+                VecTest(entry.Param);
+            }
             break;
 
         default:
-            VertexPipelineCmdDelayed4();
+            VertexPipelineCmdDelayed4<timing>();
             //printf("!! UNKNOWN GX COMMAND %02X %08X\n", entry.Command, entry.Param);
             break;
         }
@@ -2198,18 +2317,18 @@ void ExecuteCommand()
             switch (entry.Command)
             {
             // commands that stall the polygon pipeline
-            case 0x23: VertexPipelineSubmitCmd(); break;
+            case 0x23: VertexPipelineSubmitCmd<timing>(); break;
             case 0x34:
             case 0x71:
-                VertexPipelineCmdDelayed8();
+                VertexPipelineCmdDelayed8<timing>();
                 break;
-            case 0x70: StallPolygonPipeline(10 + 1, 0); break;
-            default: VertexPipelineCmdDelayed4(); break;
+            case 0x70: StallPolygonPipeline<timing>(10 + 1, 0); break;
+            default: VertexPipelineCmdDelayed4<timing>(); break;
             }
         }
         else
         {
-            AddCycles(1);
+            AddCycles<timing>(1);
 
             if (ExecParamCount >= paramsRequiredCount)
             {
@@ -2226,12 +2345,12 @@ void ExecuteCommand()
                     {
                         MatrixLoad4x4(ProjMatrix, (s32*)ExecParams);
                         ClipMatrixDirty = true;
-                        AddCycles(18);
+                        AddCycles<timing>(18);
                     }
                     else if (MatrixMode == 3)
                     {
                         MatrixLoad4x4(TexMatrix, (s32*)ExecParams);
-                        AddCycles(10);
+                        AddCycles<timing>(10);
                     }
                     else
                     {
@@ -2239,7 +2358,7 @@ void ExecuteCommand()
                         if (MatrixMode == 2)
                             MatrixLoad4x4(VecMatrix, (s32*)ExecParams);
                         ClipMatrixDirty = true;
-                        AddCycles(18);
+                        AddCycles<timing>(18);
                     }
                     break;
 
@@ -2248,12 +2367,12 @@ void ExecuteCommand()
                     {
                         MatrixLoad4x3(ProjMatrix, (s32*)ExecParams);
                         ClipMatrixDirty = true;
-                        AddCycles(18);
+                        AddCycles<timing>(18);
                     }
                     else if (MatrixMode == 3)
                     {
                         MatrixLoad4x3(TexMatrix, (s32*)ExecParams);
-                        AddCycles(7);
+                        AddCycles<timing>(7);
                     }
                     else
                     {
@@ -2261,7 +2380,7 @@ void ExecuteCommand()
                         if (MatrixMode == 2)
                             MatrixLoad4x3(VecMatrix, (s32*)ExecParams);
                         ClipMatrixDirty = true;
-                        AddCycles(18);
+                        AddCycles<timing>(18);
                     }
                     break;
 
@@ -2270,12 +2389,12 @@ void ExecuteCommand()
                     {
                         MatrixMult4x4(ProjMatrix, (s32*)ExecParams);
                         ClipMatrixDirty = true;
-                        AddCycles(35 - 16);
+                        AddCycles<timing>(35 - 16);
                     }
                     else if (MatrixMode == 3)
                     {
                         MatrixMult4x4(TexMatrix, (s32*)ExecParams);
-                        AddCycles(33 - 16);
+                        AddCycles<timing>(33 - 16);
                     }
                     else
                     {
@@ -2283,9 +2402,9 @@ void ExecuteCommand()
                         if (MatrixMode == 2)
                         {
                             MatrixMult4x4(VecMatrix, (s32*)ExecParams);
-                            AddCycles(35 + 30 - 16);
+                            AddCycles<timing>(35 + 30 - 16);
                         }
-                        else AddCycles(35 - 16);
+                        else AddCycles<timing>(35 - 16);
                         ClipMatrixDirty = true;
                     }
                     break;
@@ -2295,12 +2414,12 @@ void ExecuteCommand()
                     {
                         MatrixMult4x3(ProjMatrix, (s32*)ExecParams);
                         ClipMatrixDirty = true;
-                        AddCycles(35 - 12);
+                        AddCycles<timing>(35 - 12);
                     }
                     else if (MatrixMode == 3)
                     {
                         MatrixMult4x3(TexMatrix, (s32*)ExecParams);
-                        AddCycles(33 - 12);
+                        AddCycles<timing>(33 - 12);
                     }
                     else
                     {
@@ -2308,9 +2427,9 @@ void ExecuteCommand()
                         if (MatrixMode == 2)
                         {
                             MatrixMult4x3(VecMatrix, (s32*)ExecParams);
-                            AddCycles(35 + 30 - 12);
+                            AddCycles<timing>(35 + 30 - 12);
                         }
-                        else AddCycles(35 - 12);
+                        else AddCycles<timing>(35 - 12);
                         ClipMatrixDirty = true;
                     }
                     break;
@@ -2320,12 +2439,12 @@ void ExecuteCommand()
                     {
                         MatrixMult3x3(ProjMatrix, (s32*)ExecParams);
                         ClipMatrixDirty = true;
-                        AddCycles(35 - 9);
+                        AddCycles<timing>(35 - 9);
                     }
                     else if (MatrixMode == 3)
                     {
                         MatrixMult3x3(TexMatrix, (s32*)ExecParams);
-                        AddCycles(33 - 9);
+                        AddCycles<timing>(33 - 9);
                     }
                     else
                     {
@@ -2333,9 +2452,9 @@ void ExecuteCommand()
                         if (MatrixMode == 2)
                         {
                             MatrixMult3x3(VecMatrix, (s32*)ExecParams);
-                            AddCycles(35 + 30 - 9);
+                            AddCycles<timing>(35 + 30 - 9);
                         }
-                        else AddCycles(35 - 9);
+                        else AddCycles<timing>(35 - 9);
                         ClipMatrixDirty = true;
                     }
                     break;
@@ -2345,18 +2464,18 @@ void ExecuteCommand()
                     {
                         MatrixScale(ProjMatrix, (s32*)ExecParams);
                         ClipMatrixDirty = true;
-                        AddCycles(35 - 3);
+                        AddCycles<timing>(35 - 3);
                     }
                     else if (MatrixMode == 3)
                     {
                         MatrixScale(TexMatrix, (s32*)ExecParams);
-                        AddCycles(33 - 3);
+                        AddCycles<timing>(33 - 3);
                     }
                     else
                     {
                         MatrixScale(PosMatrix, (s32*)ExecParams);
                         ClipMatrixDirty = true;
-                        AddCycles(35 - 3);
+                        AddCycles<timing>(35 - 3);
                     }
                     break;
 
@@ -2365,12 +2484,12 @@ void ExecuteCommand()
                     {
                         MatrixTranslate(ProjMatrix, (s32*)ExecParams);
                         ClipMatrixDirty = true;
-                        AddCycles(35 - 3);
+                        AddCycles<timing>(35 - 3);
                     }
                     else if (MatrixMode == 3)
                     {
                         MatrixTranslate(TexMatrix, (s32*)ExecParams);
-                        AddCycles(33 - 3);
+                        AddCycles<timing>(33 - 3);
                     }
                     else
                     {
@@ -2378,9 +2497,9 @@ void ExecuteCommand()
                         if (MatrixMode == 2)
                         {
                             MatrixTranslate(VecMatrix, (s32*)ExecParams);
-                            AddCycles(35 + 30 - 3);
+                            AddCycles<timing>(35 + 30 - 3);
                         }
-                        else AddCycles(35 - 3);
+                        else AddCycles<timing>(35 - 3);
                         ClipMatrixDirty = true;
                     }
                     break;
@@ -2389,7 +2508,7 @@ void ExecuteCommand()
                     CurVertex[0] = ExecParams[0] & 0xFFFF;
                     CurVertex[1] = ExecParams[0] >> 16;
                     CurVertex[2] = ExecParams[1] & 0xFFFF;
-                    SubmitVertex();
+                    SubmitVertex<timing>();
                     break;
 
                 case 0x34: // shininess table
@@ -2406,16 +2525,22 @@ void ExecuteCommand()
                     break;
 
                 case 0x71: // pos test
-                    NumTestCommands -= 2;
-                    CurVertex[0] = ExecParams[0] & 0xFFFF;
-                    CurVertex[1] = ExecParams[0] >> 16;
-                    CurVertex[2] = ExecParams[1] & 0xFFFF;
-                    PosTest();
+                    if (timing)
+                    {
+                        NumTestCommands -= 2;
+                        CurVertex[0] = ExecParams[0] & 0xFFFF;
+                        CurVertex[1] = ExecParams[0] >> 16;
+                        CurVertex[2] = ExecParams[1] & 0xFFFF;
+                        PosTest();
+                    }
                     break;
 
                 case 0x70: // box test
-                    NumTestCommands -= 3;
-                    BoxTest(ExecParams);
+                    if (timing)
+                    {
+                        NumTestCommands -= 3;
+                        BoxTest(ExecParams);
+                    }
                     break;
 
                 default:
@@ -2426,6 +2551,464 @@ void ExecuteCommand()
     }
 }
 
+void LoadGeometryShadow()
+{
+    Shadow.MatrixMode = MatrixMode;
+    Shadow.ProjMatrixStackPointer = ProjMatrixStackPointer;
+    Shadow.PosMatrixStackPointer = PosMatrixStackPointer;
+    Shadow.TexMatrixStackPointer = TexMatrixStackPointer;
+
+    Shadow.PolygonMode = PolygonMode;
+    Shadow.PolygonAttr = PolygonAttr;
+    Shadow.CurPolygonAttr = CurPolygonAttr;
+    Shadow.VertexNumInPoly = VertexNumInPoly;
+    Shadow.NumConsecutivePolygons = NumConsecutivePolygons;
+
+    memcpy(Shadow.ExecParams, ExecParams, 32*4);
+    Shadow.ExecParamCount = ExecParamCount;
+}
+
+void GeometryThreadFunc()
+{
+    for (;;)
+    {
+        u32 rdpos = GeometryQueueRead.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            u32 wrpos = GeometryQueueWrite.load(std::memory_order_acquire);
+            if (rdpos == wrpos) break;
+
+            while (rdpos != wrpos)
+            {
+                ProcessCommand<false>(GeometryQueue[rdpos & (GeometryQueueSize-1)]);
+                rdpos++;
+            }
+
+            GeometryQueueRead.store(rdpos, std::memory_order_release);
+        }
+
+        if (GeometrySyncPending.exchange(false))
+            Platform::Semaphore_Post(Sema_GeometryIdle);
+
+        // go to sleep, unless there is more work to do
+        // (if the emulation thread resets the idle flag first, it will wake us up)
+        GeometryThreadIdle = true;
+        if ((GeometryQueueWrite.load() != rdpos || GeometrySyncPending.load()) &&
+            GeometryThreadIdle.exchange(false))
+            continue;
+
+        Platform::Semaphore_Wait(Sema_GeometryStart);
+        if (!GeometryThreadRunning.load(std::memory_order_relaxed))
+            break;
+    }
+}
+
+void WakeGeometryThread()
+{
+    if (GeometryThreadIdle.load(std::memory_order_relaxed) && GeometryThreadIdle.exchange(false))
+        Platform::Semaphore_Post(Sema_GeometryStart);
+}
+
+void SyncGeometry()
+{
+    // wait for the geometry thread to be done with all the queued commands
+    while (GeometryQueueRead.load(std::memory_order_acquire) != GeometryQueueWrite.load(std::memory_order_relaxed))
+    {
+        GeometrySyncPending = true;
+        WakeGeometryThread();
+        Platform::Semaphore_Wait(Sema_GeometryIdle);
+    }
+}
+
+void QueueCommand(CmdFIFOEntry& entry)
+{
+    u32 wrpos = GeometryQueueWrite.load(std::memory_order_relaxed);
+    if ((wrpos - GeometryQueueRead.load(std::memory_order_acquire)) >= GeometryQueueSize)
+        SyncGeometry();
+
+    GeometryQueue[wrpos & (GeometryQueueSize-1)] = entry;
+    GeometryQueueWrite.store(wrpos + 1, std::memory_order_release);
+}
+
+void StopGeometryThread()
+{
+    if (!GeometryThreadRunning.load(std::memory_order_relaxed))
+        return;
+
+    SyncGeometry();
+
+    GeometryThreadRunning = false;
+    Platform::Semaphore_Post(Sema_GeometryStart);
+    Platform::Thread_Wait(GeometryThread);
+    Platform::Thread_Free(GeometryThread);
+}
+
+void SetThreadedGeometry(bool threaded)
+{
+    if (threaded == GeometryThreaded)
+        return;
+
+    if (threaded)
+    {
+        LoadGeometryShadow();
+
+        GeometryQueueRead = 0;
+        GeometryQueueWrite = 0;
+        GeometrySyncPending = false;
+        GeometryThreadIdle = false;
+        Platform::Semaphore_Reset(Sema_GeometryStart);
+        Platform::Semaphore_Reset(Sema_GeometryIdle);
+
+        GeometryThreadRunning = true;
+        GeometryThread = Platform::Thread_Create(GeometryThreadFunc);
+    }
+    else
+    {
+        StopGeometryThread();
+    }
+
+    GeometryThreaded = threaded;
+}
+
+void SubmitVertexTiming()
+{
+    // follows the vertex counting of SubmitVertex()
+    // the polygon setup time depends on the culling/clipping results, which are not
+    // known here. the polygon is assumed to be visible and unclipped.
+
+    bool polygon = false;
+
+    Shadow.VertexNumInPoly++;
+    switch (Shadow.PolygonMode)
+    {
+    case 0: // triangle
+        if (Shadow.VertexNumInPoly == 3)
+        {
+            Shadow.VertexNumInPoly = 0;
+            polygon = true;
+        }
+        break;
+
+    case 1: // quad
+        if (Shadow.VertexNumInPoly == 4)
+        {
+            Shadow.VertexNumInPoly = 0;
+            polygon = true;
+        }
+        break;
+
+    case 2: // triangle strip
+        if ((Shadow.NumConsecutivePolygons & 1) || Shadow.VertexNumInPoly == 3)
+        {
+            Shadow.VertexNumInPoly = 2;
+            polygon = true;
+        }
+        break;
+
+    case 3: // quad strip
+        if (Shadow.VertexNumInPoly == 4)
+        {
+            Shadow.VertexNumInPoly = 2;
+            polygon = true;
+        }
+        break;
+    }
+
+    if (polygon)
+    {
+        Shadow.NumConsecutivePolygons++;
+
+        if (Shadow.PolygonMode & 0x1)
+        {
+            PolygonPipeline = 35;
+            VertexSlotCounter = 1;
+            if (Shadow.PolygonMode & 0x2) VertexSlotsFree = 0b11100;
+            else                          VertexSlotsFree = 0b11110;
+        }
+        else
+        {
+            PolygonPipeline = 26;
+            VertexSlotCounter = 1;
+            if (Shadow.PolygonMode & 0x2) VertexSlotsFree = 0b1000;
+            else                          VertexSlotsFree = 0b1110;
+        }
+    }
+
+    VertexPipeline = 7;
+    AddCycles(3);
+}
+
+void MatrixOpTiming(s32 numparams, bool vecmatrix)
+{
+    // timings of the matrix multiply/scale/translate commands
+    if (Shadow.MatrixMode == 3)
+        AddCycles(33 - numparams);
+    else if (Shadow.MatrixMode == 2 && vecmatrix)
+        AddCycles(35 + 30 - numparams);
+    else
+        AddCycles(35 - numparams);
+}
+
+void ProcessCommandTiming(CmdFIFOEntry& entry)
+{
+    // threaded geometry: this runs on the emulation thread and accounts for the command
+    // timings, the command itself is executed on the geometry thread
+    // box/pos/vec tests are run here, after syncing up with the geometry thread
+
+    u32 paramsRequiredCount = CmdNumParams[entry.Command];
+    if (paramsRequiredCount <= 1)
+    {
+        switch (entry.Command)
+        {
+        case 0x10: // matrix mode
+            VertexPipelineCmdDelayed4();
+            Shadow.MatrixMode = entry.Param & 0x3;
+            break;
+
+        case 0x11: // push matrix
+            VertexPipelineCmdDelayed4();
+            NumPushPopCommands--;
+            if (Shadow.MatrixMode == 0)
+            {
+                if (Shadow.ProjMatrixStackPointer > 0) GXStat |= (1<<15);
+
+                Shadow.ProjMatrixStackPointer++;
+                Shadow.ProjMatrixStackPointer &= 0x1;
+            }
+            else if (Shadow.MatrixMode == 3)
+            {
+                if (Shadow.TexMatrixStackPointer > 0) GXStat |= (1<<15);
+
+                Shadow.TexMatrixStackPointer++;
+                Shadow.TexMatrixStackPointer &= 0x1;
+            }
+            else
+            {
+                if (Shadow.PosMatrixStackPointer > 30) GXStat |= (1<<15);
+
+                Shadow.PosMatrixStackPointer++;
+                Shadow.PosMatrixStackPointer &= 0x3F;
+            }
+            AddCycles(16);
+            break;
+
+        case 0x12: // pop matrix
+            VertexPipelineCmdDelayed4();
+            NumPushPopCommands--;
+            if (Shadow.MatrixMode == 0)
+            {
+                if (Shadow.ProjMatrixStackPointer == 0) GXStat |= (1<<15);
+
+                Shadow.ProjMatrixStackPointer--;
+                Shadow.ProjMatrixStackPointer &= 0x1;
+                AddCycles(35);
+            }
+            else if (Shadow.MatrixMode == 3)
+            {
+                if (Shadow.TexMatrixStackPointer == 0) GXStat |= (1<<15);
+
+                Shadow.TexMatrixStackPointer--;
+                Shadow.TexMatrixStackPointer &= 0x1;
+                AddCycles(17);
+            }
+            else
+            {
+                s32 offset = (s32)(entry.Param << 26) >> 26;
+                Shadow.PosMatrixStackPointer -= offset;
+                Shadow.PosMatrixStackPointer &= 0x3F;
+
+                if (Shadow.PosMatrixStackPointer > 30) GXStat |= (1<<15);
+                AddCycles(35);
+            }
+            break;
+
+        case 0x13: // store matrix
+            VertexPipelineCmdDelayed4();
+            if (Shadow.MatrixMode == 1 || Shadow.MatrixMode == 2)
+            {
+                if ((entry.Param & 0x1F) > 30) GXStat |= (1<<15);
+            }
+            AddCycles(16);
+            break;
+
+        case 0x14: // restore matrix
+            VertexPipelineCmdDelayed4();
+            if (Shadow.MatrixMode == 3)
+                AddCycles(17);
+            else
+            {
+                if (Shadow.MatrixMode != 0 && (entry.Param & 0x1F) > 30) GXStat |= (1<<15);
+                AddCycles(35);
+            }
+            break;
+
+        case 0x15: // identity
+            VertexPipelineCmdDelayed4();
+            if (Shadow.MatrixMode != 3)
+                AddCycles(18);
+            break;
+
+        case 0x20: // vertex color
+            VertexPipelineCmdDelayed6();
+            break;
+
+        case 0x21: // normal
+            VertexPipelineCmdDelayed4();
+            {
+                // one cycle per enabled light, see CalculateLighting()
+                s32 c = __builtin_popcount(Shadow.CurPolygonAttr & 0xF);
+                if (c < 1) c = 1;
+                NormalPipeline = 7;
+                AddCycles(c);
+            }
+            break;
+
+        case 0x24: // 10-bit vertex
+        case 0x25: // vertex XY
+        case 0x26: // vertex XZ
+        case 0x27: // vertex YZ
+        case 0x28: // 10-bit delta vertex
+            VertexPipelineSubmitCmd();
+            SubmitVertexTiming();
+            break;
+
+        case 0x29: // polygon attributes
+            VertexPipelineCmdDelayed8();
+            Shadow.PolygonAttr = entry.Param;
+            break;
+
+        case 0x2A: // texture param
+        case 0x2B: // texture palette
+        case 0x41: // end polygons
+        case 0x60: // viewport
+            VertexPipelineCmdDelayed8();
+            break;
+
+        case 0x30: // diffuse/ambient material
+        case 0x31: // specular/emission material
+            VertexPipelineCmdDelayed6();
+            AddCycles(3);
+            break;
+
+        case 0x32: // light direction
+            StallPolygonPipeline(8 + 1,  2); // 0x32 can run 6 cycles after a vertex
+            AddCycles(5);
+            break;
+
+        case 0x33: // light color
+            VertexPipelineCmdDelayed8();
+            AddCycles(1);
+            break;
+
+        case 0x40: // begin polygons
+            StallPolygonPipeline(1, 0);
+            Shadow.PolygonMode = entry.Param & 0x3;
+            Shadow.VertexNumInPoly = 0;
+            Shadow.NumConsecutivePolygons = 0;
+            Shadow.CurPolygonAttr = Shadow.PolygonAttr;
+            break;
+
+        case 0x50: // flush
+            VertexPipelineCmdDelayed4();
+            FlushRequest = 1;
+            CycleCount = 325;
+            VertexPipeline = 0;
+            NormalPipeline = 0;
+            PolygonPipeline = 0;
+            VertexSlotCounter = 0;
+            VertexSlotsFree = 1;
+            break;
+
+        case 0x72: // vec test
+            VertexPipelineCmdDelayed6();
+            NumTestCommands--;
+            SyncGeometry();
+            VecTest(entry.Param);
+            break;
+
+        default:
+            VertexPipelineCmdDelayed4();
+            break;
+        }
+    }
+    else
+    {
+        Shadow.ExecParams[Shadow.ExecParamCount] = entry.Param;
+        Shadow.ExecParamCount++;
+
+        if (Shadow.ExecParamCount == 1)
+        {
+            // delay the first command entry as needed
+            switch (entry.Command)
+            {
+            // commands that stall the polygon pipeline
+            case 0x23: VertexPipelineSubmitCmd(); break;
+            case 0x34:
+            case 0x71:
+                VertexPipelineCmdDelayed8();
+                break;
+            case 0x70: StallPolygonPipeline(10 + 1, 0); break;
+            default: VertexPipelineCmdDelayed4(); break;
+            }
+        }
+        else
+        {
+            AddCycles(1);
+
+            if (Shadow.ExecParamCount >= paramsRequiredCount)
+            {
+                Shadow.ExecParamCount = 0;
+
+                switch (entry.Command)
+                {
+                case 0x16: // load 4x4
+                    AddCycles(Shadow.MatrixMode == 3 ? 10 : 18);
+                    break;
+
+                case 0x17: // load 4x3
+                    AddCycles(Shadow.MatrixMode == 3 ? 7 : 18);
+                    break;
+
+                case 0x18: MatrixOpTiming(16, true); break; // mult 4x4
+                case 0x19: MatrixOpTiming(12, true); break; // mult 4x3
+                case 0x1A: MatrixOpTiming(9, true); break;  // mult 3x3
+                case 0x1B: MatrixOpTiming(3, false); break; // scale
+                case 0x1C: MatrixOpTiming(3, true); break;  // translate
+
+                case 0x23: // full vertex
+                    SubmitVertexTiming();
+                    break;
+
+                case 0x71: // pos test
+                    NumTestCommands -= 2;
+                    SyncGeometry();
+                    CurVertex[0] = Shadow.ExecParams[0] & 0xFFFF;
+                    CurVertex[1] = Shadow.ExecParams[0] >> 16;
+                    CurVertex[2] = Shadow.ExecParams[1] & 0xFFFF;
+                    PosTest();
+                    break;
+
+                case 0x70: // box test
+                    NumTestCommands -= 3;
+                    SyncGeometry();
+                    BoxTest(Shadow.ExecParams);
+                    break;
+                }
+            }
+        }
+    }
+
+    QueueCommand(entry);
+}
+
+void ExecuteCommand()
+{
+    CmdFIFOEntry entry = CmdFIFORead();
+
+    if (GeometryThreaded) ProcessCommandTiming(entry);
+    else                  ProcessCommand<true>(entry);
+}
+
 s32 CyclesToRunFor()
 {
     if (CycleCount < 0) return 0;
@@ -2446,10 +3029,15 @@ void FinishWork(s32 cycles)
     GXStat &= ~(1<<27);
 }
 
+bool IsIdle()
+{
+    return !GeometryEnabled || FlushRequest ||
+        (CmdPIPE.IsEmpty() && !(GXStat & (1<<27)));
+}
+
 void Run()
 {
-    if (!GeometryEnabled || FlushRequest ||
-        (CmdPIPE.IsEmpty() && !(GXStat & (1<<27))))
+    if (IsIdle())
     {
         Timestamp = NDS::ARM9Timestamp >> NDS::ARM9ClockShift;
         return;
@@ -2468,6 +3056,8 @@ void Run()
 
             ExecuteCommand();
         }
+
+        if (GeometryThreaded) WakeGeometryThread();
     }
 
     if (CycleCount <= 0 && CmdPIPE.IsEmpty())
@@ -2502,6 +3092,9 @@ void CheckFIFODMA()
 
 void VCount144()
 {
+    // nothing to wait for if the frame was never rendered
+    if (RenderFramePending) return;
+
     CurrentRenderer->VCount144();
 }
 
@@ -2525,6 +3118,8 @@ bool YSort(Polygon* a, Polygon* b)
 
 void VBlank()
 {
+    if (GeometryThreaded) SyncGeometry();
+
     if (GeometryEnabled)
     {
         if (RenderingEnabled)
@@ -2557,7 +3152,10 @@ void VBlank()
             }
             else
             {
-                RenderFrameIdentical = RenderDispCnt == DispCnt
+                // the last rendered frame might not match the last latched state
+                // if rendering was skipped in between
+                RenderFrameIdentical = !RenderFramePending
+                    && RenderDispCnt == DispCnt
                     && RenderAlphaRef == AlphaRef
                     && RenderClearAttr1 == ClearAttr1
                     && RenderClearAttr2 == ClearAttr2
@@ -2602,6 +3200,20 @@ void VBlank()
 
 void VCount215()
 {
+    RenderFramePending = false;
+    CurrentRenderer->RenderFrame();
+}
+
+void SkipFrame()
+{
+    RenderFramePending = true;
+}
+
+void RenderPendingFrame()
+{
+    if (!RenderFramePending) return;
+
+    RenderFramePending = false;
     CurrentRenderer->RenderFrame();
 }
 
@@ -2689,6 +3301,32 @@ void WriteToGXFIFO(u32 val)
 }
 
 
+u32 MatrixStackLevels()
+{
+    // GXSTAT bits 8-13
+    if (GeometryThreaded)
+        return ((Shadow.PosMatrixStackPointer & 0x1F) << 8) |
+               ((Shadow.ProjMatrixStackPointer & 0x1) << 13);
+
+    return ((PosMatrixStackPointer & 0x1F) << 8) |
+           ((ProjMatrixStackPointer & 0x1) << 13);
+}
+
+void AckMatrixStackError()
+{
+    if (GeometryThreaded)
+    {
+        SyncGeometry();
+        Shadow.ProjMatrixStackPointer = 0;
+        Shadow.TexMatrixStackPointer = 0;
+    }
+
+    GXStat &= ~0x8000;
+    ProjMatrixStackPointer = 0;
+    //PosMatrixStackPointer = 0;
+    TexMatrixStackPointer = 0; // CHECKME
+}
+
 u8 Read8(u32 addr)
 {
     switch (addr)
@@ -2699,9 +3337,7 @@ u8 Read8(u32 addr)
     case 0x04000601:
         {
             Run();
-            return ((GXStat >> 8) & 0xFF) |
-                   (PosMatrixStackPointer & 0x1F) |
-                   ((ProjMatrixStackPointer & 0x1) << 5);
+            return ((GXStat | MatrixStackLevels()) >> 8) & 0xFF;
         }
     case 0x04000602:
         {
@@ -2733,6 +3369,7 @@ u16 Read16(u32 addr)
     switch (addr)
     {
     case 0x04000060:
+        if (GeometryThreaded) SyncGeometry();
         return DispCnt;
 
     case 0x04000320:
@@ -2742,9 +3379,7 @@ u16 Read16(u32 addr)
         {
             Run();
 
-            return (GXStat & 0xFFFF) |
-                   ((PosMatrixStackPointer & 0x1F) << 8) |
-                   ((ProjMatrixStackPointer & 0x1) << 13);
+            return (GXStat & 0xFFFF) | MatrixStackLevels();
         }
     case 0x04000602:
         {
@@ -2759,8 +3394,10 @@ u16 Read16(u32 addr)
         }
 
     case 0x04000604:
+        if (GeometryThreaded) SyncGeometry();
         return NumPolygons;
     case 0x04000606:
+        if (GeometryThreaded) SyncGeometry();
         return NumVertices;
 
     case 0x04000630: return VecTestResult[0];
@@ -2777,6 +3414,7 @@ u32 Read32(u32 addr)
     switch (addr)
     {
     case 0x04000060:
+        if (GeometryThreaded) SyncGeometry();
         return DispCnt;
 
     case 0x04000320:
@@ -2789,21 +3427,27 @@ u32 Read32(u32 addr)
             u32 fifolevel = CmdFIFO.Level();
 
             return GXStat |
-                   ((PosMatrixStackPointer & 0x1F) << 8) |
-                   ((ProjMatrixStackPointer & 0x1) << 13) |
+                   MatrixStackLevels() |
                    (fifolevel << 16) |
                    (fifolevel < 128 ? (1<<25) : 0) |
                    (fifolevel == 0  ? (1<<26) : 0);
         }
 
     case 0x04000604:
+        if (GeometryThreaded) SyncGeometry();
         return NumPolygons | (NumVertices << 16);
 
     case 0x04000620: return PosTestResult[0];
     case 0x04000624: return PosTestResult[1];
     case 0x04000628: return PosTestResult[2];
     case 0x0400062C: return PosTestResult[3];
+    }
+
+    if (GeometryThreaded && addr >= 0x04000640 && addr < 0x040006A4)
+        SyncGeometry();
 
+    switch (addr)
+    {
     case 0x04000680: return VecMatrix[0];
     case 0x04000684: return VecMatrix[1];
     case 0x04000688: return VecMatrix[2];
@@ -2839,12 +3483,7 @@ void Write8(u32 addr, u8 val)
 
     case 0x04000601:
         if (val & 0x80)
-        {
-            GXStat &= ~0x8000;
-            ProjMatrixStackPointer = 0;
-            //PosMatrixStackPointer = 0;
-            TexMatrixStackPointer = 0; // CHECKME
-        }
+            AckMatrixStackError();
         return;
     case 0x04000603:
         val &= 0xC0;
@@ -2883,6 +3522,7 @@ void Write16(u32 addr, u16 val)
     switch (addr)
     {
     case 0x04000060:
+        if (GeometryThreaded) SyncGeometry();
         DispCnt = (val & 0x4FFF) | (DispCnt & 0x3000);
         if (val & (1<<12)) DispCnt &= ~(1<<12);
         if (val & (1<<13)) DispCnt &= ~(1<<13);
@@ -2919,12 +3559,7 @@ void Write16(u32 addr, u16 val)
 
     case 0x04000600:
         if (val & 0x8000)
-        {
-            GXStat &= ~0x8000;
-            ProjMatrixStackPointer = 0;
-            //PosMatrixStackPointer = 0;
-            TexMatrixStackPointer = 0; // CHECKME
-        }
+            AckMatrixStackError();
         return;
     case 0x04000602:
         val &= 0xC000;
@@ -2934,6 +3569,7 @@ void Write16(u32 addr, u16 val)
         return;
 
     case 0x04000610:
+        if (GeometryThreaded) SyncGeometry();
         val &= 0x7FFF;
         ZeroDotWLimit = (val * 0x200) + 0x1FF;
         return;
@@ -2970,6 +3606,7 @@ void Write32(u32 addr, u32 val)
     switch (addr)
     {
     case 0x04000060:
+        if (GeometryThreaded) SyncGeometry();
         DispCnt = (val & 0x4FFF) | (DispCnt & 0x3000);
         if (val & (1<<12)) DispCnt &= ~(1<<12);
         if (val & (1<<13)) DispCnt &= ~(1<<13);
@@ -2997,12 +3634,7 @@ void Write32(u32 addr, u32 val)
 
     case 0x04000600:
         if (val & 0x8000)
-        {
-            GXStat &= ~0x8000;
-            ProjMatrixStackPointer = 0;
-            //PosMatrixStackPointer = 0;
-            TexMatrixStackPointer = 0; // CHECKME
-        }
+            AckMatrixStackError();
         val &= 0xC0000000;
         GXStat &= 0x3FFFFFFF;
         GXStat |= val;
@@ -3010,6 +3642,7 @@ void Write32(u32 addr, u32 val)
         return;
 
     case 0x04000610:
+        if (GeometryThreaded) SyncGeometry();
         val &= 0x7FFF;
         ZeroDotWLimit = (val * 0x200) + 0x1FF;
         return;
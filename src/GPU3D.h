@@ -92,6 +92,7 @@ extern u8 RenderFogDensityTable[34];
 extern u32 RenderClearAttr1, RenderClearAttr2;
 
 extern bool RenderFrameIdentical;
+extern bool RenderFramePending;
 
 extern u16 RenderXPos;
 
@@ -110,9 +111,13 @@ void DoSavestate(Savestate* file);
 
 void SetEnabled(bool geometry, bool rendering);
 
+// run the geometry engine on a separate thread (cycle timings are approximated)
+void SetThreadedGeometry(bool threaded);
+
 void ExecuteCommand();
 
 s32 CyclesToRunFor();
+bool IsIdle();
 void Run();
 void CheckFIFOIRQ();
 void CheckFIFODMA();
@@ -120,6 +125,8 @@ void CheckFIFODMA();
 void VCount144();
 void VBlank();
 void VCount215();
+void SkipFrame();
+void RenderPendingFrame();
 
 void RestartFrame();
 
@@ -62,7 +62,10 @@ void SoftRenderer::SetupRenderThread()
         Platform::Semaphore_Reset(Sema_RenderStart);
         Platform::Semaphore_Reset(Sema_ScanlineCount);
 
-        Platform::Semaphore_Post(Sema_RenderStart);
+        // if rendering the current frame was skipped, it will
+        // be started later on if it turns out to be needed
+        if (!GPU3D::RenderFramePending)
+            Platform::Semaphore_Post(Sema_RenderStart);
     }
     else
     {
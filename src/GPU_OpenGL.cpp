@@ -224,4 +224,10 @@ GLuint GLCompositor::GetOutputTexture(int buf)
     return CompScreenOutputTex[buf];
 }
 
+void GLCompositor::GetOutputSize(int& width, int& height)
+{
+    width = ScreenW;
+    height = ScreenH;
+}
+
 }
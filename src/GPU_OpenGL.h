@@ -41,6 +41,7 @@ public:
     void Stop();
     void RenderFrame();
     GLuint GetOutputTexture(int buf);
+    void GetOutputSize(int& width, int& height);
 private:
 
     int Scale;
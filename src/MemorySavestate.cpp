@@ -36,15 +36,21 @@
     Implementation details
 */
 
-MemorySavestate::MemorySavestate(u8* buffer, bool save) : Savestate()
+MemorySavestate::MemorySavestate(u8* buffer, bool save) : MemorySavestate(buffer, 0xFFFFFFFF, save)
+{
+}
+
+MemorySavestate::MemorySavestate(u8* buffer, u32 length, bool save) : Savestate()
 {
     Buffer = buffer;
     BufferPos = 0;
+    BufferLength = length;
 
     VersionMajor = SAVESTATE_MAJOR;
     VersionMinor = SAVESTATE_MINOR;
 
     Error = false;
+    Snapshot = false;
 
     if (save)
     {
@@ -259,12 +265,27 @@ void MemorySavestate::VarArray(void* data, u32 len)
 
 void MemorySavestate::BufferWrite(const void* data, u32 length)
 {
+    if (BufferPos > BufferLength || length > BufferLength - BufferPos)
+    {
+        printf("MemorySavestate: buffer full\n");
+        Error = true;
+        return;
+    }
+
     memcpy(&Buffer[BufferPos], data, length);
     BufferPos += length;
 }
 
 void MemorySavestate::BufferRead(void* into, u32 length)
 {
+    if (BufferPos > BufferLength || length > BufferLength - BufferPos)
+    {
+        printf("MemorySavestate: read past the end of the buffer\n");
+        Error = true;
+        memset(into, 0, length);
+        return;
+    }
+
     memcpy(into, &Buffer[BufferPos], length);
     BufferPos += length;
 }
@@ -24,6 +24,7 @@
 class MemorySavestate : public Savestate {
 public:
     MemorySavestate(u8* buffer, bool save);
+    MemorySavestate(u8* buffer, u32 length, bool save);
     ~MemorySavestate() override;
 
     void Section(const char* magic) override;
@@ -34,6 +35,9 @@ public:
     void Bool32(bool* var) override;
     void VarArray(void* data, u32 len) override;
 
+    // bytes used so far in the buffer
+    u32 GetLength() { return BufferPos; }
+
 private:
     const int HEADER_SIZE = 0x4;
 
@@ -43,6 +47,7 @@ private:
 
     u8* Buffer;
     u32 BufferPos;
+    u32 BufferLength;
 };
 
 
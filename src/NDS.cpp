@@ -78,6 +78,22 @@ u32 ARM9Regions[0x40000];
 u8 ARM7MemTimings[0x20000][4];
 u32 ARM7Regions[0x20000];
 
+// host pointers for directly mapped memory, in 16K pages up to 0x08000000
+// accesses to pages that are NULL go through the regular handlers
+// VRAM is only mapped for reading (writes need to be tracked)
+u8* ARM9PageRead[0x2000];
+u8* ARM9PageWrite[0x2000];
+u8* ARM7PageRead[0x2000];
+u8* ARM7PageWrite[0x2000];
+
+// idle loop verdicts are kept until the code they were made for is written to (see
+// ARM::CheckIdleLoop). the 512 byte blocks and 16K pages holding that code are set here,
+// hashed by host address: the pages are kept out of the write page tables, so that the
+// handlers see every write to them and can bump CodeGeneration when a block is hit
+u32 CodeGeneration;
+u64 CodeWatch[64];
+u64 PageWatch[64];
+
 ARMv5* ARM9;
 ARMv4* ARM7;
 
@@ -175,7 +191,8 @@ bool RunningGame;
 
 void DivDone(u32 param);
 void SqrtDone(u32 param);
-void RunTimer(u32 tid, s32 cycles);
+void TimerOverflow(u32 cpu);
+void ScheduleTimerOverflow(u32 cpu);
 void UpdateWifiTimings();
 void SetWifiWaitCnt(u16 val);
 void SetGBASlotTimings();
@@ -593,6 +610,7 @@ void Reset()
     memset(ARM7WRAM, 0, 0x10000);
 
     MapSharedWRAM(0);
+    UpdatePageTables();
 
     ExMemCnt[0] = 0x4000;
     ExMemCnt[1] = 0x4000;
@@ -732,10 +750,15 @@ bool DoSavestate_Scheduler(Savestate* file)
         DSi_CamModule::TransferScanline,
         DSi_DSP::DSPCatchUpU32,
 
+        TimerOverflow,
+
         nullptr
     };
 
     int len = Event_MAX;
+    if (!file->IsAtleastVersion(9, 2))
+        len = Event_Timer9;
+
     if (file->Saving)
     {
         for (int i = 0; i < len; i++)
@@ -816,7 +839,8 @@ bool DoSavestate(Savestate* file)
             return false;
     }
 
-    file->VarArray(MainRAM, MainRAMMaxSize);
+    // a snapshot doesn't outlive the session, so the RAM the console doesn't have can be left out
+    file->VarArray(MainRAM, file->Snapshot ? (MainRAMMask + 1) : MainRAMMaxSize);
     file->VarArray(SharedWRAM, SharedWRAMSize);
     file->VarArray(ARM7WRAM, ARM7WRAMSize);
 
@@ -894,11 +918,18 @@ bool DoSavestate(Savestate* file)
         // 'dept of redundancy dept'
         // but we do need to update the mappings
         MapSharedWRAM(WRAMCnt);
+        UpdatePageTables();
 
-        InitTimings();
+        // the base timings don't change within a session
+        if (!file->Snapshot)
+            InitTimings();
         SetGBASlotTimings();
 
         UpdateWifiTimings();
+
+        // older savestates don't have the timer events
+        ScheduleTimerOverflow(0);
+        ScheduleTimerOverflow(1);
     }
 
     for (int i = 0; i < 8; i++)
@@ -930,8 +961,15 @@ bool DoSavestate(Savestate* file)
 #ifdef JIT_ENABLED
     if (!file->Saving)
     {
-        ARMJIT::ResetBlockCache();
-        ARMJIT_Memory::Reset();
+        if (file->Snapshot)
+        {
+            ARMJIT::RetireBlockCache();
+        }
+        else
+        {
+            ARMJIT::ResetBlockCache();
+            ARMJIT_Memory::Reset();
+        }
     }
 #endif
 
@@ -954,6 +992,28 @@ bool LoadCart(const u8* romdata, u32 romlen, const u8* savedata, u32 savelen)
     return true;
 }
 
+bool LoadCart(int romfd, u32 romlen, const u8* savedata, u32 savelen)
+{
+    if (!NDSCart::LoadROM(romfd, romlen))
+        return false;
+
+    if (savedata && savelen)
+        NDSCart::LoadSave(savedata, savelen);
+
+    return true;
+}
+
+bool LoadCart(CompressedROM* rom, const u8* savedata, u32 savelen)
+{
+    if (!NDSCart::LoadROM(rom))
+        return false;
+
+    if (savedata && savelen)
+        NDSCart::LoadSave(savedata, savelen);
+
+    return true;
+}
+
 void LoadSave(const u8* savedata, u32 savelen)
 {
     if (savedata && savelen)
@@ -991,12 +1051,30 @@ void EjectGBACart()
     GBACart::EjectCart();
 }
 
+void FlushStorage()
+{
+    NDSCart::FlushStorage();
+    if (ConsoleType == 1)
+        DSi::SDMMC->Flush();
+}
+
 void LoadBIOS()
 {
     Reset();
 }
 
 
+// halted with no DMA to run and no IRQ pending: nothing but an IRQ can wake the CPU
+bool CPUSleeping(u32 cpu)
+{
+    ARM* arm = cpu ? (ARM*)ARM7 : (ARM*)ARM9;
+
+    if (arm->Halted != 1) return false;
+    if (CPUStop & (cpu ? 0x0FFF0000 : 0x80000FFF)) return false;
+
+    return !HaltInterrupted(cpu);
+}
+
 u64 NextTarget()
 {
     u64 minEvent = UINT64_MAX;
@@ -1019,6 +1097,11 @@ u64 NextTarget()
     if (minEvent < max + kIterationCycleMargin)
         return minEvent;
 
+    // with both CPUs asleep nothing happens until the next event,
+    // unless the geometry engine still has commands to get through
+    if (CPUSleeping(0) && CPUSleeping(1) && GPU3D::IsIdle())
+        return minEvent;
+
     return max;
 }
 
@@ -1060,7 +1143,11 @@ u32 RunFrame()
             ARM9Target = target << ARM9ClockShift;
             CurCPU = 0;
 
-            if (CPUStop & 0x80000000)
+            if (CPUSleeping(0))
+            {
+                ARM9Timestamp = ARM9Target;
+            }
+            else if (CPUStop & 0x80000000)
             {
                 // GXFIFO stall
                 s32 cycles = GPU3D::CyclesToRunFor();
@@ -1085,12 +1172,17 @@ u32 RunFrame()
                     ARM9->Execute();
             }
 
-            RunTimers(0);
             GPU3D::Run();
 
             target = ARM9Timestamp >> ARM9ClockShift;
             CurCPU = 1;
 
+            if (ARM7Timestamp < target && CPUSleeping(1))
+            {
+                ARM7Target = target;
+                ARM7Timestamp = target;
+            }
+
             while (ARM7Timestamp < target)
             {
                 ARM7Target = target; // might be changed by a reschedule
@@ -1112,8 +1204,6 @@ u32 RunFrame()
 #endif
                         ARM7->Execute();
                 }
-
-                RunTimers(1);
             }
 
             RunSystem(target);
@@ -1361,6 +1451,167 @@ void MapSharedWRAM(u8 val)
         SWRAM_ARM7.Mask = 0x7FFF;
         break;
     }
+
+    UpdatePageTables();
+}
+
+
+void MapPages(u8** table, u32 start, u32 end, u8* mem, u32 mask)
+{
+    for (u32 addr = start; addr < end; addr += 0x4000)
+        table[addr >> 14] = mem ? &mem[addr & mask] : NULL;
+}
+
+void UpdatePageTables()
+{
+    memset(ARM9PageRead, 0, sizeof(ARM9PageRead));
+    memset(ARM9PageWrite, 0, sizeof(ARM9PageWrite));
+    memset(ARM7PageRead, 0, sizeof(ARM7PageRead));
+    memset(ARM7PageWrite, 0, sizeof(ARM7PageWrite));
+
+    MapPages(ARM9PageRead, 0x02000000, 0x03000000, MainRAM, MainRAMMask);
+    MapPages(ARM9PageRead, 0x03000000, 0x04000000, SWRAM_ARM9.Mem, SWRAM_ARM9.Mask);
+
+    MapPages(ARM7PageRead, 0x02000000, 0x03000000, MainRAM, MainRAMMask);
+    if (SWRAM_ARM7.Mem)
+        MapPages(ARM7PageRead, 0x03000000, 0x03800000, SWRAM_ARM7.Mem, SWRAM_ARM7.Mask);
+    else
+        MapPages(ARM7PageRead, 0x03000000, 0x03800000, ARM7WRAM, ARM7WRAMSize-1);
+    MapPages(ARM7PageRead, 0x03800000, 0x04000000, ARM7WRAM, ARM7WRAMSize-1);
+
+    // writes have to invalidate JIT blocks, they are left to the handlers
+#ifdef JIT_ENABLED
+    if (!EnableJIT)
+#endif
+    {
+        memcpy(ARM9PageWrite, ARM9PageRead, sizeof(ARM9PageWrite));
+        memcpy(ARM7PageWrite, ARM7PageRead, sizeof(ARM7PageWrite));
+    }
+
+    // what's mapped where may have changed, start watching code over
+    memset(PageWatch, 0, sizeof(PageWatch));
+    CodeWritten();
+
+    UpdateVRAMPages();
+}
+
+inline bool IsWatched(const u64* watch, uintptr_t key)
+{
+    return watch[(key >> 6) & 63] & (1ULL << (key & 63));
+}
+
+inline bool InMemory(const u8* ptr, u32 len, const u8* mem, u32 size)
+{
+    return ptr >= mem && ptr + len <= mem + size;
+}
+
+bool WatchCode(u8* ptr, u32 len)
+{
+    // only memory that is never written behind the handlers' back
+    if (!InMemory(ptr, len, MainRAM, MainRAMMask + 1) &&
+        !InMemory(ptr, len, SharedWRAM, SharedWRAMSize) &&
+        !InMemory(ptr, len, ARM7WRAM, ARM7WRAMSize) &&
+        !InMemory(ptr, len, ARM9->ITCM, ITCMPhysicalSize))
+        return false;
+
+    uintptr_t start = (uintptr_t)ptr;
+    uintptr_t end = start + len - 1;
+
+    for (uintptr_t block = start >> 9; block <= (end >> 9); block++)
+        CodeWatch[(block >> 6) & 63] |= (1ULL << (block & 63));
+
+    bool newpage = false;
+    for (uintptr_t page = start >> 14; page <= (end >> 14); page++)
+    {
+        if (IsWatched(PageWatch, page)) continue;
+        PageWatch[(page >> 6) & 63] |= (1ULL << (page & 63));
+        newpage = true;
+    }
+
+    if (newpage)
+    {
+        for (u32 i = 0; i < 0x2000; i++)
+        {
+            if (ARM9PageWrite[i] && IsWatched(PageWatch, (uintptr_t)ARM9PageWrite[i] >> 14))
+                ARM9PageWrite[i] = NULL;
+            if (ARM7PageWrite[i] && IsWatched(PageWatch, (uintptr_t)ARM7PageWrite[i] >> 14))
+                ARM7PageWrite[i] = NULL;
+        }
+    }
+
+    return true;
+}
+
+void CheckCodeWrite(u8* ptr, u32 len)
+{
+    uintptr_t start = (uintptr_t)ptr;
+    uintptr_t end = start + len - 1;
+
+    for (uintptr_t block = start >> 9; block <= (end >> 9); block++)
+    {
+        if (IsWatched(CodeWatch, block))
+        {
+            CodeWritten();
+            return;
+        }
+    }
+}
+
+void CodeWritten()
+{
+    CodeGeneration++;
+    memset(CodeWatch, 0, sizeof(CodeWatch));
+}
+
+u8* GetLCDCPage(u32 addr)
+{
+    u32 offset = addr & 0xFC000;
+    int bank;
+
+    if      (offset < 0x80000) { bank = offset >> 17; offset &= 0x1FFFF; }
+    else if (offset < 0x90000) { bank = 4; offset &= 0xFFFF; }
+    else if (offset < 0x94000) { bank = 5; offset = 0; }
+    else if (offset < 0x98000) { bank = 6; offset = 0; }
+    else if (offset < 0xA0000) { bank = 7; offset &= 0x7FFF; }
+    else if (offset < 0xA4000) { bank = 8; offset = 0; }
+    else return NULL;
+
+    if (!(GPU::VRAMMap_LCDC & (1<<bank)))
+        return NULL;
+
+    return &GPU::VRAM[bank][offset];
+}
+
+void UpdateVRAMPages()
+{
+    // only pages that have one single bank mapped can be accessed directly
+    for (u32 addr = 0x06000000; addr < 0x07000000; addr += 0x4000)
+    {
+        u8* ptr;
+        switch (addr & 0x00E00000)
+        {
+        case 0x00000000: ptr = GPU::VRAMPtr_ABG[(addr >> 14) & 0x1F]; break;
+        case 0x00200000: ptr = GPU::VRAMPtr_BBG[(addr >> 14) & 0x7]; break;
+        case 0x00400000: ptr = GPU::VRAMPtr_AOBJ[(addr >> 14) & 0xF]; break;
+        case 0x00600000: ptr = GPU::VRAMPtr_BOBJ[(addr >> 14) & 0x7]; break;
+        default:         ptr = GetLCDCPage(addr); break;
+        }
+        ARM9PageRead[addr >> 14] = ptr;
+
+        u32 mask = GPU::VRAMMap_ARM7[(addr >> 17) & 0x1];
+        if (mask == (1<<2))
+            ptr = &GPU::VRAM_C[addr & 0x1C000];
+        else if (mask == (1<<3))
+            ptr = &GPU::VRAM_D[addr & 0x1C000];
+        else
+            ptr = NULL;
+        ARM7PageRead[addr >> 14] = ptr;
+    }
+}
+
+inline u8* GetPage(u8* const* table, u32 addr)
+{
+    return (addr < 0x08000000) ? table[addr >> 14] : NULL;
 }
 
 
@@ -1667,67 +1918,112 @@ void MonitorARM9Jump(u32 addr)
 
 
 
-void HandleTimerOverflow(u32 tid)
+// advances the counter by the given amount (in 16.10 fixed point), and returns how many times it overflowed
+u64 AdvanceTimer(Timer* timer, u64 amount)
 {
-    Timer* timer = &Timers[tid];
-
-    timer->Counter += (timer->Reload << 10);
-    if (timer->Cnt & (1<<6))
-        SetIRQ(tid >> 2, IRQ_Timer0 + (tid & 0x3));
-
-    if ((tid & 0x3) == 3)
-        return;
-
-    for (;;)
+    u64 counter = timer->Counter + amount;
+    if (!(counter >> 26))
     {
-        tid++;
+        timer->Counter = counter;
+        return 0;
+    }
 
-        timer = &Timers[tid];
+    // every overflow after the first one takes a full period from the reload value
+    u64 reload = timer->Reload << 10;
+    u64 period = (1 << 26) - reload;
+    counter -= (1 << 26);
 
-        if ((timer->Cnt & 0x84) != 0x84)
-            break;
+    timer->Counter = reload + (counter % period);
+    return 1 + (counter / period);
+}
 
-        timer->Counter += (1 << 10);
-        if (!(timer->Counter >> 26))
-            break;
+void RunTimer(u32 tid, u64 cycles)
+{
+    Timer* timer = &Timers[tid];
 
-        timer->Counter = timer->Reload << 10;
+    u64 overflows = AdvanceTimer(timer, cycles << timer->CycleShift);
+    while (overflows)
+    {
         if (timer->Cnt & (1<<6))
             SetIRQ(tid >> 2, IRQ_Timer0 + (tid & 0x3));
 
         if ((tid & 0x3) == 3)
             break;
-    }
-}
 
-void RunTimer(u32 tid, s32 cycles)
-{
-    Timer* timer = &Timers[tid];
+        tid++;
+        timer = &Timers[tid];
 
-    timer->Counter += (cycles << timer->CycleShift);
-    while (timer->Counter >> 26)
-    {
-        timer->Counter -= (1 << 26);
-        HandleTimerOverflow(tid);
+        if ((timer->Cnt & 0x84) != 0x84)
+            break;
+
+        overflows = AdvanceTimer(timer, overflows << 10);
     }
 }
 
+// timers aren't ticked along with the CPUs. their counters are brought up to date when they're
+// read or written, and an event is only scheduled for overflows that can raise an IRQ
 void RunTimers(u32 cpu)
 {
     u32 timermask = TimerCheckMask[cpu];
-    s32 cycles;
+    u64 timestamp;
 
     if (cpu == 0)
-        cycles = (ARM9Timestamp >> ARM9ClockShift) - TimerTimestamp[0];
+        timestamp = ARM9Timestamp >> ARM9ClockShift;
     else
-        cycles = ARM7Timestamp - TimerTimestamp[1];
+        timestamp = ARM7Timestamp;
+
+    if (timestamp <= TimerTimestamp[cpu])
+        return;
+
+    u64 cycles = timestamp - TimerTimestamp[cpu];
 
     if (timermask & 0x1) RunTimer((cpu<<2)+0, cycles);
     if (timermask & 0x2) RunTimer((cpu<<2)+1, cycles);
     if (timermask & 0x4) RunTimer((cpu<<2)+2, cycles);
     if (timermask & 0x8) RunTimer((cpu<<2)+3, cycles);
 
-    TimerTimestamp[cpu] += cycles;
+    TimerTimestamp[cpu] = timestamp;
+}
+
+void ScheduleTimerOverflow(u32 cpu)
+{
+    u32 timermask = TimerCheckMask[cpu];
+    u64 next = UINT64_MAX;
+
+    CancelEvent(Event_Timer9 + cpu);
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (!(timermask & (1<<i))) continue;
+
+        // the overflow matters if this timer or one it cascades into raises an IRQ
+        bool irq = false;
+        for (int j = i; j < 4; j++)
+        {
+            Timer* timer = &Timers[(cpu<<2)+j];
+            if (j > i && (timer->Cnt & 0x84) != 0x84) break;
+            if (timer->Cnt & (1<<6))
+            {
+                irq = true;
+                break;
+            }
+        }
+        if (!irq) continue;
+
+        Timer* timer = &Timers[(cpu<<2)+i];
+        u64 cycles = ((1 << 26) - timer->Counter + (1 << timer->CycleShift) - 1) >> timer->CycleShift;
+        if (TimerTimestamp[cpu] + cycles < next)
+            next = TimerTimestamp[cpu] + cycles;
+    }
+
+    if (next != UINT64_MAX)
+        ScheduleEvent(Event_Timer9 + cpu, next, TimerOverflow, cpu);
+}
+
+void TimerOverflow(u32 cpu)
+{
+    RunTimers(cpu);
+    ScheduleTimerOverflow(cpu);
 }
 
 const s32 TimerPrescaler[4] = {0, 6, 8, 10};
@@ -1740,6 +2036,13 @@ u16 TimerGetCounter(u32 timer)
     return ret >> 10;
 }
 
+void TimerSetReload(u32 id, u16 val)
+{
+    // overflows that are already due still reload with the old value
+    RunTimers(id>>2);
+    Timers[id].Reload = val;
+}
+
 void TimerStart(u32 id, u16 cnt)
 {
     Timer* timer = &Timers[id];
@@ -1760,6 +2063,8 @@ void TimerStart(u32 id, u16 cnt)
         TimerCheckMask[id>>2] |= 0x01 << (id&0x3);
     else
         TimerCheckMask[id>>2] &= ~(0x01 << (id&0x3));
+
+    ScheduleTimerOverflow(id>>2);
 }
 
 
@@ -2037,6 +2342,9 @@ void debug(u32 param)
 
 u8 ARM9Read8(u32 addr)
 {
+    u8* page = GetPage(ARM9PageRead, addr);
+    if (page) return *(u8*)&page[addr & 0x3FFF];
+
     if ((addr & 0xFFFFF000) == 0xFFFF0000)
     {
         return *(u8*)&ARM9BIOS[addr & 0xFFF];
@@ -2097,6 +2405,9 @@ u16 ARM9Read16(u32 addr)
 {
     addr &= ~0x1;
 
+    u8* page = GetPage(ARM9PageRead, addr);
+    if (page) return *(u16*)&page[addr & 0x3FFF];
+
     if ((addr & 0xFFFFF000) == 0xFFFF0000)
     {
         return *(u16*)&ARM9BIOS[addr & 0xFFF];
@@ -2157,6 +2468,9 @@ u32 ARM9Read32(u32 addr)
 {
     addr &= ~0x3;
 
+    u8* page = GetPage(ARM9PageRead, addr);
+    if (page) return *(u32*)&page[addr & 0x3FFF];
+
     if ((addr & 0xFFFFF000) == 0xFFFF0000)
     {
         return *(u32*)&ARM9BIOS[addr & 0xFFF];
@@ -2218,12 +2532,20 @@ u32 ARM9Read32(u32 addr)
 
 void ARM9Write8(u32 addr, u8 val)
 {
+    u8* page = GetPage(ARM9PageWrite, addr);
+    if (page)
+    {
+        *(u8*)&page[addr & 0x3FFF] = val;
+        return;
+    }
+
     switch (addr & 0xFF000000)
     {
     case 0x02000000:
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        CheckCodeWrite(&MainRAM[addr & MainRAMMask]);
         *(u8*)&MainRAM[addr & MainRAMMask] = val;
         return;
 
@@ -2233,6 +2555,7 @@ void ARM9Write8(u32 addr, u8 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
+            CheckCodeWrite(&SWRAM_ARM9.Mem[addr & SWRAM_ARM9.Mask]);
             *(u8*)&SWRAM_ARM9.Mem[addr & SWRAM_ARM9.Mask] = val;
         }
         return;
@@ -2263,12 +2586,20 @@ void ARM9Write16(u32 addr, u16 val)
 {
     addr &= ~0x1;
 
+    u8* page = GetPage(ARM9PageWrite, addr);
+    if (page)
+    {
+        *(u16*)&page[addr & 0x3FFF] = val;
+        return;
+    }
+
     switch (addr & 0xFF000000)
     {
     case 0x02000000:
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        CheckCodeWrite(&MainRAM[addr & MainRAMMask]);
         *(u16*)&MainRAM[addr & MainRAMMask] = val;
         return;
 
@@ -2278,6 +2609,7 @@ void ARM9Write16(u32 addr, u16 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
+            CheckCodeWrite(&SWRAM_ARM9.Mem[addr & SWRAM_ARM9.Mask]);
             *(u16*)&SWRAM_ARM9.Mem[addr & SWRAM_ARM9.Mask] = val;
         }
         return;
@@ -2329,12 +2661,20 @@ void ARM9Write32(u32 addr, u32 val)
 {
     addr &= ~0x3;
 
+    u8* page = GetPage(ARM9PageWrite, addr);
+    if (page)
+    {
+        *(u32*)&page[addr & 0x3FFF] = val;
+        return;
+    }
+
     switch (addr & 0xFF000000)
     {
     case 0x02000000:
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        CheckCodeWrite(&MainRAM[addr & MainRAMMask]);
         *(u32*)&MainRAM[addr & MainRAMMask] = val;
         return ;
 
@@ -2344,6 +2684,7 @@ void ARM9Write32(u32 addr, u32 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
+            CheckCodeWrite(&SWRAM_ARM9.Mem[addr & SWRAM_ARM9.Mask]);
             *(u32*)&SWRAM_ARM9.Mem[addr & SWRAM_ARM9.Mask] = val;
         }
         return;
@@ -2428,6 +2769,9 @@ bool ARM9GetMemRegion(u32 addr, bool write, MemRegion* region)
 
 u8 ARM7Read8(u32 addr)
 {
+    u8* page = GetPage(ARM7PageRead, addr);
+    if (page) return *(u8*)&page[addr & 0x3FFF];
+
     if (addr < 0x00004000)
     {
         // TODO: check the boundary? is it 4000 or higher on regular DS?
@@ -2496,6 +2840,9 @@ u16 ARM7Read16(u32 addr)
 {
     addr &= ~0x1;
 
+    u8* page = GetPage(ARM7PageRead, addr);
+    if (page) return *(u16*)&page[addr & 0x3FFF];
+
     if (addr < 0x00004000)
     {
         if (ARM7->R[15] >= 0x00004000)
@@ -2562,6 +2909,9 @@ u32 ARM7Read32(u32 addr)
 {
     addr &= ~0x3;
 
+    u8* page = GetPage(ARM7PageRead, addr);
+    if (page) return *(u32*)&page[addr & 0x3FFF];
+
     if (addr < 0x00004000)
     {
         if (ARM7->R[15] >= 0x00004000)
@@ -2629,6 +2979,13 @@ u32 ARM7Read32(u32 addr)
 
 void ARM7Write8(u32 addr, u8 val)
 {
+    u8* page = GetPage(ARM7PageWrite, addr);
+    if (page)
+    {
+        *(u8*)&page[addr & 0x3FFF] = val;
+        return;
+    }
+
     switch (addr & 0xFF800000)
     {
     case 0x02000000:
@@ -2636,6 +2993,7 @@ void ARM7Write8(u32 addr, u8 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        CheckCodeWrite(&MainRAM[addr & MainRAMMask]);
         *(u8*)&MainRAM[addr & MainRAMMask] = val;
         return;
 
@@ -2645,6 +3003,7 @@ void ARM7Write8(u32 addr, u8 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
+            CheckCodeWrite(&SWRAM_ARM7.Mem[addr & SWRAM_ARM7.Mask]);
             *(u8*)&SWRAM_ARM7.Mem[addr & SWRAM_ARM7.Mask] = val;
             return;
         }
@@ -2653,6 +3012,7 @@ void ARM7Write8(u32 addr, u8 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
+            CheckCodeWrite(&ARM7WRAM[addr & (ARM7WRAMSize - 1)]);
             *(u8*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
             return;
         }
@@ -2661,6 +3021,7 @@ void ARM7Write8(u32 addr, u8 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
+        CheckCodeWrite(&ARM7WRAM[addr & (ARM7WRAMSize - 1)]);
         *(u8*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
         return;
 
@@ -2698,6 +3059,13 @@ void ARM7Write16(u32 addr, u16 val)
 {
     addr &= ~0x1;
 
+    u8* page = GetPage(ARM7PageWrite, addr);
+    if (page)
+    {
+        *(u16*)&page[addr & 0x3FFF] = val;
+        return;
+    }
+
     switch (addr & 0xFF800000)
     {
     case 0x02000000:
@@ -2705,6 +3073,7 @@ void ARM7Write16(u32 addr, u16 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        CheckCodeWrite(&MainRAM[addr & MainRAMMask]);
         *(u16*)&MainRAM[addr & MainRAMMask] = val;
         return;
 
@@ -2714,6 +3083,7 @@ void ARM7Write16(u32 addr, u16 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
+            CheckCodeWrite(&SWRAM_ARM7.Mem[addr & SWRAM_ARM7.Mask]);
             *(u16*)&SWRAM_ARM7.Mem[addr & SWRAM_ARM7.Mask] = val;
             return;
         }
@@ -2722,6 +3092,7 @@ void ARM7Write16(u32 addr, u16 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
+            CheckCodeWrite(&ARM7WRAM[addr & (ARM7WRAMSize - 1)]);
             *(u16*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
             return;
         }
@@ -2730,6 +3101,7 @@ void ARM7Write16(u32 addr, u16 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
+        CheckCodeWrite(&ARM7WRAM[addr & (ARM7WRAMSize - 1)]);
         *(u16*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
         return;
 
@@ -2778,6 +3150,13 @@ void ARM7Write32(u32 addr, u32 val)
 {
     addr &= ~0x3;
 
+    u8* page = GetPage(ARM7PageWrite, addr);
+    if (page)
+    {
+        *(u32*)&page[addr & 0x3FFF] = val;
+        return;
+    }
+
     switch (addr & 0xFF800000)
     {
     case 0x02000000:
@@ -2785,6 +3164,7 @@ void ARM7Write32(u32 addr, u32 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        CheckCodeWrite(&MainRAM[addr & MainRAMMask]);
         *(u32*)&MainRAM[addr & MainRAMMask] = val;
         return;
 
@@ -2794,6 +3174,7 @@ void ARM7Write32(u32 addr, u32 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
+            CheckCodeWrite(&SWRAM_ARM7.Mem[addr & SWRAM_ARM7.Mask]);
             *(u32*)&SWRAM_ARM7.Mem[addr & SWRAM_ARM7.Mask] = val;
             return;
         }
@@ -2802,6 +3183,7 @@ void ARM7Write32(u32 addr, u32 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
+            CheckCodeWrite(&ARM7WRAM[addr & (ARM7WRAMSize - 1)]);
             *(u32*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
             return;
         }
@@ -2810,6 +3192,7 @@ void ARM7Write32(u32 addr, u32 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
+        CheckCodeWrite(&ARM7WRAM[addr & (ARM7WRAMSize - 1)]);
         *(u32*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
         return;
 
@@ -3424,13 +3807,13 @@ void ARM9IOWrite16(u32 addr, u16 val)
     case 0x040000EC: DMA9Fill[3] = (DMA9Fill[3] & 0xFFFF0000) | val; return;
     case 0x040000EE: DMA9Fill[3] = (DMA9Fill[3] & 0x0000FFFF) | (val << 16); return;
 
-    case 0x04000100: Timers[0].Reload = val; return;
+    case 0x04000100: TimerSetReload(0, val); return;
     case 0x04000102: TimerStart(0, val); return;
-    case 0x04000104: Timers[1].Reload = val; return;
+    case 0x04000104: TimerSetReload(1, val); return;
     case 0x04000106: TimerStart(1, val); return;
-    case 0x04000108: Timers[2].Reload = val; return;
+    case 0x04000108: TimerSetReload(2, val); return;
     case 0x0400010A: TimerStart(2, val); return;
-    case 0x0400010C: Timers[3].Reload = val; return;
+    case 0x0400010C: TimerSetReload(3, val); return;
     case 0x0400010E: TimerStart(3, val); return;
 
     case 0x04000132:
@@ -3610,19 +3993,19 @@ void ARM9IOWrite32(u32 addr, u32 val)
     case 0x040000EC: DMA9Fill[3] = val; return;
 
     case 0x04000100:
-        Timers[0].Reload = val & 0xFFFF;
+        TimerSetReload(0, val & 0xFFFF);
         TimerStart(0, val>>16);
         return;
     case 0x04000104:
-        Timers[1].Reload = val & 0xFFFF;
+        TimerSetReload(1, val & 0xFFFF);
         TimerStart(1, val>>16);
         return;
     case 0x04000108:
-        Timers[2].Reload = val & 0xFFFF;
+        TimerSetReload(2, val & 0xFFFF);
         TimerStart(2, val>>16);
         return;
     case 0x0400010C:
-        Timers[3].Reload = val & 0xFFFF;
+        TimerSetReload(3, val & 0xFFFF);
         TimerStart(3, val>>16);
         return;
 
@@ -4136,13 +4519,13 @@ void ARM7IOWrite16(u32 addr, u16 val)
     case 0x040000DC: DMAs[7]->WriteCnt((DMAs[7]->Cnt & 0xFFFF0000) | val); return;
     case 0x040000DE: DMAs[7]->WriteCnt((DMAs[7]->Cnt & 0x0000FFFF) | (val << 16)); return;
 
-    case 0x04000100: Timers[4].Reload = val; return;
+    case 0x04000100: TimerSetReload(4, val); return;
     case 0x04000102: TimerStart(4, val); return;
-    case 0x04000104: Timers[5].Reload = val; return;
+    case 0x04000104: TimerSetReload(5, val); return;
     case 0x04000106: TimerStart(5, val); return;
-    case 0x04000108: Timers[6].Reload = val; return;
+    case 0x04000108: TimerSetReload(6, val); return;
     case 0x0400010A: TimerStart(6, val); return;
-    case 0x0400010C: Timers[7].Reload = val; return;
+    case 0x0400010C: TimerSetReload(7, val); return;
     case 0x0400010E: TimerStart(7, val); return;
 
     case 0x04000132: KeyCnt = val; return;
@@ -4298,19 +4681,19 @@ void ARM7IOWrite32(u32 addr, u32 val)
     case 0x040000DC: DMAs[7]->WriteCnt(val); return;
 
     case 0x04000100:
-        Timers[4].Reload = val & 0xFFFF;
+        TimerSetReload(4, val & 0xFFFF);
         TimerStart(4, val>>16);
         return;
     case 0x04000104:
-        Timers[5].Reload = val & 0xFFFF;
+        TimerSetReload(5, val & 0xFFFF);
         TimerStart(5, val>>16);
         return;
     case 0x04000108:
-        Timers[6].Reload = val & 0xFFFF;
+        TimerSetReload(6, val & 0xFFFF);
         TimerStart(6, val>>16);
         return;
     case 0x0400010C:
-        Timers[7].Reload = val & 0xFFFF;
+        TimerSetReload(7, val & 0xFFFF);
         TimerStart(7, val>>16);
         return;
 
@@ -24,6 +24,8 @@
 #include "Savestate.h"
 #include "types.h"
 
+class CompressedROM;
+
 // when touching the main loop/timing code, pls test a lot of shit
 // with this enabled, to make sure it doesn't desync
 //#define DEBUG_CHECK_DESYNC
@@ -52,6 +54,9 @@ enum
     Event_DSi_CamTransfer,
     Event_DSi_DSP,
 
+    Event_Timer9,
+    Event_Timer7,
+
     Event_MAX
 };
 
@@ -239,6 +244,8 @@ void SetConsoleType(int type);
 void LoadBIOS();
 
 bool LoadCart(const u8* romdata, u32 romlen, const u8* savedata, u32 savelen);
+bool LoadCart(int romfd, u32 romlen, const u8* savedata, u32 savelen);
+bool LoadCart(CompressedROM* rom, const u8* savedata, u32 savelen);
 void LoadSave(const u8* savedata, u32 savelen);
 void EjectCart();
 bool CartInserted();
@@ -250,6 +257,10 @@ bool LoadGBACart(const u8* romdata, u32 romlen, const u8* savedata, u32 savelen)
 void LoadGBAAddon(int type);
 void EjectGBACart();
 
+// writes back what's cached of the DLDI and DSi SD/NAND images. the frontend
+// should call this every few seconds, since DLDI doesn't tell when it's done writing
+void FlushStorage();
+
 u32 RunFrame();
 
 void TouchScreen(u16 x, u16 y);
@@ -272,6 +283,26 @@ void debug(u32 p);
 void Halt();
 
 void MapSharedWRAM(u8 val);
+void UpdatePageTables();
+void UpdateVRAMPages();
+
+// bumped whenever code that idle loop verdicts were made for may have been written to
+extern u32 CodeGeneration;
+extern u64 CodeWatch[64];
+
+// false if the code isn't in memory where writes can be seen
+bool WatchCode(u8* ptr, u32 len);
+void CheckCodeWrite(u8* ptr, u32 len);
+void CodeWritten();
+
+// every write to main RAM, WRAM and ITCM that doesn't go through the write page tables
+// has to come through here
+inline void CheckCodeWrite(u8* ptr)
+{
+    uintptr_t block = (uintptr_t)ptr >> 9;
+    if (CodeWatch[(block >> 6) & 63] & (1ULL << (block & 63)))
+        CodeWritten();
+}
 
 void UpdateIRQ(u32 cpu);
 void SetIRQ(u32 cpu, u32 irq);
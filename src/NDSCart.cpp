@@ -18,9 +18,14 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 #include "NDS.h"
 #include "DSi.h"
 #include "NDSCart.h"
+#include "CompressedROM.h"
 #include "ARM.h"
 #include "CRC32.h"
 #include "DSi_AES.h"
@@ -53,8 +58,15 @@ u8 TransferCmd[8];
 bool CartInserted;
 u8* CartROM;
 u32 CartROMSize;
+bool CartROMMapped;
 u32 CartID;
 
+// for compressed ROMs, only the blocks that are accessed directly (header,
+// secure area, binaries, banner) are loaded into CartROM
+// the rest is read through the image's block cache
+CompressedROM* CartROMImage;
+std::vector<bool> CartROMResident;
+
 NDSHeader Header;
 NDSBanner Banner;
 
@@ -66,6 +78,33 @@ u64 Key2_X;
 u64 Key2_Y;
 
 
+void CopyROM(u8* dst, u32 addr, u32 len)
+{
+    if (!CartROMImage)
+    {
+        memcpy(dst, CartROM+addr, len);
+        return;
+    }
+
+    u32 blocksize = CartROMImage->GetBlockSize();
+    while (len > 0)
+    {
+        u32 block = addr / blocksize;
+        u32 chunk = std::min(len, blocksize - (addr & (blocksize-1)));
+
+        // past the end of the image, CartROM holds the zero padding
+        if (block >= CartROMResident.size() || CartROMResident[block])
+            memcpy(dst, CartROM+addr, chunk);
+        else
+            CartROMImage->Read(addr, chunk, dst);
+
+        dst += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+}
+
+
 u32 ByteSwap(u32 val)
 {
     return (val >> 24) | ((val >> 8) & 0xFF00) | ((val << 8) & 0xFF0000) | (val << 24);
@@ -375,6 +414,10 @@ u8 CartCommon::SPIWrite(u8 val, u32 pos, bool last)
     return 0xFF;
 }
 
+void CartCommon::FlushStorage()
+{
+}
+
 void CartCommon::SetIRQ()
 {
     NDS::SetIRQ(0, NDS::IRQ_CartIREQMC);
@@ -387,7 +430,7 @@ void CartCommon::ReadROM(u32 addr, u32 len, u8* data, u32 offset)
     if ((addr+len) > ROMLength)
         len = ROMLength - addr;
 
-    memcpy(data+offset, ROM+addr, len);
+    CopyROM(data+offset, addr, len);
 }
 
 
@@ -568,7 +611,7 @@ void CartRetail::ReadROM_B7(u32 addr, u32 len, u8* data, u32 offset)
             addr = 0x8000 + (addr & 0x1FF);
     }
 
-    memcpy(data+offset, ROM+addr, len);
+    CopyROM(data+offset, addr, len);
 }
 
 u8 CartRetail::SRAMWrite_EEPROMTiny(u8 val, u32 pos, bool last)
@@ -1234,6 +1277,11 @@ void CartHomebrew::DoSavestate(Savestate* file)
     CartCommon::DoSavestate(file);
 }
 
+void CartHomebrew::FlushStorage()
+{
+    if (SD) SD->Flush();
+}
+
 int CartHomebrew::ROMCommandStart(u8* cmd, u8* data, u32 len)
 {
     if (CmdEncMode != 2) return CartCommon::ROMCommandStart(cmd, data, len);
@@ -1428,11 +1476,30 @@ void CartHomebrew::ReadROM_B7(u32 addr, u32 len, u8* data, u32 offset)
 
     addr &= (ROMLength-1);
 
-    memcpy(data+offset, ROM+addr, len);
+    CopyROM(data+offset, addr, len);
 }
 
 
 
+void FreeROM()
+{
+    if (CartROMImage) delete CartROMImage;
+    CartROMImage = nullptr;
+    CartROMResident.clear();
+
+    if (!CartROM) return;
+
+#ifndef _WIN32
+    if (CartROMMapped)
+        munmap(CartROM, CartROMSize);
+    else
+#endif
+        delete[] CartROM;
+
+    CartROM = nullptr;
+    CartROMMapped = false;
+}
+
 bool Init()
 {
     CartInserted = false;
@@ -1444,7 +1511,7 @@ bool Init()
 
 void DeInit()
 {
-    if (CartROM) delete[] CartROM;
+    FreeROM();
     if (Cart) delete Cart;
 }
 
@@ -1506,45 +1573,29 @@ void DoSavestate(Savestate* file)
 }
 
 
-bool ReadROMParams(u32 gamecode, ROMListEntry* params)
+// ROMList is looked up by binary search, make sure it stays sorted
+constexpr bool IsROMListSorted()
 {
-    u32 len = sizeof(ROMList) / sizeof(ROMListEntry);
-
-    u32 offset = 0;
-    u32 chk_size = len >> 1;
-    for (;;)
+    for (u32 i = 1; i < sizeof(ROMList) / sizeof(ROMListEntry); i++)
     {
-        u32 key = 0;
-        ROMListEntry* curentry = &ROMList[offset + chk_size];
-        key = curentry->GameCode;
+        if (ROMList[i-1].GameCode >= ROMList[i].GameCode)
+            return false;
+    }
+    return true;
+}
+static_assert(IsROMListSorted(), "ROMList must be sorted by game code, without duplicates");
 
-        if (key == gamecode)
-        {
-            memcpy(params, curentry, sizeof(ROMListEntry));
-            return true;
-        }
-        else
-        {
-            if (key < gamecode)
-            {
-                if (chk_size == 0)
-                    offset++;
-                else
-                    offset += chk_size;
-            }
-            else if (chk_size == 0)
-            {
-                return false;
-            }
+bool ReadROMParams(u32 gamecode, ROMListEntry* params)
+{
+    const ROMListEntry* end = &ROMList[sizeof(ROMList) / sizeof(ROMListEntry)];
+    const ROMListEntry* entry = std::lower_bound(ROMList, end, gamecode,
+                                                 [](const ROMListEntry& e, u32 code) { return e.GameCode < code; });
 
-            chk_size >>= 1;
-        }
+    if (entry == end || entry->GameCode != gamecode)
+        return false;
 
-        if (offset >= len)
-        {
-            return false;
-        }
-    }
+    memcpy(params, entry, sizeof(ROMListEntry));
+    return true;
 }
 
 
@@ -1579,18 +1630,15 @@ void DecryptSecureArea(u8* out)
     }
 }
 
-bool LoadROM(const u8* romdata, u32 romlen)
-{
-    if (CartInserted)
-        EjectCart();
-
-    memset(&Header, 0, sizeof(Header));
-    memset(&Banner, 0, sizeof(Banner));
+bool InsertROM(u32 romlen);
 
+bool ReserveROM(u32 romlen)
+{
     CartROMSize = 0x200;
     while (CartROMSize < romlen)
         CartROMSize <<= 1;
 
+#ifdef _WIN32
     try
     {
         CartROM = new u8[CartROMSize];
@@ -1602,8 +1650,126 @@ bool LoadROM(const u8* romdata, u32 romlen)
     }
 
     memset(CartROM, 0, CartROMSize);
+#else
+    // zero-filled memory that is only actually allocated once it is touched
+    u8* rom = (u8*)mmap(NULL, CartROMSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (rom == MAP_FAILED)
+    {
+        printf("NDSCart: failed to reserve memory for ROM (%d bytes)\n", CartROMSize);
+        return false;
+    }
+
+    CartROM = rom;
+    CartROMMapped = true;
+#endif
+
+    return true;
+}
+
+bool LoadROM(const u8* romdata, u32 romlen)
+{
+    if (CartInserted)
+        EjectCart();
+
+    if (!ReserveROM(romlen))
+        return false;
+
     memcpy(CartROM, romdata, romlen);
 
+    return InsertROM(romlen);
+}
+
+bool LoadROM(int romfd, u32 romlen)
+{
+#ifdef _WIN32
+    printf("NDSCart: mapping ROM files isn't supported on this platform\n");
+    return false;
+#else
+    if (CartInserted)
+        EjectCart();
+
+    if (!ReserveROM(romlen))
+        return false;
+
+    // map the file over the reserved memory
+    // the mapping is private: the secure area reencryption and DLDI patching only
+    // copy the pages they touch, and the file itself is never written to
+    if (mmap(CartROM, romlen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, romfd, 0) == MAP_FAILED)
+    {
+        printf("NDSCart: failed to map ROM file\n");
+        FreeROM();
+        return false;
+    }
+
+    return InsertROM(romlen);
+#endif
+}
+
+void LoadROMRange(u32 addr, u32 len)
+{
+    if (addr >= CartROMImage->GetSize() || len == 0) return;
+
+    u32 blocksize = CartROMImage->GetBlockSize();
+    u32 first = addr / blocksize;
+    u32 last = std::min((u64)addr + len - 1, (u64)CartROMImage->GetSize() - 1) / blocksize;
+
+    for (u32 i = first; i <= last; i++)
+    {
+        if (CartROMResident[i]) continue;
+
+        if (!CartROMImage->ReadBlock(i, &CartROM[i * blocksize]))
+            printf("NDSCart: failed to read ROM block %d\n", i);
+
+        CartROMResident[i] = true;
+    }
+}
+
+bool LoadROM(CompressedROM* rom)
+{
+    if (CartInserted)
+        EjectCart();
+
+    u32 romlen = rom->GetSize();
+    if (romlen < 0x200 || !ReserveROM(romlen))
+    {
+        delete rom;
+        return false;
+    }
+
+    CartROMImage = rom;
+    CartROMResident.assign(rom->GetNumBlocks(), false);
+
+    LoadROMRange(0, 0x8000);
+
+    const NDSHeader* header = (const NDSHeader*)CartROM;
+    u32 gamecode = *(u32*)header->GameCode;
+
+    if (header->ARM9ROMOffset < 0x4000 || gamecode == 0x23232323)
+    {
+        // homebrew gets the whole ROM copied to the SD image, and they're small anyway
+        LoadROMRange(0, romlen);
+    }
+    else
+    {
+        LoadROMRange(header->ARM9ROMOffset, header->ARM9Size);
+        LoadROMRange(header->ARM7ROMOffset, header->ARM7Size);
+        LoadROMRange(header->BannerOffset, 0x23C0);
+
+        if (header->UnitCode & 0x02)
+        {
+            LoadROMRange(header->DSiARM9iROMOffset, header->DSiARM9iSize);
+            LoadROMRange(header->DSiARM7iROMOffset, header->DSiARM7iSize);
+        }
+    }
+
+    return InsertROM(romlen);
+}
+
+bool InsertROM(u32 romlen)
+{
+    memset(&Header, 0, sizeof(Header));
+    memset(&Banner, 0, sizeof(Banner));
+
     memcpy(&Header, CartROM, sizeof(Header));
 
     u8 unitcode = Header.UnitCode;
@@ -1730,6 +1896,12 @@ void SetupDirectBoot(std::string romname)
         Cart->SetupDirectBoot(romname);
 }
 
+void FlushStorage()
+{
+    if (Cart)
+        Cart->FlushStorage();
+}
+
 void EjectCart()
 {
     if (!CartInserted) return;
@@ -1742,8 +1914,7 @@ void EjectCart()
     Cart = nullptr;
 
     CartInserted = false;
-    if (CartROM) delete[] CartROM;
-    CartROM = nullptr;
+    FreeROM();
     CartROMSize = 0;
     CartID = 0;
 
@@ -26,6 +26,8 @@
 #include "NDS_Header.h"
 #include "FATStorage.h"
 
+class CompressedROM;
+
 namespace NDSCart
 {
 
@@ -52,6 +54,8 @@ public:
 
     virtual u8 SPIWrite(u8 val, u32 pos, bool last);
 
+    virtual void FlushStorage();
+
 protected:
     void ReadROM(u32 addr, u32 len, u8* data, u32 offset);
 
@@ -188,6 +192,8 @@ public:
     int ROMCommandStart(u8* cmd, u8* data, u32 len) override;
     void ROMCommandFinish(u8* cmd, u8* data, u32 len) override;
 
+    void FlushStorage() override;
+
 private:
     void ApplyDLDIPatchAt(u8* binary, u32 dldioffset, const u8* patch, u32 patchlen, bool readonly);
     void ApplyDLDIPatch(const u8* patch, u32 patchlen, bool readonly);
@@ -220,11 +226,18 @@ void DoSavestate(Savestate* file);
 void DecryptSecureArea(u8* out);
 
 bool LoadROM(const u8* romdata, u32 romlen);
+// maps the ROM file instead of copying it to memory (not available on Windows)
+bool LoadROM(int romfd, u32 romlen);
+// takes ownership of the image
+bool LoadROM(CompressedROM* rom);
 void LoadSave(const u8* savedata, u32 savelen);
 void SetupDirectBoot(std::string romname);
 
 void EjectCart();
 
+// writes back what's cached of the DLDI SD image
+void FlushStorage();
+
 void ResetCart();
 
 void WriteROMCnt(u32 val);
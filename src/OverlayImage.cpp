@@ -0,0 +1,334 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <string.h>
+#include <algorithm>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "OverlayImage.h"
+#include "Platform.h"
+
+// overlay file layout:
+//
+// header (0x1000 bytes)
+//   000  magic 'MCOW'
+//   004  version (2)
+//   008  block size
+//   00C  number of blocks
+//   010  image size (u64)
+//   018  bitmap offset (u64)
+//   020  data offset (u64)
+//   028  base image modification time (u64)
+//   030  base image path length
+//   034  base image path (UTF-8)
+//
+// the base image's size and modification time are checked on open: blocks
+// that were never written are read from the base, so if it changed since the
+// overlay was made, the overlay no longer holds a consistent image.
+//
+// bitmap: one bit per block, set if the block is stored in the overlay
+//
+// data: block N is stored at data offset + N*blocksize. blocks that were
+// never written are left as holes, so the overlay only takes up space for
+// what was written on filesystems that support sparse files.
+
+const u32 OverlayMagic = 0x574F434D;
+const u32 OverlayVersion = 2;
+const u32 HeaderSize = 0x1000;
+
+
+static bool ReadAt(FILE* file, u64 addr, void* data, u32 len)
+{
+#ifdef _WIN32
+    _fseeki64(file, addr, SEEK_SET);
+    return fread(data, len, 1, file) == 1;
+#else
+    int fd = fileno(file);
+    u32 done = 0;
+    while (done < len)
+    {
+        ssize_t res = pread(fd, (u8*)data + done, len - done, addr + done);
+        if (res <= 0) return false;
+        done += res;
+    }
+    return true;
+#endif
+}
+
+static bool GetFileInfo(FILE* file, u64* size, u64* mtime)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_fstat64(_fileno(file), &st) != 0) return false;
+#else
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) return false;
+#endif
+
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    return true;
+}
+
+static bool WriteAt(FILE* file, u64 addr, const void* data, u32 len)
+{
+#ifdef _WIN32
+    _fseeki64(file, addr, SEEK_SET);
+    return fwrite(data, len, 1, file) == 1;
+#else
+    int fd = fileno(file);
+    u32 done = 0;
+    while (done < len)
+    {
+        ssize_t res = pwrite(fd, (const u8*)data + done, len - done, addr + done);
+        if (res <= 0) return false;
+        done += res;
+    }
+    return true;
+#endif
+}
+
+
+OverlayImage::OverlayImage(FILE* file)
+{
+    File = file;
+    BaseFile = nullptr;
+
+    ImageSize = 0;
+    BlockSize = 0;
+    NumBlocks = 0;
+    BitmapOffset = 0;
+    DataOffset = 0;
+}
+
+OverlayImage::~OverlayImage()
+{
+    if (File) fclose(File);
+    if (BaseFile) fclose(BaseFile);
+}
+
+
+bool OverlayImage::IsOverlay(FILE* file)
+{
+    u32 magic;
+    if (!ReadAt(file, 0, &magic, 4)) return false;
+
+    return magic == OverlayMagic;
+}
+
+bool OverlayImage::Create(FILE* file, std::string basepath, u32 blocksize)
+{
+    if ((blocksize < 0x200) || (blocksize & (blocksize - 1)))
+        return false;
+    if (basepath.length() > (HeaderSize - 0x34))
+        return false;
+
+    FILE* base = Platform::OpenLocalFile(basepath, "rb");
+    if (!base)
+        return false;
+
+    u64 size, mtime;
+    bool gotinfo = GetFileInfo(base, &size, &mtime);
+    fclose(base);
+    if (!gotinfo)
+        return false;
+
+    u32 numblocks = (u32)((size + blocksize - 1) / blocksize);
+    u32 bitmaplen = (numblocks + 7) >> 3;
+
+    u64 bitmapoffset = HeaderSize;
+    u64 dataoffset = (bitmapoffset + bitmaplen + blocksize - 1) & ~(u64)(blocksize - 1);
+
+    std::vector<u8> header(HeaderSize + bitmaplen, 0);
+    *(u32*)&header[0x00] = OverlayMagic;
+    *(u32*)&header[0x04] = OverlayVersion;
+    *(u32*)&header[0x08] = blocksize;
+    *(u32*)&header[0x0C] = numblocks;
+    *(u64*)&header[0x10] = size;
+    *(u64*)&header[0x18] = bitmapoffset;
+    *(u64*)&header[0x20] = dataoffset;
+    *(u64*)&header[0x28] = mtime;
+    *(u32*)&header[0x30] = basepath.length();
+    memcpy(&header[0x34], basepath.data(), basepath.length());
+
+    if (!WriteAt(file, 0, header.data(), header.size()))
+        return false;
+
+    fflush(file);
+    return true;
+}
+
+
+bool OverlayImage::Open()
+{
+    u8 header[HeaderSize];
+    if (!ReadAt(File, 0, header, HeaderSize))
+        return false;
+
+    if (*(u32*)&header[0x00] != OverlayMagic)
+        return false;
+    if (*(u32*)&header[0x04] != OverlayVersion)
+    {
+        printf("OverlayImage: unsupported version %d\n", *(u32*)&header[0x04]);
+        return false;
+    }
+
+    BlockSize = *(u32*)&header[0x08];
+    NumBlocks = *(u32*)&header[0x0C];
+    ImageSize = *(u64*)&header[0x10];
+    BitmapOffset = *(u64*)&header[0x18];
+    DataOffset = *(u64*)&header[0x20];
+
+    u64 basemtime = *(u64*)&header[0x28];
+    u32 pathlen = *(u32*)&header[0x30];
+    if ((BlockSize < 0x200) || (BlockSize & (BlockSize - 1)) ||
+        (pathlen > (HeaderSize - 0x34)) ||
+        (NumBlocks != (ImageSize + BlockSize - 1) / BlockSize))
+    {
+        printf("OverlayImage: bad header\n");
+        return false;
+    }
+
+    Bitmap.resize((NumBlocks + 7) >> 3);
+    if (!ReadAt(File, BitmapOffset, Bitmap.data(), Bitmap.size()))
+        return false;
+
+    BlockBuffer.resize(BlockSize);
+
+    std::string basepath((const char*)&header[0x34], pathlen);
+    BaseFile = Platform::OpenLocalFile(basepath, "rb");
+    if (!BaseFile)
+    {
+        printf("OverlayImage: failed to open base image %s\n", basepath.c_str());
+        return false;
+    }
+
+    u64 basesize, curmtime;
+    if ((!GetFileInfo(BaseFile, &basesize, &curmtime)) ||
+        (basesize != ImageSize) || (curmtime != basemtime))
+    {
+        printf("OverlayImage: base image %s has changed since the overlay was made\n", basepath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+u32 OverlayImage::GetNumModifiedBlocks()
+{
+    u32 ret = 0;
+    for (u32 i = 0; i < NumBlocks; i++)
+    {
+        if (IsModified(i)) ret++;
+    }
+    return ret;
+}
+
+
+bool OverlayImage::Read(u64 addr, u8* data, u32 len)
+{
+    while (len > 0)
+    {
+        if (addr >= ImageSize)
+        {
+            memset(data, 0, len);
+            return true;
+        }
+
+        u32 block = (u32)(addr / BlockSize);
+        u32 offset = (u32)(addr % BlockSize);
+        u32 chunk = std::min(len, BlockSize - offset);
+        chunk = (u32)std::min((u64)chunk, ImageSize - addr);
+
+        // merge runs of blocks that come from the same file
+        bool modified = IsModified(block);
+        while (chunk < len && (addr + chunk) < ImageSize)
+        {
+            u32 next = block + ((offset + chunk) / BlockSize);
+            if (IsModified(next) != modified) break;
+
+            u32 nextlen = std::min(len - chunk, BlockSize);
+            nextlen = (u32)std::min((u64)nextlen, ImageSize - (addr + chunk));
+            chunk += nextlen;
+        }
+
+        bool res;
+        if (modified)
+            res = ReadAt(File, DataOffset + addr, data, chunk);
+        else
+            res = ReadAt(BaseFile, addr, data, chunk);
+        if (!res) return false;
+
+        addr += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+
+    return true;
+}
+
+bool OverlayImage::Write(u64 addr, const u8* data, u32 len)
+{
+    while (len > 0)
+    {
+        if (addr >= ImageSize)
+            return true;
+
+        u32 block = (u32)(addr / BlockSize);
+        u32 offset = (u32)(addr % BlockSize);
+        u32 chunk = std::min(len, BlockSize - offset);
+        chunk = (u32)std::min((u64)chunk, ImageSize - addr);
+
+        if (IsModified(block))
+        {
+            if (!WriteAt(File, DataOffset + addr, data, chunk))
+                return false;
+        }
+        else
+        {
+            // first write to this block: copy it from the base image
+            u64 blockaddr = (u64)block * BlockSize;
+            u32 blocklen = (u32)std::min((u64)BlockSize, ImageSize - blockaddr);
+
+            if (chunk < blocklen)
+            {
+                if (!ReadAt(BaseFile, blockaddr, BlockBuffer.data(), blocklen))
+                    return false;
+            }
+            memcpy(&BlockBuffer[offset], data, chunk);
+
+            if (!WriteAt(File, DataOffset + blockaddr, BlockBuffer.data(), blocklen))
+                return false;
+
+            // the data has to be in place before the block is marked
+            Bitmap[block >> 3] |= (1 << (block & 7));
+            if (!WriteAt(File, BitmapOffset + (block >> 3), &Bitmap[block >> 3], 1))
+                return false;
+        }
+
+        addr += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+
+    return true;
+}
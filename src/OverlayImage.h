@@ -0,0 +1,71 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef OVERLAYIMAGE_H
+#define OVERLAYIMAGE_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+// copy-on-write overlay over a read-only disk image (NAND, SD)
+//
+// the overlay file only holds the blocks that were written to, and a
+// bitmap of which blocks those are. everything else is read from the
+// base image, whose path is stored in the overlay header. the base image
+// must not be written to while it has overlays on it.
+// see OverlayImage.cpp for the file layout
+class OverlayImage
+{
+public:
+    // takes ownership of the file
+    OverlayImage(FILE* file);
+    ~OverlayImage();
+
+    static bool IsOverlay(FILE* file);
+    static bool Create(FILE* file, std::string basepath, u32 blocksize = 0x4000);
+
+    // validates the header and opens the base image. fails if the base image
+    // changed since the overlay was made
+    bool Open();
+
+    u64 GetSize() { return ImageSize; }
+    u32 GetNumModifiedBlocks();
+
+    bool Read(u64 addr, u8* data, u32 len);
+    bool Write(u64 addr, const u8* data, u32 len);
+
+private:
+    FILE* File;
+    FILE* BaseFile;
+
+    u64 ImageSize;
+    u32 BlockSize;
+    u32 NumBlocks;
+    u64 BitmapOffset;
+    u64 DataOffset;
+
+    std::vector<u8> Bitmap;
+    std::vector<u8> BlockBuffer;
+
+    bool IsModified(u32 block) { return Bitmap[block >> 3] & (1 << (block & 7)); }
+};
+
+#endif // OVERLAYIMAGE_H
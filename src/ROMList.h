@@ -29,7 +29,7 @@ struct ROMListEntry
 };
 
 
-ROMListEntry ROMList[] =
+constexpr ROMListEntry ROMList[] =
 {
 	{0x41464141, 0x00800000, 0x00000004},
 	{0x414D4155, 0x00800000, 0x00000008},
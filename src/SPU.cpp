@@ -83,6 +83,7 @@ u8 MasterVolume;
 u16 Bias;
 bool ApplyBias;
 bool Degrade10Bit;
+bool OutputSkip;
 
 Channel* Channels[16];
 CaptureUnit* Capture[2];
@@ -854,8 +855,19 @@ void Mix(u32 dummy)
     NDS::ScheduleEvent(NDS::Event_SPU, true, 1024, Mix, 0);
 }
 
+void SetOutputSkip(bool skip)
+{
+    OutputSkip = skip;
+}
+
 void TransferOutput()
 {
+    if (OutputSkip)
+    {
+        OutputBackbufferWritePosition = 0;
+        return;
+    }
+
     Platform::Mutex_Lock(AudioLock);
     for (u32 i = 0; i < OutputBackbufferWritePosition; i += 2)
     {
@@ -50,6 +50,10 @@ void Sync(bool wait);
 int ReadOutput(s16* data, int samples);
 void TransferOutput();
 
+// output-skip mode: samples are still mixed, but dropped at the end of
+// the frame instead of reaching the output buffer
+void SetOutputSkip(bool skip);
+
 u8 Read8(u32 addr);
 u16 Read16(u32 addr);
 u32 Read32(u32 addr);
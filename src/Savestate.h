@@ -24,7 +24,7 @@
 #include "types.h"
 
 #define SAVESTATE_MAJOR 9
-#define SAVESTATE_MINOR 0
+#define SAVESTATE_MINOR 2
 
 class Savestate
 {
@@ -32,6 +32,8 @@ public:
     bool Error;
 
     bool Saving;
+    // the state is only ever loaded back into the session it was made in
+    bool Snapshot;
     u32 VersionMajor;
     u32 VersionMinor;
 
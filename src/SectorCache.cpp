@@ -0,0 +1,379 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <string.h>
+#include <algorithm>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "SectorCache.h"
+
+
+SectorCache::SectorCache()
+{
+    File = nullptr;
+    Image = nullptr;
+    FileSize = 0;
+
+    LineData = new u8[NumLines * LineSize];
+    BatchBuffer.resize(ReadAheadLines * LineSize);
+
+    for (u32 i = 0; i < NumLines; i++)
+        Lines[i].Valid = false;
+
+    UseCounter = 0;
+    NumDirty = 0;
+    LastTag = ~0ULL;
+
+    Hits = 0;
+    Misses = 0;
+}
+
+SectorCache::~SectorCache()
+{
+    SetFile(nullptr, 0);
+    delete[] LineData;
+}
+
+
+void SectorCache::Reset()
+{
+    if (!Flush())
+        printf("SectorCache: dropping %u lines that couldn't be written\n", NumDirty);
+
+    for (u32 i = 0; i < NumLines; i++)
+        Lines[i].Valid = false;
+
+    LineMap.clear();
+    NumDirty = 0;
+    LastTag = ~0ULL;
+}
+
+void SectorCache::SetFile(FILE* file, u64 size)
+{
+    Reset();
+
+    File = file;
+    Image = nullptr;
+    FileSize = size;
+}
+
+void SectorCache::SetImage(OverlayImage* image)
+{
+    Reset();
+
+    File = nullptr;
+    Image = image;
+    FileSize = image ? image->GetSize() : 0;
+}
+
+bool SectorCache::Flush()
+{
+    if (!NumDirty) return true;
+
+    // write back in file order, merging adjacent lines
+    std::vector<u32> dirty;
+    for (u32 i = 0; i < NumLines; i++)
+    {
+        if (Lines[i].Valid && Lines[i].Dirty)
+            dirty.push_back(i);
+    }
+
+    std::sort(dirty.begin(), dirty.end(),
+              [this](u32 a, u32 b) { return Lines[a].Tag < Lines[b].Tag; });
+
+    bool ok = true;
+    for (u32 i = 0; i < dirty.size(); )
+    {
+        u64 tag = Lines[dirty[i]].Tag;
+        u32 count = 0;
+        while ((i+count) < dirty.size() && count < ReadAheadLines &&
+               Lines[dirty[i+count]].Tag == (tag+count))
+        {
+            u32 idx = dirty[i+count];
+            memcpy(&BatchBuffer[count * LineSize], &LineData[idx * LineSize], LineSize);
+            count++;
+        }
+
+        // lines that couldn't be written stay dirty, so the next flush tries again
+        if (WriteFile(tag * LineSize, BatchBuffer.data(), count * LineSize))
+        {
+            for (u32 j = 0; j < count; j++)
+                Lines[dirty[i+j]].Dirty = false;
+            NumDirty -= count;
+        }
+        else
+            ok = false;
+
+        i += count;
+    }
+
+#ifdef _WIN32
+    if (File && fflush(File) != 0) ok = false;
+#endif
+
+    return ok;
+}
+
+
+bool SectorCache::ReadFile(u64 addr, u8* data, u32 len)
+{
+    u32 avail = 0;
+    if (addr < FileSize)
+        avail = (u32)std::min((u64)len, FileSize - addr);
+
+    if (avail < len)
+        memset(&data[avail], 0, len - avail);
+
+    if (Image)
+        return Image->Read(addr, data, avail);
+
+#ifdef _WIN32
+    _fseeki64(File, addr, SEEK_SET);
+    u32 res = fread(data, 1, avail, File);
+    if (res < avail)
+    {
+        if (!feof(File)) return false;
+        memset(&data[res], 0, avail - res);
+    }
+#else
+    int fd = fileno(File);
+    u32 done = 0;
+    while (done < avail)
+    {
+        ssize_t res = pread(fd, &data[done], avail - done, addr + done);
+        if (res < 0) return false;
+        if (res == 0)
+        {
+            // the file can be shorter than the image, past its end reads as zero
+            memset(&data[done], 0, avail - done);
+            break;
+        }
+        done += res;
+    }
+#endif
+
+    return true;
+}
+
+bool SectorCache::WriteFile(u64 addr, const u8* data, u32 len)
+{
+    if (addr >= FileSize) return true;
+    len = (u32)std::min((u64)len, FileSize - addr);
+
+    if (Image)
+    {
+        if (!Image->Write(addr, data, len))
+        {
+            printf("SectorCache: write failed at %016llX\n", (unsigned long long)addr);
+            return false;
+        }
+        return true;
+    }
+
+#ifdef _WIN32
+    _fseeki64(File, addr, SEEK_SET);
+    if (fwrite(data, len, 1, File) != 1) return false;
+#else
+    int fd = fileno(File);
+    u32 done = 0;
+    while (done < len)
+    {
+        ssize_t res = pwrite(fd, &data[done], len - done, addr + done);
+        if (res <= 0)
+        {
+            printf("SectorCache: write failed at %016llX\n", (unsigned long long)(addr + done));
+            return false;
+        }
+        done += res;
+    }
+#endif
+
+    return true;
+}
+
+
+int SectorCache::FindLine(u64 tag)
+{
+    auto it = LineMap.find(tag);
+    if (it == LineMap.end()) return -1;
+    return it->second;
+}
+
+int SectorCache::AllocLine(u64 tag)
+{
+    u32 idx = 0;
+    u64 oldest = ~0ULL;
+    for (u32 i = 0; i < NumLines; i++)
+    {
+        if (!Lines[i].Valid)
+        {
+            idx = i;
+            break;
+        }
+        if (Lines[i].LastUse < oldest)
+        {
+            oldest = Lines[i].LastUse;
+            idx = i;
+        }
+    }
+
+    Line& line = Lines[idx];
+    if (line.Valid)
+    {
+        // the data would be lost if the line was taken over
+        if (line.Dirty && !WriteBack(idx))
+            return -1;
+        LineMap.erase(line.Tag);
+    }
+
+    line.Tag = tag;
+    line.LastUse = ++UseCounter;
+    line.Valid = true;
+    line.Dirty = false;
+    LineMap[tag] = idx;
+
+    return idx;
+}
+
+bool SectorCache::WriteBack(u32 idx)
+{
+    Line& line = Lines[idx];
+
+    if (!WriteFile(line.Tag * LineSize, &LineData[idx * LineSize], LineSize))
+        return false;
+
+    line.Dirty = false;
+    NumDirty--;
+    return true;
+}
+
+int SectorCache::FillLine(u64 tag, bool readahead)
+{
+    // when reading sequentially, also fetch the following lines
+    // (up to the first one that's already cached)
+    u32 count = 1;
+    if (readahead)
+    {
+        while (count < ReadAheadLines &&
+               ((tag+count) * LineSize) < FileSize &&
+               FindLine(tag+count) < 0)
+            count++;
+    }
+
+    if (!ReadFile(tag * LineSize, BatchBuffer.data(), count * LineSize))
+        printf("SectorCache: read failed at %016llX\n", (unsigned long long)(tag * LineSize));
+
+    int ret = -1;
+    for (u32 i = 0; i < count; i++)
+    {
+        int idx = AllocLine(tag+i);
+        if (idx < 0) break;
+        memcpy(&LineData[idx * LineSize], &BatchBuffer[i * LineSize], LineSize);
+        if (i == 0) ret = idx;
+    }
+
+    return ret;
+}
+
+
+u32 SectorCache::Read(u64 start, u32 num, u8* data)
+{
+    if (!File && !Image) return 0;
+
+    u64 numsectors = FileSize >> 9;
+    if (start >= numsectors) return 0;
+    if ((start + num) > numsectors) num = (u32)(numsectors - start);
+
+    for (u32 done = 0; done < num; )
+    {
+        u64 sector = start + done;
+        u64 tag = sector / SectorsPerLine;
+        u32 offset = sector % SectorsPerLine;
+        u32 len = std::min(num - done, SectorsPerLine - offset);
+
+        int idx = FindLine(tag);
+        if (idx < 0)
+        {
+            Misses++;
+            idx = FillLine(tag, tag == (LastTag+1));
+            if (idx < 0) return done;
+        }
+        else
+            Hits++;
+
+        Lines[idx].LastUse = ++UseCounter;
+        memcpy(&data[done * 0x200], &LineData[(idx * LineSize) + (offset * 0x200)], len * 0x200);
+
+        LastTag = tag;
+        done += len;
+    }
+
+    return num;
+}
+
+u32 SectorCache::Write(u64 start, u32 num, const u8* data)
+{
+    if (!File && !Image) return 0;
+
+    u64 numsectors = FileSize >> 9;
+    if (start >= numsectors) return 0;
+    if ((start + num) > numsectors) num = (u32)(numsectors - start);
+
+    for (u32 done = 0; done < num; )
+    {
+        u64 sector = start + done;
+        u64 tag = sector / SectorsPerLine;
+        u32 offset = sector % SectorsPerLine;
+        u32 len = std::min(num - done, SectorsPerLine - offset);
+
+        int idx = FindLine(tag);
+        if (idx < 0)
+        {
+            Misses++;
+
+            // no need to read lines that get entirely overwritten
+            if (len == SectorsPerLine)
+                idx = AllocLine(tag);
+            else
+                idx = FillLine(tag, false);
+            if (idx < 0) return done;
+        }
+        else
+            Hits++;
+
+        Line& line = Lines[idx];
+        line.LastUse = ++UseCounter;
+        memcpy(&LineData[(idx * LineSize) + (offset * 0x200)], &data[done * 0x200], len * 0x200);
+
+        if (!line.Dirty)
+        {
+            line.Dirty = true;
+            NumDirty++;
+        }
+
+        done += len;
+    }
+
+    // the data is still cached if this fails, but the file can't be written to
+    if (NumDirty >= MaxDirtyLines && !Flush())
+        return 0;
+
+    return num;
+}
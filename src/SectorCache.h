@@ -0,0 +1,95 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef SECTORCACHE_H
+#define SECTORCACHE_H
+
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+
+#include "types.h"
+#include "OverlayImage.h"
+
+// write-back cache for 512-byte sector storage (SD/NAND images)
+//
+// the file is accessed in lines of several sectors. sequential reads
+// fetch a few lines ahead in one go, and dirty lines are written back
+// when evicted, on Flush(), or once too many of them pile up.
+class SectorCache
+{
+public:
+    SectorCache();
+    ~SectorCache();
+
+    // flushes and drops anything cached for the previous file
+    // the file shouldn't be accessed through stdio while it's attached
+    void SetFile(FILE* file, u64 size);
+    void SetImage(OverlayImage* image);
+
+    // returns false if some lines couldn't be written, those stay dirty
+    bool Flush();
+
+    // same semantics as a fread/fwrite of whole sectors: returns the
+    // number of sectors transferred, data past the end of the file reads as zero
+    u32 Read(u64 start, u32 num, u8* data);
+    u32 Write(u64 start, u32 num, const u8* data);
+
+    // counted per line accessed
+    u64 Hits;
+    u64 Misses;
+
+private:
+    static const u32 SectorsPerLine = 16;
+    static const u32 LineSize = SectorsPerLine * 0x200;
+    static const u32 NumLines = 64;
+    static const u32 ReadAheadLines = 8;
+    static const u32 MaxDirtyLines = NumLines / 2;
+
+    struct Line
+    {
+        u64 Tag;
+        u64 LastUse;
+        bool Valid;
+        bool Dirty;
+    };
+
+    FILE* File;
+    OverlayImage* Image;
+    u64 FileSize;
+
+    Line Lines[NumLines];
+    u8* LineData;
+    std::unordered_map<u64, u32> LineMap;
+    u64 UseCounter;
+    u32 NumDirty;
+    u64 LastTag;
+
+    std::vector<u8> BatchBuffer;
+
+    void Reset();
+    bool ReadFile(u64 addr, u8* data, u32 len);
+    bool WriteFile(u64 addr, const u8* data, u32 len);
+
+    int FindLine(u64 tag);
+    int AllocLine(u64 tag);
+    bool WriteBack(u32 idx);
+    int FillLine(u64 tag, bool readahead);
+};
+
+#endif // SECTORCACHE_H
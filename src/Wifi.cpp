@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include "NDS.h"
 #include "SPI.h"
 #include "Wifi.h"
@@ -48,11 +49,14 @@ const u8 MPAckMAC[6]   = {0x03, 0x09, 0xBF, 0x00, 0x00, 0x03};
 
 const int kTimerInterval = 8;
 const u32 kTimeCheckMask = ~(kTimerInterval - 1);
+const s64 kTimerCycles = 33513982LL * kTimerInterval; // in millionths of a system cycle
 
 bool Enabled;
 bool PowerOn;
 
 s32 TimerError;
+u64 TickBase;       // system timestamp of the last timer tick that was run
+u32 PendingTicks;   // ticks covered by the scheduled timer event, including its own
 
 u16 Random;
 
@@ -234,6 +238,8 @@ void Reset()
     IOPORT(W_PowerUS) = 0x0001;
 
     USTimestamp = 0;
+    TickBase = 0;
+    PendingTicks = 0;
 
     USCounter = 0;
     USCompare = 0;
@@ -333,19 +339,143 @@ void DoSavestate(Savestate* file)
     file->Bool32(&IsMPClient);
     file->Var64(&NextSync);
     file->Var64(&RXTimestamp);
+
+    if (file->IsAtleastVersion(9, 1))
+    {
+        file->Var64(&TickBase);
+        file->Var32(&PendingTicks);
+    }
+    else if (!file->Saving)
+    {
+        // older states only ever had the next tick scheduled
+        TickBase = NDS::ARM7Timestamp;
+        PendingTicks = 1;
+    }
+}
+
+
+s64 TickDelay(u32 ticks)
+{
+    s64 cycles = (kTimerCycles * ticks) - TimerError;
+    return (cycles + 999999) / 1000000;
+}
+
+void AdvanceTickBase(u32 ticks)
+{
+    s64 cycles = (kTimerCycles * ticks) - TimerError;
+    s64 delay = (cycles + 999999) / 1000000;
+    TickBase += delay;
+    TimerError = (s32)((delay * 1000000) - cycles);
+}
+
+u32 TicksUntil(u64 timestamp)
+{
+    if (timestamp <= USTimestamp + kTimerInterval)
+        return 1;
+
+    return (u32)std::min<u64>((timestamp - USTimestamp + kTimerInterval - 1) / kTimerInterval, 0x80);
+}
+
+// how many ticks until the timer has something to do besides counting
+// the ticks before that one are only counter updates, see AdvanceIdleTicks()
+u32 IdleTicks()
+{
+    if (ComStatus) return 1;
+    if (IOPORT(W_TXBusy)) return 1;
+    if ((USUntilPowerOn >= 0) && (IOPORT(W_PowerState) & 0x0002)) return 1;
+
+    // WifiAP millisecond timer
+    u32 ticks = (0x407 - (USTimestamp & 0x3FF)) / kTimerInterval;
+
+    // polling for incoming frames
+    u32 rxpart = RXCounter & 0x1FF;
+    if (rxpart < kTimerInterval) return 1;
+    ticks = std::min(ticks, ((0x207 - rxpart) / kTimerInterval) + 1);
+
+    if (IsMPClient)
+    {
+        ticks = std::min(ticks, TicksUntil(NextSync));
+        if (RXTimestamp)
+            ticks = std::min(ticks, TicksUntil(RXTimestamp));
+    }
+
+    if (USUntilPowerOn < 0)
+        ticks = std::min(ticks, (u32)(-USUntilPowerOn + kTimerInterval - 1) / kTimerInterval);
+
+    if (IOPORT(W_USCountCnt))
+    {
+        // pre-beacon IRQ: just go tick by tick during the millisecond it can happen in
+        if (IOPORT(W_USCompareCnt) && (IOPORT(W_BeaconCount1) == (IOPORT(W_PreBeacon) >> 10)))
+            return 1;
+
+        ticks = std::min(ticks, (0x407 - (u32)(USCounter & 0x3FF)) / kTimerInterval);
+    }
+
+    return ticks;
 }
 
+void AdvanceIdleTicks(u32 ticks)
+{
+    if (!ticks) return;
+
+    u32 us = ticks * kTimerInterval;
+
+    USTimestamp += us;
+    if (USUntilPowerOn < 0)
+        USUntilPowerOn += us;
+
+    if (IOPORT(W_USCountCnt))
+        USCounter += us;
+
+    if (IOPORT(W_CmdCountCnt) & 0x0001)
+        CmdCounter = (CmdCounter > us) ? (CmdCounter - us) : 0;
+
+    if (IOPORT(W_ContentFree) > us)
+        IOPORT(W_ContentFree) -= us;
+    else
+        IOPORT(W_ContentFree) = 0;
+
+    RXCounter += us;
+}
 
 void ScheduleTimer(bool first)
 {
-    if (first) TimerError = 0;
+    if (first)
+    {
+        TimerError = 0;
+        TickBase = NDS::GetSysClockCycles(0);
+        PendingTicks = 1;
+    }
+    else
+        PendingTicks = IdleTicks();
+
+    NDS::ScheduleEvent(NDS::Event_Wifi, TickBase + TickDelay(PendingTicks), USTimer, 0);
+}
+
+// run the idle ticks that have elapsed by now, so the counters read back right
+void CatchUpTimer()
+{
+    if (PendingTicks < 2) return;
+
+    u64 now = NDS::GetSysClockCycles(0);
+    if (now <= TickBase) return;
 
-    s32 cycles = 33513982 * kTimerInterval;
-    cycles -= TimerError;
-    s32 delay = (cycles + 999999) / 1000000;
-    TimerError = (delay * 1000000) - cycles;
+    u64 ticks = (((now - TickBase) * 1000000) + TimerError) / kTimerCycles;
+    if (ticks >= PendingTicks) ticks = PendingTicks - 1;
+    if (!ticks) return;
 
-    NDS::ScheduleEvent(NDS::Event_Wifi, !first, delay, USTimer, 0);
+    AdvanceIdleTicks((u32)ticks);
+    AdvanceTickBase((u32)ticks);
+    PendingTicks -= (u32)ticks;
+}
+
+void RescheduleTimer()
+{
+    if (!PowerOn) return;
+    if (PendingTicks < 2) return;
+
+    NDS::CancelEvent(NDS::Event_Wifi);
+    ScheduleTimer(false);
 }
 
 void UpdatePowerOn()
@@ -381,6 +511,7 @@ void UpdatePowerOn()
         printf("WIFI: OFF\n");
 
         NDS::CancelEvent(NDS::Event_Wifi);
+        PendingTicks = 0;
 
         Platform::MP_End();
     }
@@ -1590,6 +1721,12 @@ void MSTimer()
 
 void USTimer(u32 param)
 {
+    if (!PendingTicks) PendingTicks = 1;
+
+    // the ticks skipped over only needed their counters updated
+    AdvanceIdleTicks(PendingTicks - 1);
+    AdvanceTickBase(PendingTicks);
+
     USTimestamp += kTimerInterval;
 
     if (IsMPClient && (!ComStatus))
@@ -1819,6 +1956,8 @@ u16 Read(u32 addr)
     if (addr >= 0x2000 && addr < 0x4000)
         return 0xFFFF;
 
+    CatchUpTimer();
+
     bool activeread = (addr < 0x1000);
 
     switch (addr)
@@ -1908,21 +2047,8 @@ u16 Read(u32 addr)
     return IOPORT(addr&0xFFF);
 }
 
-void Write(u32 addr, u16 val)
+void WriteIO(u32 addr, u16 val)
 {
-    if (addr >= 0x04810000)
-        return;
-
-    addr &= 0x7FFE;
-
-    if (addr >= 0x4000 && addr < 0x6000)
-    {
-        *(u16*)&RAM[addr & 0x1FFE] = val;
-        return;
-    }
-    if (addr >= 0x2000 && addr < 0x4000)
-        return;
-
     switch (addr)
     {
     case W_ModeReset:
@@ -2255,6 +2381,27 @@ void Write(u32 addr, u16 val)
     IOPORT(addr&0xFFF) = val;
 }
 
+void Write(u32 addr, u16 val)
+{
+    if (addr >= 0x04810000)
+        return;
+
+    addr &= 0x7FFE;
+
+    if (addr >= 0x4000 && addr < 0x6000)
+    {
+        *(u16*)&RAM[addr & 0x1FFE] = val;
+        return;
+    }
+    if (addr >= 0x2000 && addr < 0x4000)
+        return;
+
+    // the timer may have skipped ahead assuming the registers stay as they are
+    CatchUpTimer();
+    WriteIO(addr, val);
+    RescheduleTimer();
+}
+
 
 u8* GetMAC()
 {
@@ -385,16 +385,20 @@ int RecvPacket(u8* data)
 
     if (ClientStatus < 2) return 0;
 
-    int rxlen = Platform::LAN_RecvPacket(LANBuffer);
-    if (rxlen > 0)
+    // skip over frames that aren't for us, so they don't each cost an RX poll
+    int rxlen;
+    for (;;)
     {
+        rxlen = Platform::LAN_RecvPacket(LANBuffer);
+        if (rxlen <= 0) break;
+
         // check destination MAC
-        if (!MACIsBroadcast(&LANBuffer[0]))
-        {
-            if (!MACEqual(&LANBuffer[0], Wifi::GetMAC()))
-                return 0;
-        }
+        if (MACIsBroadcast(&LANBuffer[0]) || MACEqual(&LANBuffer[0], Wifi::GetMAC()))
+            break;
+    }
 
+    if (rxlen > 0)
+    {
         // packet is good
 
         u8* base = data + 12;
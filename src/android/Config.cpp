@@ -112,6 +112,10 @@ bool SocketBindAnyAddr;
 std::string LANDevice;
 bool DirectLAN;
 
+bool MPNetwork;
+int MPNetPort;
+std::string MPNetPeers;
+
 bool SavestateRelocSRAM;
 
 int AudioInterp;
@@ -282,6 +286,10 @@ ConfigEntry ConfigFile[] =
     {"LANDevice", 2, &LANDevice, (std::string)""},
     {"DirectLAN", 1, &DirectLAN, false},
 
+    {"MPNetwork", 1, &MPNetwork, false},
+    {"MPNetPort", 0, &MPNetPort, 7064},
+    {"MPNetPeers", 2, &MPNetPeers, (std::string)""},
+
     {"SavStaRelocSRAM", 1, &SavestateRelocSRAM, false},
 
     {"AudioInterp", 0, &AudioInterp, 0},
@@ -147,6 +147,10 @@ extern bool SocketBindAnyAddr;
 extern std::string LANDevice;
 extern bool DirectLAN;
 
+extern bool MPNetwork;
+extern int MPNetPort;
+extern std::string MPNetPeers;
+
 extern bool SavestateRelocSRAM;
 
 extern int AudioInterp;
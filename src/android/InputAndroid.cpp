@@ -1,40 +1,54 @@
 #include "InputAndroid.h"
+#include "Netplay.h"
 #include "../NDS.h"
 
 namespace MelonDSAndroid
 {
     u32 keyMask = 0xFFF;
 
+    // input is always handed to netplay as well, so it's up to date whenever a session starts.
+    // while one is running, it decides when input reaches the emulator
     void touchScreen(u16 x, u16 y)
     {
-        NDS::TouchScreen(x, y);
+        Netplay::SetLocalTouch(true, x, y);
+        if (!Netplay::IsActive())
+            NDS::TouchScreen(x, y);
     }
 
     void releaseScreen()
     {
-        NDS::ReleaseScreen();
+        Netplay::SetLocalTouch(false, 0, 0);
+        if (!Netplay::IsActive())
+            NDS::ReleaseScreen();
     }
 
     void pressKey(u32 key)
     {
         // Special handling for Lid input
-        if (key == 16 + 7)
-            NDS::SetLidClosed(true);
-        else {
+        if (key == 16 + 7) {
+            Netplay::SetLocalLid(true);
+            if (!Netplay::IsActive())
+                NDS::SetLidClosed(true);
+        } else {
             keyMask &= ~(1 << key);
-            NDS::SetKeyMask(keyMask);
+            Netplay::SetLocalKeyMask(keyMask);
+            if (!Netplay::IsActive())
+                NDS::SetKeyMask(keyMask);
         }
     }
 
     void releaseKey(u32 key)
     {
         // Special handling for Lid input
-        if (key == 16 + 7)
-            NDS::SetLidClosed(false);
-        else {
+        if (key == 16 + 7) {
+            Netplay::SetLocalLid(false);
+            if (!Netplay::IsActive())
+                NDS::SetLidClosed(false);
+        } else {
             keyMask |= (1 << key);
-            NDS::SetKeyMask(keyMask);
+            Netplay::SetLocalKeyMask(keyMask);
+            if (!Netplay::IsActive())
+                NDS::SetKeyMask(keyMask);
         }
     }
 }
-
@@ -17,13 +17,18 @@
 */
 
 // indirect LAN interface, powered by BSD sockets.
+//
+// libslirp isn't thread-safe, so all of it runs on a network thread. that thread also does the
+// blocking DNS lookups. the emulator only ever touches the two frame queues: TX (emu -> network)
+// and RX (network -> emu). each has one producer and one consumer, so neither needs a lock.
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <atomic>
 #include "Wifi.h"
 #include "LAN_Socket.h"
-#include "FIFO.h"
+#include "Platform.h"
 
 #include <libslirp/src/slirp.h>
 
@@ -34,6 +39,8 @@
 #include <netdb.h>
 #include <poll.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 
@@ -47,12 +54,77 @@ namespace LAN_Socket
 
     const u8 kServerMAC[6] = {0x00, 0xAB, 0x33, 0x28, 0x99, 0x44};
 
-    FIFO<u32, (0x8000 >> 2)> RXBuffer;
+    const int kMaxFrameSize = 2048;
+    const int kPollTimeout = 10; // ms, longest the network thread sleeps when slirp has nothing to do
+
+    template <int NumSlots>
+    struct FrameQueue
+    {
+        struct Slot
+        {
+            u32 Length;
+            u8 Data[kMaxFrameSize];
+        };
+
+        Slot Slots[NumSlots];
+        std::atomic<u32> Head;  // next slot to read, only written by the consumer
+        std::atomic<u32> Tail;  // next slot to write, only written by the producer
+
+        void Clear()
+        {
+            Head.store(0);
+            Tail.store(0);
+        }
+
+        bool IsEmpty()
+        {
+            return Head.load(std::memory_order_acquire) == Tail.load(std::memory_order_acquire);
+        }
+
+        bool Push(const void* data, int len)
+        {
+            u32 tail = Tail.load(std::memory_order_relaxed);
+            if ((tail - Head.load(std::memory_order_acquire)) >= NumSlots)
+                return false;
+
+            Slot* slot = &Slots[tail % NumSlots];
+            slot->Length = len;
+            memcpy(slot->Data, data, len);
+
+            Tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        int Pop(u8* data)
+        {
+            u32 head = Head.load(std::memory_order_relaxed);
+            if (head == Tail.load(std::memory_order_acquire))
+                return 0;
+
+            Slot* slot = &Slots[head % NumSlots];
+            int len = slot->Length;
+            memcpy(data, slot->Data, len);
+
+            Head.store(head + 1, std::memory_order_release);
+            return len;
+        }
+    };
+
+    FrameQueue<64> RXQueue;
+    FrameQueue<64> TXQueue;
+
+    Platform::Thread* NetThread = nullptr;
+    std::atomic<bool> NetThreadRunning;
+    std::atomic<bool> NetThreadSleeping;
+    int WakePipe[2] = {-1, -1};
 
     u32 IPv4ID;
 
     Slirp* Ctx = nullptr;
 
+    void NetThreadFunc();
+    void WakeNetThread();
+
 /*const int FDListMax = 64;
 struct pollfd FDList[FDListMax];
 int FDListSize;*/
@@ -82,24 +154,13 @@ int clock_gettime(int, struct timespec *spec)
 
     void RXEnqueue(const void* buf, int len)
     {
-        int alignedlen = (len + 3) & ~3;
-        int totallen = alignedlen + 4;
-
-        if (!RXBuffer.CanFit(totallen >> 2))
-        {
+        if (!RXQueue.Push(buf, len))
             printf("slirp: !! NOT ENOUGH SPACE IN RX BUFFER\n");
-            return;
-        }
-
-        u32 header = (alignedlen & 0xFFFF) | (len << 16);
-        RXBuffer.Write(header);
-        for (int i = 0; i < alignedlen; i += 4)
-            RXBuffer.Write(((u32*)buf)[i>>2]);
     }
 
     ssize_t SlirpCbSendPacket(const void* buf, size_t len, void* opaque)
     {
-        if (len > 2048)
+        if (len > kMaxFrameSize)
         {
             printf("slirp: packet too big (%zu)\n", len);
             return 0;
@@ -214,12 +275,50 @@ int clock_gettime(int, struct timespec *spec)
         *(u32*)&cfg.vnameserver = htonl(kDNSIP);
 
         Ctx = slirp_new(&cfg, &cb, nullptr);
+        if (!Ctx)
+            return false;
+
+        if (pipe(WakePipe) != 0)
+        {
+            printf("LAN_Socket: could not create wake pipe\n");
+            slirp_cleanup(Ctx);
+            Ctx = nullptr;
+            return false;
+        }
+        fcntl(WakePipe[0], F_SETFL, fcntl(WakePipe[0], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(WakePipe[1], F_SETFL, fcntl(WakePipe[1], F_GETFL, 0) | O_NONBLOCK);
+
+        RXQueue.Clear();
+        TXQueue.Clear();
+
+        NetThreadRunning = true;
+        NetThreadSleeping = false;
+        NetThread = Platform::Thread_Create(NetThreadFunc);
 
         return true;
     }
 
     void DeInit()
     {
+        if (NetThread)
+        {
+            NetThreadRunning = false;
+            WakeNetThread();
+
+            Platform::Thread_Wait(NetThread);
+            Platform::Thread_Free(NetThread);
+            NetThread = nullptr;
+        }
+
+        for (int i = 0; i < 2; i++)
+        {
+            if (WakePipe[i] != -1)
+            {
+                close(WakePipe[i]);
+                WakePipe[i] = -1;
+            }
+        }
+
         if (Ctx)
         {
             slirp_cleanup(Ctx);
@@ -423,16 +522,9 @@ int clock_gettime(int, struct timespec *spec)
         RXEnqueue(resp, framelen);
     }
 
-    int SendPacket(u8* data, int len)
+    // runs on the network thread
+    void HandleTXFrame(u8* data, int len)
     {
-        if (!Ctx) return 0;
-
-        if (len > 2048)
-        {
-            printf("LAN_SendPacket: error: packet too long (%d)\n", len);
-            return 0;
-        }
-
         u16 ethertype = ntohs(*(u16*)&data[0xC]);
 
         if (ethertype == 0x800)
@@ -444,12 +536,44 @@ int clock_gettime(int, struct timespec *spec)
                 if (dstport == 53 && htonl(*(u32*)&data[0x1E]) == kDNSIP) // DNS
                 {
                     HandleDNSFrame(data, len);
-                    return len;
+                    return;
                 }
             }
         }
 
         slirp_input(Ctx, data, len);
+    }
+
+    void WakeNetThread()
+    {
+        u8 val = 0;
+        if (write(WakePipe[1], &val, 1) < 0)
+        {
+            // pipe already full: the thread has wakeups pending anyway
+        }
+    }
+
+    int SendPacket(u8* data, int len)
+    {
+        if (!Ctx) return 0;
+
+        if (len > kMaxFrameSize)
+        {
+            printf("LAN_SendPacket: error: packet too long (%d)\n", len);
+            return 0;
+        }
+
+        if (!TXQueue.Push(data, len))
+        {
+            printf("LAN_SendPacket: TX queue full, dropping packet\n");
+            return 0;
+        }
+
+        // only bother the thread if it's waiting in poll(), it checks the queue before going back to sleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (NetThreadSleeping.load())
+            WakeNetThread();
+
         return len;
     }
 
@@ -506,33 +630,49 @@ int clock_gettime(int, struct timespec *spec)
         return ret;
     }
 
-    int RecvPacket(u8* data)
+    void NetThreadFunc()
     {
-        if (!Ctx) return 0;
-
-        int ret = 0;
+        u8 frame[kMaxFrameSize];
 
-        //if (PollListSize > 0)
+        while (NetThreadRunning)
         {
-            u32 timeout = 0;
+            // hand everything the emulator sent to slirp in one go
+            int len;
+            while ((len = TXQueue.Pop(frame)) > 0)
+                HandleTXFrame(frame, len);
+
+            u32 timeout = kPollTimeout;
             PollListSize = 0;
+
+            // index 0 is the wake pipe, slirp's FDs come after it
+            PollList[0].fd = WakePipe[0];
+            PollList[0].events = POLLIN;
+            PollListSize = 1;
             slirp_pollfds_fill(Ctx, &timeout, SlirpCbAddPoll, nullptr);
-            int res = poll(PollList, PollListSize, timeout);
-            slirp_pollfds_poll(Ctx, res<0, SlirpCbGetREvents, nullptr);
-        }
 
-        if (!RXBuffer.IsEmpty())
-        {
-            u32 header = RXBuffer.Read();
-            u32 len = header & 0xFFFF;
+            NetThreadSleeping = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!TXQueue.IsEmpty() || !NetThreadRunning)
+                timeout = 0;
 
-            for (int i = 0; i < len; i += 4)
-                ((u32*)data)[i>>2] = RXBuffer.Read();
+            int res = poll(PollList, PollListSize, timeout);
+            NetThreadSleeping = false;
+
+            if (res > 0 && (PollList[0].revents & POLLIN))
+            {
+                u8 buf[64];
+                while (read(WakePipe[0], buf, sizeof(buf)) > 0);
+            }
 
-            ret = header >> 16;
+            slirp_pollfds_poll(Ctx, res<0, SlirpCbGetREvents, nullptr);
         }
+    }
 
-        return ret;
+    int RecvPacket(u8* data)
+    {
+        if (!Ctx) return 0;
+
+        return RXQueue.Pop(data);
     }
 
 }
@@ -4,21 +4,27 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
-#include <sys/file.h>
 #include <sys/socket.h>
 #include <linux/ashmem.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <cstdio>
 #include <cstring>
 #include <time.h>
 #include "MelonDS.h"
+#include "MPStats.h"
 #include "ancillary.h"
 #include <android/log.h>
 #include <linux/un.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 enum RequestType {
     SHARED_MEMORY_FD = 1,
-    SEMAPHORE_MEMORY_FD = 2,
 };
 
 void debug(std::string message)
@@ -28,15 +34,26 @@ void debug(std::string message)
 #endif
 }
 
+// the shared memory holds two broadcast rings: one for regular/CMD/ack frames, one for MP replies.
+// any instance can write to a ring without taking a lock: it claims a sequence number, fills the
+// matching slot and then publishes it. every reader keeps its own position, so a slow reader only
+// loses its own frames when the ring laps it.
+
 struct MPQueueHeader
 {
-    u16 NumInstances;
-    u16 InstanceBitmask;  // bitmask of all instances present
-    u16 ConnectedBitmask; // bitmask of which instances are ready to send/receive packets
-    u32 PacketWriteOffset;
-    u32 ReplyWriteOffset;
-    u16 MPHostInstanceID; // instance ID from which the last CMD frame was sent
-    u16 MPReplyBitmask;   // bitmask of which clients replied in time
+    std::atomic<u16> NumInstances;
+    std::atomic<u16> InstanceBitmask;  // bitmask of all instances present
+    std::atomic<u16> ConnectedBitmask; // bitmask of which instances are ready to send/receive packets
+    std::atomic<u16> MPHostInstanceID; // instance ID from which the last CMD frame was sent
+    std::atomic<u16> MPReplyBitmask;   // bitmask of which clients replied in time
+};
+
+struct MPRingHeader
+{
+    std::atomic<u32> WriteSeq;    // next sequence number to be claimed by a writer
+    std::atomic<u32> Published;   // bumped after each frame is published, doubles as the futex word
+    std::atomic<u32> NumWaiters;  // readers currently sleeping on Published
+    std::atomic<u32> ReadSeq[16]; // position of each reader, to tell when one is being overrun
 };
 
 struct MPPacketHeader
@@ -48,13 +65,32 @@ struct MPPacketHeader
     u64 Timestamp;
 };
 
-const u32 kMemorySize = 0x20000;
-const u32 kPacketStart = sizeof(MPQueueHeader);
-const u32 kReplyStart = kMemorySize / 2;
-const u32 kPacketEnd = kReplyStart;
-const u32 kReplyEnd = kMemorySize;
+const u32 kSlotSize = 0x1000;
+const u32 kSlotDataSize = kSlotSize - 32;
+const u32 kNumSlots = 32;
+
+struct MPSlot
+{
+    std::atomic<u32> Seq;  // sequence number of the frame stored here plus one, 0 while it is being written
+    u32 Pad;
+    MPPacketHeader Header;
+    u8 Data[kSlotDataSize];
+};
+
+static_assert(sizeof(MPSlot) == kSlotSize, "MPSlot must be one slot in size");
+static_assert(std::atomic<u32>::is_always_lock_free, "shared memory atomics must be lock-free");
+static_assert(std::atomic<u16>::is_always_lock_free, "shared memory atomics must be lock-free");
 
-const u32 kSemMemorySize = sizeof(short) * 32;
+const u32 kRingHeaderStart = 0x100;
+const u32 kSlotStart = 0x1000;
+const u32 kMemorySize = kSlotStart + (2 * kNumSlots * kSlotSize);
+
+enum
+{
+    Ring_Empty = 0,
+    Ring_OK,
+    Ring_Overflow,
+};
 
 bool IsMasterInstance = true;
 volatile bool Running = false;
@@ -62,21 +98,70 @@ Platform::Thread* MasterThread;
 
 int MemoryFile = -1;
 u8* Memory;
-int SemMemoryFile = -1;
-u16* SemMemory;
 int InstanceID;
-u32 PacketReadOffset;
-u32 ReplyReadOffset;
+u32 PacketReadSeq;
+u32 ReplyReadSeq;
 
 int RecvTimeout;
 
 int LastHostID;
+u64 CmdSentTime;
 
-bool SemInited[32];
-int SemPool[32];
+u8 ReplyBuffer[kSlotDataSize];
 
 void StopMasterInstanceThread();
 
+MPQueueHeader* QueueHeader()
+{
+    return (MPQueueHeader*) Memory;
+}
+
+MPRingHeader* RingHeader(int ring)
+{
+    return &((MPRingHeader*) &Memory[kRingHeaderStart])[ring];
+}
+
+MPSlot* RingSlot(int ring, u32 seq)
+{
+    return &((MPSlot*) &Memory[kSlotStart])[(ring * kNumSlots) + (seq % kNumSlots)];
+}
+
+u64 GetTimeUS()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((u64)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+#if defined(__linux__)
+// the memory is shared between processes, so these can't use FUTEX_PRIVATE_FLAG
+
+void FutexWait(std::atomic<u32>* word, u32 val, u64 timeout)
+{
+    struct timespec ts;
+    ts.tv_sec = timeout / 1000000;
+    ts.tv_nsec = (timeout % 1000000) * 1000;
+    syscall(SYS_futex, (u32*) word, FUTEX_WAIT, val, &ts, nullptr, 0);
+}
+
+void FutexWake(std::atomic<u32>* word)
+{
+    syscall(SYS_futex, (u32*) word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+#else
+void FutexWait(std::atomic<u32>* word, u32 val, u64 timeout)
+{
+    // no futex: poll at a short interval instead
+    if (timeout > 250) timeout = 250;
+    if (word->load() == val)
+        usleep(timeout);
+}
+
+void FutexWake(std::atomic<u32>* word)
+{
+}
+#endif
+
 void MasterInstanceThread()
 {
     int socketFd = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -139,14 +224,6 @@ void MasterInstanceThread()
                         debug(strerror(errno));
                     }
                     break;
-                case RequestType::SEMAPHORE_MEMORY_FD:
-                    debug("Sending shared semaphores FD to slave");
-                    if (ancil_send_fd(remoteSocketFd, SemMemoryFile) != 0)
-                    {
-                        debug("Failed to send shared semaphores FD");
-                        debug(strerror(errno));
-                    }
-                    break;
             }
         }
 
@@ -156,102 +233,97 @@ void MasterInstanceThread()
     close(socketFd);
 }
 
-void SemPoolInit()
+void RingWrite(int ring, MPPacketHeader* header, u8* data, u16 readermask)
 {
-    for (int i = 0; i < 32; i++)
-    {
-        SemPool[i] = -1;
-        SemInited[i] = false;
-    }
-}
-
-void SemDeinit(int num);
+    MPRingHeader* rhdr = RingHeader(ring);
 
-void SemPoolDeinit()
-{
-    for (int i = 0; i < 32; i++)
-        SemDeinit(i);
-}
+    u32 seq = rhdr->WriteSeq.fetch_add(1);
 
-bool SemInit(int num)
-{
-    if (SemInited[num])
-        return true;
-
-    debug("Initializing semaphore " + std::to_string(num));
-    char semname[18];
-    sprintf(semname, "/melonNIFI_Lock%02d", num);
-
-    std::string filename = MelonDSAndroid::internalFilesDir + semname;
-    int lockFd = open(filename.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-    SemPool[num] = lockFd;
-    SemInited[num] = true;
-
-    return lockFd != -1;
-}
-
-void SemDeinit(int num)
-{
-    debug("Destroying semaphore " + std::to_string(num));
-    if (SemPool[num] != -1)
+    for (int i = 0; i < 16; i++)
     {
-        close(SemPool[num]);
-        SemPool[num] = -1;
+        if (!(readermask & (1<<i))) continue;
+        if ((seq - rhdr->ReadSeq[i].load(std::memory_order_relaxed)) >= kNumSlots)
+            debug("Ring " + std::to_string(ring) + " full, instance " + std::to_string(i) + " will drop frames");
     }
 
-    SemInited[num] = false;
-}
+    MPSlot* slot = RingSlot(ring, seq);
+    slot->Seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
 
-bool SemPost(int num)
-{
-    SemInit(num);
+    slot->Header = *header;
+    if (header->Length)
+        memcpy(slot->Data, data, header->Length);
 
-    flock(SemPool[num], LOCK_EX);
-    SemMemory[num]++;
+    slot->Seq.store(seq + 1, std::memory_order_release);
 
-    return flock(SemPool[num], LOCK_UN) == 0;
+    rhdr->Published.fetch_add(1);
+    if (rhdr->NumWaiters.load())
+        FutexWake(&rhdr->Published);
 }
 
-bool SemWait(int num, int timeout)
+int RingRead(int ring, u32& readseq, MPPacketHeader* header, u8* data)
 {
-    long remainingWaitingTime = timeout;
-    do
+    MPRingHeader* rhdr = RingHeader(ring);
+    MPSlot* slot = RingSlot(ring, readseq);
+
+    u32 seq = slot->Seq.load(std::memory_order_acquire);
+    if (seq != readseq + 1)
     {
-        flock(SemPool[num], LOCK_EX);
-        bool gotLock = false;
-        if (SemMemory[num] > 0)
+        // the slot still holds an older frame, or the next one is being written
+        if (seq == 0 || (s32)(seq - (readseq + 1)) < 0)
         {
-            SemMemory[num]--;
-            gotLock = true;
+            if ((rhdr->WriteSeq.load() - readseq) <= kNumSlots)
+                return Ring_Empty;
         }
-        flock(SemPool[num], LOCK_UN);
 
-        if (gotLock)
-            return true;
+        // the ring went all the way around since we last read
+        readseq = rhdr->WriteSeq.load();
+        rhdr->ReadSeq[InstanceID].store(readseq, std::memory_order_relaxed);
+        return Ring_Overflow;
+    }
 
-        if (remainingWaitingTime <= 0)
-            break;
+    *header = slot->Header;
+    if (header->Length > kSlotDataSize)
+        header->Length = 0;
+    if (header->Length)
+        memcpy(data, slot->Data, header->Length);
 
-        usleep(1000);
-        remainingWaitingTime--;
-    } while (true);
+    // make sure no writer got to the slot while we were copying it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot->Seq.load(std::memory_order_relaxed) != seq)
+    {
+        readseq = rhdr->WriteSeq.load();
+        rhdr->ReadSeq[InstanceID].store(readseq, std::memory_order_relaxed);
+        return Ring_Overflow;
+    }
 
-    return false;
+    readseq++;
+    rhdr->ReadSeq[InstanceID].store(readseq, std::memory_order_relaxed);
+    return Ring_OK;
 }
 
-void SemReset(int num)
+bool RingWait(int ring, u32 readseq, u64 deadline)
 {
-    while (SemWait(num, 0));
-}
+    MPRingHeader* rhdr = RingHeader(ring);
 
-void LockMemory()
-{
-    flock(MemoryFile, LOCK_EX);
-}
+    for (;;)
+    {
+        rhdr->NumWaiters.fetch_add(1);
+        u32 published = rhdr->Published.load();
 
-void UnlockMemory()
-{
-    flock(MemoryFile, LOCK_UN);
+        MPSlot* slot = RingSlot(ring, readseq);
+        bool ready = (slot->Seq.load(std::memory_order_acquire) != 0) &&
+                     ((s32)(slot->Seq.load(std::memory_order_acquire) - (readseq + 1)) >= 0);
+
+        u64 now = GetTimeUS();
+        if (!ready && now < deadline)
+            FutexWait(&rhdr->Published, published, deadline - now);
+
+        rhdr->NumWaiters.fetch_sub(1);
+
+        if (ready) return true;
+        if (GetTimeUS() >= deadline) return false;
+    }
 }
 
 int CreateSharedMemory(const char* name, u32 size)
@@ -281,21 +353,13 @@ void ReleaseResources()
 {
     if (Memory != nullptr && Memory != MAP_FAILED)
         munmap(Memory, kMemorySize);
+    Memory = nullptr;
 
     if (MemoryFile != -1)
     {
         close(MemoryFile);
         MemoryFile = -1;
     }
-
-    if (SemMemory != nullptr && SemMemory != MAP_FAILED)
-        munmap(SemMemory, kSemMemorySize);
-
-    if (SemMemoryFile != -1)
-    {
-        close(SemMemoryFile);
-        SemMemoryFile = -1;
-    }
 }
 
 bool LocalMultiplayer::Init()
@@ -317,31 +381,8 @@ bool LocalMultiplayer::Init()
             return false;
         }
 
-        SemMemoryFile = CreateSharedMemory("melonNIFISem", kSemMemorySize);
-        if (SemMemoryFile == -1)
-        {
-            ReleaseResources();
-            return false;
-        }
-
-        SemMemory = (u16*) mmap(NULL, kSemMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED, SemMemoryFile, 0);
-        if (SemMemory == MAP_FAILED)
-        {
-            ReleaseResources();
-            return false;
-        }
-
-        LockMemory();
+        // nobody else can see the memory before the master thread hands it out
         memset(Memory, 0, kMemorySize);
-        MPQueueHeader* header = (MPQueueHeader*) Memory;
-        header->PacketWriteOffset = kPacketStart;
-        header->ReplyWriteOffset = kReplyStart;
-        UnlockMemory();
-
-        for (int i = 0; i < 32; ++i)
-        {
-            SemMemory[i] = 1;
-        }
 
         MasterThread = Platform::Thread_Create(MasterInstanceThread);
     }
@@ -383,16 +424,6 @@ bool LocalMultiplayer::Init()
             return false;
         }
 
-        data = RequestType::SEMAPHORE_MEMORY_FD;
-        send(socketFd, &data, 1, 0);
-        if (ancil_recv_fd(socketFd, &SemMemoryFile) != 0)
-        {
-            debug("Failed to receive semaphores shared memory FD");
-            debug(strerror(errno));
-            close(socketFd);
-            return false;
-        }
-
         close(socketFd);
 
         debug("Shared memory FD: " + std::to_string(MemoryFile));
@@ -403,13 +434,6 @@ bool LocalMultiplayer::Init()
             return false;
         }
 
-        if (SemMemoryFile < 0)
-        {
-            debug("Failed to retrieve shared semaphores FD");
-            ReleaseResources();
-            return false;
-        }
-
         Memory = (u8*) mmap(NULL, kMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED, MemoryFile, 0);
         if (Memory == MAP_FAILED)
         {
@@ -418,49 +442,41 @@ bool LocalMultiplayer::Init()
             ReleaseResources();
             return false;
         }
+    }
 
-        SemMemory = (u16*) mmap(NULL, kSemMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED, SemMemoryFile, 0);
-        if (Memory == MAP_FAILED)
+    MPQueueHeader* header = QueueHeader();
+
+    u16 mask = header->InstanceBitmask.load();
+    for (;;)
+    {
+        int id = 0;
+        while (id < 16 && (mask & (1<<id))) id++;
+        if (id == 16)
         {
-            debug("Failed to map semaphore memory");
+            debug("Too many instances");
             ReleaseResources();
             return false;
         }
-    }
-
-    LockMemory();
-    MPQueueHeader* header = (MPQueueHeader*) Memory;
 
-    u16 mask = header->InstanceBitmask;
-    for (int i = 0; i < 16; i++)
-    {
-        if (!(mask & (1<<i)))
+        if (header->InstanceBitmask.compare_exchange_weak(mask, mask | (1<<id)))
         {
-            InstanceID = i;
-            header->InstanceBitmask |= (1<<i);
-            //header->ConnectedBitmask |= (1 << i);
+            InstanceID = id;
             break;
         }
     }
-    header->NumInstances++;
-
-    PacketReadOffset = header->PacketWriteOffset;
-    ReplyReadOffset = header->ReplyWriteOffset;
+    header->NumInstances.fetch_add(1);
 
-    UnlockMemory();
-
-    // prepare semaphores
-    // semaphores 0-15: regular frames; semaphore I is posted when instance I needs to process a new frame
-    // semaphores 16-31: MP replies; semaphore I is posted when instance I needs to process a new MP reply
-
-    SemPoolInit();
-    SemInit(InstanceID);
-    SemInit(16+InstanceID);
+    PacketReadSeq = RingHeader(0)->WriteSeq.load();
+    ReplyReadSeq = RingHeader(1)->WriteSeq.load();
+    RingHeader(0)->ReadSeq[InstanceID].store(PacketReadSeq);
+    RingHeader(1)->ReadSeq[InstanceID].store(ReplyReadSeq);
 
     debug("MP comm init OK, instance ID " + std::to_string(InstanceID));
 
     LastHostID = -1;
     RecvTimeout = 25;
+    CmdSentTime = 0;
+    MPStats::Reset();
 
     return true;
 }
@@ -479,14 +495,14 @@ void LocalMultiplayer::DeInit()
         MasterThread = nullptr;
     }
 
-    LockMemory();
-    MPQueueHeader* header = (MPQueueHeader*) Memory;
-    header->ConnectedBitmask &= ~(1 << InstanceID);
-    header->InstanceBitmask &= ~(1 << InstanceID);
-    header->NumInstances--;
-    UnlockMemory();
+    if (Memory == nullptr || Memory == MAP_FAILED)
+        return;
+
+    MPQueueHeader* header = QueueHeader();
+    header->ConnectedBitmask.fetch_and(~(1 << InstanceID));
+    header->InstanceBitmask.fetch_and(~(1 << InstanceID));
+    header->NumInstances.fetch_sub(1);
 
-    SemPoolDeinit();
     ReleaseResources();
 }
 
@@ -497,105 +513,30 @@ void LocalMultiplayer::SetRecvTimeout(int timeout)
 
 void LocalMultiplayer::Begin()
 {
-    LockMemory();
-    MPQueueHeader* header = (MPQueueHeader*) Memory;
-    PacketReadOffset = header->PacketWriteOffset;
-    ReplyReadOffset = header->ReplyWriteOffset;
-    SemReset(InstanceID);
-    SemReset(16+InstanceID);
-    header->ConnectedBitmask |= (1 << InstanceID);
-    UnlockMemory();
-}
+    PacketReadSeq = RingHeader(0)->WriteSeq.load();
+    ReplyReadSeq = RingHeader(1)->WriteSeq.load();
+    RingHeader(0)->ReadSeq[InstanceID].store(PacketReadSeq);
+    RingHeader(1)->ReadSeq[InstanceID].store(ReplyReadSeq);
 
-void LocalMultiplayer::End()
-{
-    LockMemory();
-    MPQueueHeader* header = (MPQueueHeader*) Memory;
-    //SemReset(InstanceID);
-    //SemReset(16+InstanceID);
-    header->ConnectedBitmask &= ~(1 << InstanceID);
-    UnlockMemory();
+    QueueHeader()->ConnectedBitmask.fetch_or(1 << InstanceID);
 }
 
-void FIFORead(int fifo, void* buf, int len)
+void LocalMultiplayer::End()
 {
-    u8* data = (u8*) Memory;
-
-    u32 offset, start, end;
-    if (fifo == 0)
-    {
-        offset = PacketReadOffset;
-        start = kPacketStart;
-        end = kPacketEnd;
-    }
-    else
-    {
-        offset = ReplyReadOffset;
-        start = kReplyStart;
-        end = kReplyEnd;
-    }
-
-    if ((offset + len) >= end)
-    {
-        u32 part1 = end - offset;
-        memcpy(buf, &data[offset], part1);
-        memcpy(&((u8*)buf)[part1], &data[start], len - part1);
-        offset = start + len - part1;
-    }
-    else
-    {
-        memcpy(buf, &data[offset], len);
-        offset += len;
-    }
-
-    if (fifo == 0) PacketReadOffset = offset;
-    else           ReplyReadOffset = offset;
+    QueueHeader()->ConnectedBitmask.fetch_and(~(1 << InstanceID));
 }
 
-void FIFOWrite(int fifo, void* buf, int len)
+int SendPacketGeneric(u32 type, u8* packet, int len, u64 timestamp)
 {
-    u8* data = Memory;
-    MPQueueHeader* header = (MPQueueHeader*)&data[0];
+    MPQueueHeader* header = QueueHeader();
 
-    u32 offset, start, end;
-    if (fifo == 0)
+    if (len > (int)kSlotDataSize)
     {
-        offset = header->PacketWriteOffset;
-        start = kPacketStart;
-        end = kPacketEnd;
-    }
-    else
-    {
-        offset = header->ReplyWriteOffset;
-        start = kReplyStart;
-        end = kReplyEnd;
-    }
-
-    if ((offset + len) >= end)
-    {
-        u32 part1 = end - offset;
-        memcpy(&data[offset], buf, part1);
-        memcpy(&data[start], &((u8*)buf)[part1], len - part1);
-        offset = start + len - part1;
-    }
-    else
-    {
-        memcpy(&data[offset], buf, len);
-        offset += len;
+        debug("Frame too long for the MP ring: " + std::to_string(len));
+        return 0;
     }
 
-    if (fifo == 0) header->PacketWriteOffset = offset;
-    else           header->ReplyWriteOffset = offset;
-}
-
-int SendPacketGeneric(u32 type, u8* packet, int len, u64 timestamp)
-{
-    LockMemory();
-    MPQueueHeader* header = (MPQueueHeader*) Memory;
-
-    u16 mask = header->ConnectedBitmask;
-
-    // TODO: check if the FIFO is full!
+    u16 mask = header->ConnectedBitmask.load();
 
     MPPacketHeader pktheader;
     pktheader.Magic = 0x4946494E;
@@ -605,38 +546,35 @@ int SendPacketGeneric(u32 type, u8* packet, int len, u64 timestamp)
     pktheader.Timestamp = timestamp;
 
     type &= 0xFFFF;
-    int nfifo = (type == 2) ? 1 : 0;
-    FIFOWrite(nfifo, &pktheader, sizeof(pktheader));
-    if (len)
-        FIFOWrite(nfifo, packet, len);
 
     if (type == 1)
     {
         // NOTE: this is not guarded against, say, multiple multiplay games happening on the same machine
         // we would need to pass the packet's SenderID through the wifi module for that
-        header->MPHostInstanceID = InstanceID;
-        header->MPReplyBitmask = 0;
-        ReplyReadOffset = header->ReplyWriteOffset;
-        SemReset(16 + InstanceID);
+        header->MPHostInstanceID.store(InstanceID);
+        header->MPReplyBitmask.store(0);
+
+        // whatever is left in the reply ring came in after we stopped waiting for it
+        u32 writeseq = RingHeader(1)->WriteSeq.load();
+        MPStats::RepliesLate(std::min(writeseq - ReplyReadSeq, kNumSlots));
+        ReplyReadSeq = writeseq;
+        RingHeader(1)->ReadSeq[InstanceID].store(ReplyReadSeq);
     }
-    else if (type == 2)
+
+    if (type == 1)
     {
-        header->MPReplyBitmask |= (1 << InstanceID);
+        MPStats::CmdSent(packet, len);
+        CmdSentTime = GetTimeUS();
     }
 
-    UnlockMemory();
-
     if (type == 2)
     {
-        SemPost(16 + header->MPHostInstanceID);
+        header->MPReplyBitmask.fetch_or(1 << InstanceID);
+        RingWrite(1, &pktheader, packet, 1 << header->MPHostInstanceID.load());
     }
     else
     {
-        for (int i = 0; i < 16; i++)
-        {
-            if (mask & (1<<i))
-                SemPost(i);
-        }
+        RingWrite(0, &pktheader, packet, mask & ~(1 << InstanceID));
     }
 
     return len;
@@ -644,50 +582,40 @@ int SendPacketGeneric(u32 type, u8* packet, int len, u64 timestamp)
 
 int RecvPacketGeneric(u8* packet, bool block, u64* timestamp)
 {
+    u64 deadline = GetTimeUS() + (block ? (RecvTimeout * 1000) : 0);
+
     for (;;)
     {
-        if (!SemWait(InstanceID, block ? RecvTimeout : 0))
-        {
-            return 0;
-        }
+        MPPacketHeader pktheader;
+        int res = RingRead(0, PacketReadSeq, &pktheader, packet);
 
-        LockMemory();
-        u8* data = (u8*) Memory;
-        MPQueueHeader* header = (MPQueueHeader*)&data[0];
+        if (res == Ring_Empty)
+        {
+            if (!block || !RingWait(0, PacketReadSeq, deadline))
+                return 0;
 
-        MPPacketHeader pktheader;
-        FIFORead(0, &pktheader, sizeof(pktheader));
+            continue;
+        }
 
-        if (pktheader.Magic != 0x4946494E)
+        if (res == Ring_Overflow || pktheader.Magic != 0x4946494E)
         {
             debug("PACKET FIFO OVERFLOW\n");
-            PacketReadOffset = header->PacketWriteOffset;
-            SemReset(InstanceID);
-            UnlockMemory();
             return 0;
         }
 
         if (pktheader.SenderID == InstanceID)
         {
             // skip this packet
-            PacketReadOffset += pktheader.Length;
-            if (PacketReadOffset >= kPacketEnd)
-                PacketReadOffset += kPacketStart - kPacketEnd;
-
-            UnlockMemory();
             continue;
         }
 
         if (pktheader.Length)
         {
-            FIFORead(0, packet, pktheader.Length);
-
             if (pktheader.Type == 1)
                 LastHostID = pktheader.SenderID;
         }
 
         if (timestamp) *timestamp = pktheader.Timestamp;
-        UnlockMemory();
         return pktheader.Length;
     }
 }
@@ -719,81 +647,85 @@ int LocalMultiplayer::SendAck(u8* packet, int len, u64 timestamp)
 
 int LocalMultiplayer::RecvHostPacket(u8* packet, u64* timestamp)
 {
+    u64 start = GetTimeUS();
     if (LastHostID != -1)
     {
         // check if the host is still connected
 
-        LockMemory();
-        u8* data = (u8*) Memory;
-        MPQueueHeader* header = (MPQueueHeader*)&data[0];
-        u16 curinstmask = header->ConnectedBitmask;
-        UnlockMemory();
+        u16 curinstmask = QueueHeader()->ConnectedBitmask.load();
 
         if (!(curinstmask & (1 << LastHostID)))
             return -1;
     }
 
-    return RecvPacketGeneric(packet, true, timestamp);
+    int ret = RecvPacketGeneric(packet, true, timestamp);
+    MPStats::Blocked(GetTimeUS() - start);
+    return ret;
 }
 
 u16 LocalMultiplayer::RecvReplies(u8* packets, u64 timestamp, u16 aidmask)
 {
     u16 ret = 0;
     u16 myinstmask = (1 << InstanceID);
-    u16 curinstmask;
-
-    {
-        LockMemory();
-        u8* data = (u8*) Memory;
-        MPQueueHeader* header = (MPQueueHeader*)&data[0];
-        curinstmask = header->ConnectedBitmask;
-        UnlockMemory();
-    }
+    u16 curinstmask = QueueHeader()->ConnectedBitmask.load();
 
     // if all clients have left: return early
     if ((myinstmask & curinstmask) == curinstmask)
         return 0;
 
+    // only wait as long as the clients usually take to reply
+    u64 start = GetTimeUS();
+    u32 timeout = MPStats::GetReplyTimeout(curinstmask & ~myinstmask, RecvTimeout * 1000);
+    u64 deadline = CmdSentTime + timeout;
+
     for (;;)
     {
-        if (!SemWait(16+InstanceID, RecvTimeout))
-        {
-            // no more replies available
-            return ret;
-        }
+        MPPacketHeader pktheader;
+        int res = RingRead(1, ReplyReadSeq, &pktheader, ReplyBuffer);
 
-        LockMemory();
-        u8* data = (u8*) Memory;
-        MPQueueHeader* header = (MPQueueHeader*)&data[0];
+        if (res == Ring_Empty)
+        {
+            if (!RingWait(1, ReplyReadSeq, deadline))
+            {
+                // no more replies available
+                for (int i = 0; i < 16; i++)
+                {
+                    if ((curinstmask & ~myinstmask) & (1<<i))
+                        MPStats::RepliesMissing(i);
+                }
+
+                MPStats::Blocked(GetTimeUS() - start);
+                return ret;
+            }
 
-        MPPacketHeader pktheader;
-        FIFORead(1, &pktheader, sizeof(pktheader));
+            continue;
+        }
 
-        if (pktheader.Magic != 0x4946494E)
+        if (res == Ring_Overflow || pktheader.Magic != 0x4946494E)
         {
             debug("REPLY FIFO OVERFLOW\n");
-            ReplyReadOffset = header->ReplyWriteOffset;
-            SemReset(16+InstanceID);
-            UnlockMemory();
+            MPStats::Blocked(GetTimeUS() - start);
             return 0;
         }
 
-        if ((pktheader.SenderID == InstanceID) || // packet we sent out (shouldn't happen, but hey)
-            (pktheader.Timestamp < (timestamp - 32))) // stale packet
+        if (pktheader.SenderID == InstanceID) // packet we sent out (shouldn't happen, but hey)
         {
             // skip this packet
-            ReplyReadOffset += pktheader.Length;
-            if (ReplyReadOffset >= kReplyEnd)
-                ReplyReadOffset += kReplyStart - kReplyEnd;
+            continue;
+        }
 
-            UnlockMemory();
+        if (pktheader.Timestamp < (timestamp - 32)) // stale packet
+        {
+            MPStats::RepliesLate(1);
             continue;
         }
 
+        MPStats::ReplyReceived(pktheader.SenderID, GetTimeUS() - CmdSentTime);
+
         if (pktheader.Length)
         {
             u32 aid = (pktheader.Type >> 16);
-            FIFORead(1, &packets[(aid-1)*1024], pktheader.Length);
+            memcpy(&packets[(aid-1)*1024], ReplyBuffer, std::min(pktheader.Length, 1024u));
             ret |= (1 << aid);
         }
 
@@ -802,12 +734,9 @@ u16 LocalMultiplayer::RecvReplies(u8* packets, u64 timestamp, u16 aidmask)
             ((ret & aidmask) == aidmask))
         {
             // all the clients have sent their reply
-
-            UnlockMemory();
+            MPStats::Blocked(GetTimeUS() - start);
             return ret;
         }
-
-        UnlockMemory();
     }
 }
 
@@ -0,0 +1,144 @@
+#include "MPStats.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+namespace MPStats
+{
+
+// latency estimate in the style of TCP's RTO: smoothed latency plus four times its mean deviation
+struct LatencyEstimate
+{
+    u32 SLatency;   // smoothed latency, us
+    u32 Deviation;  // smoothed mean deviation, us
+    bool Valid;
+};
+
+const u32 kMinReplyTimeout = 2000; // us
+const u32 kMaxCmdSize = 0x900;
+
+std::mutex Lock;
+Stats CurStats;
+LatencyEstimate Estimates[16];
+
+u8 LastCmd[kMaxCmdSize];
+int LastCmdLen;
+
+void Reset()
+{
+    std::lock_guard<std::mutex> lock(Lock);
+
+    memset(&CurStats, 0, sizeof(CurStats));
+    memset(Estimates, 0, sizeof(Estimates));
+    LastCmdLen = -1;
+}
+
+void GetStats(Stats* stats)
+{
+    std::lock_guard<std::mutex> lock(Lock);
+
+    *stats = CurStats;
+}
+
+void CmdSent(const u8* data, int len)
+{
+    std::lock_guard<std::mutex> lock(Lock);
+
+    CurStats.CmdsSent++;
+
+    // the wifi module sends the same CMD again when clients failed to reply
+    if (len == LastCmdLen && !memcmp(data, LastCmd, len))
+        CurStats.CmdResends++;
+
+    if (len <= (int)kMaxCmdSize)
+    {
+        memcpy(LastCmd, data, len);
+        LastCmdLen = len;
+    }
+    else
+        LastCmdLen = -1;
+}
+
+void ReplyReceived(int client, u64 latency)
+{
+    if (client < 0 || client >= 16) return;
+
+    std::lock_guard<std::mutex> lock(Lock);
+
+    CurStats.RepliesReceived++;
+
+    u32 sample = (u32)std::min<u64>(latency, 0xFFFFFFFF);
+    LatencyEstimate* est = &Estimates[client];
+    if (!est->Valid)
+    {
+        est->SLatency = sample;
+        est->Deviation = sample / 2;
+        est->Valid = true;
+    }
+    else
+    {
+        u32 diff = (sample > est->SLatency) ? (sample - est->SLatency) : (est->SLatency - sample);
+        est->Deviation = ((est->Deviation * 3) + diff) / 4;
+        est->SLatency = ((est->SLatency * 7) + sample) / 8;
+    }
+
+    CurStats.ReplyLatency[client] = est->SLatency;
+}
+
+void RepliesLate(u32 num)
+{
+    if (!num) return;
+
+    std::lock_guard<std::mutex> lock(Lock);
+
+    CurStats.LateReplies += num;
+}
+
+void RepliesMissing(int client)
+{
+    if (client < 0 || client >= 16) return;
+
+    std::lock_guard<std::mutex> lock(Lock);
+
+    CurStats.MissingReplies++;
+
+    // back off, so a client that got slower isn't cut off every frame
+    LatencyEstimate* est = &Estimates[client];
+    if (est->Valid)
+        est->Deviation = std::min<u32>(std::max<u32>(est->Deviation * 2, 500), 0x1000000);
+}
+
+void Blocked(u64 time)
+{
+    std::lock_guard<std::mutex> lock(Lock);
+
+    CurStats.TimeBlocked += time;
+}
+
+u32 GetReplyTimeout(u16 clientmask, u32 maxtimeout)
+{
+    std::lock_guard<std::mutex> lock(Lock);
+
+    u32 timeout = kMinReplyTimeout;
+    for (int i = 0; i < 16; i++)
+    {
+        if (!(clientmask & (1<<i))) continue;
+
+        LatencyEstimate* est = &Estimates[i];
+        if (!est->Valid)
+        {
+            // nothing known about this client yet
+            timeout = maxtimeout;
+            break;
+        }
+
+        timeout = std::max(timeout, est->SLatency + (est->Deviation * 4));
+    }
+
+    timeout = std::min(timeout, maxtimeout);
+    CurStats.ReplyTimeout = timeout;
+    return timeout;
+}
+
+}
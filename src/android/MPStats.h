@@ -0,0 +1,38 @@
+#ifndef MPSTATS_H
+#define MPSTATS_H
+
+#include <types.h>
+
+// reply latency tracking and counters shared by the multiplayer backends.
+// the host uses the per-client latency estimates to decide how long to wait for replies,
+// instead of always waiting out the full receive timeout for a client that is slow or gone.
+namespace MPStats
+{
+    struct Stats
+    {
+        u32 CmdsSent;
+        u32 CmdResends;         // CMD frames identical to the previous one
+        u32 RepliesReceived;
+        u32 LateReplies;        // arrived after the host stopped waiting for them
+        u32 MissingReplies;     // clients that hadn't replied when the host stopped waiting
+        u64 TimeBlocked;        // us spent in blocking receives
+        u32 ReplyTimeout;       // us, last timeout used when waiting for replies
+        u32 ReplyLatency[16];   // us, smoothed latency of each client's replies, 0 if unknown
+    };
+
+    void Reset();
+
+    // copy of the current counters, safe to call from any thread
+    void GetStats(Stats* stats);
+
+    void CmdSent(const u8* data, int len);
+    void ReplyReceived(int client, u64 latency);
+    void RepliesLate(u32 num);
+    void RepliesMissing(int client);
+    void Blocked(u64 time);
+
+    // how long to wait for replies from the given clients, at most maxtimeout (us)
+    u32 GetReplyTimeout(u16 clientmask, u32 maxtimeout);
+}
+
+#endif //MPSTATS_H
@@ -16,6 +16,8 @@
 #include "../AREngine.h"
 #include "../FileSavestate.h"
 #include "../DSi_I2C.h"
+#define XXH_STATIC_LINKING_ONLY
+#include "../xxhash/xxhash.h"
 #include "Config.h"
 #include "MemorySavestate.h"
 #include "FrontendUtil.h"
@@ -23,11 +25,13 @@
 #include "ROMManager.h"
 #include "AndroidCameraHandler.h"
 #include "LocalMultiplayer.h"
+#include "Netplay.h"
 #include "ScreenshotRenderer.h"
 #include "retroachievements/RetroAchievements.h"
 #include "retroachievements/RACallback.h"
 #include <android/asset_manager.h>
 #include <cstring>
+#include <ctime>
 
 #define MIC_BUFFER_SIZE 2048
 
@@ -47,9 +51,17 @@ bool isRenderConfigurationDirty = false;
 namespace MelonDSAndroid
 {
     GLuint softwareRenderingTexture;
+    // Per-row hashes of the screens last uploaded to softwareRenderingTexture
+    u64 screenRowHashes[2][192];
+    bool areScreenRowHashesValid = false;
     int frame = 0;
+    bool isFastForwardEnabled = false;
+    int framesSinceLastPresent = 0;
+    time_t lastStorageFlush = 0;
     int actualMicSource = 0;
     bool isMicInputEnabled = true;
+    // ms loop() waits for the other players' netplay input before giving up on the frame for now
+    const int kNetplayFrameTimeout = 8;
     RetroAchievements::RACallback* retroAchievementsCallback;
     AAssetManager* assetManager;
     AndroidFileHandler* fileHandler;
@@ -65,6 +77,7 @@ namespace MelonDSAndroid
     RomGbaSlotConfig* currentGbaSlotConfig = nullptr;
     RunMode currentRunMode;
 
+    bool uploadScreenChanges(int screen, u32* framebuffer);
     void setupAudioOutputStream(int audioLatency, int volume);
     void cleanupAudioOutputStream();
     void setupMicInputStream();
@@ -223,6 +236,8 @@ namespace MelonDSAndroid
         Config::RewindLengthSeconds = emulatorConfiguration.rewindLengthSeconds;
         isRenderConfigurationDirty = true;
 
+        // trimming or resetting the rewind window frees states, the last one's screenshot might still be in the works
+        screenshotRenderer->waitForScreenshot();
         if (emulatorConfiguration.rewindEnabled) {
             RewindManager::TrimRewindWindowIfRequired();
         } else {
@@ -320,6 +335,7 @@ namespace MelonDSAndroid
         screenshotRenderer->init();
         RetroAchievements::Init(retroAchievementsCallback);
         frame = 0;
+        areScreenRowHashesValid = false;
     }
 
     u32 loop()
@@ -329,7 +345,21 @@ namespace MelonDSAndroid
             isRenderConfigurationDirty = false;
         }
 
+        // When fast-forwarding, only about one frame per display refresh can be shown. The others are still fully
+        // emulated, but not drawn
+        bool skipRender = false;
+        if (isFastForwardEnabled)
+        {
+            int presentInterval = (int) currentConfiguration.fastForwardSpeedMultiplier;
+            skipRender = presentInterval > 1 && framesSinceLastPresent + 1 < presentInterval;
+        }
+        if (Netplay::IsActive() && !Netplay::BeginFrame(kNetplayFrameTimeout))
+            return 0;
+
+        GPU::SetRenderSkip(skipRender);
+
         u32 nLines = NDS::RunFrame();
+        Netplay::EndFrame();
         RetroAchievements::FrameUpdate();
 
         if (ROMManager::NDSSave)
@@ -338,29 +368,49 @@ namespace MelonDSAndroid
         if (ROMManager::GBASave)
             ROMManager::GBASave->CheckFlush();
 
-        int frontbuf = GPU::FrontBuffer;
-        int targetTexture;
-        if (GPU::Renderer == 0)
+        if (difftime(time(nullptr), lastStorageFlush) >= 2)
         {
-            if (GPU::Framebuffer[frontbuf][0] && GPU::Framebuffer[frontbuf][1])
-            {
-                glBindTexture(GL_TEXTURE_2D, softwareRenderingTexture);
-                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 192, GL_RGBA, GL_UNSIGNED_BYTE, GPU::Framebuffer[frontbuf][0]);
-                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 192 + 2, 256, 192, GL_RGBA, GL_UNSIGNED_BYTE, GPU::Framebuffer[frontbuf][1]);
-                glBindTexture(GL_TEXTURE_2D, 0);
-            }
-            targetTexture = softwareRenderingTexture;
+            NDS::FlushStorage();
+            lastStorageFlush = time(nullptr);
         }
-        else
+
+        if (GPU::FrameSkipped)
         {
-            targetTexture = GPU::CurGLCompositor->GetOutputTexture(frontbuf);
+            framesSinceLastPresent++;
         }
+        else
+        {
+            framesSinceLastPresent = 0;
 
-        glFlush();
-        frameRenderedCallback->onFrameRendered((int) targetTexture);
+            int frontbuf = GPU::FrontBuffer;
+            int targetTexture;
+            bool frameChanged = true;
+            if (GPU::Renderer == 0)
+            {
+                if (GPU::Framebuffer[frontbuf][0] && GPU::Framebuffer[frontbuf][1])
+                {
+                    glBindTexture(GL_TEXTURE_2D, softwareRenderingTexture);
+                    bool topScreenChanged = uploadScreenChanges(0, GPU::Framebuffer[frontbuf][0]);
+                    bool bottomScreenChanged = uploadScreenChanges(1, GPU::Framebuffer[frontbuf][1]);
+                    glBindTexture(GL_TEXTURE_2D, 0);
+
+                    frameChanged = topScreenChanged || bottomScreenChanged;
+                    areScreenRowHashesValid = true;
+                }
+                targetTexture = softwareRenderingTexture;
+            }
+            else
+            {
+                targetTexture = GPU::CurGLCompositor->GetOutputTexture(frontbuf);
+            }
 
-        // Capture screenshot
-        screenshotRenderer->renderScreenshot();
+            // Nothing to present if the screens are the same as in the last presented frame
+            if (frameChanged)
+            {
+                glFlush();
+                frameRenderedCallback->onFrameRendered((int) targetTexture);
+            }
+        }
 
         frame++;
         if (RewindManager::ShouldCaptureState(frame))
@@ -372,6 +422,79 @@ namespace MelonDSAndroid
         return nLines;
     }
 
+    /**
+     * Uploads the rows of a screen that changed since the last upload to the software rendering texture. Changes are
+     * detected by hashing each row, and all rows between the first and last changed one are uploaded at once.
+     *
+     * @param screen The screen to upload (0 for the top screen, 1 for the bottom screen)
+     * @param framebuffer The screen's 256x192 framebuffer
+     * @return Whether anything changed in the screen
+     */
+    bool uploadScreenChanges(int screen, u32* framebuffer)
+    {
+        int firstChangedRow = -1;
+        int lastChangedRow = -1;
+        for (int y = 0; y < 192; y++)
+        {
+            u64 hash = XXH3_64bits(&framebuffer[y * 256], 256 * 4);
+            if (!areScreenRowHashesValid || hash != screenRowHashes[screen][y])
+            {
+                if (firstChangedRow == -1)
+                    firstChangedRow = y;
+
+                lastChangedRow = y;
+                screenRowHashes[screen][y] = hash;
+            }
+        }
+
+        if (firstChangedRow == -1)
+            return false;
+
+        // Add 2 lines of spacing between the screens to match OpenGL rendering
+        int textureYOffset = screen == 0 ? 0 : 192 + 2;
+        int rowCount = lastChangedRow - firstChangedRow + 1;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, textureYOffset + firstChangedRow, 256, rowCount, GL_RGBA, GL_UNSIGNED_BYTE, &framebuffer[firstChangedRow * 256]);
+        return true;
+    }
+
+    void setFastForwardEnabled(bool enabled)
+    {
+        isFastForwardEnabled = enabled;
+        framesSinceLastPresent = 0;
+    }
+
+    void setNetworkMultiplayer(bool enabled, int port, const char* peers)
+    {
+        Config::MPNetwork = enabled;
+        Config::MPNetPort = port;
+        Config::MPNetPeers = peers ?: "";
+    }
+
+    bool startNetplay(int port, const char* peers, int player, int numPlayers, int inputDelay, int hashInterval, int maxRollback)
+    {
+        Netplay::Transport* transport = Netplay::CreateUDPTransport(port, peers ?: "");
+        return Netplay::Start(transport, player, numPlayers, inputDelay, hashInterval, maxRollback);
+    }
+
+    void stopNetplay()
+    {
+        Netplay::Stop();
+    }
+
+    Netplay::Status getNetplayStatus()
+    {
+        Netplay::Status status;
+        Netplay::GetStatus(&status);
+        return status;
+    }
+
+    MPStats::Stats getMultiplayerStats()
+    {
+        MPStats::Stats stats;
+        MPStats::GetStats(&stats);
+        return stats;
+    }
+
     void pause() {
         if (audioStream)
             audioStream->requestPause();
@@ -395,6 +518,7 @@ namespace MelonDSAndroid
         if (currentRunMode == ROM)
         {
             RetroAchievements::Reset();
+            screenshotRenderer->waitForScreenshot();
             RewindManager::Reset();
         }
         ROMManager::Reset();
@@ -442,6 +566,9 @@ namespace MelonDSAndroid
 
     bool saveState(const char* path)
     {
+        // The app picks up the savestate's thumbnail from the screenshot buffer
+        screenshotRenderer->captureScreenshot();
+
         FileSavestate* savestate = new FileSavestate(path, true);
         if (savestate->Error)
         {
@@ -505,7 +632,7 @@ namespace MelonDSAndroid
                 success = RetroAchievements::DoSavestate(savestate);
 
             if (success)
-                memcpy(rewindSaveState.screenshot, screenshotRenderer->getScreenshot(), screenshotWidth * screenshotHeight * 4);
+                screenshotRenderer->captureScreenshot((u32*) rewindSaveState.screenshot);
 
             delete savestate;
             return success;
@@ -539,6 +666,8 @@ namespace MelonDSAndroid
         remove(backupPath);
         // Restore frame
         frame = rewindSaveState.frame;
+        // the states after this one are dropped, including the one whose screenshot might still be in the works
+        screenshotRenderer->waitForScreenshot();
         RewindManager::OnRewindFromState(rewindSaveState);
 
         delete[] backupPath;
@@ -548,6 +677,9 @@ namespace MelonDSAndroid
 
     RewindWindow getRewindWindow()
     {
+        // The last rewind state's screenshot might still be in the works
+        screenshotRenderer->waitForScreenshot();
+
         return RewindWindow {
             .currentFrame = frame,
             .rewindStates = RewindManager::GetRewindWindow()
@@ -556,6 +688,10 @@ namespace MelonDSAndroid
 
     void stop()
     {
+        // the last rewind state's screenshot needs both the renderer and the rewind buffers
+        screenshotRenderer->waitForScreenshot();
+
+        Netplay::Stop();
         RetroAchievements::DeInit();
         ROMManager::EjectCart();
         ROMManager::EjectGBACart();
@@ -733,6 +869,7 @@ namespace MelonDSAndroid
         // Add 2 lines of spacing between the screens to match OpenGL rendering
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 192 * 2 + 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
         glBindTexture(GL_TEXTURE_2D, 0);
+        areScreenRowHashesValid = false;
 
         return true;
     }
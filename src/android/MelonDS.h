@@ -7,6 +7,8 @@
 #include "FrameRenderedCallback.h"
 #include "RewindManager.h"
 #include "RomGbaSlotConfig.h"
+#include "MPStats.h"
+#include "Netplay.h"
 #include "retroachievements/RAAchievement.h"
 #include "retroachievements/RACallback.h"
 #include "../types.h"
@@ -94,6 +96,59 @@ namespace MelonDSAndroid {
     extern int bootFirmware();
     extern void start();
     extern u32 loop();
+
+    /**
+     * Enables or disables fast-forward. While enabled, frames that will not be presented (based on the configured
+     * fastForwardSpeedMultiplier) are emulated without being rendered.
+     */
+    extern void setFastForwardEnabled(bool enabled);
+
+    /**
+     * Selects between local multiplayer (other instances on this device) and multiplayer over UDP. Takes effect the
+     * next time the emulator is set up.
+     *
+     * @param enabled Whether to use UDP instead of local multiplayer
+     * @param port The local UDP port
+     * @param peers Comma-separated list of host:port to exchange frames with. If empty, frames are broadcast on the LAN
+     */
+    extern void setNetworkMultiplayer(bool enabled, int port, const char* peers);
+
+    /**
+     * Returns the multiplayer counters: reply latency per client, late and missing replies, CMD resends and the time
+     * spent blocked waiting on other instances. Can be called from any thread.
+     */
+    extern MPStats::Stats getMultiplayerStats();
+
+    /**
+     * Starts a lockstep netplay session: every peer runs the same game and the input of all players is merged each
+     * frame. All peers must load the same ROM with the same firmware and settings, and start the session before running
+     * the first frame. While a session runs, loop() returns 0 without running a frame when the other players' input
+     * has not arrived yet.
+     *
+     * @param port The local UDP port
+     * @param peers Comma-separated list of host:port of the other players
+     * @param player The index of the local player, from 0 to numPlayers - 1
+     * @param numPlayers The number of players in the session, at most 4
+     * @param inputDelay How many frames input is delayed by, to hide the network latency
+     * @param hashInterval Every how many frames the peers compare state hashes to detect desyncs, 0 to never check
+     * @param maxRollback How many frames may run ahead of the other players' input on predictions, up to 16. Wrong
+     * predictions are fixed by restoring a snapshot and running the frames again without video or audio. 0 disables
+     * rollback, and every frame waits for all input
+     * @return Whether the session could be started
+     */
+    extern bool startNetplay(int port, const char* peers, int player, int numPlayers, int inputDelay, int hashInterval, int maxRollback);
+
+    /**
+     * Ends the netplay session. Must not be called while loop() is running.
+     */
+    extern void stopNetplay();
+
+    /**
+     * Returns the state of the netplay session, including whether the peers have desynced and how long snapshots and
+     * rollbacks take (RollbackFrames / TimeRollingBack is the rate at which the core can run frames again). Can be
+     * called from any thread.
+     */
+    extern Netplay::Status getNetplayStatus();
     extern void pause();
     extern void resume();
     extern void reset();
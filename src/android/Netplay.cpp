@@ -0,0 +1,823 @@
+#include "Netplay.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <time.h>
+#ifdef __ANDROID__
+#include <android/log.h>
+#endif
+#include "../NDS.h"
+#include "../ARM.h"
+#include "../GPU.h"
+#include "../SPU.h"
+#include "../MemorySavestate.h"
+
+#define XXH_STATIC_LINKING_ONLY
+#include "../xxhash/xxhash.h"
+
+// each packet carries every local input from the oldest frame a peer still needs up to the latest
+// sampled one, so a lost datagram is covered by the next one instead of needing acks and
+// retransmits. while waiting on remote input the local inputs are sent again every
+// kResendInterval, so two peers that both lost a packet don't end up waiting on each other.
+//
+// with rollback enabled, frames run ahead of the remote input using a prediction (the player
+// keeps doing what they last did), and a snapshot of the state is kept for every frame that
+// isn't confirmed yet. when the actual input turns out different from what a frame was run with,
+// the state goes back to that frame's snapshot and the frames since are run again, with video
+// and audio skipped. in that mode state hashes are taken from the snapshots, once every input
+// before them is known.
+
+namespace Netplay
+{
+
+void debug(std::string message)
+{
+#ifndef NDEBUG
+#ifdef __ANDROID__
+    __android_log_print(ANDROID_LOG_DEBUG, "Netplay", "%s", message.c_str());
+#else
+    printf("Netplay: %s\n", message.c_str());
+#endif
+#endif
+}
+
+const u32 kMagic = 0x4C504E4D; // MNPL
+const u16 kVersion = 1;
+
+const int kMaxPlayers = 4;
+const u32 kInputWindow = 128;     // frames of input kept per player
+const u32 kMaxInputDelay = 32;    // peers are at most 2*delay+rollback+1 frames apart, which has to fit in the window
+const u32 kMaxRollback = 16;
+const u32 kMaxInputsPerPacket = 100;
+const int kHashHistory = 16;
+const u32 kNoFrame = 0xFFFFFFFF;
+const int kResendInterval = 16;  // ms
+const int kMaxPacketSize = 1280;
+const u32 kMaxSnapshotSize = 32 * 1024 * 1024;
+
+struct FrameInput
+{
+    u32 KeyMask;
+    u16 TouchX;
+    u16 TouchY;
+    u8 Touching;
+    u8 LidClosed;
+    u16 Pad;
+};
+
+struct PacketHeader
+{
+    u32 Magic;
+    u16 Version;
+    u8 Player;
+    u8 NumPlayers;
+    u8 InputDelay;
+    u8 MaxRollback;
+    u16 NumInputs;
+    u32 NeedFrame;  // oldest frame the sender doesn't know every input of
+    u32 FirstFrame; // frame of the first input that follows
+    u32 HashFrame;  // frame of the latest state hash, kNoFrame if none yet
+    u64 Hash;
+};
+
+struct InputSlot
+{
+    u32 Frame;
+    bool Valid;
+    FrameInput Input;
+};
+
+struct HashSlot
+{
+    u32 Frame;
+    bool Valid;
+    u64 Hash;
+};
+
+std::atomic<bool> Active(false);
+Transport* CurTransport = nullptr;
+
+int LocalPlayer;
+int NumPlayers;
+u32 InputDelay;
+u32 HashInterval;
+u32 MaxRollback;
+
+u32 CurFrame;
+u32 ConfirmedFrame;     // every input is known for the frames before this one
+bool LocalSampled;
+InputSlot Inputs[kMaxPlayers][kInputWindow];
+u32 PeerFrames[kMaxPlayers];
+u64 LastSendTime;
+
+// rollback
+FrameInput UsedInputs[kMaxPlayers][kInputWindow];  // what each frame was last run with
+u32 RollbackFrame;      // earliest frame that was run with a wrong prediction
+std::vector<u8> Snapshots[kMaxRollback];
+u32 SnapshotFrames[kMaxRollback];
+u32 SnapshotLengths[kMaxRollback];
+u32 SnapshotSize;
+u32 NextHashFrame;
+
+HashSlot LocalHashes[kHashHistory];
+HashSlot RemoteHashes[kMaxPlayers][kHashHistory];
+u32 LastHashFrame;
+u64 LastHash;
+
+// written by the input thread, sampled once per frame
+std::atomic<u32> LocalKeyMask(0xFFF);
+std::atomic<u32> LocalTouch(0);   // bit 31: touching, 30-16: x, 15-0: y
+std::atomic<bool> LocalLid(false);
+
+std::mutex StatusLock;
+Status CurStatus;
+
+
+u64 GetTimeUS()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((u64)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+bool ParseAddress(std::string str, int defaultport, sockaddr_in* addr)
+{
+    std::string host = str;
+    int port = defaultport;
+
+    size_t colon = str.rfind(':');
+    if (colon != std::string::npos)
+    {
+        host = str.substr(0, colon);
+        port = atoi(str.substr(colon+1).c_str());
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    addrinfo* res;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0 || !res)
+        return false;
+
+    *addr = *(sockaddr_in*)res->ai_addr;
+    addr->sin_port = htons(port);
+    freeaddrinfo(res);
+    return true;
+}
+
+
+class UDPTransport : public Transport
+{
+public:
+    UDPTransport(int socket, std::vector<sockaddr_in> peers) : Socket(socket), Peers(peers) {}
+
+    ~UDPTransport() override
+    {
+        close(Socket);
+    }
+
+    void Send(const u8* data, int len) override
+    {
+        for (const sockaddr_in& peer : Peers)
+            sendto(Socket, data, len, 0, (const sockaddr*)&peer, sizeof(peer));
+    }
+
+    int Recv(u8* data, int maxlen, int timeout) override
+    {
+        int len = recv(Socket, data, maxlen, 0);
+        if (len > 0) return len;
+        if (timeout <= 0) return 0;
+
+        pollfd pfd;
+        pfd.fd = Socket;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout) <= 0)
+            return 0;
+
+        len = recv(Socket, data, maxlen, 0);
+        return (len > 0) ? len : 0;
+    }
+
+private:
+    int Socket;
+    std::vector<sockaddr_in> Peers;
+};
+
+Transport* CreateUDPTransport(int port, std::string peers)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+    {
+        debug("Failed to create socket");
+        return nullptr;
+    }
+
+    int opt = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(sock, (sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        debug("Failed to bind socket");
+        debug(strerror(errno));
+        close(sock);
+        return nullptr;
+    }
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    std::vector<sockaddr_in> targets;
+    size_t start = 0;
+    while (start < peers.size())
+    {
+        size_t end = peers.find(',', start);
+        if (end == std::string::npos) end = peers.size();
+
+        std::string entry = peers.substr(start, end - start);
+        sockaddr_in target;
+        if (!entry.empty())
+        {
+            if (ParseAddress(entry, port, &target))
+                targets.push_back(target);
+            else
+                debug("Could not resolve peer " + entry);
+        }
+
+        start = end + 1;
+    }
+
+    if (targets.empty())
+    {
+        debug("No peers to play with");
+        close(sock);
+        return nullptr;
+    }
+
+    return new UDPTransport(sock, targets);
+}
+
+
+struct LoopbackChannel
+{
+    std::mutex Lock;
+    std::condition_variable Cond;
+    std::deque<std::vector<u8>> Queue;
+};
+
+class LoopbackTransport : public Transport
+{
+public:
+    LoopbackTransport(std::shared_ptr<LoopbackChannel> in, std::shared_ptr<LoopbackChannel> out) : In(in), Out(out) {}
+
+    void Send(const u8* data, int len) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(Out->Lock);
+            Out->Queue.emplace_back(data, data + len);
+        }
+        Out->Cond.notify_one();
+    }
+
+    int Recv(u8* data, int maxlen, int timeout) override
+    {
+        std::unique_lock<std::mutex> lock(In->Lock);
+        if (In->Queue.empty() && timeout > 0)
+            In->Cond.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return !In->Queue.empty(); });
+        if (In->Queue.empty())
+            return 0;
+
+        std::vector<u8> packet = std::move(In->Queue.front());
+        In->Queue.pop_front();
+
+        int len = std::min((int)packet.size(), maxlen);
+        memcpy(data, packet.data(), len);
+        return len;
+    }
+
+private:
+    std::shared_ptr<LoopbackChannel> In;
+    std::shared_ptr<LoopbackChannel> Out;
+};
+
+void CreateLoopbackPair(Transport** a, Transport** b)
+{
+    auto atob = std::make_shared<LoopbackChannel>();
+    auto btoa = std::make_shared<LoopbackChannel>();
+
+    *a = new LoopbackTransport(btoa, atob);
+    *b = new LoopbackTransport(atob, btoa);
+}
+
+
+InputSlot* GetInputSlot(int player, u32 frame)
+{
+    return &Inputs[player][frame % kInputWindow];
+}
+
+bool Start(Transport* transport, int player, int numplayers, int inputdelay, int hashinterval, int maxrollback)
+{
+    Stop();
+
+    if (!transport) return false;
+    if (numplayers < 2 || numplayers > kMaxPlayers || player < 0 || player >= numplayers)
+    {
+        delete transport;
+        return false;
+    }
+
+    CurTransport = transport;
+    LocalPlayer = player;
+    NumPlayers = numplayers;
+    InputDelay = std::clamp<int>(inputdelay, 0, kMaxInputDelay);
+    HashInterval = std::max(hashinterval, 0);
+    MaxRollback = std::clamp<int>(maxrollback, 0, kMaxRollback);
+
+    CurFrame = 0;
+    ConfirmedFrame = 0;
+    LocalSampled = false;
+    memset(Inputs, 0, sizeof(Inputs));
+    memset(PeerFrames, 0, sizeof(PeerFrames));
+    memset(LocalHashes, 0, sizeof(LocalHashes));
+    memset(RemoteHashes, 0, sizeof(RemoteHashes));
+    LastHashFrame = kNoFrame;
+    LastHash = 0;
+
+    memset(UsedInputs, 0, sizeof(UsedInputs));
+    RollbackFrame = kNoFrame;
+    for (u32 i = 0; i < kMaxRollback; i++)
+        SnapshotFrames[i] = kNoFrame;
+    SnapshotSize = 0;
+    NextHashFrame = 0;
+
+    // nobody has input for the first frames, they run with everything released
+    for (int p = 0; p < NumPlayers; p++)
+    {
+        for (u32 f = 0; f < InputDelay; f++)
+        {
+            InputSlot* slot = GetInputSlot(p, f);
+            slot->Frame = f;
+            slot->Valid = true;
+            slot->Input.KeyMask = 0xFFF;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(StatusLock);
+        memset(&CurStatus, 0, sizeof(CurStatus));
+        CurStatus.Active = true;
+    }
+
+    debug("Started as player " + std::to_string(player) + " of " + std::to_string(numplayers));
+    Active = true;
+    return true;
+}
+
+void Stop()
+{
+    if (!Active) return;
+
+    Active = false;
+    delete CurTransport;
+    CurTransport = nullptr;
+
+    for (u32 i = 0; i < kMaxRollback; i++)
+        std::vector<u8>().swap(Snapshots[i]);
+
+    std::lock_guard<std::mutex> lock(StatusLock);
+    CurStatus.Active = false;
+}
+
+bool IsActive()
+{
+    return Active;
+}
+
+void SetLocalKeyMask(u32 mask)
+{
+    LocalKeyMask = mask;
+}
+
+void SetLocalTouch(bool touching, u16 x, u16 y)
+{
+    LocalTouch = (touching ? (1u << 31) : 0) | ((u32)(x & 0x7FFF) << 16) | y;
+}
+
+void SetLocalLid(bool closed)
+{
+    LocalLid = closed;
+}
+
+void DesyncDetected(u32 frame)
+{
+    std::lock_guard<std::mutex> lock(StatusLock);
+    if (CurStatus.Desynced) return;
+
+    debug("Desync detected at frame " + std::to_string(frame));
+    CurStatus.Desynced = true;
+    CurStatus.DesyncFrame = frame;
+}
+
+void CompareHashes(u32 frame)
+{
+    HashSlot* local = &LocalHashes[(frame / HashInterval) % kHashHistory];
+    if (!local->Valid || local->Frame != frame) return;
+
+    for (int p = 0; p < NumPlayers; p++)
+    {
+        if (p == LocalPlayer) continue;
+
+        HashSlot* remote = &RemoteHashes[p][(frame / HashInterval) % kHashHistory];
+        if (remote->Valid && remote->Frame == frame && remote->Hash != local->Hash)
+            DesyncDetected(frame);
+    }
+}
+
+void AddLocalHash(u32 frame, u64 hash)
+{
+    HashSlot* slot = &LocalHashes[(frame / HashInterval) % kHashHistory];
+    slot->Frame = frame;
+    slot->Valid = true;
+    slot->Hash = hash;
+
+    LastHashFrame = frame;
+    LastHash = hash;
+    CompareHashes(frame);
+}
+
+void SendInputs()
+{
+    u8 packet[kMaxPacketSize];
+    PacketHeader* header = (PacketHeader*)packet;
+    FrameInput* inputs = (FrameInput*)&packet[sizeof(PacketHeader)];
+
+    // from the oldest frame a peer is still waiting on, up to the latest sampled one
+    u32 latest = CurFrame + InputDelay;
+    u32 first = latest;
+    for (int p = 0; p < NumPlayers; p++)
+    {
+        if (p != LocalPlayer)
+            first = std::min(first, PeerFrames[p]);
+    }
+    if (latest - first >= kMaxInputsPerPacket)
+        first = latest + 1 - kMaxInputsPerPacket;
+
+    header->Magic = kMagic;
+    header->Version = kVersion;
+    header->Player = LocalPlayer;
+    header->NumPlayers = NumPlayers;
+    header->InputDelay = InputDelay;
+    header->MaxRollback = MaxRollback;
+    header->NumInputs = 0;
+    header->NeedFrame = ConfirmedFrame;
+    header->FirstFrame = first;
+    header->HashFrame = LastHashFrame;
+    header->Hash = LastHash;
+
+    for (u32 f = first; f <= latest; f++)
+        inputs[header->NumInputs++] = GetInputSlot(LocalPlayer, f)->Input;
+
+    CurTransport->Send(packet, sizeof(PacketHeader) + (header->NumInputs * sizeof(FrameInput)));
+    LastSendTime = GetTimeUS();
+}
+
+void HandlePacket(const u8* packet, int len)
+{
+    if (len < (int)sizeof(PacketHeader)) return;
+
+    const PacketHeader* header = (const PacketHeader*)packet;
+    if (header->Magic != kMagic || header->Version != kVersion) return;
+    if (header->Player >= NumPlayers || header->Player == LocalPlayer) return;
+    if (header->NumPlayers != NumPlayers || header->InputDelay != InputDelay || header->MaxRollback != MaxRollback)
+    {
+        debug("Ignoring packet from a peer with different settings");
+        return;
+    }
+    if (header->NumInputs > kMaxInputsPerPacket) return;
+    if (len < (int)(sizeof(PacketHeader) + (header->NumInputs * sizeof(FrameInput)))) return;
+
+    int player = header->Player;
+    PeerFrames[player] = std::max(PeerFrames[player], header->NeedFrame);
+
+    const FrameInput* inputs = (const FrameInput*)&packet[sizeof(PacketHeader)];
+    for (u32 i = 0; i < header->NumInputs; i++)
+    {
+        u32 frame = header->FirstFrame + i;
+
+        // frames already confirmed, or too far ahead to have a slot
+        if (frame < ConfirmedFrame || frame >= ConfirmedFrame + kInputWindow) continue;
+
+        InputSlot* slot = GetInputSlot(player, frame);
+        if (slot->Valid && slot->Frame == frame) continue;
+
+        slot->Frame = frame;
+        slot->Valid = true;
+        slot->Input = inputs[i];
+
+        // this frame already ran with a prediction, and it was wrong
+        if (frame < CurFrame && memcmp(&UsedInputs[player][frame % kInputWindow], &inputs[i], sizeof(FrameInput)))
+            RollbackFrame = std::min(RollbackFrame, frame);
+    }
+
+    if (HashInterval && header->HashFrame != kNoFrame && !(header->HashFrame % HashInterval))
+    {
+        HashSlot* slot = &RemoteHashes[player][(header->HashFrame / HashInterval) % kHashHistory];
+        if (!slot->Valid || slot->Frame != header->HashFrame)
+        {
+            slot->Frame = header->HashFrame;
+            slot->Valid = true;
+            slot->Hash = header->Hash;
+            CompareHashes(header->HashFrame);
+        }
+    }
+}
+
+void UpdateConfirmedFrame()
+{
+    for (;;)
+    {
+        for (int p = 0; p < NumPlayers; p++)
+        {
+            InputSlot* slot = GetInputSlot(p, ConfirmedFrame);
+            if (!slot->Valid || slot->Frame != ConfirmedFrame)
+                return;
+        }
+
+        ConfirmedFrame++;
+    }
+}
+
+bool CanRunFrame()
+{
+    // without rollback, that's once every input for the frame is known
+    return ConfirmedFrame + MaxRollback > CurFrame;
+}
+
+const FrameInput* GetFrameInput(int player, u32 frame)
+{
+    static const FrameInput neutral = {0xFFF};
+
+    // the actual input if it's known, otherwise the player is assumed
+    // to still be doing whatever they were last known to do
+    for (u32 f = frame; f + kInputWindow > frame; f--)
+    {
+        InputSlot* slot = GetInputSlot(player, f);
+        if (slot->Valid && slot->Frame == f)
+            return &slot->Input;
+        if (f == 0) break;
+    }
+
+    return &neutral;
+}
+
+void ApplyInputs(u32 frame)
+{
+    // all players share the one console: a button is held if anyone holds it,
+    // and the lowest player touching the screen gets the touch
+    u32 keymask = 0xFFF;
+    bool lid = false;
+    const FrameInput* touch = nullptr;
+    for (int p = 0; p < NumPlayers; p++)
+    {
+        const FrameInput* input = GetFrameInput(p, frame);
+        UsedInputs[p][frame % kInputWindow] = *input;
+
+        keymask &= input->KeyMask;
+        lid |= input->LidClosed;
+        if (input->Touching && !touch)
+            touch = input;
+    }
+
+    NDS::SetKeyMask(keymask);
+    NDS::SetLidClosed(lid);
+    if (touch)
+        NDS::TouchScreen(touch->TouchX, touch->TouchY);
+    else
+        NDS::ReleaseScreen();
+}
+
+bool SaveSnapshot(u32 frame)
+{
+    u64 start = GetTimeUS();
+
+    if (!SnapshotSize)
+    {
+        // the size of the state doesn't change much during a session, find out once
+        std::vector<u8> scratch(kMaxSnapshotSize);
+        MemorySavestate state(scratch.data(), kMaxSnapshotSize, true);
+        state.Snapshot = true;
+        if (!NDS::DoSavestate(&state) || state.Error)
+        {
+            debug("Failed to measure the savestate size");
+            return false;
+        }
+
+        SnapshotSize = state.GetLength() + (state.GetLength() / 8);
+        for (u32 i = 0; i < MaxRollback; i++)
+            Snapshots[i].resize(SnapshotSize);
+    }
+
+    int slot = frame % MaxRollback;
+    bool success;
+    {
+        MemorySavestate state(Snapshots[slot].data(), SnapshotSize, true);
+        state.Snapshot = true;
+        success = NDS::DoSavestate(&state) && !state.Error;
+        SnapshotLengths[slot] = state.GetLength();
+    }
+    SnapshotFrames[slot] = success ? frame : kNoFrame;
+
+    std::lock_guard<std::mutex> lock(StatusLock);
+    CurStatus.Snapshots++;
+    CurStatus.TimeSnapshotting += GetTimeUS() - start;
+    return success;
+}
+
+bool LoadSnapshot(u32 frame)
+{
+    int slot = frame % MaxRollback;
+    if (SnapshotFrames[slot] != frame)
+        return false;
+
+    MemorySavestate state(Snapshots[slot].data(), SnapshotLengths[slot], false);
+    state.Snapshot = true;
+    return NDS::DoSavestate(&state) && !state.Error;
+}
+
+void Rollback()
+{
+    u64 start = GetTimeUS();
+    u32 frame = RollbackFrame;
+    RollbackFrame = kNoFrame;
+
+    if (!LoadSnapshot(frame))
+    {
+        // nothing to go back to, the state can't be fixed anymore
+        debug("No snapshot for frame " + std::to_string(frame));
+        DesyncDetected(frame);
+        return;
+    }
+
+    GPU::SetRenderSkip(true);
+    SPU::SetOutputSkip(true);
+    for (u32 f = frame; f < CurFrame; f++)
+    {
+        if (f != frame)
+            SaveSnapshot(f);
+
+        ApplyInputs(f);
+        NDS::RunFrame();
+    }
+    SPU::SetOutputSkip(false);
+
+    std::lock_guard<std::mutex> lock(StatusLock);
+    CurStatus.Rollbacks++;
+    CurStatus.RollbackFrames += CurFrame - frame;
+    CurStatus.TimeRollingBack += GetTimeUS() - start;
+}
+
+void HashSnapshots()
+{
+    if (!HashInterval) return;
+
+    // a snapshot is final once every input before it is known
+    u32 last = std::min(ConfirmedFrame, CurFrame);
+    for (; NextHashFrame <= last; NextHashFrame++)
+    {
+        if (NextHashFrame % HashInterval) continue;
+
+        int slot = NextHashFrame % MaxRollback;
+        if (SnapshotFrames[slot] != NextHashFrame) continue;
+
+        AddLocalHash(NextHashFrame, XXH64(Snapshots[slot].data(), SnapshotLengths[slot], 0));
+    }
+}
+
+bool BeginFrame(int timeout)
+{
+    if (!Active) return true;
+
+    if (!LocalSampled)
+    {
+        u32 touch = LocalTouch;
+
+        InputSlot* slot = GetInputSlot(LocalPlayer, CurFrame + InputDelay);
+        slot->Frame = CurFrame + InputDelay;
+        slot->Valid = true;
+        slot->Input.KeyMask = LocalKeyMask & 0xFFF;
+        slot->Input.Touching = (touch >> 31) & 0x1;
+        slot->Input.TouchX = (touch >> 16) & 0x7FFF;
+        slot->Input.TouchY = touch & 0xFFFF;
+        slot->Input.LidClosed = LocalLid;
+
+        LocalSampled = true;
+        SendInputs();
+    }
+
+    u8 packet[kMaxPacketSize];
+    int len;
+    while ((len = CurTransport->Recv(packet, sizeof(packet), 0)) > 0)
+        HandlePacket(packet, len);
+    UpdateConfirmedFrame();
+
+    if (!CanRunFrame())
+    {
+        u64 start = GetTimeUS();
+        u64 deadline = start + ((u64)std::max(timeout, 0) * 1000);
+
+        while (!CanRunFrame())
+        {
+            u64 now = GetTimeUS();
+            if (now - LastSendTime >= kResendInterval * 1000)
+                SendInputs();
+
+            if (now >= deadline)
+            {
+                std::lock_guard<std::mutex> lock(StatusLock);
+                CurStatus.StalledFrames++;
+                CurStatus.TimeStalled += now - start;
+                return false;
+            }
+
+            int wait = (int)std::min<u64>((deadline - now + 999) / 1000, kResendInterval);
+            len = CurTransport->Recv(packet, sizeof(packet), wait);
+            if (len > 0)
+            {
+                HandlePacket(packet, len);
+                UpdateConfirmedFrame();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(StatusLock);
+        CurStatus.TimeStalled += GetTimeUS() - start;
+    }
+
+    if (MaxRollback)
+    {
+        if (RollbackFrame < CurFrame)
+            Rollback();
+
+        SaveSnapshot(CurFrame);
+        HashSnapshots();
+    }
+
+    ApplyInputs(CurFrame);
+    return true;
+}
+
+u64 HashState()
+{
+    XXH64_state_t hash;
+    XXH64_reset(&hash, 0);
+    XXH64_update(&hash, NDS::MainRAM, NDS::MainRAMMask + 1);
+    XXH64_update(&hash, NDS::SharedWRAM, NDS::SharedWRAMSize);
+    XXH64_update(&hash, NDS::ARM7WRAM, NDS::ARM7WRAMSize);
+    XXH64_update(&hash, NDS::ARM9->R, sizeof(NDS::ARM9->R));
+    XXH64_update(&hash, NDS::ARM7->R, sizeof(NDS::ARM7->R));
+    return XXH64_digest(&hash);
+}
+
+void EndFrame()
+{
+    if (!Active) return;
+
+    // with rollback, the state after a frame may still change, hashes come from the snapshots instead
+    if (!MaxRollback && HashInterval && !(CurFrame % HashInterval))
+        AddLocalHash(CurFrame, HashState());
+
+    CurFrame++;
+    LocalSampled = false;
+
+    std::lock_guard<std::mutex> lock(StatusLock);
+    CurStatus.Frame = CurFrame;
+}
+
+void GetStatus(Status* status)
+{
+    std::lock_guard<std::mutex> lock(StatusLock);
+
+    *status = CurStatus;
+}
+
+}
@@ -0,0 +1,70 @@
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include <string>
+#include <types.h>
+
+// lockstep netplay: every peer runs the same single console, and each frame is only run once the
+// input of every player for it is known. a player's input is sent InputDelay frames ahead of when
+// it's used, which hides the network latency as long as it stays under that many frames.
+// peers have to start from the same ROM, firmware and settings; state hashes are exchanged
+// to tell when they've drifted apart anyway.
+// with rollback, frames can also run up to MaxRollback frames ahead of the remote input, and are
+// run again from a snapshot when the input they were run with turns out wrong.
+namespace Netplay
+{
+    class Transport
+    {
+    public:
+        virtual ~Transport() {}
+
+        virtual void Send(const u8* data, int len) = 0;
+
+        // returns the length of the received packet, 0 if nothing came in within the timeout (ms)
+        virtual int Recv(u8* data, int maxlen, int timeout) = 0;
+    };
+
+    // peers: comma-separated list of host:port
+    Transport* CreateUDPTransport(int port, std::string peers);
+
+    // two transports connected to each other within the process, for driving a peer from the same process
+    void CreateLoopbackPair(Transport** a, Transport** b);
+
+    struct Status
+    {
+        bool Active;
+        u32 Frame;              // next frame to be run
+        u32 StalledFrames;      // times a frame had to wait past the timeout for remote input
+        u64 TimeStalled;        // us spent waiting for remote input
+        bool Desynced;
+        u32 DesyncFrame;
+
+        u32 Snapshots;
+        u64 TimeSnapshotting;   // us spent saving snapshots
+        u32 Rollbacks;          // times remote input turned out different from its prediction
+        u32 RollbackFrames;     // frames run again because of that
+        u64 TimeRollingBack;    // us spent restoring snapshots and running frames again
+    };
+
+    // takes ownership of the transport. hashinterval: frames between state hash checks, 0 to disable.
+    // maxrollback: how many frames may run on predicted input, 0 for plain lockstep
+    bool Start(Transport* transport, int player, int numplayers, int inputdelay, int hashinterval, int maxrollback);
+    // not while a frame is being run
+    void Stop();
+    bool IsActive();
+
+    // local input, can be called from any thread
+    void SetLocalKeyMask(u32 mask);
+    void SetLocalTouch(bool touching, u16 x, u16 y);
+    void SetLocalLid(bool closed);
+
+    // called around NDS::RunFrame(). returns false if the other players' input for the frame
+    // didn't arrive within the timeout (ms), in which case the frame must not be run yet.
+    // frames run again after a rollback leave render skip enabled
+    bool BeginFrame(int timeout);
+    void EndFrame();
+
+    void GetStatus(Status* status);
+}
+
+#endif // NETPLAY_H
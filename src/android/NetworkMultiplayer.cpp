@@ -0,0 +1,699 @@
+#include "NetworkMultiplayer.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <vector>
+#include <time.h>
+#ifdef __ANDROID__
+#include <android/log.h>
+#endif
+#include "MPStats.h"
+
+// MP frames carried over UDP, for playing across devices.
+//
+// frames go out in batches: a datagram is only sent once it is full, once its oldest frame
+// has waited kMaxBatchDelay, or right before we block waiting for frames from the other side.
+// each datagram carries a per-sender sequence number, and datagrams arriving behind a newer
+// one are dropped, so frames from a given peer are always seen in the order they were sent.
+
+namespace NetworkMultiplayer
+{
+
+void debug(std::string message)
+{
+#ifndef NDEBUG
+#ifdef __ANDROID__
+    __android_log_print(ANDROID_LOG_DEBUG, "NetworkMultiplayer", "%s", message.c_str());
+#else
+    printf("NetworkMultiplayer: %s\n", message.c_str());
+#endif
+#endif
+}
+
+struct NetDatagramHeader
+{
+    u32 Magic;
+    u16 Version;
+    u16 Kind;       // 0=frames 1=hello 2=bye 3=ping 4=pong
+    u32 SessionID;  // random per instance
+    u32 Seq;        // per-sender datagram sequence number
+    u64 Time;       // sender clock, echoed back in pongs
+    u16 NumFrames;
+    u16 Pad[3];
+};
+
+struct NetFrameHeader
+{
+    u32 Type;       // 0=regular 1=CMD 2=reply 3=ack, AID in the upper 16 bits for replies
+    u32 Length;
+    u64 Timestamp;
+};
+
+enum
+{
+    Datagram_Frames = 0,
+    Datagram_Hello,
+    Datagram_Bye,
+    Datagram_Ping,
+    Datagram_Pong,
+};
+
+struct Peer
+{
+    sockaddr_in Addr;
+    u32 SessionID;
+    u32 LastSeq;
+    u64 LastSeen;
+    bool Active;
+    bool Connected;
+    u32 RTT;
+};
+
+struct Frame
+{
+    int Sender;
+    u32 Type;
+    u64 Timestamp;
+    std::vector<u8> Data;
+};
+
+const u32 kMagic = 0x5546494E; // NIFU
+const u16 kVersion = 1;
+const int kMaxPeers = 16;
+const u32 kMaxDatagramSize = 0x2400;
+const u32 kBatchSize = 1400;        // stay under the usual MTU when batching small frames
+const u64 kMaxBatchDelay = 500;     // us
+const u64 kPingInterval = 250000;   // us
+const u64 kPeerTimeout = 2000000;   // us
+const size_t kMaxQueuedFrames = 256;
+
+int Port = 7064;
+std::string PeerList;
+
+int Socket = -1;
+std::vector<sockaddr_in> Targets;
+
+u32 SessionID;
+u32 SendSeq;
+u64 LastPing;
+
+Peer Peers[kMaxPeers]; // 0 is us
+int LastHostID;
+int RecvTimeout;
+u64 CmdSentTime;
+
+u8 SendBuffer[kMaxDatagramSize];
+u32 SendLength;
+u16 SendNumFrames;
+int SendDest;           // peer the pending batch goes to, -1 for everyone
+u64 SendOldest;
+
+u8 RecvBuffer[kMaxDatagramSize];
+
+std::deque<Frame> PacketQueue;
+std::deque<Frame> ReplyQueue;
+
+
+u64 GetTimeUS()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((u64)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+bool ParseAddress(std::string str, sockaddr_in* addr)
+{
+    std::string host = str;
+    int port = Port;
+
+    size_t colon = str.rfind(':');
+    if (colon != std::string::npos)
+    {
+        host = str.substr(0, colon);
+        port = atoi(str.substr(colon+1).c_str());
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    addrinfo* res;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0 || !res)
+        return false;
+
+    *addr = *(sockaddr_in*)res->ai_addr;
+    addr->sin_port = htons(port);
+    freeaddrinfo(res);
+    return true;
+}
+
+void InitHeader(NetDatagramHeader* header, u16 kind)
+{
+    memset(header, 0, sizeof(NetDatagramHeader));
+    header->Magic = kMagic;
+    header->Version = kVersion;
+    header->Kind = kind;
+    header->SessionID = SessionID;
+    header->Seq = SendSeq++;
+    header->Time = GetTimeUS();
+}
+
+void SendDatagram(u8* data, u32 len, int dest)
+{
+    if (dest >= 0)
+    {
+        sendto(Socket, data, len, 0, (sockaddr*)&Peers[dest].Addr, sizeof(sockaddr_in));
+        return;
+    }
+
+    for (const sockaddr_in& target : Targets)
+        sendto(Socket, data, len, 0, (const sockaddr*)&target, sizeof(sockaddr_in));
+}
+
+void SendControl(u16 kind, u64 time, int dest)
+{
+    NetDatagramHeader header;
+    InitHeader(&header, kind);
+    if (kind == Datagram_Pong) header.Time = time;
+
+    SendDatagram((u8*)&header, sizeof(header), dest);
+}
+
+void Flush()
+{
+    if (!SendNumFrames) return;
+
+    NetDatagramHeader* header = (NetDatagramHeader*)SendBuffer;
+    InitHeader(header, Datagram_Frames);
+    header->NumFrames = SendNumFrames;
+
+    SendDatagram(SendBuffer, SendLength, SendDest);
+
+    SendLength = sizeof(NetDatagramHeader);
+    SendNumFrames = 0;
+}
+
+void QueueFrame(u32 type, u8* data, u32 len, u64 timestamp, int dest)
+{
+    u32 framelen = sizeof(NetFrameHeader) + len;
+
+    // a batch only ever goes to one destination
+    if (SendNumFrames && ((SendDest != dest) || (SendLength + framelen > kBatchSize)))
+        Flush();
+
+    if (!SendNumFrames)
+    {
+        SendDest = dest;
+        SendOldest = GetTimeUS();
+    }
+
+    NetFrameHeader* frame = (NetFrameHeader*)&SendBuffer[SendLength];
+    frame->Type = type;
+    frame->Length = len;
+    frame->Timestamp = timestamp;
+    if (len) memcpy(&SendBuffer[SendLength + sizeof(NetFrameHeader)], data, len);
+
+    SendLength += framelen;
+    SendNumFrames++;
+}
+
+int FindPeer(sockaddr_in* addr, u32 session)
+{
+    int freeslot = -1;
+    for (int i = 1; i < kMaxPeers; i++)
+    {
+        if (!Peers[i].Active)
+        {
+            if (freeslot == -1) freeslot = i;
+            continue;
+        }
+
+        if (Peers[i].SessionID == session)
+            return i;
+
+        // an instance restarting on the same address takes its old slot over
+        if ((Peers[i].Addr.sin_addr.s_addr == addr->sin_addr.s_addr) &&
+            (Peers[i].Addr.sin_port == addr->sin_port))
+        {
+            freeslot = i;
+            break;
+        }
+    }
+
+    if (freeslot == -1)
+        return -1;
+
+    Peer* peer = &Peers[freeslot];
+    memset(peer, 0, sizeof(Peer));
+    peer->Addr = *addr;
+    peer->SessionID = session;
+    peer->LastSeq = 0xFFFFFFFF;
+    peer->Active = true;
+    debug("New peer " + std::to_string(freeslot) + ": " + inet_ntoa(addr->sin_addr) + ":" + std::to_string(ntohs(addr->sin_port)));
+    return freeslot;
+}
+
+void HandleDatagram(u8* data, u32 len, sockaddr_in* addr)
+{
+    if (len < sizeof(NetDatagramHeader)) return;
+
+    NetDatagramHeader* header = (NetDatagramHeader*)data;
+    if (header->Magic != kMagic || header->Version != kVersion) return;
+    if (header->SessionID == SessionID) return; // our own broadcast
+
+    int id = FindPeer(addr, header->SessionID);
+    if (id == -1) return;
+
+    Peer* peer = &Peers[id];
+    u64 now = GetTimeUS();
+    peer->LastSeen = now;
+
+    if (peer->LastSeq != 0xFFFFFFFF && (s32)(header->Seq - peer->LastSeq) <= 0)
+        return; // came in behind a newer datagram
+    peer->LastSeq = header->Seq;
+
+    switch (header->Kind)
+    {
+    case Datagram_Hello:
+        // an instance that started after us hasn't heard our hello
+        if (!peer->Connected)
+            SendControl(Datagram_Hello, 0, id);
+        peer->Connected = true;
+        return;
+
+    case Datagram_Bye:
+        peer->Connected = false;
+        return;
+
+    case Datagram_Ping:
+        // in case the hellos got lost
+        peer->Connected = true;
+        SendControl(Datagram_Pong, header->Time, id);
+        return;
+
+    case Datagram_Pong:
+        {
+            u32 rtt = (u32)std::min<u64>(now - header->Time, 0xFFFFFFFF);
+            peer->RTT = peer->RTT ? ((peer->RTT * 7) + rtt) / 8 : rtt;
+        }
+        peer->Connected = true;
+        return;
+    }
+
+    peer->Connected = true;
+
+    u32 offset = sizeof(NetDatagramHeader);
+    for (int i = 0; i < header->NumFrames; i++)
+    {
+        if (offset + sizeof(NetFrameHeader) > len) break;
+
+        NetFrameHeader* fhdr = (NetFrameHeader*)&data[offset];
+        offset += sizeof(NetFrameHeader);
+        if (offset + fhdr->Length > len) break;
+
+        Frame frame;
+        frame.Sender = id;
+        frame.Type = fhdr->Type;
+        frame.Timestamp = fhdr->Timestamp;
+        frame.Data.assign(&data[offset], &data[offset + fhdr->Length]);
+        offset += fhdr->Length;
+
+        std::deque<Frame>& queue = ((frame.Type & 0xFFFF) == 2) ? ReplyQueue : PacketQueue;
+        if (queue.size() >= kMaxQueuedFrames)
+        {
+            debug("Receive queue full, dropping the oldest frame");
+            queue.pop_front();
+        }
+        queue.push_back(std::move(frame));
+    }
+}
+
+// drain the socket and do the periodic work. waits up to the given time for something to arrive
+void Poll(int timeoutms)
+{
+    if (Socket == -1) return;
+
+    u64 now = GetTimeUS();
+
+    if (SendNumFrames && (now - SendOldest) >= kMaxBatchDelay)
+        Flush();
+
+    if ((now - LastPing) >= kPingInterval)
+    {
+        LastPing = now;
+        SendControl(Datagram_Ping, 0, -1);
+
+        for (int i = 1; i < kMaxPeers; i++)
+        {
+            if (Peers[i].Active && (now - Peers[i].LastSeen) >= kPeerTimeout)
+            {
+                debug("Peer " + std::to_string(i) + " timed out");
+                Peers[i].Active = false;
+                Peers[i].Connected = false;
+            }
+        }
+    }
+
+    if (timeoutms > 0)
+    {
+        pollfd pfd;
+        pfd.fd = Socket;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeoutms) <= 0)
+            return;
+    }
+
+    for (;;)
+    {
+        sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
+        int len = recvfrom(Socket, RecvBuffer, kMaxDatagramSize, 0, (sockaddr*)&addr, &addrlen);
+        if (len <= 0) break;
+
+        HandleDatagram(RecvBuffer, len, &addr);
+    }
+}
+
+// wait until the given queue has frames in it or the deadline passes
+bool WaitForFrames(std::deque<Frame>& queue, u64 deadline)
+{
+    Flush();
+
+    for (;;)
+    {
+        Poll(0);
+        if (!queue.empty()) return true;
+
+        u64 now = GetTimeUS();
+        if (now >= deadline) return false;
+
+        Poll((int)((deadline - now + 999) / 1000));
+        if (!queue.empty()) return true;
+    }
+}
+
+u16 ConnectedMask()
+{
+    u16 mask = 1;
+    for (int i = 1; i < kMaxPeers; i++)
+    {
+        if (Peers[i].Active && Peers[i].Connected)
+            mask |= (1 << i);
+    }
+    return mask;
+}
+
+void SetSession(int port, std::string peers)
+{
+    Port = port;
+    PeerList = peers;
+}
+
+bool Init()
+{
+    debug("Init");
+
+    Socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (Socket < 0)
+    {
+        debug("Failed to create socket");
+        debug(strerror(errno));
+        Socket = -1;
+        return false;
+    }
+
+    int opt = 1;
+    setsockopt(Socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(Socket, SOL_SOCKET, SO_BROADCAST, &opt, sizeof(opt));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(Port);
+    if (bind(Socket, (sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        debug("Failed to bind socket");
+        debug(strerror(errno));
+        close(Socket);
+        Socket = -1;
+        return false;
+    }
+
+    fcntl(Socket, F_SETFL, fcntl(Socket, F_GETFL, 0) | O_NONBLOCK);
+
+    Targets.clear();
+    size_t start = 0;
+    while (start < PeerList.size())
+    {
+        size_t end = PeerList.find(',', start);
+        if (end == std::string::npos) end = PeerList.size();
+
+        std::string entry = PeerList.substr(start, end - start);
+        sockaddr_in target;
+        if (!entry.empty())
+        {
+            if (ParseAddress(entry, &target))
+                Targets.push_back(target);
+            else
+                debug("Could not resolve peer " + entry);
+        }
+
+        start = end + 1;
+    }
+
+    if (Targets.empty())
+    {
+        sockaddr_in target;
+        memset(&target, 0, sizeof(target));
+        target.sin_family = AF_INET;
+        target.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+        target.sin_port = htons(Port);
+        Targets.push_back(target);
+    }
+
+    std::random_device rd;
+    SessionID = rd();
+    SendSeq = 0;
+    LastPing = 0;
+
+    memset(Peers, 0, sizeof(Peers));
+    SendLength = sizeof(NetDatagramHeader);
+    SendNumFrames = 0;
+    PacketQueue.clear();
+    ReplyQueue.clear();
+
+    LastHostID = -1;
+    RecvTimeout = 25;
+    CmdSentTime = 0;
+    MPStats::Reset();
+
+    debug("MP comm init OK, port " + std::to_string(Port));
+    return true;
+}
+
+void DeInit()
+{
+    debug("DeInit");
+    if (Socket == -1) return;
+
+    End();
+    close(Socket);
+    Socket = -1;
+}
+
+void SetRecvTimeout(int timeout)
+{
+    RecvTimeout = timeout;
+}
+
+void Begin()
+{
+    PacketQueue.clear();
+    ReplyQueue.clear();
+    SendControl(Datagram_Hello, 0, -1);
+    Poll(0);
+}
+
+void End()
+{
+    Flush();
+    SendControl(Datagram_Bye, 0, -1);
+}
+
+int SendPacketGeneric(u32 type, u8* packet, int len, u64 timestamp)
+{
+    if (Socket == -1) return 0;
+
+    if (len + sizeof(NetDatagramHeader) + sizeof(NetFrameHeader) > kMaxDatagramSize)
+    {
+        debug("Frame too long: " + std::to_string(len));
+        return 0;
+    }
+
+    int dest = -1;
+    if ((type & 0xFFFF) == 1)
+    {
+        // new CMD: any reply still around belongs to the previous one
+        MPStats::RepliesLate(ReplyQueue.size());
+        ReplyQueue.clear();
+
+        MPStats::CmdSent(packet, len);
+        CmdSentTime = GetTimeUS();
+    }
+    else if ((type & 0xFFFF) == 2)
+    {
+        // replies only matter to the host
+        if (LastHostID != -1 && Peers[LastHostID].Active)
+            dest = LastHostID;
+    }
+
+    QueueFrame(type, packet, len, timestamp, dest);
+    Poll(0);
+    return len;
+}
+
+int PopPacket(u8* packet, u64* timestamp)
+{
+    Frame& frame = PacketQueue.front();
+
+    int len = frame.Data.size();
+    if (len) memcpy(packet, frame.Data.data(), len);
+    if ((frame.Type & 0xFFFF) == 1)
+        LastHostID = frame.Sender;
+    if (timestamp) *timestamp = frame.Timestamp;
+
+    PacketQueue.pop_front();
+    return len;
+}
+
+int SendPacket(u8* packet, int len, u64 timestamp)
+{
+    return SendPacketGeneric(0, packet, len, timestamp);
+}
+
+int RecvPacket(u8* packet, u64* timestamp)
+{
+    Poll(0);
+    if (PacketQueue.empty()) return 0;
+
+    return PopPacket(packet, timestamp);
+}
+
+int SendCmd(u8* packet, int len, u64 timestamp)
+{
+    return SendPacketGeneric(1, packet, len, timestamp);
+}
+
+int SendReply(u8* packet, int len, u64 timestamp, u16 aid)
+{
+    return SendPacketGeneric(2 | (aid<<16), packet, len, timestamp);
+}
+
+int SendAck(u8* packet, int len, u64 timestamp)
+{
+    return SendPacketGeneric(3, packet, len, timestamp);
+}
+
+int RecvHostPacket(u8* packet, u64* timestamp)
+{
+    if (LastHostID != -1)
+    {
+        // check if the host is still connected
+        if (!(ConnectedMask() & (1 << LastHostID)))
+            return -1;
+    }
+
+    u64 start = GetTimeUS();
+    bool gotframe = WaitForFrames(PacketQueue, start + (RecvTimeout * 1000));
+    MPStats::Blocked(GetTimeUS() - start);
+    if (!gotframe)
+        return 0;
+
+    return PopPacket(packet, timestamp);
+}
+
+u16 RecvReplies(u8* packets, u64 timestamp, u16 aidmask)
+{
+    u16 ret = 0;
+    u16 myinstmask = 1;
+    u16 curinstmask = ConnectedMask();
+
+    // if all clients have left: return early
+    if ((myinstmask & curinstmask) == curinstmask)
+        return 0;
+
+    // only wait as long as the clients usually take to reply
+    u64 start = GetTimeUS();
+    u32 timeout = MPStats::GetReplyTimeout(curinstmask & ~myinstmask, RecvTimeout * 1000);
+    u64 deadline = CmdSentTime + timeout;
+
+    for (;;)
+    {
+        if (!WaitForFrames(ReplyQueue, deadline))
+        {
+            // no more replies available
+            for (int i = 1; i < kMaxPeers; i++)
+            {
+                if ((curinstmask & ~myinstmask) & (1<<i))
+                    MPStats::RepliesMissing(i);
+            }
+
+            MPStats::Blocked(GetTimeUS() - start);
+            return ret;
+        }
+
+        Frame frame = std::move(ReplyQueue.front());
+        ReplyQueue.pop_front();
+
+        if (frame.Timestamp < (timestamp - 32)) // stale packet
+        {
+            MPStats::RepliesLate(1);
+            continue;
+        }
+
+        MPStats::ReplyReceived(frame.Sender, GetTimeUS() - CmdSentTime);
+
+        if (!frame.Data.empty())
+        {
+            u32 aid = (frame.Type >> 16);
+            if (aid >= 1 && aid < 16)
+            {
+                memcpy(&packets[(aid-1)*1024], frame.Data.data(), std::min<size_t>(frame.Data.size(), 1024));
+                ret |= (1 << aid);
+            }
+        }
+
+        myinstmask |= (1 << frame.Sender);
+        if (((myinstmask & curinstmask) == curinstmask) ||
+            ((ret & aidmask) == aidmask))
+        {
+            // all the clients have sent their reply
+            MPStats::Blocked(GetTimeUS() - start);
+            return ret;
+        }
+    }
+}
+
+u32 GetPeerRTT(int peer)
+{
+    if (peer < 1 || peer >= kMaxPeers || !Peers[peer].Active)
+        return 0;
+
+    return Peers[peer].RTT;
+}
+
+}
@@ -0,0 +1,32 @@
+#ifndef NETWORKMULTIPLAYER_H
+#define NETWORKMULTIPLAYER_H
+
+#include <string>
+#include <types.h>
+
+namespace NetworkMultiplayer
+{
+    // port: local UDP port. peers: comma-separated list of host:port, or empty to broadcast on the LAN
+    void SetSession(int port, std::string peers);
+
+    bool Init();
+    void DeInit();
+
+    void SetRecvTimeout(int timeout);
+
+    void Begin();
+    void End();
+
+    int SendPacket(u8* data, int len, u64 timestamp);
+    int RecvPacket(u8* data, u64* timestamp);
+    int SendCmd(u8* data, int len, u64 timestamp);
+    int SendReply(u8* data, int len, u64 timestamp, u16 aid);
+    int SendAck(u8* data, int len, u64 timestamp);
+    int RecvHostPacket(u8* data, u64* timestamp);
+    u16 RecvReplies(u8* data, u64 timestamp, u16 aidmask);
+
+    // smoothed round-trip time to the given peer in microseconds, 0 if unknown
+    u32 GetPeerRTT(int peer);
+}
+
+#endif //NETWORKMULTIPLAYER_H
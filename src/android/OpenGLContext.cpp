@@ -185,7 +185,7 @@ void OpenGLContext::Release()
     eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 }
 
-void OpenGLContext::DeInit()
+void OpenGLContext::DeInit(bool terminateDisplay)
 {
     if (display == EGL_NO_DISPLAY)
         return;
@@ -198,7 +198,8 @@ void OpenGLContext::DeInit()
     if (surface != EGL_NO_SURFACE)
         eglDestroySurface(display, surface);
 
-    eglTerminate(display);
+    if (terminateDisplay)
+        eglTerminate(display);
 
     display = EGL_NO_DISPLAY;
     surface = EGL_NO_SURFACE;
@@ -10,7 +10,8 @@ public:
     bool InitContext(long sharedGlContext);
     bool Use();
     void Release();
-    void DeInit();
+    // contexts shared with another one must leave the display alone
+    void DeInit(bool terminateDisplay = true);
 
 private:
     EGLDisplay display = EGL_NO_DISPLAY;
@@ -31,6 +31,7 @@
 #include "Config.h"
 #include "ROMManager.h"
 #include "LocalMultiplayer.h"
+#include "NetworkMultiplayer.h"
 #include <string>
 
 namespace Platform
@@ -53,6 +54,8 @@ namespace Platform
 
     typedef pthread_mutex_t AndroidMutex;
 
+    bool UseNetworkMP = false;
+
     void* ThreadEntry(void* data)
     {
         AndroidThread* thread = (AndroidThread*)data;
@@ -334,57 +337,95 @@ namespace Platform
 
     bool MP_Init()
     {
+        // the backend is picked once per session, so both sides of a call always match
+        UseNetworkMP = Config::MPNetwork;
+
+        if (UseNetworkMP)
+        {
+            NetworkMultiplayer::SetSession(Config::MPNetPort, Config::MPNetPeers);
+            return NetworkMultiplayer::Init();
+        }
+
         return LocalMultiplayer::Init();
     }
 
     void MP_DeInit()
     {
-        LocalMultiplayer::DeInit();
-        return;
+        if (UseNetworkMP)
+            NetworkMultiplayer::DeInit();
+        else
+            LocalMultiplayer::DeInit();
     }
 
     void MP_Begin()
     {
-        LocalMultiplayer::Begin();
+        if (UseNetworkMP)
+            NetworkMultiplayer::Begin();
+        else
+            LocalMultiplayer::Begin();
     }
 
     void MP_End()
     {
-        LocalMultiplayer::End();
+        if (UseNetworkMP)
+            NetworkMultiplayer::End();
+        else
+            LocalMultiplayer::End();
     }
 
     int MP_SendPacket(u8* data, int len, u64 timestamp)
     {
+        if (UseNetworkMP)
+            return NetworkMultiplayer::SendPacket(data, len, timestamp);
+
         return LocalMultiplayer::SendPacket(data, len, timestamp);
     }
 
     int MP_RecvPacket(u8* data, u64* timestamp)
     {
+        if (UseNetworkMP)
+            return NetworkMultiplayer::RecvPacket(data, timestamp);
+
         return LocalMultiplayer::RecvPacket(data, timestamp);
     }
 
     int MP_SendCmd(u8* data, int len, u64 timestamp)
     {
+        if (UseNetworkMP)
+            return NetworkMultiplayer::SendCmd(data, len, timestamp);
+
         return LocalMultiplayer::SendCmd(data, len, timestamp);
     }
 
     int MP_SendReply(u8* data, int len, u64 timestamp, u16 aid)
     {
+        if (UseNetworkMP)
+            return NetworkMultiplayer::SendReply(data, len, timestamp, aid);
+
         return LocalMultiplayer::SendReply(data, len, timestamp, aid);
     }
 
     int MP_SendAck(u8* data, int len, u64 timestamp)
     {
+        if (UseNetworkMP)
+            return NetworkMultiplayer::SendAck(data, len, timestamp);
+
         return LocalMultiplayer::SendAck(data, len, timestamp);
     }
 
     int MP_RecvHostPacket(u8* data, u64* timestamp)
     {
+        if (UseNetworkMP)
+            return NetworkMultiplayer::RecvHostPacket(data, timestamp);
+
         return LocalMultiplayer::RecvHostPacket(data, timestamp);
     }
 
     u16 MP_RecvReplies(u8* data, u64 timestamp, u16 aidmask)
     {
+        if (UseNetworkMP)
+            return NetworkMultiplayer::RecvReplies(data, timestamp, aidmask);
+
         return LocalMultiplayer::RecvReplies(data, timestamp, aidmask);
     }
 
@@ -0,0 +1,336 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ROMLibrary.h"
+#include "CompressedROM.h"
+#include "Platform.h"
+
+
+namespace ROMLibrary
+{
+
+// index file layout:
+// 00  magic 'MRLI'
+// 04  version
+// 08  number of entries
+// 0C  entries:
+//     u32 path length, path (UTF-8)
+//     u64 file size, s64 modification time
+//     u8 valid
+//     if valid: game title (12), game code (4), unit code, DSiWare flag,
+//               u16 banner length, banner
+const char* IndexFile = "romlibrary.idx";
+const u32 IndexMagic = 0x494C524D;
+const u32 IndexVersion = 1;
+
+std::unordered_map<std::string, ROMInfo> Index;
+bool IndexLoaded = false;
+std::vector<std::string> LastScan;
+
+
+u32 GetBannerLength(u16 version)
+{
+    switch (version)
+    {
+    case 0x0001: return 0x840;
+    case 0x0002: return 0x940;
+    case 0x0003: return 0xA40;
+    case 0x0103: return 0x23C0;
+    }
+    return 0;
+}
+
+
+bool ReadIndexData(FILE* f, void* data, u32 len)
+{
+    return fread(data, len, 1, f) == 1;
+}
+
+void LoadIndex()
+{
+    IndexLoaded = true;
+    Index.clear();
+
+    FILE* f = Platform::OpenInternalFile(IndexFile, "rb");
+    if (!f) return;
+
+    u32 header[3];
+    if (!ReadIndexData(f, header, sizeof(header)) ||
+        header[0] != IndexMagic || header[1] != IndexVersion)
+    {
+        fclose(f);
+        return;
+    }
+
+    for (u32 i = 0; i < header[2]; i++)
+    {
+        ROMInfo info;
+        memset(&info.Banner, 0, sizeof(NDSBanner));
+
+        u32 pathlen;
+        if (!ReadIndexData(f, &pathlen, 4) || pathlen > 0x10000) break;
+        info.Path.resize(pathlen);
+        if (!ReadIndexData(f, &info.Path[0], pathlen)) break;
+
+        u8 valid;
+        if (!ReadIndexData(f, &info.FileSize, 8) ||
+            !ReadIndexData(f, &info.LastModified, 8) ||
+            !ReadIndexData(f, &valid, 1))
+            break;
+
+        info.Valid = valid != 0;
+        if (info.Valid)
+        {
+            u8 flags[2];
+            u16 bannerlen;
+            if (!ReadIndexData(f, info.GameTitle, 12) ||
+                !ReadIndexData(f, info.GameCode, 4) ||
+                !ReadIndexData(f, flags, 2) ||
+                !ReadIndexData(f, &bannerlen, 2) ||
+                bannerlen > sizeof(NDSBanner) ||
+                (bannerlen && !ReadIndexData(f, &info.Banner, bannerlen)))
+                break;
+
+            info.UnitCode = flags[0];
+            info.IsDSiWare = flags[1] != 0;
+        }
+
+        Index[info.Path] = info;
+    }
+
+    fclose(f);
+}
+
+void SaveIndex()
+{
+    FILE* f = Platform::OpenInternalFile(IndexFile, "wb");
+    if (!f) return;
+
+    u32 header[3] = {IndexMagic, IndexVersion, (u32)Index.size()};
+    fwrite(header, sizeof(header), 1, f);
+
+    for (const auto& [path, info] : Index)
+    {
+        u32 pathlen = path.length();
+        fwrite(&pathlen, 4, 1, f);
+        fwrite(path.data(), pathlen, 1, f);
+        fwrite(&info.FileSize, 8, 1, f);
+        fwrite(&info.LastModified, 8, 1, f);
+
+        u8 valid = info.Valid ? 1 : 0;
+        fwrite(&valid, 1, 1, f);
+        if (info.Valid)
+        {
+            u8 flags[2] = {info.UnitCode, (u8)(info.IsDSiWare ? 1 : 0)};
+            u16 bannerlen = GetBannerLength(info.Banner.Version);
+
+            fwrite(info.GameTitle, 12, 1, f);
+            fwrite(info.GameCode, 4, 1, f);
+            fwrite(flags, 2, 1, f);
+            fwrite(&bannerlen, 2, 1, f);
+            if (bannerlen) fwrite(&info.Banner, bannerlen, 1, f);
+        }
+    }
+
+    fclose(f);
+}
+
+
+bool ReadAt(FILE* f, CompressedROM* image, u64 filesize, u32 addr, void* data, u32 len)
+{
+    if ((u64)addr + len > filesize) return false;
+
+    if (image)
+    {
+        image->Read(addr, len, (u8*)data);
+        return true;
+    }
+
+    return pread(fileno(f), data, len, addr) == (ssize_t)len;
+}
+
+void ReadROMInfo(FILE* f, ROMInfo& info)
+{
+    info.Valid = false;
+    memset(&info.Banner, 0, sizeof(NDSBanner));
+
+    CompressedROM* image = nullptr;
+    u64 romsize = info.FileSize;
+    if (CompressedROM::IsCompressedROM(f))
+    {
+        int fd = dup(fileno(f));
+        if (fd < 0) return;
+
+        image = new CompressedROM(fdopen(fd, "rb"));
+        if (!image->Open())
+        {
+            delete image;
+            return;
+        }
+        romsize = image->GetSize();
+    }
+
+    // small homebrew ROMs can be shorter than a full header
+    NDSHeader header;
+    memset(&header, 0, sizeof(NDSHeader));
+    u32 headerlen = (u32)std::min(romsize, (u64)sizeof(NDSHeader));
+    if (headerlen >= 0x170 && ReadAt(f, image, romsize, 0, &header, headerlen))
+    {
+        info.Valid = true;
+        memcpy(info.GameTitle, header.GameTitle, 12);
+        memcpy(info.GameCode, header.GameCode, 4);
+        info.UnitCode = header.UnitCode;
+        info.IsDSiWare = (header.UnitCode & 0x02) && (header.DSiTitleIDHigh & 0xFF);
+
+        if (header.BannerOffset)
+        {
+            u16 version = 0;
+            ReadAt(f, image, romsize, header.BannerOffset, &version, 2);
+
+            u32 bannerlen = GetBannerLength(version);
+            if (!bannerlen || !ReadAt(f, image, romsize, header.BannerOffset, &info.Banner, bannerlen))
+                memset(&info.Banner, 0, sizeof(NDSBanner));
+        }
+    }
+
+    if (image) delete image;
+}
+
+void ScanFile(const std::string& path, ROMInfo& info)
+{
+    info.Path = path;
+    info.FileSize = 0;
+    info.LastModified = 0;
+    info.Valid = false;
+    info.Banner.Version = 0;
+
+    FILE* f = Platform::OpenFile(path, "rb", true);
+    if (!f) return;
+
+    struct stat st;
+    if (fstat(fileno(f), &st) == 0)
+    {
+        info.FileSize = st.st_size;
+        info.LastModified = ((s64)st.st_mtim.tv_sec * 1000000000) + st.st_mtim.tv_nsec;
+
+        // the index isn't modified while scanning, so this is safe from any thread
+        auto it = Index.find(path);
+        if (it != Index.end() &&
+            it->second.FileSize == info.FileSize &&
+            it->second.LastModified == info.LastModified)
+        {
+            info = it->second;
+            fclose(f);
+            return;
+        }
+
+        ReadROMInfo(f, info);
+    }
+
+    fclose(f);
+}
+
+
+void Scan(const std::vector<std::string>& paths, std::vector<ROMInfo>& results, int numthreads)
+{
+    if (!IndexLoaded) LoadIndex();
+
+    results.resize(paths.size());
+
+    if (numthreads <= 0)
+        numthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numthreads > (int)paths.size())
+        numthreads = paths.size();
+    if (numthreads < 1)
+        numthreads = 1;
+
+    std::atomic<u32> next(0);
+    auto worker = [&]()
+    {
+        for (;;)
+        {
+            u32 i = next++;
+            if (i >= paths.size()) break;
+
+            ScanFile(paths[i], results[i]);
+        }
+    };
+
+    std::vector<Platform::Thread*> threads;
+    for (int i = 1; i < numthreads; i++)
+        threads.push_back(Platform::Thread_Create(worker));
+
+    worker();
+
+    for (Platform::Thread* thread : threads)
+    {
+        Platform::Thread_Wait(thread);
+        Platform::Thread_Free(thread);
+    }
+
+    bool changed = false;
+    for (const ROMInfo& info : results)
+    {
+        auto it = Index.find(info.Path);
+        if (it != Index.end() &&
+            it->second.FileSize == info.FileSize &&
+            it->second.LastModified == info.LastModified)
+            continue;
+
+        // files that couldn't be opened aren't remembered
+        if (!info.FileSize) continue;
+
+        Index[info.Path] = info;
+        changed = true;
+    }
+
+    LastScan = paths;
+    if (changed) SaveIndex();
+}
+
+void PruneIndex()
+{
+    if (!IndexLoaded) LoadIndex();
+
+    std::unordered_map<std::string, ROMInfo> pruned;
+    for (const std::string& path : LastScan)
+    {
+        auto it = Index.find(path);
+        if (it != Index.end())
+            pruned[path] = it->second;
+    }
+
+    if (pruned.size() != Index.size())
+    {
+        Index = std::move(pruned);
+        SaveIndex();
+    }
+}
+
+}
@@ -0,0 +1,64 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef ROMLIBRARY_H
+#define ROMLIBRARY_H
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "NDS_Header.h"
+
+// metadata for building a ROM library without loading every ROM
+//
+// only the header and banner are read, and the results are kept in an
+// index (in the internal files directory) keyed by path, size and
+// modification time, so that unchanged files aren't read again
+namespace ROMLibrary
+{
+
+struct ROMInfo
+{
+    std::string Path;
+    u64 FileSize;
+    s64 LastModified;
+
+    // false if the file couldn't be read or isn't a DS ROM
+    bool Valid;
+
+    char GameTitle[12];
+    char GameCode[4];
+    u8 UnitCode;
+    bool IsDSiWare;
+
+    // zero-filled past what the banner version uses
+    // no banner: Banner.Version is zero
+    NDSBanner Banner;
+};
+
+// scans the given files using several threads (0 = one per CPU core)
+// results are in the same order as the paths
+void Scan(const std::vector<std::string>& paths, std::vector<ROMInfo>& results, int numthreads = 0);
+
+// drops index entries for files that weren't part of the last scan
+void PruneIndex();
+
+}
+
+#endif // ROMLIBRARY_H
@@ -31,6 +31,7 @@
 
 #include "NDS.h"
 #include "DSi.h"
+#include "CompressedROM.h"
 #include "SPI.h"
 #include "DSi_I2C.h"
 
@@ -288,32 +289,38 @@ bool LoadROM(std::string filepath, std::string sramPath, bool reset)
 {
     if (filepath.empty()) return false;
 
-    u8* filedata;
     u32 filelen;
+    CompressedROM* image = nullptr;
 
     FILE* f = Platform::OpenFile(filepath, "rb", true);
     if (!f) return false;
 
-    fseek(f, 0, SEEK_END);
-    long len = ftell(f);
-    if (len > 0x40000000)
+    if (CompressedROM::IsCompressedROM(f))
     {
-        fclose(f);
-        return false;
-    }
+        // the image owns the file from here on
+        image = new CompressedROM(f);
+        f = nullptr;
 
-    fseek(f, 0, SEEK_SET);
-    filedata = new u8[len];
-    size_t nread = fread(filedata, (size_t)len, 1, f);
-    if (nread != 1)
-    {
-        fclose(f);
-        delete[] filedata;
-        return false;
+        if (!image->Open() || image->GetSize() > 0x40000000)
+        {
+            delete image;
+            return false;
+        }
+
+        filelen = image->GetSize();
     }
+    else
+    {
+        fseek(f, 0, SEEK_END);
+        long len = ftell(f);
+        if (len > 0x40000000)
+        {
+            fclose(f);
+            return false;
+        }
 
-    fclose(f);
-    filelen = (u32)len;
+        filelen = (u32)len;
+    }
 
     if (NDSSave) delete NDSSave;
     NDSSave = nullptr;
@@ -329,6 +336,7 @@ bool LoadROM(std::string filepath, std::string sramPath, bool reset)
     u32 savelen = 0;
     u8* savedata = nullptr;
 
+    SaveManager::RecoverJournal(sramPath);
     FILE* sav = Platform::OpenFile(sramPath, "rb", true);
     if (sav)
     {
@@ -344,7 +352,31 @@ bool LoadROM(std::string filepath, std::string sramPath, bool reset)
         fclose(sav);
     }
 
-    bool res = NDS::LoadCart(filedata, filelen, savedata, savelen);
+    bool res;
+    if (image)
+    {
+        // compressed images are read block by block as the game needs them
+        res = NDS::LoadCart(image, savedata, savelen);
+    }
+    else
+    {
+        // the ROM file is mapped rather than read, so that large ROMs don't have to be
+        // loaded in memory up front and unused parts can be paged out
+        res = NDS::LoadCart(fileno(f), filelen, savedata, savelen);
+        if (!res)
+        {
+            // not every file descriptor can be mapped, fall back to reading the whole file
+            u8* filedata = new u8[filelen];
+            fseek(f, 0, SEEK_SET);
+            if (fread(filedata, (size_t)filelen, 1, f) == 1)
+                res = NDS::LoadCart(filedata, filelen, savedata, savelen);
+
+            delete[] filedata;
+        }
+
+        fclose(f);
+    }
+
     if (res && reset)
     {
         if (Config::DirectBoot || NDS::NeedsDirectBoot())
@@ -361,7 +393,6 @@ bool LoadROM(std::string filepath, std::string sramPath, bool reset)
     }
 
     if (savedata) delete[] savedata;
-    delete[] filedata;
     return res;
 }
 
@@ -418,6 +449,7 @@ bool LoadGBAROM(std::string filepath, std::string sramPath)
     u32 savelen = 0;
     u8* savedata = nullptr;
 
+    SaveManager::RecoverJournal(sramPath);
     FILE* sav = Platform::OpenFile(sramPath, "rb", true);
     if (sav)
     {
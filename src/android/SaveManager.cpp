@@ -18,10 +18,29 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <algorithm>
 
 #include "SaveManager.h"
 #include "Platform.h"
 
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash/xxhash.h"
+
+
+// flushes only write the pages that changed, in place. to make sure a crash
+// or power loss in the middle of that can't leave a half-written save, the
+// changed data is first written to a journal in internal storage, which is
+// replayed on the next load if it is complete.
+//
+// journal layout:
+// 00  magic 'MSJ1'
+// 04  save file length
+// 08  number of ranges
+// 0C  ranges: offset, length, data
+// ..  XXH64 of everything before
+const u32 JournalMagic = 0x314A534D;
+
 
 SaveManager::SaveManager(std::string path)
 {
@@ -36,6 +55,8 @@ SaveManager::SaveManager(std::string path)
     Buffer = nullptr;
     Length = 0;
     FlushRequested = false;
+    FullWriteRequested = false;
+    SecondaryFullWrite = false;
 
     FlushVersion = 0;
     PreviousFlushVersion = 0;
@@ -76,6 +97,7 @@ void SaveManager::SetPath(std::string path, bool reload)
 
     if (reload)
     {
+        RecoverJournal(Path);
         FILE* f = Platform::OpenFile(Path, "rb", true);
         if (f)
         {
@@ -84,7 +106,22 @@ void SaveManager::SetPath(std::string path, bool reload)
         }
     }
     else
+    {
         FlushRequested = true;
+        FullWriteRequested = true;
+    }
+}
+
+void SaveManager::MarkDirty(u32 offset, u32 len)
+{
+    if (len == 0 || offset >= Length) return;
+
+    u32 first = offset / PageSize;
+    u32 last = (offset + len - 1) / PageSize;
+    if (last >= DirtyPages.size()) last = DirtyPages.size() - 1;
+
+    for (u32 i = first; i <= last; i++)
+        DirtyPages[i] = true;
 }
 
 void SaveManager::RequestFlush(const u8* savedata, u32 savelen, u32 writeoffset, u32 writelen)
@@ -93,10 +130,17 @@ void SaveManager::RequestFlush(const u8* savedata, u32 savelen, u32 writeoffset,
     {
         if (Buffer) delete[] Buffer;
 
+        // the first request comes with the save as it was loaded, so only the written
+        // range differs from the file. if the file doesn't match that length, the
+        // flush rewrites it entirely anyway
+        bool initial = (Length == 0);
+
         Length = savelen;
         Buffer = new u8[Length];
 
         memcpy(Buffer, savedata, Length);
+
+        DirtyPages.assign((Length + PageSize - 1) / PageSize, !initial);
     }
     else
     {
@@ -114,6 +158,14 @@ void SaveManager::RequestFlush(const u8* savedata, u32 savelen, u32 writeoffset,
         }
     }
 
+    if ((writeoffset+writelen) > savelen)
+    {
+        MarkDirty(writeoffset, savelen - writeoffset);
+        MarkDirty(0, writelen - (savelen - writeoffset));
+    }
+    else
+        MarkDirty(writeoffset, writelen);
+
     FlushRequested = true;
 }
 
@@ -127,13 +179,38 @@ void SaveManager::CheckFlush()
 
     if (SecondaryBufferLength != Length)
     {
-        if (SecondaryBuffer) delete[] SecondaryBuffer;
+        if (SecondaryBuffer)
+        {
+            delete[] SecondaryBuffer;
+            SecondaryFullWrite = true;
+        }
 
         SecondaryBufferLength = Length;
         SecondaryBuffer = new u8[SecondaryBufferLength];
+
+        memcpy(SecondaryBuffer, Buffer, Length);
+        SecondaryDirtyPages = DirtyPages;
+    }
+    else
+    {
+        for (u32 i = 0; i < DirtyPages.size(); i++)
+        {
+            if (!DirtyPages[i]) continue;
+
+            u32 offset = i * PageSize;
+            u32 len = std::min(PageSize, Length - offset);
+            memcpy(&SecondaryBuffer[offset], &Buffer[offset], len);
+            SecondaryDirtyPages[i] = true;
+        }
     }
 
-    memcpy(SecondaryBuffer, Buffer, Length);
+    DirtyPages.assign(DirtyPages.size(), false);
+
+    if (FullWriteRequested)
+    {
+        SecondaryFullWrite = true;
+        FullWriteRequested = false;
+    }
 
     FlushRequested = false;
     FlushVersion++;
@@ -170,25 +247,266 @@ void SaveManager::FlushSecondaryBuffer(u8* dst, u32 dstLength)
     if (dst && dstLength < SecondaryBufferLength) return;
 
     Platform::Mutex_Lock(SecondaryBufferLock);
+    bool written = true;
     if (dst)
     {
         memcpy(dst, SecondaryBuffer, SecondaryBufferLength);
     }
     else
     {
-        FILE* f = Platform::OpenFile(Path, "wb");
+        std::vector<DirtyRange> ranges;
+
+        // pages can only be written in place if the file is already there with the right size
+        FILE* f = nullptr;
+        if (!SecondaryFullWrite)
+        {
+            f = Platform::OpenFile(Path, "r+b", true);
+            if (f)
+            {
+                fseek(f, 0, SEEK_END);
+                if ((u32)ftell(f) != SecondaryBufferLength)
+                {
+                    fclose(f);
+                    f = nullptr;
+                }
+            }
+        }
+
         if (f)
+            ranges = GetDirtyRanges();
+        else
+            ranges.push_back({0, SecondaryBufferLength});
+
+        if (!WriteJournal(Path, SecondaryBuffer, SecondaryBufferLength, ranges))
         {
-            printf("SaveManager: Written\n");
-            fwrite(SecondaryBuffer, SecondaryBufferLength, 1, f);
-            fclose(f);
+            // without a journal, a crash halfway through would corrupt the save
+            printf("SaveManager: failed to write journal, leaving %s as it is\n", Path.c_str());
+            if (f) fclose(f);
+            f = nullptr;
+            written = false;
+        }
+        else if (!f)
+            f = Platform::OpenFile(Path, "wb");
+
+        if (f)
+        {
+            int fd = fileno(f);
+            bool ok = true;
+
+            for (const DirtyRange& range : ranges)
+            {
+                if (pwrite(fd, &SecondaryBuffer[range.Offset], range.Length, range.Offset) != (ssize_t)range.Length)
+                    ok = false;
+            }
+
+            if (fsync(fd) != 0) ok = false;
+            if (fclose(f) != 0) ok = false;
+
+            if (ok)
+            {
+                printf("SaveManager: Written (%d ranges)\n", (int)ranges.size());
+                ClearJournal(Path);
+
+                SecondaryDirtyPages.assign(SecondaryDirtyPages.size(), false);
+                SecondaryFullWrite = false;
+            }
+            else
+            {
+                // the journal is complete, so it still holds the new data if nothing else does
+                printf("SaveManager: failed to write %s\n", Path.c_str());
+                written = false;
+            }
+        }
+        else if (written)
+        {
+            printf("SaveManager: failed to open %s\n", Path.c_str());
+            written = false;
         }
     }
-    PreviousFlushVersion = FlushVersion;
-    TimeAtLastFlushRequest = 0;
+
+    if (written)
+    {
+        PreviousFlushVersion = FlushVersion;
+        TimeAtLastFlushRequest = 0;
+    }
+    else
+    {
+        // the pages stay dirty, try again after the usual delay
+        TimeAtLastFlushRequest = time(nullptr);
+    }
     Platform::Mutex_Unlock(SecondaryBufferLock);
 }
 
+std::vector<SaveManager::DirtyRange> SaveManager::GetDirtyRanges()
+{
+    std::vector<DirtyRange> ranges;
+
+    u32 numpages = SecondaryDirtyPages.size();
+    for (u32 i = 0; i < numpages; )
+    {
+        if (!SecondaryDirtyPages[i])
+        {
+            i++;
+            continue;
+        }
+
+        u32 start = i;
+        while (i < numpages && SecondaryDirtyPages[i])
+            i++;
+
+        u32 offset = start * PageSize;
+        u32 end = std::min(i * PageSize, SecondaryBufferLength);
+        ranges.push_back({offset, end - offset});
+    }
+
+    return ranges;
+}
+
+std::string SaveManager::GetJournalName(std::string path)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "save_%016llx.journal", (unsigned long long)XXH64(path.data(), path.size(), 0));
+    return name;
+}
+
+bool SaveManager::WriteJournal(std::string path, const u8* data, u32 len, const std::vector<DirtyRange>& ranges)
+{
+    FILE* f = Platform::OpenInternalFile(GetJournalName(path), "wb");
+    if (!f) return false;
+
+    XXH64_state_t hash;
+    XXH64_reset(&hash, 0);
+
+    u32 header[3] = {JournalMagic, len, (u32)ranges.size()};
+    bool ok = fwrite(header, sizeof(header), 1, f) == 1;
+    XXH64_update(&hash, header, sizeof(header));
+
+    for (const DirtyRange& range : ranges)
+    {
+        ok = ok && fwrite(&range, sizeof(range), 1, f) == 1;
+        ok = ok && fwrite(&data[range.Offset], range.Length, 1, f) == 1;
+        XXH64_update(&hash, &range, sizeof(range));
+        XXH64_update(&hash, &data[range.Offset], range.Length);
+    }
+
+    u64 checksum = XXH64_digest(&hash);
+    ok = ok && fwrite(&checksum, sizeof(checksum), 1, f) == 1;
+
+    ok = ok && fflush(f) == 0;
+    ok = ok && fsync(fileno(f)) == 0;
+    if (fclose(f) != 0) ok = false;
+
+    return ok;
+}
+
+void SaveManager::ClearJournal(std::string path)
+{
+    FILE* f = Platform::OpenInternalFile(GetJournalName(path), "wb");
+    if (f) fclose(f);
+}
+
+void SaveManager::RecoverJournal(std::string path)
+{
+    if (path.empty()) return;
+
+    FILE* f = Platform::OpenInternalFile(GetJournalName(path), "rb");
+    if (!f) return;
+
+    fseek(f, 0, SEEK_END);
+    long journallen = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (journallen < (long)(sizeof(u32)*3 + sizeof(u64)))
+    {
+        // empty journal, the last flush went through
+        fclose(f);
+        return;
+    }
+
+    std::vector<u8> journal(journallen);
+    bool ok = fread(journal.data(), journallen, 1, f) == 1;
+    fclose(f);
+
+    u32 datalen = journallen - sizeof(u64);
+    if (!ok || *(u32*)&journal[0] != JournalMagic ||
+        XXH64(journal.data(), datalen, 0) != *(u64*)&journal[datalen])
+    {
+        // the flush was interrupted while writing the journal, so the save file wasn't touched
+        printf("SaveManager: discarding incomplete journal for %s\n", path.c_str());
+        ClearJournal(path);
+        return;
+    }
+
+    u32 savelen = *(u32*)&journal[4];
+    u32 numranges = *(u32*)&journal[8];
+
+    // check all ranges before touching the save file
+    std::vector<DirtyRange> ranges;
+    std::vector<u32> rangedata;
+    u32 pos = 12;
+    for (u32 i = 0; i < numranges; i++)
+    {
+        DirtyRange range;
+        if (pos + sizeof(range) > datalen) { ok = false; break; }
+        memcpy(&range, &journal[pos], sizeof(range));
+        pos += sizeof(range);
+
+        if (pos + range.Length > datalen || range.Offset + range.Length > savelen) { ok = false; break; }
+        ranges.push_back(range);
+        rangedata.push_back(pos);
+        pos += range.Length;
+    }
+
+    if (!ok)
+    {
+        printf("SaveManager: journal for %s is malformed, keeping it\n", path.c_str());
+        return;
+    }
+
+    FILE* sav = Platform::OpenFile(path, "r+b", true);
+    if (!sav)
+    {
+        // recreating the file only gives a valid save if the journal has all of it
+        std::vector<DirtyRange> sorted = ranges;
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const DirtyRange& a, const DirtyRange& b) { return a.Offset < b.Offset; });
+
+        u32 covered = 0;
+        for (const DirtyRange& range : sorted)
+        {
+            if (range.Offset > covered) break;
+            covered = std::max(covered, range.Offset + range.Length);
+        }
+
+        if (covered < savelen)
+        {
+            printf("SaveManager: can't open %s to replay its journal, keeping it\n", path.c_str());
+            return;
+        }
+
+        sav = Platform::OpenFile(path, "wb");
+        if (!sav) return;
+    }
+
+    int fd = fileno(sav);
+    for (u32 i = 0; i < ranges.size() && ok; i++)
+        ok = pwrite(fd, &journal[rangedata[i]], ranges[i].Length, ranges[i].Offset) == (ssize_t)ranges[i].Length;
+
+    ok = ok && ftruncate(fd, savelen) == 0;
+    ok = ok && fsync(fd) == 0;
+    if (fclose(sav) != 0) ok = false;
+
+    if (ok)
+    {
+        printf("SaveManager: replayed journal for %s\n", path.c_str());
+        ClearJournal(path);
+    }
+    else
+    {
+        printf("SaveManager: failed to replay journal for %s, keeping it\n", path.c_str());
+    }
+}
+
 bool SaveManager::NeedsFlush()
 {
     return FlushVersion != PreviousFlushVersion;
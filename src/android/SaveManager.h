@@ -20,6 +20,7 @@
 #define SAVEMANAGER_H
 
 #include <string>
+#include <vector>
 #include <unistd.h>
 #include <time.h>
 
@@ -41,10 +42,28 @@ public:
     bool NeedsFlush();
     void FlushSecondaryBuffer(u8* dst = nullptr, u32 dstLength = 0);
 
+    // replays a journal left behind by an interrupted flush
+    // has to be called before the save file is read
+    static void RecoverJournal(std::string path);
+
 private:
+    static constexpr u32 PageSize = 0x1000;
+
+    struct DirtyRange
+    {
+        u32 Offset;
+        u32 Length;
+    };
 
     void run();
 
+    void MarkDirty(u32 offset, u32 len);
+    std::vector<DirtyRange> GetDirtyRanges();
+
+    static std::string GetJournalName(std::string path);
+    static bool WriteJournal(std::string path, const u8* data, u32 len, const std::vector<DirtyRange>& ranges);
+    static void ClearJournal(std::string path);
+
     std::string Path;
 
     std::atomic_bool Running;
@@ -52,12 +71,20 @@ private:
     u8* Buffer;
     u32 Length;
     bool FlushRequested;
+    bool FullWriteRequested;
+
+    // pages changed since the last flush request
+    std::vector<bool> DirtyPages;
 
     Platform::Thread* Thread;
     Platform::Mutex* SecondaryBufferLock;
     u8* SecondaryBuffer;
     u32 SecondaryBufferLength;
 
+    // pages that differ from the save file
+    std::vector<bool> SecondaryDirtyPages;
+    bool SecondaryFullWrite;
+
     time_t TimeAtLastFlushRequest;
 
     // We keep versions in case the user closes the application before
@@ -1,242 +1,317 @@
+#include <algorithm>
+#include <functional>
+#include <string.h>
+#include <vector>
 #include "ScreenshotRenderer.h"
+#include "OpenGLContext.h"
 #include "MelonLog.h"
 #include "../GPU.h"
 
-static void scaleScreen(const u32* src, int srcW, int srcH,
-                        u32* dst, int dstW, int dstH)
+// Box filter: every destination pixel is the average of the block of source pixels it covers. The rows of a block are
+// first added up into per-channel column sums, which is a plain loop over contiguous bytes that the compiler vectorizes
+static void downscaleScreen(const u8* src, int srcW, int srcH, u8* dst, int dstW, int dstH)
 {
+    std::vector<u32> columnSums(srcW * 4);
+
     for (int y = 0; y < dstH; y++)
     {
-        int srcY = (y * srcH) / dstH;
-        const u32* srcRow = src + srcY * srcW;
-        u32* dstRow = dst + y * dstW;
+        int startY = (y * srcH) / dstH;
+        int endY = std::max(startY + 1, ((y + 1) * srcH) / dstH);
+
+        u32* sums = columnSums.data();
+        std::fill(columnSums.begin(), columnSums.end(), 0);
+        for (int srcY = startY; srcY < endY; srcY++)
+        {
+            const u8* srcRow = src + srcY * srcW * 4;
+            for (int i = 0; i < srcW * 4; i++)
+                sums[i] += srcRow[i];
+        }
+
+        u8* dstRow = dst + y * dstW * 4;
         for (int x = 0; x < dstW; x++)
         {
-            int srcX = (x * srcW) / dstW;
-            dstRow[x] = srcRow[srcX];
+            int startX = (x * srcW) / dstW;
+            int endX = std::max(startX + 1, ((x + 1) * srcW) / dstW);
+            u32 count = (endX - startX) * (endY - startY);
+
+            for (int c = 0; c < 4; c++)
+            {
+                u32 total = 0;
+                for (int srcX = startX; srcX < endX; srcX++)
+                    total += sums[srcX * 4 + c];
+
+                dstRow[x * 4 + c] = (total + count / 2) / count;
+            }
         }
     }
 }
 
+// The screenshot has the top screen in its upper half and the bottom screen in its lower half
+static void downscaleScreens(const u8* src, int srcW, int srcScreenH, int srcBottomScreenY, u32* dst, int dstW, int dstH)
+{
+    int dstScreenH = dstH / 2;
+    downscaleScreen(src, srcW, srcScreenH, (u8*) dst, dstW, dstScreenH);
+    downscaleScreen(src + srcBottomScreenY * srcW * 4, srcW, srcScreenH, (u8*) &dst[dstW * dstScreenH], dstW, dstScreenH);
+}
+
 ScreenshotRenderer::ScreenshotRenderer(u32* screenshotBuffer, int screenshotWidth, int screenshotHeight)
 {
     this->screenshotBuffer = screenshotBuffer;
     this->screenshotWidth = screenshotWidth;
     this->screenshotHeight = screenshotHeight;
-    this->currentBuffer = 0;
+    this->workerThread = nullptr;
 }
 
 void ScreenshotRenderer::init()
 {
-    setupFrameBuffers();
-    setupShaders();
-    setupVertexBuffers();
+    emulatorContext = eglGetCurrentContext();
+
+    glGenFramebuffers(1, &readFrameBuffer);
+    glGenFramebuffers(1, &captureFrameBuffer);
+    glGenTextures(1, &captureTexture);
+    glBindTexture(GL_TEXTURE_2D, captureTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    captureTextureWidth = 0;
+    captureTextureHeight = 0;
+
+    softwareFrame = new u32[256 * 192 * 2];
+
+    jobAvailable = Platform::Semaphore_Create();
+    jobDone = Platform::Semaphore_Create();
+    jobLock = Platform::Mutex_Create();
+    isJobPending = false;
+    isWorkerRunning = true;
+    workerThread = Platform::Thread_Create(std::bind(&ScreenshotRenderer::runWorker, this));
+}
+
+void ScreenshotRenderer::captureScreenshot()
+{
+    captureScreenshot(screenshotBuffer);
+    waitForScreenshot();
 }
 
-void ScreenshotRenderer::renderScreenshot()
+void ScreenshotRenderer::captureScreenshot(u32* destination)
 {
-    int frontBuffer = GPU::FrontBuffer;
-    if (GPU::Renderer == 0)
+    if (!workerThread)
+        return;
+
+    Platform::Mutex_Lock(jobLock);
+
+    // Only one screenshot is taken at a time, they're rare enough
+    if (isJobPending)
     {
-        scaleScreen(GPU::Framebuffer[frontBuffer][0], 256, 192,
-                    screenshotBuffer, screenshotWidth, screenshotHeight / 2);
-        scaleScreen(GPU::Framebuffer[frontBuffer][1], 256, 192,
-                    &screenshotBuffer[screenshotWidth * (screenshotHeight / 2)],
-                    screenshotWidth, screenshotHeight / 2);
+        Platform::Semaphore_Wait(jobDone);
+        isJobPending = false;
     }
-    else
+
+    if (prepareJob(destination))
     {
-        glDisable(GL_SCISSOR_TEST);
-        glDisable(GL_DEPTH_TEST);
-        glDisable(GL_STENCIL_TEST);
-        glDisable(GL_BLEND);
-        glViewport(0, 0, screenshotWidth, screenshotHeight);
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, frameBuffers[currentBuffer]);
-        glUseProgram(screenshotRenderShader);
-
-        // Render to screenshot front buffer
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, GPU::CurGLCompositor->GetOutputTexture(frontBuffer));
-
-        glBindVertexArray(vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glEnableVertexAttribArray(posAttribLocation);
-        glEnableVertexAttribArray(texCoordAttribLocation);
-        glVertexAttribPointer(posAttribLocation, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
-        glVertexAttribPointer(texCoordAttribLocation, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
-        glUniform1i(textureUniformLocation, 0);
-
-        glDrawArrays(GL_TRIANGLES, 0, 12);
-
-        // Update screenshotBuffer using back buffer. This is so that we don't have to wait for the GPU to finish rendering the current frame. This means that screenshots in
-        // OpenGL have a 1 frame delay, but at least we avoid slowdowns
-        int screenshotBackBuffer = currentBuffer ? 0 : 1;
-        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, frameBuffers[screenshotBackBuffer]);
-        glReadBuffer(GL_COLOR_ATTACHMENT0);
-        glReadPixels(0, 0, screenshotWidth, screenshotHeight, GL_RGBA, GL_UNSIGNED_BYTE, screenshotBuffer);
-
-        glBindVertexArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-
-        currentBuffer = (currentBuffer + 1) % 2;
+        isJobPending = true;
+        Platform::Semaphore_Post(jobAvailable);
     }
+
+    Platform::Mutex_Unlock(jobLock);
 }
 
-u32* ScreenshotRenderer::getScreenshot()
+void ScreenshotRenderer::waitForScreenshot()
 {
-    return screenshotBuffer;
+    if (!workerThread)
+        return;
+
+    Platform::Mutex_Lock(jobLock);
+    if (isJobPending)
+    {
+        Platform::Semaphore_Wait(jobDone);
+        isJobPending = false;
+    }
+    Platform::Mutex_Unlock(jobLock);
 }
 
-void ScreenshotRenderer::setupFrameBuffers()
+bool ScreenshotRenderer::prepareJob(u32* destination)
 {
-    glGenFramebuffers(2, frameBuffers);
-    glGenTextures(2, bufferTextures);
+    int frontBuffer = GPU::FrontBuffer;
 
-    for (int i = 0; i < 2; i++)
+    job.destination = destination;
+    job.fence = 0;
+
+    if (GPU::Renderer == 0)
     {
-        glBindTexture(GL_TEXTURE_2D, bufferTextures[i]);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, screenshotWidth, screenshotHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, frameBuffers[i]);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bufferTextures[i], 0);
+        if (!GPU::Framebuffer[frontBuffer][0] || !GPU::Framebuffer[frontBuffer][1])
+            return false;
+
+        memcpy(softwareFrame, GPU::Framebuffer[frontBuffer][0], 256 * 192 * 4);
+        memcpy(&softwareFrame[256 * 192], GPU::Framebuffer[frontBuffer][1], 256 * 192 * 4);
+        job.isSoftwareFrame = true;
+        return true;
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    if (!GPU::CurGLCompositor)
+        return false;
+
+    job.isSoftwareFrame = false;
+    prepareTextureJob();
+    return true;
 }
 
-void ScreenshotRenderer::setupShaders()
+void ScreenshotRenderer::prepareTextureJob()
 {
-    const char *vertexShaderSource =
-            "#version 100\n"
-            "attribute vec2 aTexCoord;\n"
-            "attribute vec2 aPosition;\n"
-            "varying vec2 vTexCoord;\n"
-            "void main() {\n"
-            "    gl_Position = vec4(aPosition, 0.0, 1.0);\n"
-            "    vTexCoord = aTexCoord;\n"
-            "}\n";
-    const char *fragmentShaderSource =
-            "#version 100\n"
-            "precision mediump float;\n"
-            "precision mediump sampler2D;\n"
-            "varying vec2 vTexCoord;\n"
-            "uniform sampler2D sTexture;\n"
-            "void main() {\n"
-            "    gl_FragColor = texture2D(sTexture, vTexCoord);\n"
-            "}\n";
-
-    GLint shaderResult;
-    screenshotRenderVertexShader = glCreateShader(GL_VERTEX_SHADER);
-    GLint len = strlen(vertexShaderSource);
-    glShaderSource(screenshotRenderVertexShader, 1, &vertexShaderSource, &len);
-    glCompileShader(screenshotRenderVertexShader);
-    glGetShaderiv(screenshotRenderVertexShader, GL_COMPILE_STATUS, &shaderResult);
-    if (shaderResult != GL_TRUE)
-    {
-        glGetShaderiv(screenshotRenderVertexShader, GL_INFO_LOG_LENGTH, &shaderResult);
-        if (shaderResult < 1) shaderResult = 1024;
-        char* log = new char[shaderResult + 1];
-        glGetShaderInfoLog(screenshotRenderVertexShader, shaderResult + 1, NULL, log);
-        LOG_ERROR("OpenGL", "Failed to compile vertex shader: %s", log);
-        delete[] log;
+    int frontBuffer = GPU::FrontBuffer;
+    GLuint frameTexture = GPU::CurGLCompositor->GetOutputTexture(frontBuffer);
+    int width, height;
+    GPU::CurGLCompositor->GetOutputSize(width, height);
 
-        glDeleteShader(screenshotRenderVertexShader);
+    job.textureWidth = width;
+    job.textureHeight = height;
 
+    if (eglGetCurrentContext() != emulatorContext)
+    {
+        // Not called from the emulator thread, so emulation is paused and the frame stays as it is
+        job.texture = frameTexture;
         return;
     }
 
-    screenshotRenderFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    len = strlen(fragmentShaderSource);
-    glShaderSource(screenshotRenderFragmentShader, 1, &fragmentShaderSource, &len);
-    glCompileShader(screenshotRenderFragmentShader);
-    glGetShaderiv(screenshotRenderFragmentShader, GL_COMPILE_STATUS, &shaderResult);
-    if (shaderResult != GL_TRUE)
+    // The compositor draws over this texture again two frames from now, so it's copied for the worker to read at
+    // its own pace. This is a GPU-side copy and doesn't stall the emulator thread
+    if (captureTextureWidth != width || captureTextureHeight != height)
     {
-        glGetShaderiv(screenshotRenderFragmentShader, GL_INFO_LOG_LENGTH, &shaderResult);
-        if (shaderResult < 1) shaderResult = 1024;
-        char* log = new char[shaderResult + 1];
-        glGetShaderInfoLog(screenshotRenderFragmentShader, shaderResult + 1, NULL, log);
-        LOG_ERROR("OpenGL", "Failed to compile fragment shader: %s", log);
-        delete[] log;
+        glBindTexture(GL_TEXTURE_2D, captureTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
 
-        glDeleteShader(screenshotRenderVertexShader);
-        glDeleteShader(screenshotRenderFragmentShader);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, captureFrameBuffer);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, captureTexture, 0);
 
-        return;
+        captureTextureWidth = width;
+        captureTextureHeight = height;
     }
 
-    screenshotRenderShader = glCreateProgram();
-    glAttachShader(screenshotRenderShader, screenshotRenderVertexShader);
-    glAttachShader(screenshotRenderShader, screenshotRenderFragmentShader);
-    glLinkProgram(screenshotRenderShader);
-    glGetProgramiv(screenshotRenderShader, GL_LINK_STATUS, &shaderResult);
-    if (shaderResult != GL_TRUE)
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFrameBuffer);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, frameTexture, 0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, captureFrameBuffer);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    job.texture = captureTexture;
+    job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+}
+
+void ScreenshotRenderer::runWorker()
+{
+    // Shares textures and sync objects with the emulator's context
+    workerContext = new OpenGLContext();
+    bool hasContext = workerContext->InitContext((long) emulatorContext) && workerContext->Use();
+    if (hasContext)
+    {
+        glGenFramebuffers(1, &workerFrameBuffer);
+        glGenBuffers(1, &pixelBuffer);
+        pixelBufferSize = 0;
+    }
+    else
+    {
+        LOG_ERROR("OpenGL", "Failed to create screenshot context. Screenshots won't work with the OpenGL renderer");
+    }
+
+    for (;;)
     {
-        glGetProgramiv(screenshotRenderShader, GL_INFO_LOG_LENGTH, &shaderResult);
-        if (shaderResult < 1) shaderResult = 1024;
-        char* log = new char[shaderResult + 1];
-        glGetProgramInfoLog(screenshotRenderShader, shaderResult + 1, NULL, log);
-        LOG_ERROR("OpenGL", "Failed to link shader program: %s", log);
-        delete[] log;
+        Platform::Semaphore_Wait(jobAvailable);
+        if (!isWorkerRunning)
+            break;
 
-        glDeleteShader(screenshotRenderVertexShader);
-        glDeleteShader(screenshotRenderFragmentShader);
-        glDeleteProgram(screenshotRenderShader);
+        if (job.isSoftwareFrame)
+            downscaleScreens((u8*) softwareFrame, 256, 192, 192, job.destination, screenshotWidth, screenshotHeight);
+        else if (hasContext)
+            readTexture();
 
-        return;
+        Platform::Semaphore_Post(jobDone);
     }
 
-    posAttribLocation = glGetAttribLocation(screenshotRenderShader, "aPosition");
-    texCoordAttribLocation = glGetAttribLocation(screenshotRenderShader, "aTexCoord");
-    textureUniformLocation = glGetUniformLocation(screenshotRenderShader, "sTexture");
+    if (hasContext)
+    {
+        glDeleteBuffers(1, &pixelBuffer);
+        glDeleteFramebuffers(1, &workerFrameBuffer);
+    }
+
+    workerContext->DeInit(false);
+    delete workerContext;
+    workerContext = nullptr;
 }
 
-void ScreenshotRenderer::setupVertexBuffers()
+void ScreenshotRenderer::readTexture()
 {
-    float margin = 1.0f / 192.0f;
-    // Image is vertically flipped
-    const float vertices[] = {
-        //Position        // UV
-        -1.0f,  -1.0f,    0.0f, 0.0f,
-        -1.0f,  0.0f,     0.0f, 0.5f - margin,
-        1.0f,  0.0f,      1.0f, 0.5f - margin,
-
-        -1.0f,  -1.0f,    0.0f, 0.0f,
-        1.0f,  0.0f,      1.0f, 0.5f - margin,
-        1.0f, -1.0f,      1.0f, 0.0f,
-
-        -1.0f, 0.0f,      0.0f, 0.5f + margin,
-        -1.0f, 1.0f,      0.0f, 1.0f,
-        1.0f, 1.0f,       1.0f, 1.0f,
-
-        -1.0f, 0.0f,      0.0f, 0.5f + margin,
-        1.0f, 1.0f,       1.0f, 1.0f,
-        1.0f, 0.0f,       1.0f, 0.5f + margin,
-    };
-
-    glGenBuffers(1, &vbo);
-    glGenVertexArrays(1, &vao);
-
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    if (job.fence)
+    {
+        // Don't read the frame before the emulator thread is done copying it
+        glWaitSync(job.fence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(job.fence);
+    }
+
+    int width = job.textureWidth;
+    int height = job.textureHeight;
+    int size = width * height * 4;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, workerFrameBuffer);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, job.texture, 0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+    // Read into a pixel buffer so that the transfer happens asynchronously, and only map it once the fence says it's done
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+    if (size > pixelBufferSize)
+    {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        pixelBufferSize = size;
+    }
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+    GLsync readFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    while (glClientWaitSync(readFence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(readFence);
+
+    const u8* pixels = (const u8*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (pixels)
+    {
+        // The output has both screens with a 2 line gap between them, all at the renderer's scale
+        int scale = width / 256;
+        downscaleScreens(pixels, width, 192 * scale, 194 * scale, job.destination, screenshotWidth, screenshotHeight);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    else
+    {
+        LOG_ERROR("OpenGL", "Failed to map screenshot pixel buffer");
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
 }
 
 void ScreenshotRenderer::cleanup()
 {
-    glDeleteShader(screenshotRenderVertexShader);
-    glDeleteShader(screenshotRenderFragmentShader);
-    glDeleteProgram(screenshotRenderShader);
-    glDeleteTextures(2, bufferTextures);
-    glDeleteFramebuffers(2, frameBuffers);
-    glDeleteBuffers(1, &vbo);
-    glDeleteVertexArrays(1, &vao);
+    if (!workerThread)
+        return;
+
+    waitForScreenshot();
+
+    isWorkerRunning = false;
+    Platform::Semaphore_Post(jobAvailable);
+    Platform::Thread_Wait(workerThread);
+    Platform::Thread_Free(workerThread);
+    workerThread = nullptr;
+
+    Platform::Semaphore_Free(jobAvailable);
+    Platform::Semaphore_Free(jobDone);
+    Platform::Mutex_Free(jobLock);
+    delete[] softwareFrame;
+
+    glDeleteTextures(1, &captureTexture);
+    glDeleteFramebuffers(1, &captureFrameBuffer);
+    glDeleteFramebuffers(1, &readFrameBuffer);
 }
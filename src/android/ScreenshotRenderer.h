@@ -2,34 +2,71 @@
 #define SCREENSHOTRENDERER_H
 
 #include "../types.h"
+#include "../Platform.h"
 #include <GLES3/gl3.h>
+#include <EGL/egl.h>
 
+class OpenGLContext;
+
+// Screenshots are only taken when a savestate or rewind state needs one. The emulator thread just holds on to
+// the current frame, while reading it back and downscaling it happens on a worker thread with its own GL context
 class ScreenshotRenderer {
 private:
+    struct ScreenshotJob
+    {
+        u32* destination;
+        bool isSoftwareFrame;
+        GLuint texture;
+        int textureWidth;
+        int textureHeight;
+        GLsync fence;
+    };
+
     u32* screenshotBuffer;
     int screenshotWidth;
     int screenshotHeight;
-    GLuint frameBuffers[2];
-    GLuint bufferTextures[2];
-    GLuint vao;
-    GLuint vbo;
-    GLuint screenshotRenderVertexShader;
-    GLuint screenshotRenderFragmentShader;
-    GLuint screenshotRenderShader;
-    GLuint textureUniformLocation;
-    GLuint posAttribLocation;
-    GLuint texCoordAttribLocation;
-    int currentBuffer;
-
-    void setupFrameBuffers();
-    void setupShaders();
-    void setupVertexBuffers();
+
+    // Emulator thread
+    EGLContext emulatorContext;
+    GLuint readFrameBuffer;
+    GLuint captureFrameBuffer;
+    GLuint captureTexture;
+    int captureTextureWidth;
+    int captureTextureHeight;
+
+    // Worker thread
+    OpenGLContext* workerContext;
+    GLuint workerFrameBuffer;
+    GLuint pixelBuffer;
+    int pixelBufferSize;
+    u32* softwareFrame;
+
+    Platform::Thread* workerThread;
+    Platform::Semaphore* jobAvailable;
+    Platform::Semaphore* jobDone;
+    Platform::Mutex* jobLock;
+    ScreenshotJob job;
+    bool isJobPending;
+    bool isWorkerRunning;
+
+    bool prepareJob(u32* destination);
+    void prepareTextureJob();
+    void runWorker();
+    void readTexture();
 
 public:
     ScreenshotRenderer(u32* screenshotBuffer, int screenshotWidth, int screenshotHeight);
     void init();
-    void renderScreenshot();
-    u32* getScreenshot();
+    /**
+     * Captures the current frame into the screenshot buffer shared with the app, and waits for it to be done.
+     */
+    void captureScreenshot();
+    /**
+     * Starts capturing the current frame into the given buffer. The screenshot is only there once
+     * waitForScreenshot() returns.
+     */
+    void captureScreenshot(u32* destination);
+    void waitForScreenshot();
     void cleanup();
 };
 
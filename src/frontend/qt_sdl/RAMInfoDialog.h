@@ -68,6 +68,7 @@ struct ramInfo_RowData
 
     void SetValue(const s32& value)
     {
+        NDS::CheckCodeWrite(&NDS::MainRAM[Address&NDS::MainRAMMask]);
         NDS::MainRAM[Address&NDS::MainRAMMask] = (u32)value;
         Value = value;
     }
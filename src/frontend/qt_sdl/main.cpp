@@ -526,6 +526,7 @@ void EmuThread::run()
     double lastTime = SDL_GetPerformanceCounter() * perfCountsSec;
     double frameLimitError = 0.0;
     double lastMeasureTime = lastTime;
+    double lastStorageFlush = lastTime;
 
     u32 winUpdateCount = 0, winUpdateFreq = 1;
 
@@ -653,6 +654,13 @@ void EmuThread::run()
             if (ROMManager::GBASave)
                 ROMManager::GBASave->CheckFlush();
 
+            double flushtime = SDL_GetPerformanceCounter() * perfCountsSec;
+            if ((flushtime - lastStorageFlush) >= 2.0)
+            {
+                NDS::FlushStorage();
+                lastStorageFlush = flushtime;
+            }
+
             if (!oglContext)
             {
                 FrontBufferLock.lock();
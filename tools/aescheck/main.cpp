@@ -0,0 +1,383 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// checks every AES backend the host supports against the published test vectors
+// (FIPS-197, SP800-38A CTR, SP800-38C CCM) and against tiny-AES on random buffers
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+#include "AESCrypt.h"
+
+
+struct BlockVector
+{
+    const char* Key;
+    const char* Plaintext;
+    const char* Ciphertext;
+};
+
+struct CTRVector
+{
+    const char* Key;
+    const char* Counter;
+    const char* Plaintext;
+    const char* Ciphertext;
+};
+
+struct CCMVector
+{
+    const char* Key;
+    const char* Nonce;
+    const char* AssocData;
+    const char* Plaintext;
+    const char* Ciphertext; // followed by the tag
+    int TagLength;
+};
+
+const BlockVector BlockVectors[] =
+{
+    // FIPS-197 appendix B
+    {"2b7e151628aed2a6abf7158809cf4f3c", "3243f6a8885a308d313198a2e0370734", "3925841d02dc09fbdc118597196a0b32"},
+    // FIPS-197 appendix C.1
+    {"000102030405060708090a0b0c0d0e0f", "00112233445566778899aabbccddeeff", "69c4e0d86a7b0430d8cdb78070b4c55a"},
+};
+
+const CTRVector CTRVectors[] =
+{
+    // SP800-38A F.5.1
+    {"2b7e151628aed2a6abf7158809cf4f3c", "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+     "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+     "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710",
+     "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+     "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee"},
+};
+
+const CCMVector CCMVectors[] =
+{
+    // SP800-38C appendix C, examples 1 to 3
+    {"404142434445464748494a4b4c4d4e4f", "10111213141516", "0001020304050607",
+     "20212223", "7162015b4dac255d", 4},
+    {"404142434445464748494a4b4c4d4e4f", "1011121314151617", "000102030405060708090a0b0c0d0e0f",
+     "202122232425262728292a2b2c2d2e2f", "d2a1f0e051ea5f62081a7792073d593d1fc64fbfaccd", 6},
+    {"404142434445464748494a4b4c4d4e4f", "101112131415161718191a1b", "000102030405060708090a0b0c0d0e0f10111213",
+     "202122232425262728292a2b2c2d2e2f3031323334353637",
+     "e3b201a9f5b71a7a9b1ceaeccd97e70b6176aad9a4428aa5484392fbc1b09951", 8},
+};
+
+
+std::vector<u8> FromHex(const char* str)
+{
+    std::vector<u8> ret;
+    for (size_t i = 0; str[i] && str[i+1]; i += 2)
+    {
+        char byte[3] = {str[i], str[i+1], '\0'};
+        ret.push_back((u8)strtoul(byte, nullptr, 16));
+    }
+    return ret;
+}
+
+bool Check(const char* what, const u8* result, const u8* expected, u32 len)
+{
+    if (!memcmp(result, expected, len))
+        return true;
+
+    printf("  %s: mismatch\n", what);
+    return false;
+}
+
+// a single block goes through both CTR (the keystream of a counter is its encryption)
+// and CBC-MAC (the MAC of one block over a zero IV is its encryption)
+bool CheckBlockVector(const BlockVector& vec)
+{
+    std::vector<u8> key = FromHex(vec.Key);
+    std::vector<u8> plain = FromHex(vec.Plaintext);
+    std::vector<u8> cipher = FromHex(vec.Ciphertext);
+    bool ok = true;
+
+    AES_ctx ctx;
+    AES_init_ctx_iv(&ctx, key.data(), plain.data());
+    u8 block[16] = {0};
+    AESCrypt::CTRXcrypt(&ctx, block, 16);
+    ok &= Check("FIPS-197 block via CTR", block, cipher.data(), 16);
+
+    u8 mac[16] = {0};
+    AESCrypt::CBCMAC(&ctx, mac, plain.data(), 16);
+    ok &= Check("FIPS-197 block via CBC-MAC", mac, cipher.data(), 16);
+
+    return ok;
+}
+
+bool CheckCTRVector(const CTRVector& vec)
+{
+    std::vector<u8> key = FromHex(vec.Key);
+    std::vector<u8> counter = FromHex(vec.Counter);
+    std::vector<u8> plain = FromHex(vec.Plaintext);
+    std::vector<u8> cipher = FromHex(vec.Ciphertext);
+    bool ok = true;
+
+    AES_ctx ctx;
+    AES_init_ctx_iv(&ctx, key.data(), counter.data());
+    std::vector<u8> data = plain;
+    AESCrypt::CTRXcrypt(&ctx, data.data(), data.size());
+    ok &= Check("SP800-38A CTR encrypt", data.data(), cipher.data(), data.size());
+
+    AES_ctx_set_iv(&ctx, counter.data());
+    AESCrypt::CTRXcrypt(&ctx, data.data(), data.size());
+    ok &= Check("SP800-38A CTR decrypt", data.data(), plain.data(), data.size());
+
+    return ok;
+}
+
+// AESCrypt only does the CCM payload, like the DSi hardware. the first MAC block,
+// the associated data and the tag are handled here as per SP800-38C
+bool CheckCCMVector(const CCMVector& vec)
+{
+    std::vector<u8> key = FromHex(vec.Key);
+    std::vector<u8> nonce = FromHex(vec.Nonce);
+    std::vector<u8> assoc = FromHex(vec.AssocData);
+    std::vector<u8> plain = FromHex(vec.Plaintext);
+    std::vector<u8> expected = FromHex(vec.Ciphertext);
+    bool ok = true;
+
+    u32 q = 15 - nonce.size();
+    u32 paddedlen = (plain.size() + 15) & ~15;
+
+    u8 b0[16] = {0};
+    b0[0] = (assoc.empty() ? 0 : 0x40) | (((vec.TagLength - 2) / 2) << 3) | (q - 1);
+    memcpy(&b0[1], nonce.data(), nonce.size());
+    for (u32 i = 0; i < q; i++)
+        b0[15 - i] = (plain.size() >> (i * 8)) & 0xFF;
+
+    std::vector<u8> adata;
+    if (!assoc.empty())
+    {
+        adata.push_back(assoc.size() >> 8);
+        adata.push_back(assoc.size() & 0xFF);
+        adata.insert(adata.end(), assoc.begin(), assoc.end());
+        adata.resize((adata.size() + 15) & ~15, 0);
+    }
+
+    u8 ctr0[16] = {0};
+    ctr0[0] = q - 1;
+    memcpy(&ctr0[1], nonce.data(), nonce.size());
+    u8 ctr1[16];
+    memcpy(ctr1, ctr0, 16);
+    ctr1[15] = 1;
+
+    AES_ctx ctx;
+    AES_init_ctx(&ctx, key.data());
+
+    // the tag is the MAC encrypted with the keystream of counter 0
+    u8 s0[16] = {0};
+    AES_ctx_set_iv(&ctx, ctr0);
+    AESCrypt::CTRXcrypt(&ctx, s0, 16);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        bool encrypt = (pass == 0);
+
+        u8 mac[16] = {0};
+        AESCrypt::CBCMAC(&ctx, mac, b0, 16);
+        AESCrypt::CBCMAC(&ctx, mac, adata.data(), adata.size());
+
+        // the last block of the payload is zero-padded for the MAC, the padding's
+        // ciphertext is thrown away
+        std::vector<u8> data(paddedlen, 0);
+        if (encrypt)
+            memcpy(data.data(), plain.data(), plain.size());
+        else
+            memcpy(data.data(), expected.data(), plain.size());
+
+        AES_ctx_set_iv(&ctx, ctr1);
+        if (encrypt)
+        {
+            AESCrypt::CCMEncrypt(&ctx, mac, data.data(), paddedlen);
+        }
+        else
+        {
+            // keep the padding zero in the plaintext the MAC is computed over
+            std::vector<u8> keystream(paddedlen, 0);
+            AESCrypt::CTRXcrypt(&ctx, keystream.data(), paddedlen);
+            for (u32 i = plain.size(); i < paddedlen; i++)
+                data[i] = keystream[i];
+
+            AES_ctx_set_iv(&ctx, ctr1);
+            AESCrypt::CCMDecrypt(&ctx, mac, data.data(), paddedlen);
+        }
+
+        u8 tag[16];
+        for (int i = 0; i < 16; i++)
+            tag[i] = mac[i] ^ s0[i];
+
+        if (encrypt)
+        {
+            ok &= Check("SP800-38C CCM ciphertext", data.data(), expected.data(), plain.size());
+            ok &= Check("SP800-38C CCM tag (encrypt)", tag, &expected[plain.size()], vec.TagLength);
+        }
+        else
+        {
+            ok &= Check("SP800-38C CCM plaintext", data.data(), plain.data(), plain.size());
+            ok &= Check("SP800-38C CCM tag (decrypt)", tag, &expected[plain.size()], vec.TagLength);
+        }
+    }
+
+    return ok;
+}
+
+
+void ReverseBlocks(u8* data, u32 len)
+{
+    for (u32 i = 0; i < len; i += 16)
+    {
+        for (int j = 0; j < 8; j++)
+            std::swap(data[i+j], data[i+15-j]);
+    }
+}
+
+// the reference versions, on tiny-AES alone. reversed data is turned around,
+// processed normally, and turned back
+void RefCTRXcrypt(AES_ctx* ctx, u8* data, u32 len, bool reversed)
+{
+    if (reversed) ReverseBlocks(data, len);
+    AES_CTR_xcrypt_buffer(ctx, data, len);
+    if (reversed) ReverseBlocks(data, len);
+}
+
+void RefCBCMAC(const AES_ctx* ctx, u8* mac, const u8* data, u32 len, bool reversed)
+{
+    std::vector<u8> tmp(data, data + len);
+    if (reversed) ReverseBlocks(tmp.data(), len);
+
+    for (u32 i = 0; i < len; i += 16)
+    {
+        for (int j = 0; j < 16; j++)
+            mac[j] ^= tmp[i+j];
+        AES_ECB_encrypt(ctx, mac);
+    }
+}
+
+bool CheckRandom(std::mt19937& random, int iterations)
+{
+    std::vector<u8> data, ref;
+    int failures = 0;
+
+    for (int i = 0; i < iterations && failures < 10; i++)
+    {
+        u8 key[16], iv[16], mac[16];
+        for (int j = 0; j < 16; j++)
+        {
+            key[j] = random();
+            iv[j] = random();
+            mac[j] = random();
+        }
+
+        // make the counter carry across bytes now and then
+        if ((i & 3) == 0)
+            memset(&iv[16 - 1 - (i >> 2) % 4], 0xFF, 1 + (i >> 2) % 4);
+
+        bool reversed = (i & 1) != 0;
+        int mode = (i >> 1) % 3;
+
+        // CTR takes any length, the DSi only ever uses whole blocks with reversed data
+        u32 len = (random() % 4096) + 1;
+        if (reversed || mode != 0)
+            len = (len + 15) & ~15;
+
+        data.resize(len);
+        for (u32 j = 0; j < len; j++)
+            data[j] = random();
+        ref = data;
+
+        AES_ctx ctx, refctx;
+        AES_init_ctx_iv(&ctx, key, iv);
+        refctx = ctx;
+
+        u8 refmac[16];
+        memcpy(refmac, mac, 16);
+
+        const char* name;
+        switch (mode)
+        {
+        case 0:
+            name = "CTR";
+            AESCrypt::CTRXcrypt(&ctx, data.data(), len, reversed);
+            RefCTRXcrypt(&refctx, ref.data(), len, reversed);
+            break;
+
+        case 1:
+            name = "CCM encrypt";
+            AESCrypt::CCMEncrypt(&ctx, mac, data.data(), len, reversed);
+            RefCBCMAC(&refctx, refmac, ref.data(), len, reversed);
+            RefCTRXcrypt(&refctx, ref.data(), len, reversed);
+            break;
+
+        default:
+            name = "CCM decrypt";
+            AESCrypt::CCMDecrypt(&ctx, mac, data.data(), len, reversed);
+            RefCTRXcrypt(&refctx, ref.data(), len, reversed);
+            RefCBCMAC(&refctx, refmac, ref.data(), len, reversed);
+            break;
+        }
+
+        if (data != ref || memcmp(mac, refmac, 16) || memcmp(ctx.Iv, refctx.Iv, 16))
+        {
+            printf("  random %s: mismatch, %u bytes%s\n", name, len, reversed ? ", reversed" : "");
+            failures++;
+        }
+    }
+
+    return failures == 0;
+}
+
+
+int main(int argc, char** argv)
+{
+    int iterations = 20000;
+    if (argc > 1)
+        iterations = atoi(argv[1]);
+
+    AESCrypt::Init();
+
+    bool ok = true;
+    for (int b = 0; b < AESCrypt::GetNumBackends(); b++)
+    {
+        AESCrypt::SetBackend(b);
+        printf("%s:\n", AESCrypt::GetBackendName(b));
+
+        bool backendok = true;
+        for (const BlockVector& vec : BlockVectors)
+            backendok &= CheckBlockVector(vec);
+        for (const CTRVector& vec : CTRVectors)
+            backendok &= CheckCTRVector(vec);
+        for (const CCMVector& vec : CCMVectors)
+            backendok &= CheckCCMVector(vec);
+
+        // same buffers for every backend
+        std::mt19937 random(1234);
+        backendok &= CheckRandom(random, iterations);
+
+        printf("  %s\n", backendok ? "OK" : "FAILED");
+        ok &= backendok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// measures the round-trip time of MP frames over the UDP multiplayer backend: a host
+// and a client process on 127.0.0.1 go through CMD/reply exchanges the same way two
+// instances do during a wifi session
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "NetworkMultiplayer.h"
+#include "MPStats.h"
+
+
+struct Options
+{
+    int Exchanges = 2000;
+    int CmdSize = 200;
+    int ReplySize = 64;
+    int Port = 17064;
+};
+
+u64 GetTimeUS()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+void PrintUsage(const char* name)
+{
+    printf("usage: %s [options]\n", name);
+    printf("\n");
+    printf("  -n  CMD/reply exchanges to go through (default 2000)\n");
+    printf("  -s  CMD frame size in bytes (default 200)\n");
+    printf("  -r  reply frame size in bytes (default 64)\n");
+    printf("  -p  UDP port of the host, the client uses the next port (default 17064)\n");
+}
+
+// answers every CMD, until the host says bye or goes quiet
+int RunClient(const Options& opt)
+{
+    std::string host = "127.0.0.1:" + std::to_string(opt.Port);
+    NetworkMultiplayer::SetSession(opt.Port + 1, host);
+    if (!NetworkMultiplayer::Init())
+    {
+        printf("client: could not open port %d\n", opt.Port + 1);
+        return 1;
+    }
+    NetworkMultiplayer::Begin();
+
+    std::vector<u8> packet(0x2000);
+    std::vector<u8> reply(opt.ReplySize, 0);
+    int cmds = 0;
+    u64 lastcmd = GetTimeUS();
+
+    while (GetTimeUS() - lastcmd < 5000000)
+    {
+        u64 timestamp;
+        int len = NetworkMultiplayer::RecvHostPacket(packet.data(), &timestamp);
+        if (len < 0)
+            break;
+        if (len == 0)
+            continue;
+
+        cmds++;
+        lastcmd = GetTimeUS();
+        NetworkMultiplayer::SendReply(reply.data(), reply.size(), timestamp, 1);
+    }
+
+    NetworkMultiplayer::DeInit();
+
+    printf("client: answered %d CMDs\n", cmds);
+    return 0;
+}
+
+int RunHost(const Options& opt)
+{
+    std::string client = "127.0.0.1:" + std::to_string(opt.Port + 1);
+    NetworkMultiplayer::SetSession(opt.Port, client);
+    if (!NetworkMultiplayer::Init())
+    {
+        printf("host: could not open port %d\n", opt.Port);
+        return 1;
+    }
+    NetworkMultiplayer::Begin();
+
+    std::vector<u8> packet(0x2000);
+    std::vector<u8> replies(15 * 1024);
+    std::vector<u8> cmd(opt.CmdSize, 0);
+
+    // the client shows up once it has answered a ping
+    u64 start = GetTimeUS();
+    while (!NetworkMultiplayer::GetPeerRTT(1))
+    {
+        if (GetTimeUS() - start > 5000000)
+        {
+            printf("host: the client never showed up\n");
+            NetworkMultiplayer::DeInit();
+            return 1;
+        }
+
+        u64 timestamp;
+        NetworkMultiplayer::RecvPacket(packet.data(), &timestamp);
+        usleep(1000);
+    }
+
+    std::vector<u32> times;
+    times.reserve(opt.Exchanges);
+    u64 total = 0;
+
+    for (int i = 0; i < opt.Exchanges; i++)
+    {
+        u64 timestamp = 1000 + i * 100;
+        cmd[0] = i & 0xFF;
+
+        u64 sent = GetTimeUS();
+        NetworkMultiplayer::SendCmd(cmd.data(), cmd.size(), timestamp);
+        u16 got = NetworkMultiplayer::RecvReplies(replies.data(), timestamp, 1 << 1);
+        u64 time = GetTimeUS() - sent;
+
+        if (got & (1 << 1))
+        {
+            times.push_back(time);
+            total += time;
+        }
+    }
+
+    u32 pingrtt = NetworkMultiplayer::GetPeerRTT(1);
+    MPStats::Stats stats;
+    MPStats::GetStats(&stats);
+
+    NetworkMultiplayer::DeInit();
+
+    // the client reports first, so that the output doesn't get mixed up
+    wait(nullptr);
+
+    printf("host: %d of %d CMDs answered\n", (int)times.size(), opt.Exchanges);
+    if (!times.empty())
+    {
+        std::sort(times.begin(), times.end());
+        printf("  round trip: %llu us average, %u us median, %u us 99th percentile, %u us max\n",
+               (unsigned long long)(total / times.size()), times[times.size() / 2],
+               times[(times.size() * 99) / 100], times.back());
+    }
+    printf("  ping round trip: %u us\n", pingrtt);
+    printf("  late replies: %u, missing replies: %u, %llu ms blocked\n",
+           stats.LateReplies, stats.MissingReplies, (unsigned long long)(stats.TimeBlocked / 1000));
+
+    return times.empty() ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "n:s:r:p:")) != -1)
+    {
+        switch (opt_char)
+        {
+        case 'n': opt.Exchanges = atoi(optarg); break;
+        case 's': opt.CmdSize = atoi(optarg); break;
+        case 'r': opt.ReplySize = atoi(optarg); break;
+        case 'p': opt.Port = atoi(optarg); break;
+        default:
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind != argc || opt.Exchanges <= 0 ||
+        opt.CmdSize < 1 || opt.CmdSize > 0x2000 ||
+        opt.ReplySize < 0 || opt.ReplySize > 1024)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    fflush(stdout);
+    pid_t child = fork();
+    if (child < 0)
+    {
+        printf("could not start the client\n");
+        return 1;
+    }
+
+    if (child == 0)
+    {
+        int res = RunClient(opt);
+        fflush(stdout);
+        _exit(res);
+    }
+
+    return RunHost(opt);
+}
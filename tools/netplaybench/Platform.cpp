@@ -0,0 +1,308 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// headless platform for the benchmark: built-in BIOS and firmware, default settings,
+// no saves, no wifi and no camera
+
+#include <stdio.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "Platform.h"
+
+
+namespace Platform
+{
+
+struct Thread
+{
+    std::thread Handle;
+};
+
+struct Semaphore
+{
+    std::mutex Lock;
+    std::condition_variable Cond;
+    int Count;
+};
+
+struct Mutex
+{
+    std::mutex Lock;
+};
+
+
+void Init(int argc, char** argv)
+{
+}
+
+void DeInit()
+{
+}
+
+void StopEmu()
+{
+}
+
+int InstanceID()
+{
+    return 0;
+}
+
+std::string InstanceFileSuffix()
+{
+    return "";
+}
+
+int GetConfigInt(ConfigEntry entry)
+{
+    switch (entry)
+    {
+#ifdef JIT_ENABLED
+    case JIT_MaxBlockSize: return 32;
+#endif
+    case Firm_Language: return 1;
+    case Firm_BirthdayMonth: return 1;
+    case Firm_BirthdayDay: return 1;
+    default: return 0;
+    }
+}
+
+bool GetConfigBool(ConfigEntry entry)
+{
+    return false;
+}
+
+std::string GetConfigString(ConfigEntry entry)
+{
+    switch (entry)
+    {
+    case Firm_Username: return "melonDS";
+    default: return "";
+    }
+}
+
+bool GetConfigArray(ConfigEntry entry, void* data)
+{
+    return false;
+}
+
+FILE* OpenFile(std::string path, std::string mode, bool mustexist)
+{
+    if (path.empty())
+        return nullptr;
+
+    if (mustexist && access(path.c_str(), F_OK) != 0)
+        return nullptr;
+
+    return fopen(path.c_str(), mode.c_str());
+}
+
+FILE* OpenLocalFile(std::string path, std::string mode)
+{
+    return OpenFile(path, mode, mode[0] == 'r');
+}
+
+FILE* OpenDataFile(std::string path)
+{
+    return OpenFile(path, "rb", true);
+}
+
+FILE* OpenInternalFile(std::string path, std::string mode)
+{
+    return OpenFile(path, mode, mode[0] == 'r');
+}
+
+Thread* Thread_Create(std::function<void()> func)
+{
+    Thread* thread = new Thread;
+    thread->Handle = std::thread(func);
+    return thread;
+}
+
+void Thread_Free(Thread* thread)
+{
+    if (thread->Handle.joinable())
+        thread->Handle.detach();
+    delete thread;
+}
+
+void Thread_Wait(Thread* thread)
+{
+    thread->Handle.join();
+}
+
+Semaphore* Semaphore_Create()
+{
+    Semaphore* sema = new Semaphore;
+    sema->Count = 0;
+    return sema;
+}
+
+void Semaphore_Free(Semaphore* sema)
+{
+    delete sema;
+}
+
+void Semaphore_Reset(Semaphore* sema)
+{
+    std::lock_guard<std::mutex> lock(sema->Lock);
+    sema->Count = 0;
+}
+
+void Semaphore_Wait(Semaphore* sema)
+{
+    std::unique_lock<std::mutex> lock(sema->Lock);
+    sema->Cond.wait(lock, [sema] { return sema->Count > 0; });
+    sema->Count--;
+}
+
+void Semaphore_Post(Semaphore* sema, int count)
+{
+    {
+        std::lock_guard<std::mutex> lock(sema->Lock);
+        sema->Count += count;
+    }
+    sema->Cond.notify_all();
+}
+
+Mutex* Mutex_Create()
+{
+    return new Mutex;
+}
+
+void Mutex_Free(Mutex* mutex)
+{
+    delete mutex;
+}
+
+void Mutex_Lock(Mutex* mutex)
+{
+    mutex->Lock.lock();
+}
+
+void Mutex_Unlock(Mutex* mutex)
+{
+    mutex->Lock.unlock();
+}
+
+bool Mutex_TryLock(Mutex* mutex)
+{
+    return mutex->Lock.try_lock();
+}
+
+void Sleep(u64 usecs)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(usecs));
+}
+
+void WriteNDSSave(const u8* savedata, u32 savelen, u32 writeoffset, u32 writelen)
+{
+}
+
+void WriteGBASave(const u8* savedata, u32 savelen, u32 writeoffset, u32 writelen)
+{
+}
+
+bool MP_Init()
+{
+    return false;
+}
+
+void MP_DeInit()
+{
+}
+
+void MP_Begin()
+{
+}
+
+void MP_End()
+{
+}
+
+int MP_SendPacket(u8* data, int len, u64 timestamp)
+{
+    return 0;
+}
+
+int MP_RecvPacket(u8* data, u64* timestamp)
+{
+    return 0;
+}
+
+int MP_SendCmd(u8* data, int len, u64 timestamp)
+{
+    return 0;
+}
+
+int MP_SendReply(u8* data, int len, u64 timestamp, u16 aid)
+{
+    return 0;
+}
+
+int MP_SendAck(u8* data, int len, u64 timestamp)
+{
+    return 0;
+}
+
+int MP_RecvHostPacket(u8* data, u64* timestamp)
+{
+    return 0;
+}
+
+u16 MP_RecvReplies(u8* data, u64 timestamp, u16 aidmask)
+{
+    return 0;
+}
+
+bool LAN_Init()
+{
+    return false;
+}
+
+void LAN_DeInit()
+{
+}
+
+int LAN_SendPacket(u8* data, int len)
+{
+    return 0;
+}
+
+int LAN_RecvPacket(u8* data)
+{
+    return 0;
+}
+
+void Camera_Start(int num)
+{
+}
+
+void Camera_Stop(int num)
+{
+}
+
+void Camera_CaptureFrame(int num, u32* frame, int width, int height, bool yuv)
+{
+}
+
+}
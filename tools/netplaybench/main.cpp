@@ -0,0 +1,378 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// runs a two player netplay session between two cores on this machine, with a fixed delay
+// added to every packet, and reports how much rollback and snapshotting cost.
+// the core is all global state, so each player gets its own process, and the players
+// talk over UDP on 127.0.0.1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "NDS.h"
+#include "GPU.h"
+#include "SPU.h"
+#include "Netplay.h"
+
+
+struct Options
+{
+    int Delay = 50;
+    int InputDelay = 1;
+    int MaxRollback = 8;
+    int HashInterval = 60;
+    int Frames = 1800;
+    int ChangeInterval = 10;
+    int Port = 17064;
+    bool Throttle = true;
+};
+
+u64 GetTimeUS()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+// holds every outgoing packet back for a fixed time before it goes out
+class DelayTransport : public Netplay::Transport
+{
+public:
+    DelayTransport(Netplay::Transport* inner, int delay) : Inner(inner), Delay(delay * 1000), Running(true)
+    {
+        Sender = std::thread(&DelayTransport::RunSender, this);
+    }
+
+    ~DelayTransport() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(Lock);
+            Running = false;
+        }
+        Cond.notify_one();
+        Sender.join();
+        delete Inner;
+    }
+
+    void Send(const u8* data, int len) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(Lock);
+            Queue.push_back({GetTimeUS() + Delay, std::vector<u8>(data, data + len)});
+        }
+        Cond.notify_one();
+    }
+
+    int Recv(u8* data, int maxlen, int timeout) override
+    {
+        return Inner->Recv(data, maxlen, timeout);
+    }
+
+private:
+    struct Packet
+    {
+        u64 Time;
+        std::vector<u8> Data;
+    };
+
+    void RunSender()
+    {
+        std::unique_lock<std::mutex> lock(Lock);
+        while (Running)
+        {
+            if (Queue.empty())
+            {
+                Cond.wait(lock);
+                continue;
+            }
+
+            u64 now = GetTimeUS();
+            if (Queue.front().Time > now)
+            {
+                Cond.wait_for(lock, std::chrono::microseconds(Queue.front().Time - now));
+                continue;
+            }
+
+            Packet packet = std::move(Queue.front());
+            Queue.pop_front();
+
+            lock.unlock();
+            Inner->Send(packet.Data.data(), packet.Data.size());
+            lock.lock();
+        }
+    }
+
+    Netplay::Transport* Inner;
+    u64 Delay;
+
+    std::thread Sender;
+    std::mutex Lock;
+    std::condition_variable Cond;
+    std::deque<Packet> Queue;
+    bool Running;
+};
+
+// scripted player: holds a random set of buttons for a random number of frames, so the
+// prediction that the other player keeps doing the same thing is regularly wrong
+class InputScript
+{
+public:
+    InputScript(int player, int changeinterval) : Random(player + 1), ChangeInterval(changeinterval), Hold(0), KeyMask(0xFFF) {}
+
+    void Next()
+    {
+        if (Hold > 0)
+        {
+            Hold--;
+            return;
+        }
+
+        KeyMask = 0xFFF & ~(Random() & 0x3FF);
+        Hold = Random() % (2 * ChangeInterval);
+        Netplay::SetLocalKeyMask(KeyMask);
+    }
+
+private:
+    std::mt19937 Random;
+    int ChangeInterval;
+    int Hold;
+    u32 KeyMask;
+};
+
+void PrintUsage(const char* name)
+{
+    printf("usage: %s [options] <rom.nds>\n", name);
+    printf("\n");
+    printf("  -d  delay added to every packet, in ms (default 50)\n");
+    printf("  -i  input delay, in frames (default 1)\n");
+    printf("  -r  max rollback, in frames (default 8)\n");
+    printf("  -f  frames to run (default 1800)\n");
+    printf("  -c  average frames between input changes (default 10)\n");
+    printf("  -p  UDP port of the first player, the second one uses the next port (default 17064)\n");
+    printf("  -u  run unthrottled instead of at 60 fps\n");
+}
+
+bool LoadROM(const char* path, std::vector<u8>& rom)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+    {
+        printf("could not open %s\n", path);
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    rom.resize(len);
+    bool res = len > 0 && fread(rom.data(), len, 1, f) == 1;
+    fclose(f);
+
+    if (!res)
+        printf("could not read %s\n", path);
+    return res;
+}
+
+bool StartCore(const std::vector<u8>& rom)
+{
+    if (!NDS::Init())
+        return false;
+
+    GPU::RenderSettings settings;
+    memset(&settings, 0, sizeof(settings));
+    GPU::InitRenderer(0);
+    GPU::SetRenderSettings(0, settings);
+
+    NDS::Reset();
+    if (!NDS::LoadCart(rom.data(), rom.size(), nullptr, 0))
+        return false;
+
+    // there's no firmware to boot from with the built-in one
+    NDS::SetupDirectBoot("");
+    NDS::Start();
+    return true;
+}
+
+void RunFrame()
+{
+    NDS::RunFrame();
+    SPU::DrainOutput();
+}
+
+void PrintStatus(int player, const Netplay::Status& status, u64 time)
+{
+    printf("player %d: %u frames in %.1fs, %u stalls (%llu ms waiting)\n",
+           player, status.Frame, time / 1000000.0, status.StalledFrames,
+           (unsigned long long)(status.TimeStalled / 1000));
+
+    printf("  snapshots: %u, %.0f us each\n",
+           status.Snapshots, status.Snapshots ? (double)status.TimeSnapshotting / status.Snapshots : 0.0);
+
+    printf("  rollbacks: %u, %u frames run again, %.0f frames/s while rolling back\n",
+           status.Rollbacks, status.RollbackFrames,
+           status.TimeRollingBack ? status.RollbackFrames * 1000000.0 / status.TimeRollingBack : 0.0);
+
+    if (status.Desynced)
+        printf("  desynced at frame %u\n", status.DesyncFrame);
+    else
+        printf("  in sync\n");
+}
+
+bool RunPlayer(int player, const std::vector<u8>& rom, const Options& opt, Netplay::Status* status, u64* time)
+{
+    if (!StartCore(rom))
+    {
+        printf("player %d: could not start the core\n", player);
+        return false;
+    }
+
+    std::string peer = "127.0.0.1:" + std::to_string(opt.Port + (1 - player));
+    Netplay::Transport* udp = Netplay::CreateUDPTransport(opt.Port + player, peer);
+    if (!udp)
+    {
+        printf("player %d: could not open port %d\n", player, opt.Port + player);
+        NDS::DeInit();
+        return false;
+    }
+
+    Netplay::Start(new DelayTransport(udp, opt.Delay), player, 2, opt.InputDelay, opt.HashInterval, opt.MaxRollback);
+
+    InputScript input(player, opt.ChangeInterval);
+    const u64 frametime = 1000000 / 60;
+
+    u64 start = GetTimeUS();
+    u64 nextframe = start;
+    u64 end = 0;
+
+    for (;;)
+    {
+        u64 now = GetTimeUS();
+        if (end == 0)
+        {
+            Netplay::GetStatus(status);
+            if (status->Frame >= (u32)opt.Frames)
+                end = now;
+        }
+
+        // keep going for a bit so that the other player gets the input for its last frames
+        if (end != 0 && now - end > 1000000)
+            break;
+
+        if (!Netplay::BeginFrame(8))
+            continue;
+
+        RunFrame();
+        Netplay::EndFrame();
+        input.Next();
+
+        if (opt.Throttle)
+        {
+            nextframe += frametime;
+            now = GetTimeUS();
+            if (now < nextframe)
+                std::this_thread::sleep_for(std::chrono::microseconds(nextframe - now));
+            else if (now - nextframe > 4 * frametime)
+                nextframe = now;
+        }
+    }
+
+    Netplay::Stop();
+    NDS::DeInit();
+
+    *time = end - start;
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "d:i:r:f:c:p:u")) != -1)
+    {
+        switch (opt_char)
+        {
+        case 'd': opt.Delay = atoi(optarg); break;
+        case 'i': opt.InputDelay = atoi(optarg); break;
+        case 'r': opt.MaxRollback = atoi(optarg); break;
+        case 'f': opt.Frames = atoi(optarg); break;
+        case 'c': opt.ChangeInterval = atoi(optarg); break;
+        case 'p': opt.Port = atoi(optarg); break;
+        case 'u': opt.Throttle = false; break;
+        default:
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind + 1 != argc || opt.Delay < 0 || opt.Frames <= 0 || opt.ChangeInterval <= 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<u8> rom;
+    if (!LoadROM(argv[optind], rom))
+        return 1;
+
+    printf("%d ms delay, input delay %d, max rollback %d\n", opt.Delay, opt.InputDelay, opt.MaxRollback);
+    fflush(stdout);
+
+    pid_t child = fork();
+    if (child < 0)
+    {
+        printf("could not start the second player\n");
+        return 1;
+    }
+
+    int player = (child == 0) ? 1 : 0;
+    Netplay::Status status;
+    u64 time;
+    bool res = RunPlayer(player, rom, opt, &status, &time);
+
+    if (child == 0)
+    {
+        if (res)
+            PrintStatus(player, status, time);
+        fflush(stdout);
+        _exit((res && !status.Desynced) ? 0 : 1);
+    }
+
+    // the second player reports first, so that the output doesn't get mixed up
+    int childres;
+    waitpid(child, &childres, 0);
+
+    if (res)
+        PrintStatus(player, status, time);
+
+    if (!res || status.Desynced)
+        return 1;
+    if (!WIFEXITED(childres) || WEXITSTATUS(childres) != 0)
+        return 1;
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+    Copyright 2016-2022 melonDS team
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// converts NDS ROMs to and from compressed ROM images
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "CompressedROM.h"
+
+
+void PrintUsage(const char* name)
+{
+    printf("usage: %s [-b blocksize] [-l level] <rom.nds> <out.mdsc>\n", name);
+    printf("       %s -x <in.mdsc> <rom.nds>\n", name);
+    printf("\n");
+    printf("  -b  block size in KB, power of two from 4 to 1024 (default 64)\n");
+    printf("  -l  compression level, 1-9 (default 9)\n");
+    printf("  -x  extract a compressed image back to a plain ROM\n");
+}
+
+bool Extract(FILE* in, FILE* out)
+{
+    CompressedROM rom(in);
+    if (!rom.Open())
+    {
+        printf("not a valid compressed ROM image\n");
+        return false;
+    }
+
+    std::vector<u8> block(rom.GetBlockSize());
+    for (u32 i = 0; i < rom.GetNumBlocks(); i++)
+    {
+        u32 len = rom.GetBlockSize();
+        if ((i+1) * len > rom.GetSize())
+            len = rom.GetSize() - i * len;
+
+        if (!rom.ReadBlock(i, block.data()))
+        {
+            printf("failed to read block %d\n", i);
+            return false;
+        }
+
+        if (fwrite(block.data(), len, 1, out) != 1)
+            return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    u32 blocksize = 64;
+    int level = 9;
+    bool extract = false;
+
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-') break;
+
+        if (!strcmp(argv[i], "-x"))
+            extract = true;
+        else if (!strcmp(argv[i], "-b") && (i+1) < argc)
+            blocksize = strtoul(argv[++i], nullptr, 0);
+        else if (!strcmp(argv[i], "-l") && (i+1) < argc)
+            level = strtol(argv[++i], nullptr, 0);
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if ((argc - i) != 2 || level < 1 || level > 9)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    FILE* in = fopen(argv[i], "rb");
+    if (!in)
+    {
+        printf("failed to open %s\n", argv[i]);
+        return 1;
+    }
+
+    FILE* out = fopen(argv[i+1], "wb");
+    if (!out)
+    {
+        printf("failed to create %s\n", argv[i+1]);
+        fclose(in);
+        return 1;
+    }
+
+    bool res;
+    if (extract)
+    {
+        // the image takes ownership of the input file
+        res = Extract(in, out);
+    }
+    else
+    {
+        res = CompressedROM::Compress(in, out, blocksize * 1024, level);
+        if (!res)
+            printf("compression failed (bad block size, or ROM over 1GB?)\n");
+        fclose(in);
+    }
+
+    fclose(out);
+    if (!res)
+    {
+        remove(argv[i+1]);
+        return 1;
+    }
+
+    return 0;
+}